@@ -28,6 +28,8 @@
 #include <clocale>
 #include <csignal>
 #include <cstddef>
+#include <fstream>
+#include <iostream>
 #include <stdexcept>
 
 #if defined(Q_OS_LINUX)
@@ -80,6 +82,7 @@
 #include "Engine/ProcessHandler.h" // ProcessInputChannel
 #include "Engine/Project.h"
 #include "Engine/PrecompNode.h"
+#include "Engine/RenderArena.h"
 #include "Engine/RotoPaint.h"
 #include "Engine/RotoSmear.h"
 #include "Engine/StandardPaths.h"
@@ -274,6 +277,7 @@ AppManager::load(int &argc,
     _imp->idealThreadCount = QThread::idealThreadCount();
     QThreadPool::globalInstance()->setExpiryTimeout(-1); //< make threads never exit on their own
     //otherwise it might crash with thread local storage
+    _imp->taskScheduler.reset( new TaskScheduler(_imp->idealThreadCount) );
 
 #if QT_VERSION < 0x050000
     QTextCodec::setCodecForCStrings(QTextCodec::codecForName("UTF-8"));
@@ -344,6 +348,7 @@ AppManager::~AppManager()
 
     ///Caches may have launched some threads to delete images, wait for them to be done
     QThreadPool::globalInstance()->waitForDone();
+    _imp->taskScheduler.reset();
     
     ///Kill caches now because decreaseNCacheFilesOpened can be called
     _imp->_nodeCache->waitForDeleterThread();
@@ -352,6 +357,7 @@ AppManager::~AppManager()
     _imp->_nodeCache.reset();
     _imp->_viewerCache.reset();
     _imp->_diskCache.reset();
+    _imp->_sharedImageCache.reset();
     
     tearDownPython();
     
@@ -539,7 +545,7 @@ bool
 AppManager::loadInternalAfterInitGui(const CLArgs& cl)
 {
     try {
-        size_t maxCacheRAM = _imp->_settings->getRamMaximumPercent() * getSystemTotalRAM();
+        size_t maxCacheRAM = _imp->_settings->getRamMaximumPercent() * getMemoryPressureState().totalRAM;
         U64 maxViewerDiskCache = _imp->_settings->getMaximumViewerDiskCacheSize();
         U64 playbackSize = maxCacheRAM * _imp->_settings->getRamPlaybackMaximumPercent();
         U64 viewerCacheSize = maxViewerDiskCache + playbackSize;
@@ -549,6 +555,9 @@ AppManager::loadInternalAfterInitGui(const CLArgs& cl)
         _imp->_nodeCache.reset( new Cache<Image>("NodeCache",NATRON_CACHE_VERSION, maxCacheRAM - playbackSize,1.) );
         _imp->_diskCache.reset( new Cache<Image>("DiskCache",NATRON_CACHE_VERSION, maxDiskCacheNode,0.) );
         _imp->_viewerCache.reset( new Cache<FrameEntry>("ViewerCache",NATRON_CACHE_VERSION,viewerCacheSize,(double)playbackSize / (double)viewerCacheSize) );
+        _imp->_sharedImageCache.reset( SharedImageCache::createFromEnvironment() );
+        setApplicationsCachesCompressedPortion( _imp->_settings->getCompressedCachePercent() );
+        setApplicationsCachesEvictionPolicy( _imp->_settings->getCacheEvictionPolicy() );
     } catch (std::logic_error) {
         // ignore
     }
@@ -631,6 +640,18 @@ AppManager::loadInternalAfterInitGui(const CLArgs& cl)
         if ( (_imp->_appType == eAppTypeBackgroundAutoRun ||
               _imp->_appType == eAppTypeBackgroundAutoRunLaunchedFromGui ||
               _imp->_appType == eAppTypeInterpreter) && mainInstance ) {
+            ///Write the cache stats while the nodes still exist
+            const QString & cacheStatsFilePath = args.getCacheStatsFilePath();
+            if (cacheStatsFilePath == "-") {
+                writeCachesStatsJSON(std::cout);
+            } else if ( !cacheStatsFilePath.isEmpty() ) {
+                std::ofstream ofile( cacheStatsFilePath.toStdString().c_str() );
+                if ( ofile.is_open() ) {
+                    writeCachesStatsJSON(ofile);
+                } else {
+                    std::cerr << tr("Cannot write the cache statistics to %1").arg(cacheStatsFilePath).toStdString() << std::endl;
+                }
+            }
             try {
                 mainInstance->getProject()->closeProject(true);
             } catch (std::logic_error) {
@@ -814,8 +835,10 @@ AppManager::wipeAndCreateDiskCacheStructure()
     clearAllCaches();
     
     assert(_imp->_diskCache);
+    _imp->_diskCache->resetSegmentStore();
     _imp->cleanUpCacheDiskStructure(_imp->_diskCache->getCachePath());
     assert(_imp->_viewerCache);
+    _imp->_viewerCache->resetSegmentStore();
     _imp->cleanUpCacheDiskStructure(_imp->_viewerCache->getCachePath());
 }
 
@@ -885,7 +908,7 @@ AppManager::registerAppInstance(AppInstance* app)
 void
 AppManager::setApplicationsCachesMaximumMemoryPercent(double p)
 {
-    size_t maxCacheRAM = p * getSystemTotalRAM_conditionnally();
+    size_t maxCacheRAM = p * getMemoryPressureState().totalRAM;
     U64 playbackSize = maxCacheRAM * _imp->_settings->getRamPlaybackMaximumPercent();
 
     _imp->_nodeCache->setMaximumCacheSize(maxCacheRAM - playbackSize);
@@ -897,7 +920,7 @@ AppManager::setApplicationsCachesMaximumMemoryPercent(double p)
 void
 AppManager::setApplicationsCachesMaximumViewerDiskSpace(unsigned long long size)
 {
-    size_t maxCacheRAM = _imp->_settings->getRamMaximumPercent() * getSystemTotalRAM_conditionnally();
+    size_t maxCacheRAM = _imp->_settings->getRamMaximumPercent() * getMemoryPressureState().totalRAM;
     U64 playbackSize = maxCacheRAM * _imp->_settings->getRamPlaybackMaximumPercent();
 
     _imp->_viewerCache->setMaximumCacheSize(size);
@@ -910,10 +933,26 @@ AppManager::setApplicationsCachesMaximumDiskSpace(unsigned long long size)
     _imp->_diskCache->setMaximumCacheSize(size);
 }
 
+void
+AppManager::setApplicationsCachesCompressedPortion(double p)
+{
+    _imp->_nodeCache->setCompressedPortion(p);
+    _imp->_diskCache->setCompressedPortion(p);
+    _imp->_viewerCache->setCompressedPortion(p);
+}
+
+void
+AppManager::setApplicationsCachesEvictionPolicy(Natron::CacheEvictionPolicyEnum policy)
+{
+    _imp->_nodeCache->setEvictionPolicy(policy);
+    _imp->_diskCache->setEvictionPolicy(policy);
+    _imp->_viewerCache->setEvictionPolicy(policy);
+}
+
 void
 AppManager::setPlaybackCacheMaximumSize(double p)
 {
-    size_t maxCacheRAM = _imp->_settings->getRamMaximumPercent() * getSystemTotalRAM_conditionnally();
+    size_t maxCacheRAM = _imp->_settings->getRamMaximumPercent() * getMemoryPressureState().totalRAM;
     U64 playbackSize = maxCacheRAM * p;
 
     _imp->_nodeCache->setMaximumCacheSize(maxCacheRAM - playbackSize);
@@ -1675,6 +1714,18 @@ AppManager::removeFromViewerCache(U64 hash)
     _imp->_viewerCache->removeEntry(hash);
 }
 
+SharedImageCache*
+AppManager::getSharedImageCache() const
+{
+    return _imp->_sharedImageCache.get();
+}
+
+TaskScheduler*
+AppManager::getTaskScheduler() const
+{
+    return _imp->taskScheduler.get();
+}
+
 void
 AppManager::getMemoryStatsForCacheEntryHolder(const CacheEntryHolder* holder,
                                        std::size_t* ramOccupied,
@@ -1811,7 +1862,8 @@ AppManager::isAggressiveCachingEnabled() const
 U64
 AppManager::getCachesTotalMemorySize() const
 {
-    return _imp->_viewerCache->getMemoryCacheSize() + _imp->_nodeCache->getMemoryCacheSize();
+    return _imp->_viewerCache->getMemoryCacheSize() + _imp->_viewerCache->getCompressedCacheSize() +
+           _imp->_nodeCache->getMemoryCacheSize() + _imp->_nodeCache->getCompressedCacheSize();
 }
 
 Natron::CacheSignalEmitter*
@@ -2055,7 +2107,7 @@ AppManager::qt_tildeExpansion(const QString &path,
 bool
 AppManager::isNodeCacheAlmostFull() const
 {
-    std::size_t nodeCacheSize = _imp->_nodeCache->getMemoryCacheSize();
+    std::size_t nodeCacheSize = _imp->_nodeCache->getMemoryCacheSize() + _imp->_nodeCache->getCompressedCacheSize();
     std::size_t nodeMaxCacheSize = _imp->_nodeCache->getMaximumMemorySize();
     
     if (nodeMaxCacheSize == 0) {
@@ -2073,41 +2125,219 @@ void
 AppManager::checkCacheFreeMemoryIsGoodEnough()
 {
     ///Before allocating the memory check that there's enough space to fit in memory
-    size_t systemRAMToKeepFree = getSystemTotalRAM() * appPTR->getCurrentSettings()->getUnreachableRamPercent();
-    size_t totalFreeRAM = getAmountFreePhysicalRAM();
-    
+    _imp->memoryPressure->setRamToKeepFree( _imp->_settings->getUnreachableRamPercent() );
+    MemoryPressureState state;
+    if ( !_imp->memoryPressure->refreshState(&state) ) {
+        ///The state was checked very recently, the caches budgets are up to date
+        return;
+    }
 
-    double playbackRAMPercent = appPTR->getCurrentSettings()->getRamPlaybackMaximumPercent();
-    while (totalFreeRAM <= systemRAMToKeepFree) {
-        
-        size_t nodeCacheSize =  _imp->_nodeCache->getMemoryCacheSize();
-        size_t viewerRamCacheSize =  _imp->_viewerCache->getMemoryCacheSize();
+    ///The blocks kept for reuse by the renders in progress only get a fraction of the RAM given to the node cache
+    RenderArena::setMaxKeptBytes( (std::size_t)(_imp->_nodeCache->getMemoryBudget() * NATRON_RENDER_ARENA_MAX_KEPT_CACHE_FRACTION) );
+
+    double nodeScale = _imp->_nodeCache->getMemoryBudgetScale();
+    double viewerScale = _imp->_viewerCache->getMemoryBudgetScale();
+    MemoryBudgetActionEnum action = _imp->memoryPressure->getBudgetAction(state);
+    
+    if (action == eMemoryBudgetActionGrow) {
+        ///Give the memory back to the caches progressively in case the pressure comes back
+        if (nodeScale < 1.) {
+            _imp->_nodeCache->setMemoryBudgetScale(nodeScale + NATRON_MEMORY_PRESSURE_RECOVERY_STEP);
+        }
+        if (viewerScale < 1.) {
+            _imp->_viewerCache->setMemoryBudgetScale(viewerScale + NATRON_MEMORY_PRESSURE_RECOVERY_STEP);
+        }
         
-        ///If the viewer cache represents more memory than the node cache, clear some of the viewer cache
-        if (nodeCacheSize == 0 || (viewerRamCacheSize / (double)nodeCacheSize) > playbackRAMPercent) {
-#ifdef NATRON_DEBUG_CACHE
-            qDebug() << "Total system free RAM is below the threshold:" << printAsRAM(totalFreeRAM)
-                     << ", clearing least recently used ViewerCache texture...";
-#endif
-            
-            if (!_imp->_viewerCache->evictLRUInMemoryEntry()) {
-                break;
-            }
-            
-            
-        } else {
+        return;
+    }
+    if (action == eMemoryBudgetActionNone) {
+        ///The caches were already shrunk for this pressure episode
+        return;
+    }
+    
+    ///The blocks kept for reuse by the renders in progress are given back first
+    U64 arenasSize = RenderArena::getTotalKeptBytes();
+    RenderArena::releaseAllKeptBlocks();
+
+    ///Free in a single batch what is missing to keep the requested RAM free, plus a fraction of the caches
+    ///so that the next allocations do not hit the limit again right away
+    U64 nodeCacheSize = _imp->_nodeCache->getMemoryCacheSize() + _imp->_nodeCache->getCompressedCacheSize();
+    U64 viewerCacheSize = _imp->_viewerCache->getMemoryCacheSize() + _imp->_viewerCache->getCompressedCacheSize();
+    U64 cachesSize = nodeCacheSize + viewerCacheSize;
+    if (cachesSize == 0) {
+        return;
+    }
+    U64 toFree = MemoryPressure::computeAmountToFree(state, _imp->_settings->getUnreachableRamPercent(), cachesSize);
+    toFree -= std::min(toFree, arenasSize);
+    
 #ifdef NATRON_DEBUG_CACHE
-            qDebug() << "Total system free RAM is below the threshold:" << printAsRAM(totalFreeRAM)
-                     << ", clearing least recently used NodeCache image...";
+    qDebug() << "Memory pressure" << (int)state.level << ", available RAM:" << printAsRAM(state.availableRAM)
+             << ", freeing" << printAsRAM(toFree) << "from the caches";
 #endif
-            if (!_imp->_nodeCache->evictLRUInMemoryEntry()) {
-                break;
-            }
+    
+    ///Each cache gives back memory in proportion to what it uses
+    U64 nodeToFree = (U64)( (double)toFree * nodeCacheSize / cachesSize );
+    U64 viewerToFree = toFree - std::min(toFree, nodeToFree);
+    std::size_t nodeMaxSize = _imp->_nodeCache->getMaximumMemorySize();
+    std::size_t viewerMaxSize = _imp->_viewerCache->getMaximumMemorySize();
+    if (nodeMaxSize > 0) {
+        double scale = (double)(nodeCacheSize - std::min(nodeCacheSize, nodeToFree)) / nodeMaxSize;
+        _imp->_nodeCache->setMemoryBudgetScale( std::min(scale, nodeScale) );
+    }
+    if (viewerMaxSize > 0) {
+        double scale = (double)(viewerCacheSize - std::min(viewerCacheSize, viewerToFree)) / viewerMaxSize;
+        _imp->_viewerCache->setMemoryBudgetScale( std::min(scale, viewerScale) );
+    }
+    _imp->_nodeCache->clearExceedingEntries();
+    _imp->_viewerCache->clearExceedingEntries();
+}
+
+MemoryPressureState
+AppManager::getMemoryPressureState() const
+{
+    return _imp->memoryPressure->getState();
+}
+
+U64
+AppManager::getNodeCacheMemoryBudget() const
+{
+    return _imp->_nodeCache ? _imp->_nodeCache->getMemoryBudget() : 0;
+}
+
+U64
+AppManager::getViewerCacheMemoryBudget() const
+{
+    return _imp->_viewerCache ? _imp->_viewerCache->getMemoryBudget() : 0;
+}
+
+void
+AppManager::notifyImageCacheDownscaledHit(bool useDiskCache) const
+{
+    if (useDiskCache) {
+        if (_imp->_diskCache) {
+            _imp->_diskCache->notifyDownscaledHit();
         }
-        
-        totalFreeRAM = getAmountFreePhysicalRAM();
+    } else if (_imp->_nodeCache) {
+        _imp->_nodeCache->notifyDownscaledHit();
+    }
+}
+
+void
+AppManager::getCachesStats(std::map<std::string, Natron::CacheStatsSnapshot>* stats) const
+{
+    stats->clear();
+    if (_imp->_nodeCache) {
+        (*stats)[_imp->_nodeCache->cacheName()] = _imp->_nodeCache->getStats();
+    }
+    if (_imp->_diskCache) {
+        (*stats)[_imp->_diskCache->cacheName()] = _imp->_diskCache->getStats();
+    }
+    if (_imp->_viewerCache) {
+        (*stats)[_imp->_viewerCache->cacheName()] = _imp->_viewerCache->getStats();
     }
+}
+
+void
+AppManager::getNodesCacheStats(std::map<std::string, Natron::CacheStatsSnapshot>* stats) const
+{
+    stats->clear();
+
+    std::map<int,AppInstanceRef> copy;
+    {
+        QMutexLocker k(&_imp->_appInstancesMutex);
+        copy = _imp->_appInstances;
+    }
+    for (std::map<int,AppInstanceRef>::iterator it = copy.begin(); it != copy.end(); ++it) {
+        boost::shared_ptr<Natron::Project> project = it->second.app->getProject();
+        if (!project) {
+            continue;
+        }
+        NodeList nodes;
+        project->getNodes_recursive(nodes, false);
+        std::string prefix = it->second.app->getAppIDString() + '.';
+        for (NodeList::iterator it2 = nodes.begin(); it2 != nodes.end(); ++it2) {
+            (*stats)[prefix + (*it2)->getFullyQualifiedName()] = (*it2)->getCacheStats()->getSnapshot();
+        }
+    }
+}
+
+void
+AppManager::resetCachesStats()
+{
+    if (_imp->_nodeCache) {
+        _imp->_nodeCache->resetStats();
+    }
+    if (_imp->_diskCache) {
+        _imp->_diskCache->resetStats();
+    }
+    if (_imp->_viewerCache) {
+        _imp->_viewerCache->resetStats();
+    }
+
+    std::map<int,AppInstanceRef> copy;
+    {
+        QMutexLocker k(&_imp->_appInstancesMutex);
+        copy = _imp->_appInstances;
+    }
+    for (std::map<int,AppInstanceRef>::iterator it = copy.begin(); it != copy.end(); ++it) {
+        boost::shared_ptr<Natron::Project> project = it->second.app->getProject();
+        if (!project) {
+            continue;
+        }
+        NodeList nodes;
+        project->getNodes_recursive(nodes, false);
+        for (NodeList::iterator it2 = nodes.begin(); it2 != nodes.end(); ++it2) {
+            (*it2)->getCacheStats()->reset();
+        }
+    }
+}
+
+/**
+ * @brief Script names cannot contain quotes nor backslashes, but escape them anyway so that the JSON stays valid.
+ **/
+static std::string
+escapeJSONString(const std::string & str)
+{
+    std::string ret;
+
+    for (std::size_t i = 0; i < str.size(); ++i) {
+        if ( (str[i] == '"') || (str[i] == '\\') ) {
+            ret.push_back('\\');
+        }
+        ret.push_back(str[i]);
+    }
+
+    return ret;
+}
 
+static void
+writeCacheStatsMapJSON(std::ostream & os,
+                       const std::map<std::string, Natron::CacheStatsSnapshot> & stats)
+{
+    os << "{";
+    for (std::map<std::string, Natron::CacheStatsSnapshot>::const_iterator it = stats.begin(); it != stats.end(); ++it) {
+        if ( it != stats.begin() ) {
+            os << ',';
+        }
+        os << "\n        \"" << escapeJSONString(it->first) << "\": ";
+        it->second.writeJSON(os, "        ");
+    }
+    os << "\n    }";
+}
+
+void
+AppManager::writeCachesStatsJSON(std::ostream & os) const
+{
+    std::map<std::string, Natron::CacheStatsSnapshot> cachesStats, nodesStats;
+
+    getCachesStats(&cachesStats);
+    getNodesCacheStats(&nodesStats);
+
+    os << "{\n    \"caches\": ";
+    writeCacheStatsMapJSON(os, cachesStats);
+    os << ",\n    \"nodes\": ";
+    writeCacheStatsMapJSON(os, nodesStats);
+    os << "\n}\n";
 }
 
 void
@@ -2137,8 +2367,14 @@ AppManager::getOCIOConfigPath() const
 void
 AppManager::setNThreadsToRender(int nThreads)
 {
-    QMutexLocker l(&_imp->nThreadsMutex);
-    _imp->nThreadsToRender = nThreads;
+    {
+        QMutexLocker l(&_imp->nThreadsMutex);
+        _imp->nThreadsToRender = nThreads;
+    }
+    if (_imp->taskScheduler) {
+        ///-1 means no multi-threading, the renders do not split their work in that case
+        _imp->taskScheduler->setThreadCount(nThreads > 0 ? nThreads : (nThreads == 0 ? _imp->idealThreadCount : 1) );
+    }
 }
 
 void
@@ -2171,6 +2407,20 @@ AppManager::getUseThreadPool() const
     return _imp->useThreadPool;
 }
 
+void
+AppManager::setNThreadsPerImageOperation(int nThreads)
+{
+    QMutexLocker l(&_imp->nThreadsMutex);
+    _imp->nThreadsPerImageOperation = nThreads;
+}
+
+int
+AppManager::getNThreadsPerImageOperation() const
+{
+    QMutexLocker l(&_imp->nThreadsMutex);
+    return _imp->nThreadsPerImageOperation;
+}
+
 void
 AppManager::fetchAndAddNRunningThreads(int nThreads)
 {
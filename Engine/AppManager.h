@@ -26,6 +26,8 @@
 // ***** END PYTHON BLOCK *****
 
 #include <list>
+#include <map>
+#include <ostream>
 #include <string>
 #include "Global/GlobalDefines.h"
 CLANG_DIAG_OFF(deprecated)
@@ -43,7 +45,9 @@ CLANG_DIAG_ON(deprecated)
 #endif
 
 #include "Engine/Plugin.h"
+#include "Engine/CacheStats.h"
 #include "Engine/KnobFactory.h"
+#include "Engine/MemoryPressure.h"
 #include "Engine/EngineFwd.h"
 
 /*macro to get the unique pointer to the controler*/
@@ -214,11 +218,27 @@ public:
 
     void setPlaybackCacheMaximumSize(double p);
 
+    void setApplicationsCachesCompressedPortion(double p);
+
+    void setApplicationsCachesEvictionPolicy(Natron::CacheEvictionPolicyEnum policy);
+
     void removeFromNodeCache(const boost::shared_ptr<Natron::Image> & image);
     void removeFromViewerCache(const boost::shared_ptr<Natron::FrameEntry> & texture);
     
     void removeFromNodeCache(U64 hash);
     void removeFromViewerCache(U64 hash);
+
+    /**
+     * @brief Returns the cache of images shared with the other processes, or NULL if it is not enabled.
+     * @see NATRON_SHARED_IMAGE_CACHE_SIZE_ENV_VAR
+     **/
+    Natron::SharedImageCache* getSharedImageCache() const;
+
+    /**
+     * @brief Returns the threads shared by all the renders to run their tiles and image operations in parallel,
+     * whose number follows the "Number of render threads" preference.
+     **/
+    Natron::TaskScheduler* getTaskScheduler() const;
     /**
      * @brief Given the following tree version, removes all images from the node cache with a matching
      * tree version. This is useful to wipe the cache for one particular node.
@@ -311,9 +331,52 @@ public:
 
     /**
      * @brief Called by the caches to check that there's enough free memory on the computer to perform the allocation.
+     * When the system or the cgroup of the process is under memory pressure, the budgets of the node and viewer caches
+     * are shrunk in a single batch. They grow back progressively once the pressure is gone.
      * WARNING: This functin may remove some entries from the caches.
      **/
     void checkCacheFreeMemoryIsGoodEnough();
+
+    /**
+     * @brief Returns the memory state of the system as last read by checkCacheFreeMemoryIsGoodEnough().
+     **/
+    Natron::MemoryPressureState getMemoryPressureState() const;
+
+    /**
+     * @brief Returns the RAM the node cache may currently use, which is lower than its maximum size under memory pressure.
+     **/
+    U64 getNodeCacheMemoryBudget() const;
+
+    /**
+     * @brief Returns the RAM the viewer cache may currently use, which is lower than its maximum size under memory pressure.
+     **/
+    U64 getViewerCacheMemoryBudget() const;
+
+    /**
+     * @brief Records in the node cache (or the disk cache) telemetry that an image found had to be downscaled.
+     **/
+    void notifyImageCacheDownscaledHit(bool useDiskCache) const;
+
+    /**
+     * @brief Returns the telemetry of each cache, by cache name.
+     **/
+    void getCachesStats(std::map<std::string, Natron::CacheStatsSnapshot>* stats) const;
+
+    /**
+     * @brief Returns the cache telemetry of the nodes of all the app instances, by fully qualified node name
+     * prefixed by the app instance, e.g: "app1.Blur1".
+     **/
+    void getNodesCacheStats(std::map<std::string, Natron::CacheStatsSnapshot>* stats) const;
+
+    /**
+     * @brief Resets the telemetry of the caches and of all nodes.
+     **/
+    void resetCachesStats();
+
+    /**
+     * @brief Writes the telemetry of the caches and of all nodes as a JSON object, @see CLArgs::getCacheStatsFilePath()
+     **/
+    void writeCachesStatsJSON(std::ostream & os) const;
     
     void onCheckerboardSettingsChanged() { Q_EMIT  checkerboardSettingsChanged(); }
     
@@ -342,10 +405,17 @@ public:
     void setNThreadsToRender(int nThreads);
     void setNThreadsPerEffect(int nThreadsPerEffect);
     void setUseThreadPool(bool useThreadPool);
+    void setNThreadsPerImageOperation(int nThreads);
     
     void getNThreadsSettings(int* nThreadsToRender,int* nThreadsPerEffect) const;
     bool getUseThreadPool() const;
     
+    /**
+     * @brief Returns the maximum number of threads used by the operations on large images such as Image::fill(),
+     * 0 meaning the ideal thread count of the hardware.
+     **/
+    int getNThreadsPerImageOperation() const;
+    
     /**
      * @brief Updates the global runningThreadsCount maintained across the whole application
      **/
@@ -46,6 +46,8 @@
 #include "Engine/Cache.h"
 #include "Engine/FrameEntry.h"
 #include "Engine/Image.h"
+#include "Engine/SharedImageCache.h"
+#include "Engine/TaskScheduler.h"
 #include "Engine/EngineFwd.h"
 #include "Engine/TLSHolder.h"
 
@@ -78,6 +80,9 @@ struct AppManagerPrivate
     boost::shared_ptr<Natron::Cache<Natron::Image> >  _nodeCache; //< Images cache
     boost::shared_ptr<Natron::Cache<Natron::Image> >  _diskCache; //< Images disk cache (used by DiskCache nodes)
     boost::shared_ptr<Natron::Cache<Natron::FrameEntry> > _viewerCache; //< Viewer textures cache
+    boost::scoped_ptr<Natron::SharedImageCache> _sharedImageCache; //< Images cache shared with other processes, may be NULL
+    boost::scoped_ptr<Natron::MemoryPressure> memoryPressure; //< memory available to the process, shrinks the caches budgets
+    boost::scoped_ptr<Natron::TaskScheduler> taskScheduler; //< threads running the tiles, rows and viewer renders of all the renders
     
     mutable QMutex diskCachesLocationMutex;
     QString diskCachesLocation;
@@ -101,7 +106,8 @@ struct AppManagerPrivate
     int nThreadsToRender; // the value held by the corresponding Knob in the Settings, stored here for faster access (3 RW lock vs 1 mutex here)
     int nThreadsPerEffect;  // the value held by the corresponding Knob in the Settings, stored here for faster access (3 RW lock vs 1 mutex here)
     bool useThreadPool; // whether the multi-thread suite should use the global thread pool (of QtConcurrent) or not
-    mutable QMutex nThreadsMutex; // protects nThreadsToRender & nThreadsPerEffect & useThreadPool
+    int nThreadsPerImageOperation; // the value held by the corresponding Knob in the Settings, stored here for faster access
+    mutable QMutex nThreadsMutex; // protects nThreadsToRender & nThreadsPerEffect & useThreadPool & nThreadsPerImageOperation
     
     //The idea here is to keep track of the number of threads launched by Natron (except the ones of the global thread pool of QtConcurrent)
     //So that we can properly have an estimation of how much the cores of the CPU are used.
@@ -61,6 +61,8 @@ struct CLArgsPrivate
     
     bool enableRenderStats;
     
+    QString cacheStatsFilePath;
+    
     bool isEmpty;
     
     mutable QString imageFilename;
@@ -87,6 +89,7 @@ struct CLArgsPrivate
     , frameRanges()
     , rangeSet(false)
     , enableRenderStats(false)
+    , cacheStatsFilePath()
     , isEmpty(true)
     , imageFilename()
     , breakpadPipeFilePath()
@@ -182,6 +185,7 @@ CLArgs::operator=(const CLArgs& other)
     _imp->frameRanges = other._imp->frameRanges;
     _imp->rangeSet = other._imp->rangeSet;
     _imp->enableRenderStats = other._imp->enableRenderStats;
+    _imp->cacheStatsFilePath = other._imp->cacheStatsFilePath;
     _imp->isEmpty = other._imp->isEmpty;
     _imp->imageFilename = other._imp->imageFilename;
 }
@@ -270,7 +274,11 @@ CLArgs::printUsage(const std::string& programName)
                               "     breakdown contains informations about each nodes, render times etc...\n"
                               "     This option is useful for debugging purposes or to control that a render\n"
                               "     is working correctly.\n"
-                              "     **Please note** that it does not work when writing video files."
+                              "     **Please note** that it does not work when writing video files.\n"
+                              "  --cache-stats <filename> : Once the render is finished, writes to the given\n"
+                              "     file the cache statistics (hits, misses, memory allocated, evictions...)\n"
+                              "     of each cache and of each node, in JSON format. Use - to print them on the\n"
+                              "     standard output. This is useful to tune the cache sizes.\n"
                               "Sample uses:\n"
                               "  %1 /Users/Me/MyNatronProjects/MyProject.ntp\n"
                               "  %1 -b -w MyWriter /Users/Me/MyNatronProjects/MyProject.ntp\n"
@@ -418,6 +426,12 @@ CLArgs::areRenderStatsEnabled() const
     return _imp->enableRenderStats;
 }
 
+const QString&
+CLArgs::getCacheStatsFilePath() const
+{
+    return _imp->cacheStatsFilePath;
+}
+
 bool
 CLArgs::isPythonScript() const
 {
@@ -654,6 +668,24 @@ CLArgsPrivate::parse()
         }
     }
     
+    {
+        QStringList::iterator it = hasToken("cache-stats", "");
+        if (it != args.end()) {
+            it = args.erase(it);
+            if (it != args.end()) {
+                cacheStatsFilePath = *it;
+#ifdef __NATRON_UNIX__
+                cacheStatsFilePath = AppManager::qt_tildeExpansion(cacheStatsFilePath);
+#endif
+                args.erase(it);
+            } else {
+                std::cout << QObject::tr("--cache-stats specified, you must enter a filename afterwards.").toStdString() << std::endl;
+                error = 1;
+                return;
+            }
+        }
+    }
+    
     {
         QStringList::iterator it = hasToken(NATRON_BREAKPAD_PROCESS_PID, "");
         if (it != args.end()) {
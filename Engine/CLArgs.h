@@ -106,6 +106,12 @@ public:
     
     bool areRenderStatsEnabled() const;
     
+    /*
+     * @brief The file the cache statistics are written to once the render is finished, "-" for the standard output.
+     * Empty if they should not be written.
+     */
+    const QString& getCacheStatsFilePath() const;
+    
     const QString& getBreakpadProcessExecutableFilePath() const;
     
     qint64 getBreakpadProcessPID() const;
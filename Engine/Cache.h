@@ -30,6 +30,7 @@
 #include <fstream>
 #include <functional>
 #include <list>
+#include <map>
 #include <cstddef>
 #include <utility>
 #include <algorithm> // min, max
@@ -38,6 +39,7 @@
 #include "Global/MemoryInfo.h"
 GCC_DIAG_OFF(deprecated)
 #include <QtCore/QMutex>
+#include <QtCore/QDir>
 #include <QtCore/QThread>
 #include <QtCore/QWaitCondition>
 #include <QtCore/QMutexLocker>
@@ -47,11 +49,17 @@ GCC_DIAG_OFF(deprecated)
 GCC_DIAG_ON(deprecated)
 #if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
 #endif
 
 #include "Engine/AppManager.h" //for access to settings
 #include "Engine/Settings.h"
+#include "Engine/CacheAccessTrace.h"
 #include "Engine/CacheEntry.h"
+#include "Engine/CacheSegmentStore.h"
+#include "Engine/CacheStats.h"
 #include "Engine/LRUHashTable.h"
 #include "Engine/StandardPaths.h"
 #include "Engine/ImageLocker.h"
@@ -61,6 +69,20 @@ GCC_DIAG_ON(deprecated)
 //Beyond that percentage of occupation, the cache will start evicting LRU entries
 #define NATRON_CACHE_LIMIT_PERCENT 0.9
 
+//The default number of shards of a cache is the number of cores times this, rounded to the next power of 2
+#define NATRON_CACHE_SHARDS_PER_THREAD 2
+
+//Upper bound of the default number of shards of a cache
+#define NATRON_CACHE_MAX_SHARDS 64
+
+//Number of threads writing the entries evicted from the memory portion of a cache to disk, i.e: the maximum number
+//of such writes done concurrently
+#define NATRON_CACHE_WRITE_BACK_THREADS 2
+
+//Number of records an eviction index may hold beyond twice the number of entries it had when it was last rebuilt,
+//@see CacheShard::EvictionIndex
+#define NATRON_CACHE_EVICTION_INDEX_SLACK 64
+
 ///When defined, number of opened files, memory size and disk size of the cache are printed whenever there's activity.
 //#define NATRON_DEBUG_CACHE
 
@@ -309,6 +331,174 @@ private:
 };
 
 
+template<typename EntryType>
+class Cache;
+
+/**
+ * @brief The point of this thread is to write the data of the entries evicted from the memory portion of the cache to
+ * the segment files, so that the thread evicting them (i.e: allocating a new entry) doesn't wait for the I/O.
+ * The entries stay in the memory portion of the cache while they are written and are moved to the disk portion
+ * only once written, @see Cache::onEntryWrittenBack
+ **/
+template <typename EntryType>
+class WriteBackThread
+    : public QThread
+{
+public:
+
+    struct WriteBackRequest
+    {
+        boost::shared_ptr<EntryType> entry;
+        std::size_t size; //< the size of the entry when it was evicted
+        unsigned int accessCount; //< the access count of the entry when it was evicted
+        bool allowCompression; //< whether the entry may be kept compressed in RAM once written
+        bool written; //< set by the thread once the data is written
+
+        WriteBackRequest()
+            : entry()
+            , size(0)
+            , accessCount(0)
+            , allowCompression(false)
+            , written(false)
+        {
+        }
+    };
+
+private:
+
+    mutable QMutex _requestsQueueMutex;
+    std::list<WriteBackRequest> _requestsQueue;
+    QWaitCondition _requestsQueueNotEmptyCond;
+    QWaitCondition _idleCond; //< woken when the queue is empty and no request is being processed
+    bool _processing; //< protected by _requestsQueueMutex
+    const Cache<EntryType>* cache;
+    QMutex mustQuitMutex;
+    QWaitCondition mustQuitCond;
+    bool mustQuit;
+
+public:
+
+    WriteBackThread(const Cache<EntryType>* cache)
+        : QThread()
+        , _requestsQueueMutex()
+        , _requestsQueue()
+        , _requestsQueueNotEmptyCond()
+        , _idleCond()
+        , _processing(false)
+        , cache(cache)
+        , mustQuitMutex()
+        , mustQuitCond()
+        , mustQuit(false)
+    {
+        setObjectName("CacheWriteBack");
+    }
+
+    virtual ~WriteBackThread()
+    {
+    }
+
+    void appendToQueue(const WriteBackRequest & request)
+    {
+        {
+            QMutexLocker k(&_requestsQueueMutex);
+            _requestsQueue.push_back(request);
+        }
+        if ( !isRunning() ) {
+            start();
+        } else {
+            QMutexLocker k(&_requestsQueueMutex);
+            _requestsQueueNotEmptyCond.wakeOne();
+        }
+    }
+
+    void quitThread()
+    {
+        if ( !isRunning() ) {
+            return;
+        }
+        QMutexLocker k(&mustQuitMutex);
+        mustQuit = true;
+
+        {
+            QMutexLocker k2(&_requestsQueueMutex);
+            _requestsQueue.push_back( WriteBackRequest() );
+            _requestsQueueNotEmptyCond.wakeOne();
+        }
+        while (mustQuit) {
+            mustQuitCond.wait(&mustQuitMutex);
+        }
+    }
+
+    bool isWorking() const
+    {
+        QMutexLocker k(&_requestsQueueMutex);
+
+        return !_requestsQueue.empty() || _processing;
+    }
+
+    /**
+     * @brief Blocks until all the requests appended so far are processed.
+     **/
+    void waitForIdle()
+    {
+        QMutexLocker k(&_requestsQueueMutex);
+
+        while ( isRunning() && ( !_requestsQueue.empty() || _processing ) ) {
+            _idleCond.wait(&_requestsQueueMutex);
+        }
+    }
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        for (;; ) {
+            bool quit;
+            {
+                QMutexLocker k(&mustQuitMutex);
+                quit = mustQuit;
+            }
+
+            {
+                WriteBackRequest front;
+                {
+                    QMutexLocker k(&_requestsQueueMutex);
+                    if ( quit && _requestsQueue.empty() ) {
+                        _idleCond.wakeAll();
+                        _requestsQueueMutex.unlock();
+                        QMutexLocker k(&mustQuitMutex);
+                        mustQuit = false;
+                        mustQuitCond.wakeAll();
+
+                        return;
+                    }
+                    while ( _requestsQueue.empty() ) {
+                        _requestsQueueNotEmptyCond.wait(&_requestsQueueMutex);
+                    }
+
+                    assert( !_requestsQueue.empty() );
+                    front = _requestsQueue.front();
+                    _requestsQueue.pop_front();
+                    _processing = true;
+                }
+                if (front.entry) {
+                    ///This is EXPENSIVE! No lock of the cache is held here
+                    front.written = front.entry->writeToDisk();
+                    cache->onEntryWrittenBack(front);
+                }
+            } // front. After this scope, the entry is no longer referenced by the thread
+            {
+                QMutexLocker k(&_requestsQueueMutex);
+                _processing = false;
+                if ( _requestsQueue.empty() ) {
+                    _idleCond.wakeAll();
+                }
+            }
+        }
+    }
+};
+
+
 class CacheSignalEmitter
     : public QObject
 {
@@ -365,12 +555,32 @@ Q_SIGNALS:
 
 /*
  * ValueType must be derived of CacheEntryHelper
+ *
+ * The cache is split into several shards: an entry always lives in the shard selected by its hash key.
+ * Each shard has its own LRU containers and its own locks so that threads looking-up or inserting
+ * entries of different shards never wait for each other. The memory budget is global to the cache:
+ * when it is exceeded, entries are evicted from the shards that occupy the most memory.
+ *
+ * Entries evicted from the memory portion may be kept compressed in RAM (@see setCompressedPortion). A hit on a compressed
+ * entry only costs its decompression. Compressed entries count in the memory budget for their compressed size, they are
+ * evicted to the disk portion (or deleted) when the compressed portion exceeds its share of the budget.
+ * Entries are compressed and decompressed outside of the shard lock: they are taken out of their container meanwhile and
+ * the look-ups of their key wait for them, @see CacheShard::inTransit.
+ *
+ * Which entry is evicted first is decided by the eviction policy (@see setEvictionPolicy): either the least recently used
+ * one, or with the GreedyDual-Size-Frequency policy the one that is the cheapest to render again per byte, given the number
+ * of times it was used. The accesses to the cache can be recorded to be replayed later on, @see CacheAccessTrace.
+ *
+ * The data of entries evicted from the memory portion that are stored on disk is written by write-back threads: the
+ * entries remain in the memory portion until their data is written, then they are moved to the disk portion. The memory
+ * they use is not counted in the memory budget in the meantime so that allocations do not wait for the I/O.
  */
 template<typename EntryType>
 class Cache
     : public CacheAPI
 {
     friend class CacheCleanerThread;
+    friend class WriteBackThread<EntryType>;
 
 public:
 
@@ -450,6 +660,84 @@ public:
 
 private:
 
+    /**
+     * @brief A hash-partitioned portion of the cache. All entries sharing the same hash key live in the same shard.
+     **/
+    struct CacheShard
+    {
+        /**
+         * @brief The entries of a container of the shard ordered by their GreedyDual-Size-Frequency priority, so that
+         * the entry to evict is found in logarithmic time. Only maintained with that policy.
+         * Records are not removed when their entry leaves the container, nor updated when the priority of their entry
+         * changes: evictEntry() drops the records of the entries no longer in the container and re-inserts the records
+         * of the entries whose priority was raised since, e.g: by an access or a longer render time. The index is
+         * rebuilt from the container once it holds too many such stale records.
+         * Records do not keep their entry alive, nor identify it by its address which may be reused by another entry.
+         **/
+        struct EvictionIndex
+        {
+            typedef std::pair<hash_type, boost::weak_ptr<EntryType> > Record;
+
+            std::multimap<double, Record> records;
+            std::size_t maxRecords; //< the index is rebuilt beyond this
+
+            EvictionIndex()
+                : records()
+                , maxRecords(NATRON_CACHE_EVICTION_INDEX_SLACK)
+            {
+            }
+        };
+
+        mutable QMutex getLock; //prevents get() and getOrCreate() to be called simultaneously for keys of this shard
+        mutable QMutex lock; //protects memoryCache, compressedCache & diskCache, their eviction indexes, evictionPolicy & inflation
+
+        /*These are mutable because we need to modify the LRU list even
+           when we call get() and we want this function to be const.*/
+        mutable CacheContainer memoryCache;
+        mutable CacheContainer compressedCache; //< entries whose data is compressed in RAM
+        mutable CacheContainer diskCache;
+        mutable EvictionIndex memoryIndex, compressedIndex, diskIndex;
+
+        /**
+         * @brief An entry being compressed or decompressed outside of the shard lock, in none of the containers meanwhile.
+         **/
+        struct EntryInTransit
+        {
+            EntryTypePtr entry;
+            bool cancelled; //< set if the entry was removed from the cache meanwhile: it is not put back once done
+        };
+
+        std::list<EntryInTransit> inTransit; //< protected by lock
+        QWaitCondition transitDone; //< woken under lock when an entry leaves inTransit
+
+        //Protected by the _sizeLock of the cache so that the shards sizes always sum up to the cache sizes
+        std::size_t memoryCacheSize;
+        std::size_t compressedCacheSize;
+        std::size_t diskCacheSize;
+
+        Natron::CacheEvictionPolicyEnum evictionPolicy;
+        double inflation; //< the priority of the last entry evicted with the GreedyDual-Size-Frequency policy
+
+        CacheShard()
+            : getLock()
+            , lock()
+            , memoryCache()
+            , compressedCache()
+            , diskCache()
+            , memoryIndex()
+            , compressedIndex()
+            , diskIndex()
+            , inTransit()
+            , transitDone()
+            , memoryCacheSize(0)
+            , compressedCacheSize(0)
+            , diskCacheSize(0)
+            , evictionPolicy(Natron::eCacheEvictionPolicyLRU)
+            , inflation(0.)
+        {
+        }
+    };
+
 
     std::size_t _maximumInMemorySize;     // the maximum size of the in-memory portion of the cache.(in % of the maximum cache size)
     std::size_t _maximumCacheSize;     // maximum size allowed for the cache
@@ -458,15 +746,16 @@ private:
          is called by an external object that have a const ref to the cache.
      */
     mutable std::size_t _memoryCacheSize;     // current size of the cache in bytes
+    mutable std::size_t _compressedCacheSize; // current size of the compressed entries in bytes
     mutable std::size_t _diskCacheSize;
-    mutable QMutex _sizeLock; // protects _memoryCacheSize & _diskCacheSize & _maximumInMemorySize & _maximumCacheSize
-    mutable QMutex _lock; //protects _memoryCache & _diskCache
-    mutable QMutex _getLock;  //prevents get() and getOrCreate() to be called simultaneously
-
-    /*These 2 are mutable because we need to modify the LRU list even
-         when we call get() and we want this function to be const.*/
-    mutable CacheContainer _memoryCache;
-    mutable CacheContainer _diskCache;
+    mutable std::size_t _writeBackSize; // size of the entries of the memory portion being written to disk
+    double _compressedPortion; // fraction of _maximumInMemorySize that compressed entries may use
+    double _memoryBudgetScale; // fraction of _maximumInMemorySize that may be used, lowered when the system is under memory pressure
+    mutable QMutex _sizeLock; // protects the sizes above & _maximumInMemorySize & _maximumCacheSize and the shards sizes
+
+    // The shards are allocated once in the constructor and never change afterwards: no need to take a lock to access them
+    const unsigned int _nShards;
+    boost::scoped_array<CacheShard> _shards;
     const std::string _cacheName;
     const unsigned int _version;
 
@@ -477,57 +766,137 @@ private:
     ///Store the system physical total RAM in a member
     std::size_t _maxPhysicalRAM;
     bool _tearingDown;
+
+    ///Created the first time an entry is stored on disk. Declared before the threads so that it outlives
+    ///the entries they may still hold when the cache is destroyed
+    mutable boost::scoped_ptr<CacheSegmentStore> _segmentStore;
+    mutable QMutex _segmentStoreLock;
     mutable Natron::DeleterThread<EntryType> _deleterThread;
     mutable QWaitCondition _memoryFullCondition; //< protected by _sizeLock
     mutable Natron::CacheCleanerThread _cleanerThread;
+    std::vector<boost::shared_ptr<Natron::WriteBackThread<EntryType> > > _writeBackThreads;
+
+    ///Only set if the NATRON_CACHE_TRACE_DIR_ENV_VAR environment variable is set
+    boost::scoped_ptr<CacheAccessTrace> _accessTrace;
+
+    ///Always recorded, the entries holders have their own, @see CacheEntryHolder::getCacheStats
+    mutable Natron::CacheStats _stats;
 
 public:
 
 
+    /**
+     * @param nShards The number of shards the cache is split into. If <= 0 it is derived from the number of
+     * cores of the computer.
+     **/
     Cache(const std::string & cacheName
           ,
           unsigned int version
           ,
           U64 maximumCacheSize      // total size
           ,
-          double maximumInMemoryPercentage)      //how much should live in RAM
+          double maximumInMemoryPercentage      //how much should live in RAM
+          ,
+          int nShards = 0)
         : CacheAPI()
         , _maximumInMemorySize(maximumCacheSize * maximumInMemoryPercentage)
         , _maximumCacheSize(maximumCacheSize)
         , _memoryCacheSize(0)
+        , _compressedCacheSize(0)
         , _diskCacheSize(0)
+        , _writeBackSize(0)
+        , _compressedPortion(0.)
+        , _memoryBudgetScale(1.)
         , _sizeLock()
-        , _lock()
-        , _getLock()
-        , _memoryCache()
-        , _diskCache()
+        , _nShards( nShards > 0 ? (unsigned int)nShards : getDefaultShardsCount() )
+        , _shards()
         , _cacheName(cacheName)
         , _version(version)
         , _signalEmitter(new CacheSignalEmitter)
         , _maxPhysicalRAM( getSystemTotalRAM() )
         , _tearingDown(false)
+        , _segmentStore()
+        , _segmentStoreLock()
         , _deleterThread(this)
         , _memoryFullCondition()
         , _cleanerThread(this)
+        , _writeBackThreads()
+        , _accessTrace()
     {
+        _shards.reset(new CacheShard[_nShards]);
+        for (int i = 0; i < NATRON_CACHE_WRITE_BACK_THREADS; ++i) {
+            _writeBackThreads.push_back( boost::shared_ptr<Natron::WriteBackThread<EntryType> >( new Natron::WriteBackThread<EntryType>(this) ) );
+        }
+
+        QByteArray traceDir = qgetenv(NATRON_CACHE_TRACE_DIR_ENV_VAR);
+        if ( !traceDir.isEmpty() ) {
+            QString tracePath = QDir( QString::fromUtf8( traceDir.constData() ) ).absoluteFilePath( QString( cacheName.c_str() ) + ".trace" );
+            _accessTrace.reset( new CacheAccessTrace( tracePath.toStdString() ) );
+            if ( !_accessTrace->isOpen() ) {
+                qDebug() << "Could not open the cache access trace file" << tracePath;
+                _accessTrace.reset();
+            }
+        }
     }
 
     virtual ~Cache()
     {
-        QMutexLocker locker(&_lock);
-
+        ///The write-back threads call the cache back: make sure they are done before destroying anything
+        for (std::size_t i = 0; i < _writeBackThreads.size(); ++i) {
+            _writeBackThreads[i]->quitThread();
+        }
         _tearingDown = true;
-        _memoryCache.clear();
-        _diskCache.clear();
+        for (unsigned int i = 0; i < _nShards; ++i) {
+            QMutexLocker locker(&_shards[i].lock);
+            _shards[i].memoryCache.clear();
+            _shards[i].compressedCache.clear();
+            _shards[i].diskCache.clear();
+        }
         delete _signalEmitter;
     }
 
+    /**
+     * @brief Returns the number of shards used when none is given to the constructor: a power of 2
+     * greater or equal to NATRON_CACHE_SHARDS_PER_THREAD times the number of cores.
+     **/
+    static unsigned int getDefaultShardsCount()
+    {
+        int nThreads = std::max(1, QThread::idealThreadCount());
+        unsigned int ret = 1;
+
+        while ( ret < (unsigned int)(nThreads * NATRON_CACHE_SHARDS_PER_THREAD) && ret < NATRON_CACHE_MAX_SHARDS ) {
+            ret *= 2;
+        }
+
+        return ret;
+    }
+
+    unsigned int getShardsCount() const
+    {
+        return _nShards;
+    }
+
     void waitForDeleterThread()
     {
+        ///Quit the write-back threads first: entries that could not be moved to the disk portion are given to the deleter thread
+        for (std::size_t i = 0; i < _writeBackThreads.size(); ++i) {
+            _writeBackThreads[i]->quitThread();
+        }
         _deleterThread.quitThread();
         _cleanerThread.quitThread();
     }
 
+    /**
+     * @brief Blocks until the data of all the entries evicted so far from the memory portion is written to disk
+     * and these entries are moved to the disk portion.
+     **/
+    void waitForWriteBack()
+    {
+        for (std::size_t i = 0; i < _writeBackThreads.size(); ++i) {
+            _writeBackThreads[i]->waitForIdle();
+        }
+    }
+
     /**
      * @brief Look-up the cache for an entry whose key matches the params.
      * @param params The key identifying the entry we're looking for.
@@ -542,65 +911,76 @@ public:
     bool get(const typename EntryType::key_type & key,
              std::list<EntryTypePtr>* returnValue) const
     {
-        ///Be atomic, so it cannot be created by another thread in the meantime
-        QMutexLocker getlocker(&_getLock);
+        CacheShard & shard = getShard( key.getHash() );
+
+        ///Do not hold the get lock of the shard while an entry with this key is being compressed or decompressed
+        waitForTransit(shard, key);
+
+        EntryTypePtr toDecompress;
+        std::list<EntryTypePtr> toCompress;
+        bool found;
+        {
+            ///Be atomic, so it cannot be created by another thread in the meantime
+            Natron::CacheStatsMutexLocker getlocker( &shard.getLock, &_stats, key.getCacheHolderStats() );
 
-        ///lock the cache before reading it.
-        QMutexLocker locker(&_lock);
+            ///lock the cache before reading it.
+            QMutexLocker locker(&shard.lock);
 
-        return getInternal(key, returnValue);
+            found = getInternal(shard, key, returnValue, &toDecompress, &toCompress);
+        }
+        if (toDecompress) {
+            found = decompressEntry(shard, toDecompress, &toCompress);
+            if (found) {
+                returnValue->push_back(toDecompress);
+            }
+        }
+        compressEntries(shard, toCompress);
+        if (found) {
+            _stats.addHit();
+        } else {
+            _stats.addMiss();
+        }
+
+        return found;
     } // get
 
 private:
 
-    void createInternal(const typename EntryType::key_type & key,
+    CacheShard & getShard(hash_type hash) const
+    {
+        // Fold the upper bits of the hash so that keys only differing by their upper bits are spread too
+        return _shards[ (unsigned int)( ( (U64)hash ^ ( (U64)hash >> 32 ) ) % _nShards ) ];
+    }
+
+    void createInternal(CacheShard & shard,
+                        const typename EntryType::key_type & key,
                         const ParamsTypePtr & params,
                         EntryTypePtr* returnValue) const
     {
-        //_lock must not be taken here
+        //No shard lock must be taken here
 
         ///Before allocating the memory check that there's enough space to fit in memory
         appPTR->checkCacheFreeMemoryIsGoodEnough();
 
 
-        ///Just in case, we don't allow more than X files to be removed at once.
-        int safeCounter = 0;
-        ///If too many files are opened, fall-back on RAM storage.
-        while (appPTR->isNCacheFilesOpenedCapped() && safeCounter < 1000) {
-#ifdef NATRON_DEBUG_CACHE
-            qDebug() << "Reached maximum cache files opened limit,clearing last recently used one...";
-#endif
-            if ( !evictLRUDiskEntry() ) {
-                break;
-            }
-            ++safeCounter;
-        }
-
         U64 memoryCacheSize, maximumInMemorySize;
         {
             QMutexLocker k(&_sizeLock);
-            memoryCacheSize = _memoryCacheSize;
-            maximumInMemorySize = std::max( (std::size_t)1, _maximumInMemorySize );
+            memoryCacheSize = getMemoryOccupation();
+            maximumInMemorySize = std::max( (std::size_t)1, getMemoryBudgetInternal() );
         }
         {
-            QMutexLocker locker(&_lock);
             std::list<EntryTypePtr> entriesToBeDeleted;
             double occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
             ///While the current cache size can't fit the new entry, erase the last recently used entries.
             ///Also if the total free RAM is under the limit of the system free RAM to keep free, erase LRU entries.
             while (occupationPercentage > NATRON_CACHE_LIMIT_PERCENT) {
-                std::list<EntryTypePtr> deleted;
-                if ( !tryEvictEntry(deleted) ) {
+                std::size_t freedMemory = 0;
+                if ( !evictFromLargestShard(entriesToBeDeleted, &freedMemory) ) {
                     break;
                 }
 
-                for (typename std::list<EntryTypePtr>::iterator it = deleted.begin(); it != deleted.end(); ++it) {
-                    if ( !(*it)->isStoredOnDisk() ) {
-                        memoryCacheSize -= (*it)->size();
-                    }
-                    entriesToBeDeleted.push_back(*it);
-                }
-
+                memoryCacheSize -= std::min( (U64)freedMemory, memoryCacheSize );
                 occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
             }
 
@@ -626,7 +1006,6 @@ private:
             }
         }
         {
-            QMutexLocker locker(&_lock);
             Natron::StorageModeEnum storage;
             if (params->getCost() == 0) {
                 storage = Natron::eStorageModeRAM;
@@ -643,6 +1022,7 @@ private:
                     filePath = getCachePath().toStdString();
                     filePath += '/';
                 }
+                ///The entry is created outside of the shard lock: only the insertion must be protected
                 returnValue->reset( new EntryType(key, params, this, storage, filePath) );
 
                 ///Don't call allocateMemory() here because we're still under the lock and we might force tons of threads to wait unnecesserarily
@@ -651,7 +1031,8 @@ private:
             }
 
             if (*returnValue) {
-                sealEntry(*returnValue, true);
+                QMutexLocker locker(&shard.lock);
+                sealEntry(shard, *returnValue, true);
             }
         }
     } // createInternal
@@ -661,13 +1042,16 @@ public:
     void swapOrInsert(const EntryTypePtr& entryToBeEvicted,
                       const EntryTypePtr& newEntry)
     {
-        QMutexLocker locker(&_lock);
-        
         const typename EntryType::key_type& key = entryToBeEvicted->getKey();
         typename EntryType::hash_type hash = entryToBeEvicted->getHashKey();
+        CacheShard & shard = getShard(hash);
+
+        QMutexLocker locker(&shard.lock);
+        cancelTransit(shard, key);
+        
         ///find a matching value in the internal memory container
-        CacheIterator memoryCached = _memoryCache(hash);
-        if (memoryCached != _memoryCache.end()) {
+        CacheIterator memoryCached = shard.memoryCache(hash);
+        if (memoryCached != shard.memoryCache.end()) {
             std::list<EntryTypePtr> & ret = getValueFromIterator(memoryCached);
             for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                 if ( (*it)->getKey() == key && (*it)->getParams() == entryToBeEvicted->getParams()) {
@@ -676,11 +1060,22 @@ public:
                 }
             }
             ///Append it
-            ret.push_back(newEntry);
+            insertInContainer(shard, shard.memoryCache, hash, newEntry);
         } else {
-            ///Look in disk cache
-            CacheIterator diskCached = _diskCache(hash);
-            if (diskCached != _diskCache.end()) {
+            ///Look in the compressed and disk caches
+            CacheIterator compressedCached = shard.compressedCache(hash);
+            if (compressedCached != shard.compressedCache.end()) {
+                ///Remove the old entry
+                std::list<EntryTypePtr> & ret = getValueFromIterator(compressedCached);
+                for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
+                    if ( (*it)->getKey() == key && (*it)->getParams() == entryToBeEvicted->getParams()) {
+                        ret.erase(it);
+                        break;
+                    }
+                }
+            }
+            CacheIterator diskCached = shard.diskCache(hash);
+            if (diskCached != shard.diskCache.end()) {
                 ///Remove the old entry
                 std::list<EntryTypePtr> & ret = getValueFromIterator(diskCached);
                 for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
@@ -692,7 +1087,7 @@ public:
 
             }
             ///Insert in mem cache
-            _memoryCache.insert(hash, newEntry);
+            insertInContainer(shard, shard.memoryCache, hash, newEntry);
         }
     }
 
@@ -731,29 +1126,59 @@ public:
         ///Make sure the shared_ptrs live in this list and are destroyed not while under the lock
         ///so that the memory freeing (which might be expensive for large images) doesn't happen while under the lock
 
-        {
-            ///Be atomic, so it cannot be created by another thread in the meantime
-            QMutexLocker getlocker(&_getLock);
-            std::list<EntryTypePtr> entries;
-            bool didGetSucceed;
-            {
-                QMutexLocker locker(&_lock);
-                didGetSucceed = getInternal(key, &entries);
-            }
-            if (didGetSucceed) {
-                for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
-                    if (*(*it)->getParams() == *params) {
-                        *returnValue = *it;
+        CacheShard & shard = getShard( key.getHash() );
 
-                        return true;
+        ///Do not hold the get lock of the shard while an entry with this key is being compressed or decompressed
+        waitForTransit(shard, key);
+        for (;;) {
+            EntryTypePtr found, toDecompress;
+            std::list<EntryTypePtr> toCompress;
+            bool created = false;
+            {
+                ///Be atomic, so it cannot be created by another thread in the meantime
+                Natron::CacheStatsMutexLocker getlocker( &shard.getLock, &_stats, key.getCacheHolderStats() );
+                std::list<EntryTypePtr> entries;
+                bool didGetSucceed;
+                {
+                    QMutexLocker locker(&shard.lock);
+                    didGetSucceed = getInternal(shard, key, &entries, &toDecompress, &toCompress);
+                }
+                if (didGetSucceed) {
+                    for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
+                        if (*(*it)->getParams() == *params) {
+                            found = *it;
+                            break;
+                        }
                     }
                 }
+
+                if ( !found && !toDecompress ) {
+                    _stats.addMiss();
+                    createInternal(shard, key, params, returnValue);
+                    created = true;
+                }
+            } // getlocker
+
+            if (created) {
+                compressEntries(shard, toCompress);
+
+                return false;
             }
 
-            createInternal(key, params, returnValue);
+            ///The entry is decompressed without holding the get lock: the look-ups of its key wait for it
+            if ( toDecompress && decompressEntry(shard, toDecompress, &toCompress) &&
+                 ( *toDecompress->getParams() == *params ) ) {
+                found = toDecompress;
+            }
+            compressEntries(shard, toCompress);
+            if (found) {
+                *returnValue = found;
+                _stats.addHit();
 
-            return false;
-        } // getlocker
+                return true;
+            }
+            ///The entry could not be decompressed or does not have the requested params: look-up again
+        }
     }
 
     /**
@@ -761,6 +1186,8 @@ public:
      **/
     void clear()
     {
+        ///Entries being written to disk cannot be evicted until then
+        waitForWriteBack();
         clearDiskPortion();
 
 
@@ -768,13 +1195,27 @@ public:
             ///block signals otherwise the we would be spammed of notifications
             _signalEmitter->blockSignals(true);
         }
-        QMutexLocker locker(&_lock);
-        std::pair<hash_type, EntryTypePtr> evictedFromMemory = _memoryCache.evict();
-        while (evictedFromMemory.second) {
-            if ( evictedFromMemory.second->isStoredOnDisk() ) {
-                evictedFromMemory.second->removeAnyBackingFile();
+        for (unsigned int i = 0; i < _nShards; ++i) {
+            CacheShard & shard = _shards[i];
+            QMutexLocker locker(&shard.lock);
+            ///The entries being compressed or decompressed are deleted once done
+            for (typename std::list<typename CacheShard::EntryInTransit>::iterator it = shard.inTransit.begin(); it != shard.inTransit.end(); ++it) {
+                it->cancelled = true;
+            }
+            std::pair<hash_type, EntryTypePtr> evictedFromMemory = shard.memoryCache.evict();
+            while (evictedFromMemory.second) {
+                if ( evictedFromMemory.second->isStoredOnDisk() ) {
+                    evictedFromMemory.second->removeAnyBackingFile();
+                }
+                evictedFromMemory = shard.memoryCache.evict();
+            }
+            std::pair<hash_type, EntryTypePtr> evictedFromCompressed = shard.compressedCache.evict();
+            while (evictedFromCompressed.second) {
+                if ( evictedFromCompressed.second->isStoredOnDisk() ) {
+                    evictedFromCompressed.second->removeAnyBackingFile();
+                }
+                evictedFromCompressed = shard.compressedCache.evict();
             }
-            evictedFromMemory = _memoryCache.evict();
         }
 
         if (_signalEmitter) {
@@ -793,17 +1234,20 @@ public:
             ///block signals otherwise the we would be spammed of notifications
             _signalEmitter->blockSignals(true);
         }
-        QMutexLocker locker(&_lock);
-
-        /// An entry which has a use_count greater than 1 is not removable:
-        /// The backing file must not be removed because it might be read/written to
-        /// at the same time. The best we can do is just let it here in the cache.
-        std::pair<hash_type, EntryTypePtr> evictedFromDisk = _diskCache.evict();
-        //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
-        //we'll let the user of these entries purge the extra entries left in the cache later on
-        while (evictedFromDisk.second) {
-            evictedFromDisk.second->removeAnyBackingFile();
-            evictedFromDisk = _diskCache.evict();
+        for (unsigned int i = 0; i < _nShards; ++i) {
+            CacheShard & shard = _shards[i];
+            QMutexLocker locker(&shard.lock);
+
+            /// An entry which has a use_count greater than 1 is not removable:
+            /// The backing file must not be removed because it might be read/written to
+            /// at the same time. The best we can do is just let it here in the cache.
+            std::pair<hash_type, EntryTypePtr> evictedFromDisk = shard.diskCache.evict();
+            //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
+            //we'll let the user of these entries purge the extra entries left in the cache later on
+            while (evictedFromDisk.second) {
+                evictedFromDisk.second->removeAnyBackingFile();
+                evictedFromDisk = shard.diskCache.evict();
+            }
         }
 
 
@@ -820,51 +1264,40 @@ public:
             ///block signals otherwise the we would be spammed of notifications
             _signalEmitter->blockSignals(true);
         }
-        QMutexLocker locker(&_lock);
-        std::pair<hash_type, EntryTypePtr> evictedFromMemory = _memoryCache.evict();
-        while (evictedFromMemory.second) {
-            ///move back the entry on disk if it can be store on disk
-            if ( evictedFromMemory.second->isStoredOnDisk() ) {
-                evictedFromMemory.second->deallocate();
-                /*insert it back into the disk portion */
-
-                U64 diskCacheSize, maximumCacheSize;
-                {
-                    QMutexLocker k(&_sizeLock);
-                    diskCacheSize = _diskCacheSize;
-                    maximumCacheSize = _maximumCacheSize;
+        for (unsigned int i = 0; i < _nShards; ++i) {
+            CacheShard & shard = _shards[i];
+            QMutexLocker locker(&shard.lock);
+            std::list<std::pair<hash_type, EntryTypePtr> > toWriteBack;
+            std::pair<hash_type, EntryTypePtr> evictedFromMemory = shard.memoryCache.evict();
+            while (evictedFromMemory.second) {
+                ///move back the entry on disk if it can be store on disk
+                if ( evictedFromMemory.second->isStoredOnDisk() ) {
+                    toWriteBack.push_back(evictedFromMemory);
                 }
 
-                /*before that we need to clear the disk cache if it exceeds the maximum size allowed*/
-                while (diskCacheSize + evictedFromMemory.second->size() >= maximumCacheSize) {
-                    {
-                        std::pair<hash_type, EntryTypePtr> evictedFromDisk = _diskCache.evict();
-                        //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
-                        //we'll let the user of these entries purge the extra entries left in the cache later on
-                        if (!evictedFromDisk.second) {
-                            break;
-                        }
-                        ///Erase the file from the disk if we reach the limit.
-                        evictedFromDisk.second->removeAnyBackingFile();
-                    }
-                    {
-                        QMutexLocker k(&_sizeLock);
-                        diskCacheSize = _diskCacheSize;
-                        maximumCacheSize = _maximumCacheSize;
-                    }
-                }
+                evictedFromMemory = shard.memoryCache.evict();
+            }
 
-                /*update the disk cache size*/
-                CacheIterator existingDiskCacheEntry = _diskCache( evictedFromMemory.second->getHashKey() );
-                /*if the entry doesn't exist on the disk cache,make a new list and insert it*/
-                if ( existingDiskCacheEntry == _diskCache.end() ) {
-                    _diskCache.insert(evictedFromMemory.second->getHashKey(), evictedFromMemory.second);
-                }
+            ///The data is written by the write-back threads, not under the shard lock. The entries are moved
+            ///to the disk portion once written, @see onEntryWrittenBack
+            for (typename std::list<std::pair<hash_type, EntryTypePtr> >::iterator it = toWriteBack.begin(); it != toWriteBack.end(); ++it) {
+                insertInContainer(shard, shard.memoryCache, it->first, it->second);
+                writeBack(shard, it->second, false);
             }
 
-            evictedFromMemory = _memoryCache.evict();
+            ///The compressed entries are in RAM too: move back the ones stored on disk to the disk portion
+            std::pair<hash_type, EntryTypePtr> evictedFromCompressed = shard.compressedCache.evict();
+            while (evictedFromCompressed.second) {
+                if ( evictedFromCompressed.second->isStoredOnDisk() ) {
+                    evictedFromCompressed.second->releaseCompressed();
+                    insertInContainer(shard, shard.diskCache, evictedFromCompressed.first, evictedFromCompressed.second);
+                }
+                evictedFromCompressed = shard.compressedCache.evict();
+            }
         }
 
+        waitForWriteBack();
+
         _signalEmitter->blockSignals(false);
         if (emitSignals) {
             _signalEmitter->emitSignalClearedInMemoryPortion();
@@ -878,26 +1311,20 @@ public:
         std::list<EntryTypePtr> entriesToBeDeleted;
 
         {
-            QMutexLocker locker(&_lock);
             U64 memoryCacheSize, maximumInMemorySize;
             {
                 QMutexLocker k(&_sizeLock);
-                memoryCacheSize = _memoryCacheSize;
-                maximumInMemorySize = std::max( (std::size_t)1, _maximumInMemorySize );
+                memoryCacheSize = getMemoryOccupation();
+                maximumInMemorySize = std::max( (std::size_t)1, getMemoryBudgetInternal() );
             }
             double occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
             while (occupationPercentage >= NATRON_CACHE_LIMIT_PERCENT) {
-                std::list<EntryTypePtr> deleted;
-                if ( !tryEvictEntry(deleted) ) {
+                std::size_t freedMemory = 0;
+                if ( !evictFromLargestShard(entriesToBeDeleted, &freedMemory) ) {
                     break;
                 }
 
-                for (typename std::list<EntryTypePtr>::iterator it = deleted.begin(); it != deleted.end(); ++it) {
-                    if ( !(*it)->isStoredOnDisk() ) {
-                        memoryCacheSize -= (*it)->size();
-                    }
-                    entriesToBeDeleted.push_back(*it);
-                }
+                memoryCacheSize -= std::min( (U64)freedMemory, memoryCacheSize );
                 occupationPercentage = (double)memoryCacheSize / maximumInMemorySize;
             }
         }
@@ -910,20 +1337,28 @@ public:
      **/
     void getCopy(std::list<EntryTypePtr>* copy) const
     {
-        QMutexLocker locker(&_lock);
+        for (unsigned int i = 0; i < _nShards; ++i) {
+            CacheShard & shard = _shards[i];
+            QMutexLocker locker(&shard.lock);
 
-        for (CacheIterator it = _memoryCache.begin(); it != _memoryCache.end(); ++it) {
-            const std::list<EntryTypePtr> & entries = getValueFromIterator(it);
-            copy->insert( copy->end(), entries.begin(), entries.end() );
-        }
-        for (CacheIterator it = _diskCache.begin(); it != _diskCache.end(); ++it) {
-            const std::list<EntryTypePtr> & entries = getValueFromIterator(it);
-            copy->insert( copy->end(), entries.begin(), entries.end() );
+            for (CacheIterator it = shard.memoryCache.begin(); it != shard.memoryCache.end(); ++it) {
+                const std::list<EntryTypePtr> & entries = getValueFromIterator(it);
+                copy->insert( copy->end(), entries.begin(), entries.end() );
+            }
+            for (CacheIterator it = shard.compressedCache.begin(); it != shard.compressedCache.end(); ++it) {
+                const std::list<EntryTypePtr> & entries = getValueFromIterator(it);
+                copy->insert( copy->end(), entries.begin(), entries.end() );
+            }
+            for (CacheIterator it = shard.diskCache.begin(); it != shard.diskCache.end(); ++it) {
+                const std::list<EntryTypePtr> & entries = getValueFromIterator(it);
+                copy->insert( copy->end(), entries.begin(), entries.end() );
+            }
         }
     }
 
     /**
-     * @brief Removes the last recently used entry from the in-memory cache.
+     * @brief Removes the first entry to evict from the in-memory cache according to the eviction policy. When the in-memory
+     * cache is empty, a compressed entry is removed instead.
      * This is expensive since it takes the lock. Returns false
      * if there's nothing left to evict.
      **/
@@ -932,45 +1367,72 @@ public:
         ///Make sure the shared_ptrs live in this list and are destroyed not while under the lock
         ///so that the memory freeing (which might be expensive for large images) doesn't happen while under the lock
         std::list<EntryTypePtr> entriesToBeDeleted;
-        bool ret;
-        {
-            QMutexLocker locker(&_lock);
-            ret = tryEvictEntry(entriesToBeDeleted);
+        std::size_t freedMemory = 0;
+
+        if ( evictFromLargestShard(entriesToBeDeleted, &freedMemory) ) {
+            return true;
         }
 
-        return ret;
+        for (unsigned int i = 0; i < _nShards; ++i) {
+            CacheShard & shard = _shards[i];
+            QMutexLocker locker(&shard.lock);
+            std::pair<hash_type, EntryTypePtr> evicted = evictEntry(shard, shard.compressedCache);
+            if (!evicted.second) {
+                continue;
+            }
+            if ( evicted.second->isStoredOnDisk() ) {
+                evicted.second->releaseCompressed();
+                insertInDiskPortion(shard, evicted.first, evicted.second);
+            } else {
+                entriesToBeDeleted.push_back(evicted.second);
+            }
+
+            return true;
+        }
+
+        return false;
     }
 
     /**
-     * @brief Removes the last recently used entry from the disk cache.
+     * @brief Removes the first entry to evict from the disk cache according to the eviction policy.
      * This is expensive since it takes the lock. Returns false
      * if there's nothing left to evict.
      **/
     bool evictLRUDiskEntry() const
     {
-        QMutexLocker locker(&_lock);
-        std::pair<hash_type, EntryTypePtr> evicted = _diskCache.evict();
+        std::vector<unsigned int> order;
 
-        //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
-        //we'll let the user of these entries purge the extra entries left in the cache later on
-        if (!evicted.second) {
-            return false;
-        }
-        /*if it is stored on disk, remove it from memory*/
+        getShardsSortedBySize(false, &order);
+        for (std::size_t i = 0; i < order.size(); ++i) {
+            CacheShard & shard = _shards[order[i]];
+            QMutexLocker locker(&shard.lock);
+            std::pair<hash_type, EntryTypePtr> evicted = evictEntry(shard, shard.diskCache);
 
-        assert( evicted.second.unique() );
-        evicted.second->removeAnyBackingFile();
+            //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
+            //we'll let the user of these entries purge the extra entries left in the cache later on
+            if (!evicted.second) {
+                continue;
+            }
+            /*if it is stored on disk, remove it from memory*/
 
-        return true;
+            assert( evicted.second.unique() );
+            evicted.second->removeAnyBackingFile();
+
+            return true;
+        }
+
+        return false;
     }
 
     /**
      * @brief To be called by a CacheEntry whenever it's size changes.
      * This way the cache can keep track of the real memory footprint.
      **/
-    virtual void notifyEntrySizeChanged(std::size_t oldSize,
+    virtual void notifyEntrySizeChanged(U64 hash,
+                                        std::size_t oldSize,
                                         std::size_t newSize) const OVERRIDE FINAL
     {
+        CacheShard & shard = getShard(hash);
         ///The entry has notified it's memory layout has changed, it must have been due to an action from the cache
         QMutexLocker k(&_sizeLock);
 
@@ -981,9 +1443,11 @@ public:
         qint64 diff = (qint64)newSize - (qint64)oldSize;
 
         if (diff < 0) {
-            _memoryCacheSize = diff > (qint64)_memoryCacheSize ? 0 : _memoryCacheSize + diff;
+            _memoryCacheSize = -diff > (qint64)_memoryCacheSize ? 0 : _memoryCacheSize + diff;
+            shard.memoryCacheSize = -diff > (qint64)shard.memoryCacheSize ? 0 : shard.memoryCacheSize + diff;
         } else {
             _memoryCacheSize += diff;
+            shard.memoryCacheSize += diff;
         }
 #ifdef NATRON_DEBUG_CACHE
         qDebug() << cacheName().c_str() << " memory size: " << printAsRAM(_memoryCacheSize);
@@ -993,20 +1457,22 @@ public:
     /**
      * @brief To be called by a CacheEntry on allocation.
      **/
-    virtual void notifyEntryAllocated(double time,
+    virtual void notifyEntryAllocated(U64 hash,
+                                      double time,
                                       std::size_t size,
                                       Natron::StorageModeEnum storage) const OVERRIDE FINAL
     {
+        CacheShard & shard = getShard(hash);
         ///The entry has notified it's memory layout has changed, it must have been due to an action from the cache, hence the
         ///lock should already be taken.
+        _stats.addBytesAllocated(size);
+
         QMutexLocker k(&_sizeLock);
 
         _memoryCacheSize += size;
+        shard.memoryCacheSize += size;
         _signalEmitter->emitAddedEntry(time);
-
-        if (storage == Natron::eStorageModeDisk) {
-            appPTR->increaseNCacheFilesOpened();
-        }
+        Q_UNUSED(storage);
 #ifdef NATRON_DEBUG_CACHE
         qDebug() << cacheName().c_str() << " memory size: " << printAsRAM(_memoryCacheSize);
 #endif
@@ -1015,19 +1481,23 @@ public:
     /**
      * @brief To be called by a CacheEntry on destruction.
      **/
-    virtual void notifyEntryDestroyed(double time,
+    virtual void notifyEntryDestroyed(U64 hash,
+                                      double time,
                                       std::size_t size,
                                       Natron::StorageModeEnum storage) const OVERRIDE FINAL
     {
+        CacheShard & shard = getShard(hash);
         QMutexLocker k(&_sizeLock);
 
         if (storage == Natron::eStorageModeRAM) {
             _memoryCacheSize = size > _memoryCacheSize ? 0 : _memoryCacheSize - size;
+            shard.memoryCacheSize = size > shard.memoryCacheSize ? 0 : shard.memoryCacheSize - size;
 #ifdef NATRON_DEBUG_CACHE
             qDebug() << cacheName().c_str() << " memory size: " << printAsRAM(_memoryCacheSize);
 #endif
         } else if (storage == Natron::eStorageModeDisk) {
             _diskCacheSize = size > _diskCacheSize ? 0 : _diskCacheSize - size;
+            shard.diskCacheSize = size > shard.diskCacheSize ? 0 : shard.diskCacheSize - size;
 #ifdef NATRON_DEBUG_CACHE
             qDebug() << cacheName().c_str() << " disk size: " << printAsRAM(_diskCacheSize);
 #endif
@@ -1048,7 +1518,8 @@ public:
      * @brief To be called whenever an entry is deallocated from memory and put back on disk or whenever
      * it is reallocated in the RAM.
      **/
-    virtual void notifyEntryStorageChanged(Natron::StorageModeEnum oldStorage,
+    virtual void notifyEntryStorageChanged(U64 hash,
+                                           Natron::StorageModeEnum oldStorage,
                                            Natron::StorageModeEnum newStorage,
                                            double time,
                                            std::size_t size) const OVERRIDE FINAL
@@ -1056,6 +1527,7 @@ public:
         if (_tearingDown) {
             return;
         }
+        CacheShard & shard = getShard(hash);
         QMutexLocker k(&_sizeLock);
 
         assert(oldStorage != newStorage);
@@ -1063,35 +1535,133 @@ public:
         if (oldStorage == Natron::eStorageModeRAM) {
             _memoryCacheSize = size > _memoryCacheSize ? 0 : _memoryCacheSize - size;
             _diskCacheSize += size;
+            shard.memoryCacheSize = size > shard.memoryCacheSize ? 0 : shard.memoryCacheSize - size;
+            shard.diskCacheSize += size;
 #ifdef NATRON_DEBUG_CACHE
             qDebug() << cacheName().c_str() << " memory size: " << printAsRAM(_memoryCacheSize);
             qDebug() << cacheName().c_str() << " disk size: " << printAsRAM(_diskCacheSize);
 #endif
-            ///We switched from RAM to DISK that means the MemoryFile object has been destroyed hence the file has been closed.
-            appPTR->decreaseNCacheFilesOpened();
         } else if (oldStorage == Natron::eStorageModeDisk) {
             _memoryCacheSize += size;
             _diskCacheSize = size > _diskCacheSize ? 0 : _diskCacheSize - size;
+            shard.memoryCacheSize += size;
+            shard.diskCacheSize = size > shard.diskCacheSize ? 0 : shard.diskCacheSize - size;
 #ifdef NATRON_DEBUG_CACHE
             qDebug() << cacheName().c_str() << " memory size: " << printAsRAM(_memoryCacheSize);
             qDebug() << cacheName().c_str() << " disk size: " << printAsRAM(_diskCacheSize);
 #endif
-            ///We switched from DISK to RAM that means the MemoryFile object has been created and the file opened
-            appPTR->increaseNCacheFilesOpened();
         } else {
             if (newStorage == Natron::eStorageModeRAM) {
                 _memoryCacheSize += size;
+                shard.memoryCacheSize += size;
             } else if (newStorage == Natron::eStorageModeDisk) {
                 _diskCacheSize += size;
+                shard.diskCacheSize += size;
             }
         }
 
         _signalEmitter->emitEntryStorageChanged(time, (int)oldStorage, (int)newStorage);
     }
 
-    virtual void backingFileClosed() const OVERRIDE FINAL
+    virtual void notifyEntryCompressed(U64 hash,
+                                       std::size_t freedSize,
+                                       std::size_t compressedSize) const OVERRIDE FINAL
+    {
+        CacheShard & shard = getShard(hash);
+        QMutexLocker k(&_sizeLock);
+
+        _memoryCacheSize = freedSize > _memoryCacheSize ? 0 : _memoryCacheSize - freedSize;
+        shard.memoryCacheSize = freedSize > shard.memoryCacheSize ? 0 : shard.memoryCacheSize - freedSize;
+        _compressedCacheSize += compressedSize;
+        shard.compressedCacheSize += compressedSize;
+#ifdef NATRON_DEBUG_CACHE
+        qDebug() << cacheName().c_str() << " memory size: " << printAsRAM(_memoryCacheSize);
+        qDebug() << cacheName().c_str() << " compressed size: " << printAsRAM(_compressedCacheSize);
+#endif
+    }
+
+    virtual void notifyEntryDecompressed(U64 hash,
+                                         std::size_t allocatedSize,
+                                         std::size_t compressedSize) const OVERRIDE FINAL
     {
-        appPTR->decreaseNCacheFilesOpened();
+        CacheShard & shard = getShard(hash);
+        QMutexLocker k(&_sizeLock);
+
+        _memoryCacheSize += allocatedSize;
+        shard.memoryCacheSize += allocatedSize;
+        _compressedCacheSize = compressedSize > _compressedCacheSize ? 0 : _compressedCacheSize - compressedSize;
+        shard.compressedCacheSize = compressedSize > shard.compressedCacheSize ? 0 : shard.compressedCacheSize - compressedSize;
+#ifdef NATRON_DEBUG_CACHE
+        qDebug() << cacheName().c_str() << " memory size: " << printAsRAM(_memoryCacheSize);
+        qDebug() << cacheName().c_str() << " compressed size: " << printAsRAM(_compressedCacheSize);
+#endif
+    }
+
+    virtual void notifyCompressedEntryReleased(U64 hash,
+                                               double time,
+                                               std::size_t size,
+                                               std::size_t compressedSize,
+                                               Natron::StorageModeEnum newStorage) const OVERRIDE FINAL
+    {
+        if (_tearingDown) {
+            return;
+        }
+        CacheShard & shard = getShard(hash);
+        QMutexLocker k(&_sizeLock);
+
+        _compressedCacheSize = compressedSize > _compressedCacheSize ? 0 : _compressedCacheSize - compressedSize;
+        shard.compressedCacheSize = compressedSize > shard.compressedCacheSize ? 0 : shard.compressedCacheSize - compressedSize;
+        ///A compressed entry is seen as in RAM from the outside
+        if (newStorage == Natron::eStorageModeDisk) {
+            _diskCacheSize += size;
+            shard.diskCacheSize += size;
+            _signalEmitter->emitEntryStorageChanged(time, (int)Natron::eStorageModeRAM, (int)Natron::eStorageModeDisk);
+        } else {
+            _signalEmitter->emitRemovedEntry(time, (int)Natron::eStorageModeRAM);
+        }
+#ifdef NATRON_DEBUG_CACHE
+        qDebug() << cacheName().c_str() << " compressed size: " << printAsRAM(_compressedCacheSize);
+        qDebug() << cacheName().c_str() << " disk size: " << printAsRAM(_diskCacheSize);
+#endif
+    }
+
+    virtual void notifyEntryRenderTimeChanged(U64 hash,
+                                              std::size_t size,
+                                              double renderTime) const OVERRIDE FINAL
+    {
+        if (_accessTrace) {
+            _accessTrace->recordRenderTime(hash, size, renderTime);
+        }
+    }
+
+    virtual CacheSegmentStore* getSegmentStore() const OVERRIDE FINAL
+    {
+        std::string path = getCachePath().toStdString();
+        QMutexLocker k(&_segmentStoreLock);
+
+        if (!_segmentStore) {
+            _segmentStore.reset( new CacheSegmentStore(path) );
+        } else if (_segmentStore->getDirectoryPath() != path + '/') {
+            ///The location of the disk cache was changed in the preferences: entries stored at the
+            ///previous location can no longer be read
+            _segmentStore->reset(path);
+        }
+
+        return _segmentStore.get();
+    }
+
+    /**
+     * @brief Closes the segment files of the disk portion of the cache, all entries stored on disk can no longer be read.
+     * To be called before the cache directory is wiped.
+     **/
+    void resetSegmentStore()
+    {
+        std::string path = getCachePath().toStdString();
+        QMutexLocker k(&_segmentStoreLock);
+
+        if (_segmentStore) {
+            _segmentStore->reset(path);
+        }
     }
 
     // const data member: no need to take the lock
@@ -1158,6 +1728,103 @@ public:
         return _maximumInMemorySize;
     }
 
+    /**
+     * @brief Scales the RAM the cache may use, without changing its maximum size. This is used to shrink the cache
+     * when the system is under memory pressure and to grow it back afterwards.
+     * Call clearExceedingEntries() to evict right away the entries that no longer fit.
+     **/
+    void setMemoryBudgetScale(double scale)
+    {
+        QMutexLocker k(&_sizeLock);
+
+        _memoryBudgetScale = std::max( 0., std::min(scale, 1.) );
+    }
+
+    double getMemoryBudgetScale() const
+    {
+        QMutexLocker k(&_sizeLock);
+        return _memoryBudgetScale;
+    }
+
+    /**
+     * @brief Returns the RAM the cache may currently use: getMaximumMemorySize() scaled by getMemoryBudgetScale().
+     **/
+    std::size_t getMemoryBudget() const
+    {
+        QMutexLocker k(&_sizeLock);
+        return getMemoryBudgetInternal();
+    }
+
+    /**
+     * @brief Returns the telemetry of the cache, @see CacheStats
+     **/
+    Natron::CacheStatsSnapshot getStats() const
+    {
+        return _stats.getSnapshot();
+    }
+
+    void resetStats()
+    {
+        _stats.reset();
+    }
+
+    /**
+     * @brief Called when an entry found in the cache had to be downscaled to be used, which the cache cannot know.
+     **/
+    void notifyDownscaledHit() const
+    {
+        _stats.addDownscaledHit();
+    }
+
+    /**
+     * @brief Sets the fraction of the memory portion of the cache that may be used to keep entries evicted from
+     * the memory portion compressed in RAM. 0 disables the compression of evicted entries.
+     **/
+    void setCompressedPortion(double portion)
+    {
+        QMutexLocker k(&_sizeLock);
+
+        _compressedPortion = std::max( 0., std::min(portion, 1.) );
+    }
+
+    double getCompressedPortion() const
+    {
+        QMutexLocker k(&_sizeLock);
+        return _compressedPortion;
+    }
+
+    /**
+     * @brief Sets the policy deciding which entries are evicted first when the cache is full.
+     **/
+    void setEvictionPolicy(Natron::CacheEvictionPolicyEnum policy)
+    {
+        for (unsigned int i = 0; i < _nShards; ++i) {
+            CacheShard & shard = _shards[i];
+            QMutexLocker locker(&shard.lock);
+            if (shard.evictionPolicy == policy) {
+                continue;
+            }
+            shard.evictionPolicy = policy;
+            ///The eviction indexes are not maintained with the LRU policy
+            rebuildEvictionIndex(shard, shard.memoryCache);
+            rebuildEvictionIndex(shard, shard.compressedCache);
+            rebuildEvictionIndex(shard, shard.diskCache);
+        }
+    }
+
+    Natron::CacheEvictionPolicyEnum getEvictionPolicy() const
+    {
+        QMutexLocker locker(&_shards[0].lock);
+
+        return _shards[0].evictionPolicy;
+    }
+
+    std::size_t getCompressedCacheSize() const
+    {
+        QMutexLocker k(&_sizeLock);
+        return _compressedCacheSize;
+    }
+
     std::size_t getMemoryCacheSize() const
     {
         QMutexLocker k(&_sizeLock);
@@ -1187,9 +1854,11 @@ public:
         std::list<EntryTypePtr> toRemove;
 
         {
-            QMutexLocker l(&_lock);
-            CacheIterator existingEntry = _memoryCache( entry->getHashKey() );
-            if ( existingEntry != _memoryCache.end() ) {
+            CacheShard & shard = getShard( entry->getHashKey() );
+            QMutexLocker l(&shard.lock);
+            cancelTransit( shard, entry->getKey() );
+            CacheIterator existingEntry = shard.memoryCache( entry->getHashKey() );
+            if ( existingEntry != shard.memoryCache.end() ) {
                 std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
                 for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                     if ( (*it)->getKey() == entry->getKey() ) {
@@ -1200,11 +1869,25 @@ public:
                     }
                 }
                 if ( ret.empty() ) {
-                    _memoryCache.erase(existingEntry);
+                    shard.memoryCache.erase(existingEntry);
                 }
             } else {
-                existingEntry = _diskCache( entry->getHashKey() );
-                if ( existingEntry != _diskCache.end() ) {
+                existingEntry = shard.compressedCache( entry->getHashKey() );
+                if ( existingEntry != shard.compressedCache.end() ) {
+                    std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
+                    for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
+                        if ( (*it)->getKey() == entry->getKey() ) {
+                            toRemove.push_back(*it);
+                            ret.erase(it);
+                            break;
+                        }
+                    }
+                    if ( ret.empty() ) {
+                        shard.compressedCache.erase(existingEntry);
+                    }
+                }
+                existingEntry = shard.diskCache( entry->getHashKey() );
+                if ( existingEntry != shard.diskCache.end() ) {
                     std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
                     for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                         if ( (*it)->getKey() == entry->getKey() ) {
@@ -1215,11 +1898,11 @@ public:
                         }
                     }
                     if ( ret.empty() ) {
-                        _diskCache.erase(existingEntry);
+                        shard.diskCache.erase(existingEntry);
                     }
                 }
             }
-        } // QMutexLocker l(&_lock);
+        } // QMutexLocker l(&shard.lock);
         if ( !toRemove.empty() ) {
             _deleterThread.appendToQueue(toRemove);
 
@@ -1233,27 +1916,39 @@ public:
     {
         std::list<EntryTypePtr> toRemove;
         {
-            QMutexLocker l(&_lock);
-            CacheIterator existingEntry = _memoryCache( hash);
-            if ( existingEntry != _memoryCache.end() ) {
+            CacheShard & shard = getShard(hash);
+            QMutexLocker l(&shard.lock);
+            for (typename std::list<typename CacheShard::EntryInTransit>::iterator it = shard.inTransit.begin(); it != shard.inTransit.end(); ++it) {
+                if (it->entry->getHashKey() == hash) {
+                    it->cancelled = true;
+                }
+            }
+            CacheIterator existingEntry = shard.memoryCache( hash);
+            if ( existingEntry != shard.memoryCache.end() ) {
                 std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
                 for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                     //(*it)->scheduleForDestruction();
                     toRemove.push_back(*it);
                 }
-                _memoryCache.erase(existingEntry);
+                shard.memoryCache.erase(existingEntry);
             } else {
-                existingEntry = _diskCache( hash );
-                if ( existingEntry != _diskCache.end() ) {
+                existingEntry = shard.compressedCache( hash );
+                if ( existingEntry != shard.compressedCache.end() ) {
+                    std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
+                    toRemove.insert( toRemove.end(), ret.begin(), ret.end() );
+                    shard.compressedCache.erase(existingEntry);
+                }
+                existingEntry = shard.diskCache( hash );
+                if ( existingEntry != shard.diskCache.end() ) {
                     std::list<EntryTypePtr> & ret = getValueFromIterator(existingEntry);
                     for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
                         //(*it)->scheduleForDestruction();
                         toRemove.push_back(*it);
                     }
-                    _diskCache.erase(existingEntry);
+                    shard.diskCache.erase(existingEntry);
                 }
             }
-        } // QMutexLocker l(&_lock);
+        } // QMutexLocker l(&shard.lock);
 
         if ( !toRemove.empty() ) {
             _deleterThread.appendToQueue(toRemove);
@@ -1296,31 +1991,48 @@ public:
         
         std::string holderID = holder->getCacheID();
         
-        QMutexLocker locker(&_lock);
-        
-        for (CacheIterator memIt = _memoryCache.begin(); memIt != _memoryCache.end(); ++memIt) {
-            std::list<EntryTypePtr> & entries = getValueFromIterator(memIt);
-            if ( !entries.empty() ) {
-                
-                const EntryTypePtr & front = entries.front();
-                
-                if (front->getKey().getCacheHolderID() == holderID) {
-                    for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
-                        *ramOccupied += (*it)->size();
+        for (unsigned int i = 0; i < _nShards; ++i) {
+            CacheShard & shard = _shards[i];
+            QMutexLocker locker(&shard.lock);
+
+            for (CacheIterator memIt = shard.memoryCache.begin(); memIt != shard.memoryCache.end(); ++memIt) {
+                std::list<EntryTypePtr> & entries = getValueFromIterator(memIt);
+                if ( !entries.empty() ) {
+
+                    const EntryTypePtr & front = entries.front();
+
+                    if (front->getKey().getCacheHolderID() == holderID) {
+                        for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
+                            *ramOccupied += (*it)->size();
+                        }
                     }
                 }
             }
-        }
-        
-        for (CacheIterator memIt = _diskCache.begin(); memIt != _diskCache.end(); ++memIt) {
-            std::list<EntryTypePtr> & entries = getValueFromIterator(memIt);
-            if ( !entries.empty() ) {
-                
-                const EntryTypePtr & front = entries.front();
-                
-                if (front->getKey().getCacheHolderID() == holderID) {
-                    for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
-                        *diskOccupied += (*it)->size();
+
+            for (CacheIterator memIt = shard.compressedCache.begin(); memIt != shard.compressedCache.end(); ++memIt) {
+                std::list<EntryTypePtr> & entries = getValueFromIterator(memIt);
+                if ( !entries.empty() ) {
+
+                    const EntryTypePtr & front = entries.front();
+
+                    if (front->getKey().getCacheHolderID() == holderID) {
+                        for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
+                            *ramOccupied += (*it)->getCompressedSize();
+                        }
+                    }
+                }
+            }
+
+            for (CacheIterator memIt = shard.diskCache.begin(); memIt != shard.diskCache.end(); ++memIt) {
+                std::list<EntryTypePtr> & entries = getValueFromIterator(memIt);
+                if ( !entries.empty() ) {
+
+                    const EntryTypePtr & front = entries.front();
+
+                    if (front->getKey().getCacheHolderID() == holderID) {
+                        for (typename std::list<EntryTypePtr>::iterator it = entries.begin(); it != entries.end(); ++it) {
+                            *diskOccupied += (*it)->size();
+                        }
                     }
                 }
             }
@@ -1334,11 +2046,20 @@ private:
                                                                        bool removeAll) OVERRIDE FINAL
     {
         std::list<EntryTypePtr> toDelete;
-        CacheContainer newMemCache, newDiskCache;
-        {
-            QMutexLocker locker(&_lock);
 
-            for (CacheIterator memIt = _memoryCache.begin(); memIt != _memoryCache.end(); ++memIt) {
+        for (unsigned int i = 0; i < _nShards; ++i) {
+            CacheShard & shard = _shards[i];
+            CacheContainer newMemCache, newCompressedCache, newDiskCache;
+            QMutexLocker locker(&shard.lock);
+
+            for (typename std::list<typename CacheShard::EntryInTransit>::iterator it = shard.inTransit.begin(); it != shard.inTransit.end(); ++it) {
+                if ( (it->entry->getKey().getCacheHolderID() == holderID) &&
+                     ( ( it->entry->getKey().getTreeVersion() != nodeHash) || removeAll ) ) {
+                    it->cancelled = true;
+                }
+            }
+
+            for (CacheIterator memIt = shard.memoryCache.begin(); memIt != shard.memoryCache.end(); ++memIt) {
                 std::list<EntryTypePtr> & entries = getValueFromIterator(memIt);
                 if ( !entries.empty() ) {
                     const EntryTypePtr & front = entries.front();
@@ -1356,7 +2077,22 @@ private:
                 }
             }
 
-            for (CacheIterator dIt = _diskCache.begin(); dIt != _diskCache.end(); ++dIt) {
+            for (CacheIterator cIt = shard.compressedCache.begin(); cIt != shard.compressedCache.end(); ++cIt) {
+                std::list<EntryTypePtr> & entries = getValueFromIterator(cIt);
+                if ( !entries.empty() ) {
+                    const EntryTypePtr & front = entries.front();
+
+                    if ( (front->getKey().getCacheHolderID() == holderID) &&
+                         ( ( front->getKey().getTreeVersion() != nodeHash) || removeAll ) ) {
+                        toDelete.insert( toDelete.end(), entries.begin(), entries.end() );
+                    } else {
+                        typename EntryType::hash_type hash = front->getHashKey();
+                        newCompressedCache.insert(hash, entries);
+                    }
+                }
+            }
+
+            for (CacheIterator dIt = shard.diskCache.begin(); dIt != shard.diskCache.end(); ++dIt) {
                 std::list<EntryTypePtr> & entries = getValueFromIterator(dIt);
                 if ( !entries.empty() ) {
                     const EntryTypePtr & front = entries.front();
@@ -1374,9 +2110,13 @@ private:
                 }
             }
 
-            _memoryCache = newMemCache;
-            _diskCache = newDiskCache;
-        } // QMutexLocker locker(&_lock);
+            shard.memoryCache = newMemCache;
+            shard.compressedCache = newCompressedCache;
+            shard.diskCache = newDiskCache;
+            rebuildEvictionIndex(shard, shard.memoryCache);
+            rebuildEvictionIndex(shard, shard.compressedCache);
+            rebuildEvictionIndex(shard, shard.diskCache);
+        } // for all shards
 
         if ( !toDelete.empty() ) {
             _deleterThread.appendToQueue(toDelete);
@@ -1387,21 +2127,89 @@ private:
         }
     } // removeAllEntriesWithDifferentNodeHashForHolderPrivate
 
-    bool getInternal(const typename EntryType::key_type & key,
-                     std::list<EntryTypePtr>* returnValue) const
+    /**
+     * @brief Returns the indexes of all shards sorted by decreasing memory (or disk) occupation.
+     **/
+    void getShardsSortedBySize(bool memory,
+                               std::vector<unsigned int>* order) const
+    {
+        std::vector<std::pair<std::size_t, unsigned int> > sizes(_nShards);
+        {
+            QMutexLocker k(&_sizeLock);
+            for (unsigned int i = 0; i < _nShards; ++i) {
+                sizes[i] = std::make_pair(memory ? _shards[i].memoryCacheSize : _shards[i].diskCacheSize, i);
+            }
+        }
+        std::sort( sizes.begin(), sizes.end(), std::greater<std::pair<std::size_t, unsigned int> >() );
+        order->resize(_nShards);
+        for (unsigned int i = 0; i < _nShards; ++i) {
+            (*order)[i] = sizes[i].second;
+        }
+    }
+
+    /**
+     * @brief Evicts the least recently used entry of the shard occupying the most memory. If nothing can be evicted
+     * from it, the other shards are tried by decreasing memory occupation. This keeps the memory budget global
+     * to the cache even though entries are spread across shards.
+     * No shard lock must be held by the caller since only one shard at a time is locked. An evicted entry that is kept
+     * compressed is compressed once the shard lock is released.
+     * @param freedMemory [out] @see tryEvictEntry
+     **/
+    bool evictFromLargestShard(std::list<EntryTypePtr> & entriesToBeDeleted,
+                               std::size_t* freedMemory) const
+    {
+        std::vector<unsigned int> order;
+
+        getShardsSortedBySize(true, &order);
+        for (std::size_t i = 0; i < order.size(); ++i) {
+            CacheShard & shard = _shards[order[i]];
+            std::list<EntryTypePtr> toCompress;
+            bool evicted;
+            {
+                QMutexLocker locker(&shard.lock);
+                evicted = tryEvictEntry(shard, entriesToBeDeleted, &toCompress, freedMemory);
+            }
+            if (evicted) {
+                compressEntries(shard, toCompress);
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * @brief Looks-up the shard for the entries with the given key. An entry found in the compressed portion is not
+     * decompressed here but taken out of it and returned in toDecompress, the caller must decompress it once the shard
+     * lock is released, @see decompressEntry. The entries that must be compressed are returned in toCompress, @see compressEntries.
+     **/
+    bool getInternal(CacheShard & shard,
+                     const typename EntryType::key_type & key,
+                     std::list<EntryTypePtr>* returnValue,
+                     EntryTypePtr* toDecompress,
+                     std::list<EntryTypePtr>* toCompress) const
     {
         ///Private should be locked
-        assert( !_lock.tryLock() );
+        assert( !shard.lock.tryLock() );
+
+        if (_accessTrace) {
+            _accessTrace->recordLookup( key.getHash() );
+        }
+
+        ///An entry with this key may be in none of the containers while it is compressed or decompressed
+        waitForTransitLocked(shard, key);
 
         ///find a matching value in the internal memory container
-        CacheIterator memoryCached = _memoryCache( key.getHash() );
+        CacheIterator memoryCached = shard.memoryCache( key.getHash() );
 
-        if ( memoryCached != _memoryCache.end() ) {
+        if ( memoryCached != shard.memoryCache.end() ) {
             ///we found something with a matching hash key. There may be several entries linked to
             ///this key, we need to find one with matching params
             std::list<EntryTypePtr> & ret = getValueFromIterator(memoryCached);
             for (typename std::list<EntryTypePtr>::const_iterator it = ret.begin(); it != ret.end(); ++it) {
                 if ( (*it)->getKey() == key ) {
+                    (*it)->onAccessedByCache(shard.inflation);
                     returnValue->push_back(*it);
 
                     ///Q_EMIT te added signal otherwise when first reading something that's already cached
@@ -1413,11 +2221,32 @@ private:
             }
 
             return returnValue->size() > 0;
-        } else {
+        }
+
+        ///fallback on the compressed cache internal container
+        CacheIterator compressedCached = shard.compressedCache( key.getHash() );
+        if ( compressedCached != shard.compressedCache.end() ) {
+            std::list<EntryTypePtr> & ret = getValueFromIterator(compressedCached);
+            for (typename std::list<EntryTypePtr>::iterator it = ret.begin(); it != ret.end(); ++it) {
+                if ( (*it)->getKey() == key ) {
+                    EntryTypePtr entry = *it;
+                    ret.erase(it);
+                    if ( ret.empty() ) {
+                        shard.compressedCache.erase(compressedCached);
+                    }
+                    beginTransit(shard, entry);
+                    *toDecompress = entry;
+
+                    return false;
+                }
+            }
+        }
+
+        {
             ///fallback on the disk cache internal container
-            CacheIterator diskCached = _diskCache( key.getHash() );
+            CacheIterator diskCached = shard.diskCache( key.getHash() );
 
-            if ( diskCached == _diskCache.end() ) {
+            if ( diskCached == shard.diskCache.end() ) {
                 /*the entry was neither in memory or disk, just allocate a new one*/
                 return false;
             } else {
@@ -1429,59 +2258,42 @@ private:
                      it != ret.end(); ++it) {
                     if ( (*it)->getKey() == key ) {
                         /*If we found 1 entry in the list that has exactly the same key params,
-                           we re-open the mapping to the RAM put the entry
+                           we read its data back in RAM and put the entry
                            back into the memoryCache.*/
 
                         try {
-                            (*it)->reOpenFileMapping();
+                            (*it)->reloadFromDisk();
                         } catch (const std::exception & e) {
-                            qDebug() << "Error while reopening cache file: " << e.what();
+                            qDebug() << "Error while reading cache entry from disk: " << e.what();
                             ret.erase(it);
 
                             return false;
                         } catch (...) {
-                            qDebug() << "Error while reopening cache file";
+                            qDebug() << "Error while reading cache entry from disk";
                             ret.erase(it);
 
                             return false;
                         }
 
                         //put it back into the RAM
-                        _memoryCache.insert( (*it)->getHashKey(), *it );
-                        
-
-                        U64 memoryCacheSize, maximumInMemorySize;
-                        {
-                            QMutexLocker k(&_sizeLock);
-                            memoryCacheSize = _memoryCacheSize;
-                            maximumInMemorySize = _maximumInMemorySize;
-                        }
-                        std::list<EntryTypePtr> entriesToBeDeleted;
-
-                        //now clear extra entries from the disk cache so it doesn't exceed the RAM limit.
-                        while (memoryCacheSize > maximumInMemorySize) {
-                            if ( !tryEvictEntry(entriesToBeDeleted) ) {
-                                break;
-                            }
-
-                            {
-                                QMutexLocker k(&_sizeLock);
-                                memoryCacheSize = _memoryCacheSize;
-                                maximumInMemorySize = _maximumInMemorySize;
-                            }
-                        }
+                        EntryTypePtr entry = *it;
+                        entry->onAccessedByCache(shard.inflation);
+                        insertInContainer(shard, shard.memoryCache, entry->getHashKey(), entry);
+                        returnValue->push_back(entry);
 
-                        returnValue->push_back(*it);
+                        ///Remove it from the disk cache
                         ret.erase(it);
+                        shard.diskCache.erase(diskCached);
+
+                        //now clear extra entries from the memory cache so it doesn't exceed the RAM limit.
+                        trimMemoryPortion(shard, toCompress);
+
                         ///Q_EMIT te added signal otherwise when first reading something that's already cached
                         ///the timeline wouldn't update
                         if (_signalEmitter) {
                             _signalEmitter->emitAddedEntry( key.getTime() );
                         }
-                        
-                        ///Remove it from the disk cache
-                        _diskCache.erase(diskCached);
-                        
+
                         return true;
                     }
                 }
@@ -1493,99 +2305,634 @@ private:
         }
     } // getInternal
 
-    /** @brief Inserts into the cache an entry that was previously allocated by the createInternal()
-     * function. This is called directly by createInternal() if the allocation was successful
+    /**
+     * @brief Returns true if an entry with the given key is being compressed or decompressed.
+     * Must be called under the shard lock.
      **/
-    void sealEntry(const EntryTypePtr & entry,
-                   bool inMemory) const
+    static bool isInTransit(const CacheShard & shard,
+                            const typename EntryType::key_type & key)
     {
-        assert( !_lock.tryLock() );   // must be locked
-        typename EntryType::hash_type hash = entry->getHashKey();
+        for (typename std::list<typename CacheShard::EntryInTransit>::const_iterator it = shard.inTransit.begin(); it != shard.inTransit.end(); ++it) {
+            if (it->entry->getKey() == key) {
+                return true;
+            }
+        }
 
-        if (inMemory) {
-            /*if the entry doesn't exist on the memory cache,make a new list and insert it*/
-            CacheIterator existingEntry = _memoryCache(hash);
-            if ( existingEntry == _memoryCache.end() ) {
-                _memoryCache.insert(hash, entry);
-            } else {
-                /*append to the existing list*/
-                getValueFromIterator(existingEntry).push_back(entry);
+        return false;
+    }
+
+    /**
+     * @brief Blocks until no entry with the given key is being compressed or decompressed. Must be called under the shard lock.
+     **/
+    static void waitForTransitLocked(CacheShard & shard,
+                                     const typename EntryType::key_type & key)
+    {
+        while ( isInTransit(shard, key) ) {
+            shard.transitDone.wait(&shard.lock);
+        }
+    }
+
+    static void waitForTransit(CacheShard & shard,
+                               const typename EntryType::key_type & key)
+    {
+        QMutexLocker locker(&shard.lock);
+
+        waitForTransitLocked(shard, key);
+    }
+
+    /**
+     * @brief Records an entry taken out of the containers of the shard to be compressed or decompressed without the shard lock.
+     **/
+    static void beginTransit(CacheShard & shard,
+                             const EntryTypePtr & entry)
+    {
+        assert( !shard.lock.tryLock() );
+        typename CacheShard::EntryInTransit transit;
+        transit.entry = entry;
+        transit.cancelled = false;
+        shard.inTransit.push_back(transit);
+    }
+
+    /**
+     * @brief Ends the transit of an entry recorded by beginTransit() and wakes up the look-ups waiting for it.
+     * @returns False if the entry was removed from the cache meanwhile, in which case it must not be put back.
+     **/
+    static bool endTransit(CacheShard & shard,
+                           const EntryTypePtr & entry)
+    {
+        assert( !shard.lock.tryLock() );
+        bool cancelled = false;
+        for (typename std::list<typename CacheShard::EntryInTransit>::iterator it = shard.inTransit.begin(); it != shard.inTransit.end(); ++it) {
+            if (it->entry == entry) {
+                cancelled = it->cancelled;
+                shard.inTransit.erase(it);
+                break;
             }
-        } else {
-            CacheIterator existingEntry = _diskCache(hash);
-            if ( existingEntry == _diskCache.end() ) {
-                _diskCache.insert(hash, entry);
+        }
+        shard.transitDone.wakeAll();
+
+        return !cancelled;
+    }
+
+    /**
+     * @brief Decompresses an entry taken out of the compressed portion by getInternal(), without holding any lock of the
+     * shard, then puts it back in the memory portion unless it was removed from the cache meanwhile.
+     * @param toCompress [out] @see compressEntries
+     * @returns False if the data could not be decompressed.
+     **/
+    bool decompressEntry(CacheShard & shard,
+                         const EntryTypePtr & entry,
+                         std::list<EntryTypePtr>* toCompress) const
+    {
+        bool decompressed = true;
+        try {
+            entry->decompress();
+        } catch (const std::exception & e) {
+            qDebug() << "Error while decompressing cache entry: " << e.what();
+            decompressed = false;
+        }
+        {
+            QMutexLocker locker(&shard.lock);
+            if ( !endTransit(shard, entry) ) {
+                ///The caller may still use the entry, it is destroyed once no longer referenced
+            } else if (decompressed) {
+                //put it back into the RAM
+                sealEntry(shard, entry, true);
+                trimMemoryPortion(shard, toCompress);
+            } else if ( entry->isStoredOnDisk() ) {
+                insertInDiskPortion(shard, entry->getHashKey(), entry);
+            }
+        }
+        if (decompressed && _signalEmitter) {
+            _signalEmitter->emitAddedEntry( entry->getKey().getTime() );
+        }
+
+        return decompressed;
+    }
+
+    /**
+     * @brief Compresses the entries demoteEntry() chose to keep compressed in RAM, without holding any lock of the shard.
+     * Each entry is then put in the compressed portion, or demoted further if it does not compress well, unless it was
+     * removed from the cache meanwhile. No shard lock must be held by the caller.
+     **/
+    void compressEntries(CacheShard & shard,
+                         std::list<EntryTypePtr> & toCompress) const
+    {
+        if ( toCompress.empty() ) {
+            return;
+        }
+        std::list<EntryTypePtr> entriesToBeDeleted;
+        for (typename std::list<EntryTypePtr>::iterator it = toCompress.begin(); it != toCompress.end(); ++it) {
+            ///This is EXPENSIVE! No lock of the cache is held here
+            bool compressed = (*it)->compress();
+
+            QMutexLocker locker(&shard.lock);
+            if ( !endTransit(shard, *it) ) {
+                entriesToBeDeleted.push_back(*it);
+                continue;
+            }
+            std::size_t freedMemory = 0;
+            if (compressed) {
+                insertInContainer(shard, shard.compressedCache, (*it)->getHashKey(), *it);
+                trimCompressedPortion(shard, entriesToBeDeleted, &freedMemory);
             } else {
-                /*append to the existing list*/
-                getValueFromIterator(existingEntry).push_back(entry);
+                demoteUncompressedEntry(shard, (*it)->getHashKey(), *it, entriesToBeDeleted, &freedMemory);
             }
         }
+        toCompress.clear();
+        if ( !entriesToBeDeleted.empty() ) {
+            _deleterThread.appendToQueue(entriesToBeDeleted);
+        }
+    }
+
+    /**
+     * @brief Marks the entries of the shard being compressed or decompressed that have the given key as removed from the cache.
+     **/
+    static void cancelTransit(CacheShard & shard,
+                              const typename EntryType::key_type & key)
+    {
+        for (typename std::list<typename CacheShard::EntryInTransit>::iterator it = shard.inTransit.begin(); it != shard.inTransit.end(); ++it) {
+            if (it->entry->getKey() == key) {
+                it->cancelled = true;
+            }
+        }
+    }
+
+    /** @brief Inserts into the cache an entry that was previously allocated by the createInternal()
+     * function. This is called directly by createInternal() if the allocation was successful
+     **/
+    void sealEntry(CacheShard & shard,
+                   const EntryTypePtr & entry,
+                   bool inMemory) const
+    {
+        assert( !shard.lock.tryLock() );   // must be locked
+        typename EntryType::hash_type hash = entry->getHashKey();
+
+        entry->onAccessedByCache(shard.inflation);
+        insertInContainer(shard, inMemory ? shard.memoryCache : shard.diskCache, hash, entry);
     }
 
-    bool tryEvictEntry(std::list<EntryTypePtr> & entriesToBeDeleted) const
+    /**
+     * @brief Evicts an entry of the memory portion of the shard, @see evictEntry. The data of an entry stored on disk is
+     * first written by a write-back thread, @see writeBack. Otherwise the entry is demoted right away, @see demoteEntry.
+     * @param toCompress [out] @see demoteEntry
+     * @param freedMemory [out] Incremented by the amount of RAM freed, once the entries to be deleted are destroyed,
+     * the entries to compress are compressed and the entries being written are moved to the disk portion.
+     **/
+    bool tryEvictEntry(CacheShard & shard,
+                       std::list<EntryTypePtr> & entriesToBeDeleted,
+                       std::list<EntryTypePtr>* toCompress,
+                       std::size_t* freedMemory) const
     {
-        assert( !_lock.tryLock() );
-        std::pair<hash_type, EntryTypePtr> evicted = _memoryCache.evict();
+        assert( !shard.lock.tryLock() );
+        std::pair<hash_type, EntryTypePtr> evicted = evictEntry(shard, shard.memoryCache);
         //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
         //we'll let the user of these entries purge the extra entries left in the cache later on
         if (!evicted.second) {
             return false;
         }
-        /*if it is stored on disk, remove it from memory*/
+
+        _stats.addEviction();
+        Natron::CacheStats* holderStats = evicted.second->getKey().getCacheHolderStats();
+        if (holderStats) {
+            holderStats->addEviction();
+        }
 
         if ( evicted.second->isStoredOnDisk() ) {
-            assert( evicted.second.unique() );
+            ///The entry stays in the memory portion until its data is written so that it can still be found in the meantime.
+            ///It cannot be evicted again since the write-back thread references it.
+            *freedMemory += evicted.second->size();
+            insertInContainer(shard, shard.memoryCache, evicted.first, evicted.second);
+            writeBack(shard, evicted.second, true);
+
+            return true;
+        }
+
+        demoteEntry(shard, evicted.first, evicted.second, true, entriesToBeDeleted, toCompress, freedMemory);
+
+        return true;
+    } // tryEvictEntry
 
-            ///This is EXPENSIVE! it calls msync
-            evicted.second->deallocate();
+    /**
+     * @brief Demotes an entry removed from the memory portion of the shard. If the compressed portion is enabled, the
+     * entry is appended to toCompress: the caller must compress it once the shard lock is released, @see compressEntries.
+     * Otherwise it is moved to the disk portion if it is stored on disk, or deleted, @see demoteUncompressedEntry.
+     * The data of an entry stored on disk must have been written already, @see writeBack
+     * @param freedMemory [out] @see tryEvictEntry
+     **/
+    void demoteEntry(CacheShard & shard,
+                     hash_type hash,
+                     const EntryTypePtr & entry,
+                     bool allowCompression,
+                     std::list<EntryTypePtr> & entriesToBeDeleted,
+                     std::list<EntryTypePtr>* toCompress,
+                     std::size_t* freedMemory) const
+    {
+        assert( !shard.lock.tryLock() );
+        bool compressionEnabled;
+        {
+            QMutexLocker k(&_sizeLock);
+            compressionEnabled = allowCompression && _maximumInMemorySize * _compressedPortion > 0;
+        }
+        if (compressionEnabled) {
+            ///The look-ups of the entry wait until it is compressed
+            *freedMemory += entry->size();
+            beginTransit(shard, entry);
+            toCompress->push_back(entry);
 
-            /*insert it back into the disk portion */
+            return;
+        }
+        demoteUncompressedEntry(shard, hash, entry, entriesToBeDeleted, freedMemory);
+    }
 
-            U64 diskCacheSize, maximumCacheSize, maximumInMemorySize;
+    /**
+     * @brief Moves an entry removed from the memory portion of the shard to the disk portion if it is stored on disk,
+     * or deletes it.
+     **/
+    void demoteUncompressedEntry(CacheShard & shard,
+                                 hash_type hash,
+                                 const EntryTypePtr & entry,
+                                 std::list<EntryTypePtr> & entriesToBeDeleted,
+                                 std::size_t* freedMemory) const
+    {
+        assert( !shard.lock.tryLock() );
+        *freedMemory += entry->size();
+        /*if it is stored on disk, remove it from memory*/
+        if ( entry->isStoredOnDisk() ) {
+            ///The data was already written, this only frees the RAM
+            entry->deallocate();
+
+            insertInDiskPortion(shard, hash, entry);
+            _stats.addDemotionToDisk();
+            Natron::CacheStats* holderStats = entry->getKey().getCacheHolderStats();
+            if (holderStats) {
+                holderStats->addDemotionToDisk();
+            }
+        } else {
+            entriesToBeDeleted.push_back(entry);
+        }
+    }
+
+    /**
+     * @brief Queues an entry of the memory portion of the shard to have its data written to disk by a write-back thread.
+     * The entries of a shard are always written by the same thread, there are NATRON_CACHE_WRITE_BACK_THREADS
+     * writes at most at the same time.
+     **/
+    void writeBack(CacheShard & shard,
+                   const EntryTypePtr & entry,
+                   bool allowCompression) const
+    {
+        assert( !shard.lock.tryLock() );
+        typename Natron::WriteBackThread<EntryType>::WriteBackRequest request;
+        request.entry = entry;
+        request.size = entry->size();
+        request.accessCount = entry->getCacheAccessCount();
+        request.allowCompression = allowCompression;
+        {
+            QMutexLocker k(&_sizeLock);
+            _writeBackSize += request.size;
+        }
+        std::size_t shardIndex = &shard - &_shards[0];
+        _writeBackThreads[shardIndex % _writeBackThreads.size()]->appendToQueue(request);
+    }
+
+    /**
+     * @brief Called by a write-back thread once the data of an entry was written, @see writeBack. The entry is demoted
+     * unless it was used in the meantime, in which case it stays in the memory portion.
+     **/
+    void onEntryWrittenBack(const typename Natron::WriteBackThread<EntryType>::WriteBackRequest & request) const
+    {
+        std::list<EntryTypePtr> entriesToBeDeleted;
+        std::list<EntryTypePtr> toCompress;
+        CacheShard & shard = getShard( request.entry->getHashKey() );
+        {
+            QMutexLocker locker(&shard.lock);
+            {
+                QMutexLocker k(&_sizeLock);
+                _writeBackSize -= std::min(request.size, _writeBackSize);
+            }
+
+            if ( request.entry->getCacheAccessCount() != request.accessCount ) {
+                ///The entry was found in the cache while it was written: it may have been modified after the write
+                request.entry->invalidateWrittenData();
+            } else if ( (request.entry.use_count() == 2) && removeFromContainer(shard.memoryCache, request.entry) ) {
+                ///Only the memory portion and the request reference the entry
+                if (request.written) {
+                    std::size_t freedMemory = 0;
+                    demoteEntry(shard, request.entry->getHashKey(), request.entry, request.allowCompression, entriesToBeDeleted, &toCompress, &freedMemory);
+                } else {
+                    ///The chunk of the entry was released, its data cannot be read back
+                    entriesToBeDeleted.push_back(request.entry);
+                }
+            }
+        }
+        compressEntries(shard, toCompress);
+        if ( !entriesToBeDeleted.empty() ) {
+            _deleterThread.appendToQueue(entriesToBeDeleted);
+        }
+        notifyMemoryDeallocated();
+    }
+
+    /**
+     * @brief Removes the given entry from the container.
+     * @returns False if the entry is not in the container.
+     **/
+    static bool removeFromContainer(CacheContainer & container,
+                                    const EntryTypePtr & entry)
+    {
+        CacheIterator found = container( entry->getHashKey() );
+
+        if ( found == container.end() ) {
+            return false;
+        }
+        std::list<EntryTypePtr> & entries = getValueFromIterator(found);
+        typename std::list<EntryTypePtr>::iterator it = std::find( entries.begin(), entries.end(), entry );
+        if ( it == entries.end() ) {
+            return false;
+        }
+        entries.erase(it);
+        if ( entries.empty() ) {
+            container.erase(found);
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Returns the RAM counted in the memory budget: the memory and compressed portions, minus the entries being
+     * written to disk which are about to leave the memory portion.
+     * Must be called under _sizeLock.
+     **/
+    std::size_t getMemoryOccupation() const
+    {
+        std::size_t ret = _memoryCacheSize + _compressedCacheSize;
+
+        return ret - std::min(ret, _writeBackSize);
+    }
+
+    /**
+     * @brief Returns the RAM the memory and compressed portions may use, @see setMemoryBudgetScale.
+     * Must be called under _sizeLock.
+     **/
+    std::size_t getMemoryBudgetInternal() const
+    {
+        return _maximumInMemorySize * _memoryBudgetScale;
+    }
+
+    /**
+     * @brief Evicts compressed entries of the shard until the compressed portion of the cache fits
+     * in its share of the memory budget. Entries stored on disk are moved to the disk portion, others are deleted.
+     **/
+    void trimCompressedPortion(CacheShard & shard,
+                               std::list<EntryTypePtr> & entriesToBeDeleted,
+                               std::size_t* freedMemory) const
+    {
+        assert( !shard.lock.tryLock() );
+        std::size_t compressedCacheSize, maximumCompressedSize;
+        {
+            QMutexLocker k(&_sizeLock);
+            compressedCacheSize = _compressedCacheSize;
+            maximumCompressedSize = getMemoryBudgetInternal() * _compressedPortion;
+        }
+        while (compressedCacheSize > maximumCompressedSize) {
+            std::pair<hash_type, EntryTypePtr> evicted = evictEntry(shard, shard.compressedCache);
+            if (!evicted.second) {
+                break;
+            }
+            ///Entries to be deleted release their compressed data only when destroyed: keep track of the size here
+            std::size_t compressedSize = evicted.second->getCompressedSize();
+            compressedCacheSize -= std::min(compressedSize, compressedCacheSize);
+            *freedMemory += compressedSize;
+            if ( evicted.second->isStoredOnDisk() ) {
+                evicted.second->releaseCompressed();
+                insertInDiskPortion(shard, evicted.first, evicted.second);
+            } else {
+                entriesToBeDeleted.push_back(evicted.second);
+            }
+        }
+    }
+
+    /**
+     * @brief Inserts an entry whose data was written to disk in the disk portion of the shard. Before that, entries
+     * of the disk portion are removed if it exceeds the maximum size allowed.
+     **/
+    void insertInDiskPortion(CacheShard & shard,
+                             hash_type hash,
+                             const EntryTypePtr & entry) const
+    {
+        assert( !shard.lock.tryLock() );
+        U64 diskCacheSize, maximumCacheSize, maximumInMemorySize;
+        {
+            QMutexLocker k(&_sizeLock);
+            diskCacheSize = _diskCacheSize;
+            maximumInMemorySize = _maximumInMemorySize;
+            maximumCacheSize = _maximumCacheSize;
+        }
+
+        /*before that we need to clear the disk cache if it exceeds the maximum size allowed*/
+        U64 entrySize = entry->getParams()->getElementsCount() * sizeof(data_t);
+        while ( ( diskCacheSize  + entrySize ) >= (maximumCacheSize - maximumInMemorySize) ) {
+            {
+                std::pair<hash_type, EntryTypePtr> evictedFromDisk = evictEntry(shard, shard.diskCache);
+                //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
+                //we'll let the user of these entries purge the extra entries left in the cache later on
+                if (!evictedFromDisk.second) {
+                    break;
+                }
+
+                ///Release the chunk in the segment files: the entry is no longer referenced anywhere else
+                evictedFromDisk.second->removeAnyBackingFile();
+            }
             {
                 QMutexLocker k(&_sizeLock);
                 diskCacheSize = _diskCacheSize;
                 maximumInMemorySize = _maximumInMemorySize;
                 maximumCacheSize = _maximumCacheSize;
             }
+        }
 
-            /*before that we need to clear the disk cache if it exceeds the maximum size allowed*/
-            while ( ( diskCacheSize  + evicted.second->size() ) >= (maximumCacheSize - maximumInMemorySize) ) {
-                {
-                    std::pair<hash_type, EntryTypePtr> evictedFromDisk = _diskCache.evict();
-                    //if the cache couldn't evict that means all entries are used somewhere and we shall not remove them!
-                    //we'll let the user of these entries purge the extra entries left in the cache later on
-                    if (!evictedFromDisk.second) {
-                        break;
-                    }
+        insertInContainer(shard, shard.diskCache, hash, entry);
+    }
 
-                    ///Erase the file from the disk if we reach the limit.
-                    //evictedFromDisk.second->scheduleForDestruction();
+    static typename CacheShard::EvictionIndex & getEvictionIndex(CacheShard & shard,
+                                                                 const CacheContainer & container)
+    {
+        if (&container == &shard.memoryCache) {
+            return shard.memoryIndex;
+        } else if (&container == &shard.compressedCache) {
+            return shard.compressedIndex;
+        }
+        assert(&container == &shard.diskCache);
 
+        return shard.diskIndex;
+    }
 
-                    entriesToBeDeleted.push_back(evictedFromDisk.second);
-                }
-                {
-                    QMutexLocker k(&_sizeLock);
-                    diskCacheSize = _diskCacheSize;
-                    maximumInMemorySize = _maximumInMemorySize;
-                    maximumCacheSize = _maximumCacheSize;
+    /**
+     * @brief Inserts an entry in the given container of the shard, appending it to the entries with the same hash,
+     * and records it in the eviction index of the container.
+     **/
+    void insertInContainer(CacheShard & shard,
+                           CacheContainer & container,
+                           hash_type hash,
+                           const EntryTypePtr & entry) const
+    {
+        assert( !shard.lock.tryLock() );
+        CacheIterator existingEntry = container(hash);
+        /*if the entry doesn't exist in the container,make a new list and insert it*/
+        if ( existingEntry == container.end() ) {
+            container.insert(hash, entry);
+        } else {   /*append to the existing list*/
+            getValueFromIterator(existingEntry).push_back(entry);
+        }
+
+        if (shard.evictionPolicy != Natron::eCacheEvictionPolicyGDSF) {
+            return;
+        }
+        typename CacheShard::EvictionIndex & index = getEvictionIndex(shard, container);
+        if (index.records.size() >= index.maxRecords) {
+            ///Drop the stale records
+            rebuildEvictionIndex(shard, container);
+        } else {
+            index.records.insert( std::make_pair( entry->getEvictionPriority(), typename CacheShard::EvictionIndex::Record(hash, entry) ) );
+        }
+    }
+
+    /**
+     * @brief Records all the entries of the container in its eviction index, or clears the index if the shard does
+     * not use the GreedyDual-Size-Frequency policy.
+     **/
+    static void rebuildEvictionIndex(CacheShard & shard,
+                                     CacheContainer & container)
+    {
+        typename CacheShard::EvictionIndex & index = getEvictionIndex(shard, container);
+
+        index.records.clear();
+        if (shard.evictionPolicy == Natron::eCacheEvictionPolicyGDSF) {
+            for (CacheIterator it = container.begin(); it != container.end(); ++it) {
+                std::list<EntryTypePtr> & entries = getValueFromIterator(it);
+                for (typename std::list<EntryTypePtr>::iterator it2 = entries.begin(); it2 != entries.end(); ++it2) {
+                    index.records.insert( std::make_pair( (*it2)->getEvictionPriority(), typename CacheShard::EvictionIndex::Record( (*it2)->getHashKey(), *it2 ) ) );
                 }
             }
+        }
+        index.maxRecords = index.records.size() * 2 + NATRON_CACHE_EVICTION_INDEX_SLACK;
+    }
 
-            CacheIterator existingDiskCacheEntry = _diskCache(evicted.first);
-            /*if the entry doesn't exist on the disk cache,make a new list and insert it*/
-            if ( existingDiskCacheEntry == _diskCache.end() ) {
-                _diskCache.insert(evicted.first, evicted.second);
-            } else {   /*append to the existing list*/
-                getValueFromIterator(existingDiskCacheEntry).push_back(evicted.second);
+    /**
+     * @brief Removes from the container of the shard the entry to evict first according to the eviction policy of the shard.
+     * Entries that are used outside of the cache are never evicted.
+     * @returns A NULL entry if nothing could be evicted.
+     **/
+    std::pair<hash_type, EntryTypePtr> evictEntry(CacheShard & shard,
+                                                  CacheContainer & container) const
+    {
+        assert( !shard.lock.tryLock() );
+        if (shard.evictionPolicy == Natron::eCacheEvictionPolicyLRU) {
+            return container.evict();
+        }
+
+        ///GreedyDual-Size-Frequency: evict the entry with the lowest priority. Priorities depend on the render time of the
+        ///entries which is only known once they are rendered, and on their accesses: the records of the index hold the
+        ///priority of their entry when it was inserted, which may have been raised since.
+        typename CacheShard::EvictionIndex & index = getEvictionIndex(shard, container);
+        if ( index.records.empty() && (container.size() > 0) ) {
+            rebuildEvictionIndex(shard, container);
+        }
+        typedef typename CacheShard::EvictionIndex::Record Record;
+        std::vector<std::pair<double, Record> > inUse;
+        CacheIterator victimIt = container.end();
+        typename std::list<EntryTypePtr>::iterator victim;
+        double victimPriority = 0.;
+        while ( !index.records.empty() ) {
+            typename std::multimap<double, Record>::iterator first = index.records.begin();
+            const double recordedPriority = first->first;
+            const Record record = first->second;
+            index.records.erase(first);
+
+            CacheIterator found = container(record.first);
+            if ( found == container.end() ) {
+                continue;
+            }
+            std::list<EntryTypePtr> & entries = getValueFromIterator(found);
+            typename std::list<EntryTypePtr>::iterator it = entries.begin();
+            {
+                EntryTypePtr recorded = record.second.lock();
+                if (!recorded) {
+                    ///The entry was destroyed
+                    continue;
+                }
+                while ( ( it != entries.end() ) && (*it != recorded) ) {
+                    ++it;
+                }
+            }
+            if ( it == entries.end() ) {
+                ///The entry left the container
+                continue;
+            }
+            double priority = (*it)->getEvictionPriority();
+            if (it->use_count() != 1) {
+                ///Entries that are used outside of the cache are never evicted
+                inUse.push_back( std::make_pair(priority, record) );
+                continue;
             }
+            if (priority > recordedPriority) {
+                ///Another entry may have a lower priority now
+                index.records.insert( std::make_pair(priority, record) );
+                continue;
+            }
+            victimIt = found;
+            victim = it;
+            victimPriority = priority;
+            break;
+        }
+        for (std::size_t i = 0; i < inUse.size(); ++i) {
+            index.records.insert(inUse[i]);
+        }
+        if ( victimIt == container.end() ) {
+            return std::make_pair( hash_type(), EntryTypePtr() );
+        }
+
+        std::pair<hash_type, EntryTypePtr> ret = std::make_pair( (*victim)->getHashKey(), *victim );
+        std::list<EntryTypePtr> & entries = getValueFromIterator(victimIt);
+        if (entries.size() == 1) {
+            container.erase(victimIt);
         } else {
-            entriesToBeDeleted.push_back(evicted.second);
+            entries.erase(victim);
         }
+        ///Age the entries remaining in the shard
+        shard.inflation = std::max(shard.inflation, victimPriority);
 
-        return true;
-    } // tryEvictEntry
+        return ret;
+    }
+
+    /**
+     * @brief Evicts entries of the memory portion of the shard until the RAM used by the cache fits in its budget.
+     * Only this shard is locked: other shards will be trimmed by the next createInternal() call.
+     * @param toCompress [out] @see demoteEntry
+     **/
+    void trimMemoryPortion(CacheShard & shard,
+                           std::list<EntryTypePtr>* toCompress) const
+    {
+        assert( !shard.lock.tryLock() );
+        U64 memoryCacheSize, maximumInMemorySize;
+        {
+            QMutexLocker k(&_sizeLock);
+            memoryCacheSize = getMemoryOccupation();
+            maximumInMemorySize = getMemoryBudgetInternal();
+        }
+        std::list<EntryTypePtr> entriesToBeDeleted;
+        while (memoryCacheSize > maximumInMemorySize) {
+            std::size_t freedMemory = 0;
+            if ( !tryEvictEntry(shard, entriesToBeDeleted, toCompress, &freedMemory) ) {
+                break;
+            }
+            memoryCacheSize -= std::min( (U64)freedMemory, memoryCacheSize );
+        }
+        if ( !entriesToBeDeleted.empty() ) {
+            ///Do not free the memory while under the shard lock
+            _deleterThread.appendToQueue(entriesToBeDeleted);
+        }
+    }
 };
 } // namespace Natron
 
@@ -0,0 +1,117 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "CacheAccessTrace.h"
+
+#include <fstream>
+#include <sstream>
+
+#include <QtCore/QMutex>
+
+using namespace Natron;
+
+namespace Natron {
+
+struct CacheAccessTracePrivate
+{
+    QMutex lock; //< protects file
+    std::ofstream file;
+
+    CacheAccessTracePrivate()
+    : lock()
+    , file()
+    {
+    }
+};
+
+} // namespace Natron
+
+CacheAccessTrace::CacheAccessTrace(const std::string & filePath)
+    : _imp( new CacheAccessTracePrivate() )
+{
+    _imp->file.open(filePath.c_str(), std::ios::out | std::ios::app);
+}
+
+CacheAccessTrace::~CacheAccessTrace()
+{
+    delete _imp;
+}
+
+bool
+CacheAccessTrace::isOpen() const
+{
+    return _imp->file.is_open();
+}
+
+void
+CacheAccessTrace::recordLookup(U64 hash)
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->file << "L " << hash << '\n';
+}
+
+void
+CacheAccessTrace::recordRenderTime(U64 hash,
+                                   U64 size,
+                                   double renderTime)
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->file << "R " << hash << ' ' << size << ' ' << renderTime << '\n';
+}
+
+bool
+CacheAccessTrace::read(const std::string & filePath,
+                       std::vector<CacheAccessTraceRecord>* records)
+{
+    std::ifstream file( filePath.c_str() );
+
+    if ( !file.is_open() ) {
+        return false;
+    }
+
+    std::string line;
+    while ( std::getline(file, line) ) {
+        std::istringstream ss(line);
+        char type;
+        CacheAccessTraceRecord record;
+        if ( !(ss >> type >> record.hash) ) {
+            continue;
+        }
+        if (type == 'L') {
+            record.type = CacheAccessTraceRecord::eTypeLookup;
+        } else if (type == 'R') {
+            record.type = CacheAccessTraceRecord::eTypeRenderTime;
+            if ( !(ss >> record.size >> record.renderTime) ) {
+                continue;
+            }
+        } else {
+            continue;
+        }
+        records->push_back(record);
+    }
+
+    return true;
+}
@@ -0,0 +1,103 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NATRON_ENGINE_CACHEACCESSTRACE_H
+#define NATRON_ENGINE_CACHEACCESSTRACE_H
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <string>
+#include <vector>
+
+#include "Global/GlobalDefines.h"
+#include "Engine/EngineFwd.h"
+
+///When this environment variable is set to a directory, each cache records its accesses to <directory>/<cache name>.trace
+#define NATRON_CACHE_TRACE_DIR_ENV_VAR "NATRON_CACHE_TRACE_DIR"
+
+namespace Natron {
+
+/**
+ * @brief A record of an access trace, @see CacheAccessTrace
+ **/
+struct CacheAccessTraceRecord
+{
+    enum TypeEnum
+    {
+        eTypeLookup = 0, //< the cache was looked-up for an entry with the hash
+        eTypeRenderTime //< the render time of the entry with the hash was updated
+    };
+
+    TypeEnum type;
+    U64 hash;
+    U64 size; //< the size in bytes of the entry, only for eTypeRenderTime
+    double renderTime; //< the total time in seconds spent rendering the entry, only for eTypeRenderTime
+
+    CacheAccessTraceRecord()
+    : type(eTypeLookup)
+    , hash(0)
+    , size(0)
+    , renderTime(0.)
+    {
+    }
+};
+
+struct CacheAccessTracePrivate;
+
+/**
+ * @brief Records the accesses made to a cache in a text file so that they can be replayed later on to compare eviction
+ * policies with real workloads. Each line is a record:
+ * "L <hash>" for a look-up and "R <hash> <size in bytes> <render time in seconds>" when the render time of an entry is known.
+ *
+ * This class is MT-safe.
+ **/
+class CacheAccessTrace
+{
+public:
+
+    /**
+     * @brief Opens the file for appending.
+     **/
+    CacheAccessTrace(const std::string & filePath);
+
+    ~CacheAccessTrace();
+
+    bool isOpen() const;
+
+    void recordLookup(U64 hash);
+
+    void recordRenderTime(U64 hash, U64 size, double renderTime);
+
+    /**
+     * @brief Reads all records of the trace file. Malformed lines are skipped.
+     * @returns False if the file could not be opened.
+     **/
+    static bool read(const std::string & filePath, std::vector<CacheAccessTraceRecord>* records) WARN_UNUSED_RETURN;
+
+private:
+
+    CacheAccessTracePrivate* _imp;
+};
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_CACHEACCESSTRACE_H
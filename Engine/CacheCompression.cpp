@@ -0,0 +1,399 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "CacheCompression.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "Global/GlobalDefines.h"
+
+///A match must be at least this long to be encoded
+#define MIN_MATCH 4
+
+///Matches can reference at most this many bytes backward (2 bytes offsets)
+#define MAX_OFFSET 65535
+
+///log2 of the number of entries of the match finder hash table
+#define HASH_BITS 14
+
+///Flag of a block header telling the block is stored uncompressed
+#define STORED_BLOCK_FLAG 0x80000000U
+
+namespace {
+inline U32
+read32(const unsigned char* p)
+{
+    U32 v;
+
+    std::memcpy(&v, p, sizeof(U32));
+
+    return v;
+}
+
+inline U32
+hash32(U32 v)
+{
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+inline void
+writeHeader(U32 header,
+            unsigned char* p)
+{
+    p[0] = (unsigned char)(header & 0xff);
+    p[1] = (unsigned char)( (header >> 8) & 0xff );
+    p[2] = (unsigned char)( (header >> 16) & 0xff );
+    p[3] = (unsigned char)( (header >> 24) & 0xff );
+}
+
+inline U32
+readHeader(const unsigned char* p)
+{
+    return (U32)p[0] | ( (U32)p[1] << 8 ) | ( (U32)p[2] << 16 ) | ( (U32)p[3] << 24 );
+}
+
+/**
+ * @brief Gathers the i-th byte of all elements of src in the i-th plane of dst.
+ * Trailing bytes that do not form a full element are copied as is.
+ **/
+void
+shuffle(const unsigned char* src,
+        std::size_t size,
+        std::size_t elementSize,
+        unsigned char* dst)
+{
+    std::size_t n = size / elementSize;
+
+    for (std::size_t b = 0; b < elementSize; ++b) {
+        const unsigned char* s = src + b;
+        unsigned char* d = dst + b * n;
+        for (std::size_t i = 0; i < n; ++i, s += elementSize) {
+            d[i] = *s;
+        }
+    }
+    std::memcpy(dst + n * elementSize, src + n * elementSize, size - n * elementSize);
+}
+
+void
+unshuffle(const unsigned char* src,
+          std::size_t size,
+          std::size_t elementSize,
+          unsigned char* dst)
+{
+    std::size_t n = size / elementSize;
+
+    for (std::size_t b = 0; b < elementSize; ++b) {
+        const unsigned char* s = src + b * n;
+        unsigned char* d = dst + b;
+        for (std::size_t i = 0; i < n; ++i, d += elementSize) {
+            *d = s[i];
+        }
+    }
+    std::memcpy(dst + n * elementSize, src + n * elementSize, size - n * elementSize);
+}
+
+inline unsigned char*
+writeLength(std::size_t length,
+            unsigned char* op)
+{
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+
+    return op;
+}
+
+/**
+ * @brief Writes a sequence made of literals followed by a match. matchLength is 0 for the last sequence of a block
+ * which has no match. Returns NULL if the sequence does not fit before oend.
+ **/
+unsigned char*
+writeSequence(const unsigned char* literals,
+              std::size_t literalsLength,
+              std::size_t offset,
+              std::size_t matchLength,
+              unsigned char* op,
+              unsigned char* oend)
+{
+    std::size_t needed = 1 + literalsLength / 255 + 1 + literalsLength + 2 + matchLength / 255 + 1;
+
+    if ( needed > (std::size_t)(oend - op) ) {
+        return 0;
+    }
+
+    unsigned char* token = op++;
+    std::size_t ml = matchLength > 0 ? matchLength - MIN_MATCH : 0;
+    *token = (unsigned char)( (std::min(literalsLength, (std::size_t)15) << 4) | std::min(ml, (std::size_t)15) );
+    if (literalsLength >= 15) {
+        op = writeLength(literalsLength - 15, op);
+    }
+    std::memcpy(op, literals, literalsLength);
+    op += literalsLength;
+    if (matchLength > 0) {
+        *op++ = (unsigned char)(offset & 0xff);
+        *op++ = (unsigned char)( (offset >> 8) & 0xff );
+        if (ml >= 15) {
+            op = writeLength(ml - 15, op);
+        }
+    }
+
+    return op;
+}
+
+/**
+ * @brief Compresses a block with a greedy LZ77 parser. The hash table stores positions relative to the whole input
+ * (biased by 1, 0 meaning empty) so that it does not need to be cleared between blocks: entries older than
+ * blockStart are ignored.
+ * Returns the end of the compressed data or NULL if it does not fit before oend.
+ **/
+unsigned char*
+compressBlock(const unsigned char* src,
+              std::size_t size,
+              U32 blockStart,
+              U32* table,
+              unsigned char* op,
+              unsigned char* oend)
+{
+    const unsigned char* ip = src;
+    const unsigned char* anchor = src;
+    const unsigned char* iend = src + size;
+
+    if (size >= MIN_MATCH) {
+        const unsigned char* ilimit = iend - MIN_MATCH;
+        while (ip <= ilimit) {
+            U32 sequence = read32(ip);
+            U32 h = hash32(sequence);
+            U32 candidatePos = table[h];
+            U32 pos = blockStart + (U32)(ip - src) + 1;
+            table[h] = pos;
+            if ( (candidatePos > blockStart) && (pos - candidatePos <= MAX_OFFSET) ) {
+                const unsigned char* candidate = src + (candidatePos - blockStart - 1);
+                if (read32(candidate) == sequence) {
+                    const unsigned char* p = ip + MIN_MATCH;
+                    const unsigned char* m = candidate + MIN_MATCH;
+                    while (p < iend && *p == *m) {
+                        ++p;
+                        ++m;
+                    }
+                    op = writeSequence(anchor, ip - anchor, ip - candidate, p - ip, op, oend);
+                    if (!op) {
+                        return 0;
+                    }
+                    ip = p;
+                    anchor = p;
+                    continue;
+                }
+            }
+            ///Skip faster through data that does not compress
+            ip += 1 + ( (ip - anchor) >> 6 );
+        }
+    }
+
+    return writeSequence(anchor, iend - anchor, 0, 0, op, oend);
+}
+
+bool
+decompressBlock(const unsigned char* ip,
+                std::size_t compressedSize,
+                unsigned char* dst,
+                std::size_t size)
+{
+    const unsigned char* iend = ip + compressedSize;
+    unsigned char* op = dst;
+    unsigned char* oend = dst + size;
+
+    while (ip < iend) {
+        unsigned int token = *ip++;
+        std::size_t literalsLength = token >> 4;
+        if (literalsLength == 15) {
+            unsigned char c;
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                c = *ip++;
+                literalsLength += c;
+            } while (c == 255);
+        }
+        if ( ( literalsLength > (std::size_t)(iend - ip) ) || ( literalsLength > (std::size_t)(oend - op) ) ) {
+            return false;
+        }
+        std::memcpy(op, ip, literalsLength);
+        op += literalsLength;
+        ip += literalsLength;
+        if (ip == iend) {
+            ///Last sequence of the block
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return false;
+        }
+        std::size_t offset = (std::size_t)ip[0] | ( (std::size_t)ip[1] << 8 );
+        ip += 2;
+        std::size_t matchLength = token & 15;
+        if (matchLength == 15) {
+            unsigned char c;
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                c = *ip++;
+                matchLength += c;
+            } while (c == 255);
+        }
+        matchLength += MIN_MATCH;
+        if ( (offset == 0) || ( offset > (std::size_t)(op - dst) ) || ( matchLength > (std::size_t)(oend - op) ) ) {
+            return false;
+        }
+        const unsigned char* match = op - offset;
+        if (offset >= matchLength) {
+            std::memcpy(op, match, matchLength);
+            op += matchLength;
+        } else {
+            ///Overlapping copy: repeats the last offset bytes
+            for (std::size_t i = 0; i < matchLength; ++i) {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return op == oend;
+}
+} // anon namespace
+
+namespace Natron {
+namespace CacheCompression {
+bool
+compress(const void* data,
+         std::size_t size,
+         std::size_t elementSize,
+         std::size_t maxCompressedSize,
+         std::vector<unsigned char>* compressed)
+{
+    assert(elementSize > 0 && NATRON_CACHE_COMPRESSION_BLOCK_SIZE % elementSize == 0);
+    ///Positions in the hash table are 32 bits
+    if ( (size == 0) || (size >= 0xffffffffU) ) {
+        return false;
+    }
+
+    const unsigned char* src = (const unsigned char*)data;
+    std::vector<unsigned char> shuffled(std::min(size, (std::size_t)NATRON_CACHE_COMPRESSION_BLOCK_SIZE));
+    std::vector<U32> table(1 << HASH_BITS, 0);
+    std::size_t used = 0;
+
+    compressed->clear();
+    for (std::size_t blockStart = 0; blockStart < size; blockStart += NATRON_CACHE_COMPRESSION_BLOCK_SIZE) {
+        std::size_t blockSize = std::min(size - blockStart, (std::size_t)NATRON_CACHE_COMPRESSION_BLOCK_SIZE);
+        ///Header + stored block
+        std::size_t blockBound = 4 + blockSize;
+        if (used + 4 >= maxCompressedSize) {
+            return false;
+        }
+        compressed->resize( used + std::min(blockBound, maxCompressedSize - used) );
+
+        const unsigned char* blockData = src + blockStart;
+        if (elementSize > 1) {
+            shuffle(blockData, blockSize, elementSize, &shuffled[0]);
+            blockData = &shuffled[0];
+        }
+
+        unsigned char* header = &(*compressed)[used];
+        unsigned char* oend = &(*compressed)[0] + compressed->size();
+        ///A compressed block must be smaller than the stored block
+        unsigned char* blockEnd = compressBlock( blockData, blockSize, (U32)blockStart, &table[0], header + 4,
+                                                 std::min(oend, header + 4 + blockSize - 1) );
+        if (blockEnd) {
+            writeHeader( (U32)(blockEnd - header - 4), header );
+            used = blockEnd - &(*compressed)[0];
+        } else {
+            if (blockBound > (std::size_t)(oend - header)) {
+                return false;
+            }
+            writeHeader( (U32)blockSize | STORED_BLOCK_FLAG, header );
+            std::memcpy(header + 4, blockData, blockSize);
+            used += blockBound;
+        }
+    }
+    if (used > maxCompressedSize) {
+        return false;
+    }
+    compressed->resize(used);
+
+    return true;
+} // compress
+
+bool
+decompress(const unsigned char* compressed,
+           std::size_t compressedSize,
+           std::size_t elementSize,
+           void* data,
+           std::size_t size)
+{
+    assert(elementSize > 0 && NATRON_CACHE_COMPRESSION_BLOCK_SIZE % elementSize == 0);
+    unsigned char* dst = (unsigned char*)data;
+    const unsigned char* ip = compressed;
+    const unsigned char* iend = compressed + compressedSize;
+    std::vector<unsigned char> shuffled;
+    if (elementSize > 1) {
+        shuffled.resize( std::min(size, (std::size_t)NATRON_CACHE_COMPRESSION_BLOCK_SIZE) );
+    }
+
+    for (std::size_t blockStart = 0; blockStart < size; blockStart += NATRON_CACHE_COMPRESSION_BLOCK_SIZE) {
+        std::size_t blockSize = std::min(size - blockStart, (std::size_t)NATRON_CACHE_COMPRESSION_BLOCK_SIZE);
+        if (iend - ip < 4) {
+            return false;
+        }
+        U32 header = readHeader(ip);
+        ip += 4;
+
+        unsigned char* blockData = elementSize > 1 ? &shuffled[0] : dst + blockStart;
+        if (header & STORED_BLOCK_FLAG) {
+            if ( ( (header & ~STORED_BLOCK_FLAG) != blockSize ) || ( blockSize > (std::size_t)(iend - ip) ) ) {
+                return false;
+            }
+            std::memcpy(blockData, ip, blockSize);
+            ip += blockSize;
+        } else {
+            if ( header > (std::size_t)(iend - ip) ) {
+                return false;
+            }
+            if ( !decompressBlock(ip, header, blockData, blockSize) ) {
+                return false;
+            }
+            ip += header;
+        }
+        if (elementSize > 1) {
+            unshuffle(blockData, blockSize, elementSize, dst + blockStart);
+        }
+    }
+
+    return ip == iend;
+} // decompress
+} // namespace CacheCompression
+} // namespace Natron
@@ -0,0 +1,73 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NATRON_ENGINE_CACHECOMPRESSION_H
+#define NATRON_ENGINE_CACHECOMPRESSION_H
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <cstddef>
+#include <vector>
+
+#include "Global/Macros.h"
+
+///Size in bytes of the blocks compressed independently. Must be a multiple of the largest element size (4)
+#define NATRON_CACHE_COMPRESSION_BLOCK_SIZE (256 * 1024)
+
+///Data is kept compressed in the caches only if its compressed size is at most this ratio of its size
+#define NATRON_CACHE_COMPRESSION_MAX_RATIO 0.75
+
+namespace Natron {
+namespace CacheCompression {
+/**
+ * @brief Fast lossless codec used by the compressed in-RAM portion of the caches.
+ * The data is cut in blocks of NATRON_CACHE_COMPRESSION_BLOCK_SIZE bytes. In each block the bytes of the elements
+ * are shuffled so that the i-th bytes of all elements are contiguous (e.g: all exponents of floating point pixels),
+ * then the block is compressed with a byte oriented LZ77 coder similar to LZ4. Blocks that do not compress
+ * are stored as is.
+ **/
+
+/**
+ * @brief Compresses size bytes of data made of elements of elementSize bytes (1, 2 or 4 for pixel components).
+ * @param maxCompressedSize The compression is aborted if the result would be larger than this.
+ * @returns True if the data could be compressed in at most maxCompressedSize bytes, in which case compressed
+ * holds the result.
+ **/
+bool compress(const void* data,
+              std::size_t size,
+              std::size_t elementSize,
+              std::size_t maxCompressedSize,
+              std::vector<unsigned char>* compressed) WARN_UNUSED_RETURN;
+
+/**
+ * @brief Decompresses data compressed with compress() with the same size and elementSize.
+ * @returns False if the compressed data is corrupted.
+ **/
+bool decompress(const unsigned char* compressed,
+                std::size_t compressedSize,
+                std::size_t elementSize,
+                void* data,
+                std::size_t size) WARN_UNUSED_RETURN;
+} // namespace CacheCompression
+} // namespace Natron
+
+#endif // NATRON_ENGINE_CACHECOMPRESSION_H
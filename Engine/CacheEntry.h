@@ -26,12 +26,15 @@
 // ***** END PYTHON BLOCK *****
 
 #include <iostream>
+#include <algorithm> // for std::max
 #include <cassert>
 #include <cstdio> // for std::remove
+#include <cstring> // for memcpy
 #include <stdexcept>
 #include <vector>
 #include <fstream>
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QFile>
 #include <QtCore/QMutex>
 #include <QtCore/QReadWriteLock>
@@ -43,9 +46,12 @@
 #include <boost/scoped_ptr.hpp>
 #endif
 #include "Engine/Hash64.h"
+#include "Engine/CacheCompression.h"
 #include "Engine/CacheEntryHolder.h"
-#include "Engine/MemoryFile.h"
+#include "Engine/CacheSegmentStore.h"
+#include "Engine/CacheStats.h"
 #include "Engine/NonKeyParams.h"
+#include "Engine/RenderArena.h"
 #include <SequenceParsing.h> // for removePath
 #include "Engine/EngineFwd.h"
 
@@ -53,21 +59,46 @@ namespace Natron {
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////BUFFER////////////////////////////////////////////////////
 
+/**
+ * @brief The reference count of the data of RamBuffers, allocated along with it.
+ **/
+struct RamBufferHeader
+{
+    QAtomicInt refCount; //< the number of RamBuffers referencing the data
+    boost::shared_ptr<RenderArena> arena; //< the arena the data was allocated in, or NULL if it was malloc'ed
+
+    RamBufferHeader(const boost::shared_ptr<RenderArena> & arena)
+    : refCount(1)
+    , arena(arena)
+    {
+    }
+};
+
+/**
+ * @brief A malloc'ed array, or allocated in the RenderArena of a render for the temporary images. Its data may be
+ * shared with other RamBuffers (@see share()): it is then reference counted and copied by detach() before being written to.
+ * RamBuffer is not thread-safe, but 2 RamBuffers sharing the same data may be used by different threads.
+ **/
 template <typename T>
 class RamBuffer
 {
     T* data;
     U64 count;
+    RamBufferHeader* header;
     
 public:
     
     RamBuffer()
     : data(0)
     , count(0)
+    , header(0)
     {
         
     }
     
+    /**
+     * @brief Returns the data, which must not be written to if it is shared: call detach() first.
+     **/
     T* getData()
     {
         return data;
@@ -82,6 +113,7 @@ public:
     {
         std::swap(data, other.data);
         std::swap(count, other.count);
+        std::swap(header, other.header);
     }
     
     U64 size() const
@@ -89,51 +121,138 @@ public:
         return count;
     }
     
-    void resize(U64 size)
+    /**
+     * @param arena If set, the data is allocated in the arena instead of being malloc'ed
+     **/
+    void resize(U64 size,
+                const boost::shared_ptr<RenderArena> & arena = boost::shared_ptr<RenderArena>())
     {
         if (size == 0) {
             return;
         }
+        release();
+        data = allocateData(size, arena);
         count = size;
-        if (data) {
-            free(data);
-            data = 0;
-        }
-        if (count == 0) {
+        header = new RamBufferHeader(arena);
+    }
+    
+    void clear()
+    {
+        release();
+    }
+    
+    /**
+     * @brief Returns the arena the data was allocated in, or NULL.
+     **/
+    boost::shared_ptr<RenderArena> getArena() const
+    {
+        return header ? header->arena : boost::shared_ptr<RenderArena>();
+    }
+    
+    /**
+     * @brief Makes this buffer reference the data of other instead of its own. The data is then copied by
+     * the first of the 2 buffers that calls detach().
+     **/
+    void share(const RamBuffer& other)
+    {
+        if ( (&other == this) || (other.data == data) ) {
             return;
         }
-        data = (T*)malloc(size * sizeof(T));
-        if (!data) {
-            throw std::bad_alloc();
+        release();
+        if (!other.data) {
+            return;
         }
+        other.header->refCount.ref();
+        data = other.data;
+        count = other.count;
+        header = other.header;
     }
     
-    void clear()
+    /**
+     * @brief Returns true if the data is referenced by another RamBuffer.
+     **/
+    bool isShared() const
     {
-        count = 0;
-        if (data) {
-            free(data);
-            data = 0;
+        return data && header->refCount.fetchAndAddOrdered(0) > 1;
+    }
+    
+    /**
+     * @brief Makes the data owned by this buffer only, by copying it if it is shared. The copy is allocated
+     * in the same arena.
+     **/
+    void detach()
+    {
+        if ( !isShared() ) {
+            return;
         }
+        boost::shared_ptr<RenderArena> arena = header->arena;
+        T* copy = allocateData(count, arena);
+        memcpy(copy, data, count * sizeof(T));
+        U64 copyCount = count;
+        release();
+        data = copy;
+        count = copyCount;
+        header = new RamBufferHeader(arena);
     }
     
     ~RamBuffer()
     {
-        if (data) {
-            free(data);
-            data = 0;
+        release();
+    }
+    
+private:
+    
+    // RamBuffer has a pointer member: copies must go through share()
+    RamBuffer(const RamBuffer&);
+    RamBuffer& operator=(const RamBuffer&);
+    
+    static T* allocateData(U64 size,
+                           const boost::shared_ptr<RenderArena> & arena)
+    {
+        T* ret;
+        if (arena) {
+            ret = (T*)arena->allocate(size * sizeof(T));
+        } else {
+            ret = (T*)malloc(size * sizeof(T));
+        }
+        if (!ret) {
+            throw std::bad_alloc();
+        }
+        
+        return ret;
+    }
+    
+    void release()
+    {
+        if ( data && !header->refCount.deref() ) {
+            if (header->arena) {
+                header->arena->deallocate(data, count * sizeof(T));
+            } else {
+                free(data);
+            }
+            delete header;
         }
+        data = 0;
+        count = 0;
+        header = 0;
     }
 };
 
 /** @brief Buffer represents  an internal buffer that can be allocated on different devices.
- * For now the class is simple and can only be either on disk using mmap or in RAM using malloc.
+ * For now the class is simple and can only be either in RAM using malloc or on disk in the segment files
+ * of the CacheSegmentStore of the cache.
  * The cost parameter given to the allocate() function is a hint that the Buffer classes uses
  * to select a device to use. By default -1 means it should not allocate any memory,
- * 0 means RAM and >= 1 means the data will be stored on disk using mmap. We could see this
+ * 0 means RAM and >= 1 means the data will be stored on disk. We could see this
  * scheme evolve in the future with other storage devices such as OpenGL textures, Cuda buffers,
  * ... etc
  *
+ * A buffer stored on disk owns a chunk in the segment files. While it is allocated its data lives in RAM,
+ * it is written to its chunk by deallocate() and read back by reloadFromStore().
+ *
+ * The data of an allocated buffer may also be compressed in RAM with compress(): the buffer is then no longer
+ * allocated until decompress() is called.
+ *
  * Thread safety : This class is not thread-safe but is used ONLY by the CacheEntryHelper class
  * which is itself manipulated by the Cache which is thread-safe.
  *
@@ -147,10 +266,15 @@ public:
 
 
     Buffer()
-    : _path()
-    , _buffer()
-    , _backingFile()
+    : _buffer()
+    , _store(0)
+    , _location()
+    , _diskCount(0)
+    , _dirty(false)
     , _storageMode(eStorageModeRAM)
+    , _compressed()
+    , _compressedCount(0)
+    , _compressedElementSize(1)
     {
     }
     
@@ -159,59 +283,54 @@ public:
         deallocate();
     }
 
+    /**
+     * @param store The store of the disk portion of the cache, it must be set when storage is eStorageModeDisk.
+     * @param arena If set, the data of a buffer in RAM is allocated in the arena, @see RenderArena
+     **/
     void allocate( U64 count,
                    Natron::StorageModeEnum storage,
-                   std::string path = std::string() )
+                   CacheSegmentStore* store = 0,
+                   const boost::shared_ptr<RenderArena> & arena = boost::shared_ptr<RenderArena>() )
     {
         /*allocate should be called only once.*/
-        assert( _path.empty() );
-        assert( ( (_buffer.size() == 0) && !_backingFile ) || ( (_buffer.size() != 0) && !_backingFile ) || (!(_buffer.size() != 0) && _backingFile) );
-        if ( (_buffer.size() > 0) || _backingFile ) {
+        assert( !_location.isValid() );
+        if ( (_buffer.size() > 0) || _location.isValid() ) {
             return;
         }
 
 
         if (storage == Natron::eStorageModeDisk) {
-            _storageMode = eStorageModeDisk;
-            _path = path;
-            try {
-                _backingFile.reset( new MemoryFile(_path,MemoryFile::eFileOpenModeEnumIfExistsKeepElseCreate) );
-            } catch (const std::runtime_error & r) {
-                std::cout << r.what() << std::endl;
-
-                ///if opening the file mapping failed, just call allocate again, but this time on RA%!
-                _backingFile.reset();
-                _path.clear();
-                allocate(count,Natron::eStorageModeRAM, path);
+            if ( !store || !store->allocate(count * sizeof(DataType), &_location) ) {
+                ///if we could not get a chunk in the segment files, just call allocate again, but this time on RAM!
+                _location = CacheSegmentLocation();
+                allocate(count, Natron::eStorageModeRAM, 0, arena);
 
                 return;
             }
-
-            if ( !path.empty() && (count != 0) ) {
-                //if the backing file has already the good size and we just wanted to re-open the mapping
-                _backingFile->resize(count);
-            }
+            _storageMode = eStorageModeDisk;
+            _store = store;
+            _diskCount = count;
+            _buffer.resize(count);
+            _dirty = true;
         } else if (storage == Natron::eStorageModeRAM) {
             _storageMode = eStorageModeRAM;
-            _buffer.resize(count);
+            _buffer.resize(count, arena);
         }
     }
 
     /**
      * @brief Reallocates the internal buffer so that it countains "count" elements of the DataType.
-     * Content defined in the previous portions of the buffer will be kept.
      *
      * Pre-condition: allocate(..) must have been called already.
      **/
     void reallocate(U64 count)
     {
-        if (_storageMode == eStorageModeRAM) {
-            assert(_buffer.size() > 0); // could be 0 if we allocate 0...
-            _buffer.resize(count);
-        } else if (_storageMode == eStorageModeDisk) {
-            assert(_backingFile);
-            _backingFile->resize( count * sizeof(DataType) );
+        if (_storageMode == eStorageModeDisk) {
+            ensureDiskCapacity(count);
         }
+        assert(_buffer.size() > 0); // could be 0 if we allocate 0...
+        _buffer.resize( count, _buffer.getArena() );
+        _dirty = true;
     }
     
     /**
@@ -219,81 +338,198 @@ public:
      **/
     void swap(Buffer& other)
     {
-        if (_storageMode == eStorageModeRAM) {
-            if (other._storageMode == eStorageModeRAM) {
-                _buffer.swap(other._buffer);
-            } else {
-                _buffer.resize(other._backingFile->size() / sizeof(DataType));
-                const char* src = other._backingFile->data();
-                char* dst = (char*)_buffer.getData();
-                memcpy(dst,src,other._backingFile->size());
-            }
-        } else if (_storageMode == eStorageModeDisk) {
-            if (other._storageMode == eStorageModeDisk) {
-                assert(_backingFile);
-                _backingFile.swap(other._backingFile);
-                _path = other._path;
-            } else {
-                _backingFile->resize(other._buffer.size() * sizeof(DataType));
-				assert(_backingFile->data());
-                const char* src = (const char*)other._buffer.getData();
-                char* dst = (char*)_backingFile->data();
-                memcpy(dst,src,other._buffer.size() * sizeof(DataType));
+        if ( (_storageMode == eStorageModeDisk) && (other._storageMode == eStorageModeDisk) ) {
+            _buffer.swap(other._buffer);
+            std::swap(_store, other._store);
+            std::swap(_location, other._location);
+            std::swap(_diskCount, other._diskCount);
+            _dirty = true;
+            other._dirty = true;
+        } else if (other._storageMode == eStorageModeRAM) {
+            if (_storageMode == eStorageModeDisk) {
+                ensureDiskCapacity( other._buffer.size() );
+                _dirty = true;
             }
+            _buffer.swap(other._buffer);
+        } else {
+            _buffer.resize( other._buffer.size() );
+            memcpy( _buffer.getData(), other._buffer.getData(), other._buffer.size() * sizeof(DataType) );
         }
         
     }
     
-    const std::string& getFilePath() const {
-        return _path;
+    /**
+     * @brief Makes this buffer reference the data of other, which must have the same size, instead of its own:
+     * the data is copied only when one of them is written to. Only buffers in RAM can be shared.
+     * @returns False if the buffers cannot be shared, in which case this buffer is left untouched.
+     **/
+    bool share(const Buffer& other)
+    {
+        if ( (_storageMode != eStorageModeRAM) || (other._storageMode != eStorageModeRAM) ||
+             (_buffer.size() == 0) || ( _buffer.size() != other._buffer.size() ) || (_compressed.size() > 0) ) {
+            return false;
+        }
+        _buffer.share(other._buffer);
+
+        return true;
     }
 
-    void reOpenFileMapping() const
+    bool isShared() const
     {
-        assert(!_backingFile && _storageMode == eStorageModeDisk);
-        try{
-            _backingFile.reset( new MemoryFile(_path,MemoryFile::eFileOpenModeEnumIfExistsKeepElseCreate) );
-        } catch (const std::exception & e) {
-            _backingFile.reset();
-            throw std::bad_alloc();
+        return _buffer.isShared();
+    }
+
+    const CacheSegmentLocation& getDiskLocation() const
+    {
+        return _location;
+    }
+
+    /**
+     * @brief Reads back the data of a buffer stored on disk that was deallocated.
+     **/
+    void reloadFromStore() const
+    {
+        assert(_storageMode == eStorageModeDisk && _buffer.size() == 0);
+        _compressed.clear();
+        if (!_store) {
+            throw std::runtime_error("Cache entry is not stored on disk");
         }
+        _buffer.resize(_diskCount);
+        if ( !_store->read( _location, _buffer.getData(), _diskCount * sizeof(DataType) ) ) {
+            _buffer.clear();
+            throw std::runtime_error("Failed to read cache entry from the cache segment files");
+        }
+        _dirty = false;
     }
 
-    void restoreBufferFromFile(const std::string & path)
+    /**
+     * @brief Sets the location of a buffer stored on disk in a previous session, without reading its data.
+     **/
+    void restoreFromStore(CacheSegmentStore* store,
+                          const CacheSegmentLocation& location,
+                          U64 count)
     {
-        _path = path;
+        _store = store;
+        _location = location;
+        _diskCount = count;
         _storageMode = eStorageModeDisk;
     }
 
     void deallocate()
     {
-        if (_storageMode == eStorageModeRAM) {
+        if (_storageMode == eStorageModeDisk) {
+            writeToStore();
+        }
+        _buffer.clear();
+        _compressed.clear();
+    }
+
+    /**
+     * @brief Writes the data of a buffer stored on disk to its chunk if it was modified, without freeing it.
+     * @returns False if the data could not be written.
+     **/
+    bool flush() const
+    {
+        if (_storageMode != eStorageModeDisk) {
+            return true;
+        }
+
+        return writeToStore();
+    }
+
+    /**
+     * @brief Marks the data as modified so that it is written again to its chunk by the next flush() or deallocate().
+     **/
+    void setDirty() const
+    {
+        if ( _buffer.size() > 0 ) {
+            _dirty = true;
+        }
+    }
+
+    /**
+     * @brief Compresses the data and frees the uncompressed buffer. The data of a buffer stored on disk is first
+     * written to its chunk so that the compressed copy may be dropped at any time with dropCompressed().
+     * @param elementSize The size in bytes of the elements the data is made of, @see CacheCompression::compress
+     * @returns False if the data does not compress well enough, in which case the buffer is left untouched.
+     **/
+    bool compress(std::size_t elementSize)
+    {
+        if ( (_buffer.size() == 0) || (_compressed.size() > 0) ) {
+            return false;
+        }
+        if ( (_storageMode == eStorageModeDisk) && !writeToStore() ) {
+            return false;
+        }
+
+        std::size_t bytes = _buffer.size() * sizeof(DataType);
+        std::vector<unsigned char> compressed;
+        if ( !CacheCompression::compress(_buffer.getData(), bytes, elementSize,
+                                         bytes * NATRON_CACHE_COMPRESSION_MAX_RATIO, &compressed) ) {
+            return false;
+        }
+        ///Copy to a buffer of the exact size, the vector may have a larger capacity
+        _compressed.resize( compressed.size() );
+        memcpy( _compressed.getData(), &compressed[0], compressed.size() );
+        _compressedCount = _buffer.size();
+        _compressedElementSize = elementSize;
+        _buffer.clear();
+
+        return true;
+    }
+
+    /**
+     * @brief Restores the uncompressed buffer from the compressed data, which is then freed.
+     * WARNING: This function throws a std::runtime_error if the compressed data is corrupted.
+     **/
+    void decompress()
+    {
+        assert(_compressed.size() > 0 && _buffer.size() == 0);
+        _buffer.resize(_compressedCount);
+        if ( !CacheCompression::decompress( _compressed.getData(), _compressed.size(), _compressedElementSize,
+                                            _buffer.getData(), _compressedCount * sizeof(DataType) ) ) {
             _buffer.clear();
-        } else {
-            if (_backingFile) {
-                bool flushOk = _backingFile->flush();
-                _backingFile.reset();
-                if (!flushOk) {
-                    throw std::runtime_error("Failed to flush RAM data to backing file.");
-                }
-            }
+            _compressed.clear();
+            throw std::runtime_error("Failed to decompress cache entry");
         }
+        _compressed.clear();
+    }
+
+    /**
+     * @brief Frees the compressed data without decompressing it.
+     **/
+    void dropCompressed()
+    {
+        _compressed.clear();
+    }
+
+    bool isCompressed() const
+    {
+        return _compressed.size() > 0;
+    }
+
+    /**
+     * @brief Returns the size in bytes of the compressed data.
+     **/
+    std::size_t getCompressedSize() const
+    {
+        return _compressed.size();
     }
 
-    bool removeAnyBackingFile() const
+    /**
+     * @brief Releases the chunk owned by the buffer in the segment files.
+     **/
+    void removeAnyBackingFile() const
     {
         if (_storageMode == eStorageModeDisk) {
-            if (_backingFile) {
-                _backingFile->remove();
-                _backingFile.reset();
-                return true;
-            } else {
-                int ret_code = std::remove( _path.c_str() );
-                Q_UNUSED(ret_code);
-                return false;
+            _buffer.clear();
+            _compressed.clear();
+            _dirty = false;
+            if (_store) {
+                _store->release(_location);
             }
+            _location = CacheSegmentLocation();
         }
-        return false;
     }
 
     /**
@@ -301,38 +537,39 @@ public:
      **/
     size_t size() const
     {
-        if (_storageMode == eStorageModeRAM) {
-            return _buffer.size() * sizeof(DataType);
-        } else {
-            return _backingFile ? _backingFile->size() : 0;
-        }
+        return _buffer.size() * sizeof(DataType);
     }
 
     bool isAllocated() const
     {
-        return (_buffer.size() > 0) || ( _backingFile && _backingFile->data() );
+        return _buffer.size() > 0;
     }
 
+    /**
+     * @brief Returns the data to write to, copied first if it is shared. This modifies the buffer: it must be called by
+     * a single thread, under the write lock of the entry.
+     **/
     DataType* writable()
     {
-        if (_storageMode == eStorageModeDisk) {
-            if (_backingFile) {
-                return (DataType*)_backingFile->data();
-            } else {
-                return NULL;
-            }
-        } else {
-            return _buffer.getData();
+        if (!_dirty) {
+            _dirty = true;
         }
+        _buffer.detach();
+        return _buffer.getData();
+    }
+
+    /**
+     * @brief Returns the data without copying it if it is shared: it may be written to only if writable() was called
+     * since the buffer was last shared. Unlike writable() this does not modify the buffer.
+     **/
+    DataType* getData()
+    {
+        return _buffer.getData();
     }
 
     const DataType* readable() const
     {
-        if (_storageMode == eStorageModeDisk) {
-            return _backingFile ? (const DataType*)_backingFile->data() : 0;
-        } else {
-            return _buffer.getData();
-        }
+        return _buffer.getData();
     }
 
     Natron::StorageModeEnum getStorageMode() const
@@ -342,13 +579,52 @@ public:
 
 private:
 
-    std::string _path;
-    RamBuffer<DataType> _buffer;
+    /**
+     * @brief Writes the data to the chunk if it was modified since it was last written or read.
+     * On failure the chunk is released so that a later reload does not read garbage.
+     **/
+    bool writeToStore() const
+    {
+        if ( _dirty && (_buffer.size() > 0) && _store ) {
+            if ( !_store->write( _location, _buffer.getData(), _diskCount * sizeof(DataType) ) ) {
+                qDebug() << "Failed to write cache entry to the cache segment files";
+                _store->release(_location);
+                _location = CacheSegmentLocation();
+                _dirty = false;
+
+                return false;
+            }
+        }
+        _dirty = false;
 
-    /*mutable so the reOpenFileMapping function can reopen the mmaped file. It doesn't
+        return true;
+    }
+
+    void ensureDiskCapacity(U64 count)
+    {
+        U64 bytes = count * sizeof(DataType);
+        if ( bytes > _location.capacity ) {
+            CacheSegmentLocation newLocation;
+            if ( !_store || !_store->allocate(bytes, &newLocation) ) {
+                throw std::bad_alloc();
+            }
+            _store->release(_location);
+            _location = newLocation;
+        }
+        _diskCount = count;
+    }
+
+    /*mutable so reloadFromStore() and removeAnyBackingFile() can be called on const entries. It doesn't
        change the underlying data*/
-    mutable boost::scoped_ptr<MemoryFile> _backingFile;
+    mutable RamBuffer<DataType> _buffer;
+    CacheSegmentStore* _store;
+    mutable CacheSegmentLocation _location;
+    U64 _diskCount; //< number of elements stored in the chunk
+    mutable bool _dirty; //< true if the RAM data may differ from the data in the chunk
     Natron::StorageModeEnum _storageMode;
+    mutable RamBuffer<unsigned char> _compressed; //< the compressed data, empty unless compress() succeeded
+    U64 _compressedCount; //< number of elements of the compressed data
+    std::size_t _compressedElementSize;
 };
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -364,18 +640,19 @@ public:
     /**
      * @brief To be called by a CacheEntry whenever it's size is changed.
      * This way the cache can keep track of the real memory footprint.
+     * The hash is the hash key of the entry, it is used to find the shard of the cache holding the entry.
      **/
-    virtual void notifyEntrySizeChanged(size_t oldSize,size_t newSize) const = 0;
+    virtual void notifyEntrySizeChanged(U64 hash, size_t oldSize,size_t newSize) const = 0;
 
     /**
      * @brief To be called by a CacheEntry on allocation.
      **/
-    virtual void notifyEntryAllocated(double time, size_t size, Natron::StorageModeEnum storage) const = 0;
+    virtual void notifyEntryAllocated(U64 hash, double time, size_t size, Natron::StorageModeEnum storage) const = 0;
 
     /**
      * @brief To be called by a CacheEntry on destruction.
      **/
-    virtual void notifyEntryDestroyed(double time, size_t size, Natron::StorageModeEnum storage) const = 0;
+    virtual void notifyEntryDestroyed(U64 hash, double time, size_t size, Natron::StorageModeEnum storage) const = 0;
     
     /**
      * @brief Called by the Cache deleter thread to wake up sleeping threads that were attempting to create a new iamge
@@ -383,76 +660,48 @@ public:
     virtual void notifyMemoryDeallocated() const = 0;
 
     /**
-     * @brief To be called when a backing file has been closed
+     * @brief Returns the store holding the disk portion of the cache.
      **/
-    virtual void backingFileClosed() const = 0;
+    virtual CacheSegmentStore* getSegmentStore() const = 0;
 
     /**
      * @brief To be called whenever an entry is deallocated from memory and put back on disk or whenever
      * it is reallocated in the RAM.
      **/
-    virtual void notifyEntryStorageChanged(Natron::StorageModeEnum oldStorage,Natron::StorageModeEnum newStorage,
+    virtual void notifyEntryStorageChanged(U64 hash, Natron::StorageModeEnum oldStorage,Natron::StorageModeEnum newStorage,
                                            double time,size_t size) const = 0;
+
+    /**
+     * @brief To be called when the data of an entry is compressed in RAM.
+     * @param freedSize The size of the uncompressed data that was freed
+     **/
+    virtual void notifyEntryCompressed(U64 hash, size_t freedSize, size_t compressedSize) const = 0;
+
+    /**
+     * @brief To be called when the data of a compressed entry is decompressed in RAM.
+     * @param allocatedSize The size of the uncompressed data that was allocated
+     **/
+    virtual void notifyEntryDecompressed(U64 hash, size_t allocatedSize, size_t compressedSize) const = 0;
+
+    /**
+     * @brief To be called when the compressed data of an entry is freed without being decompressed.
+     * @param newStorage eStorageModeDisk if the data can still be read back from disk, eStorageModeNone otherwise.
+     **/
+    virtual void notifyCompressedEntryReleased(U64 hash, double time, size_t size, size_t compressedSize,
+                                               Natron::StorageModeEnum newStorage) const = 0;
+
+    /**
+     * @brief To be called when the time spent rendering the data of an entry changes.
+     * @param size The size in bytes of the data of the entry
+     **/
+    virtual void notifyEntryRenderTimeChanged(U64 hash, size_t size, double renderTime) const = 0;
     
     /**
      * @brief Remove from the cache all entries that matches the holderID and have a different nodeHash than the given one.
      * @param removeAll If true, remove even entries that match the nodeHash
      **/
     virtual void removeAllEntriesWithDifferentNodeHashForHolderPrivate(const std::string& holderID, U64 nodeHash, bool removeAll) = 0;
-    
-    
-#ifdef DEBUG
-    static bool checkFileNameMatchesHash(const std::string &originalFileName,U64 hash)
-    {
-        
-        std::string filename = originalFileName;
-        std::string path = SequenceParsing::removePath(filename);
-        //remove extension from filename
-        {
-            size_t lastdot = filename.find_last_of('.');
-            if (lastdot != std::string::npos) {
-                filename.erase(lastdot, std::string::npos);
-            }
-        }
-        
-        //remove index if it has one
-        {
-            std::size_t foundSep = filename.find_last_of('_');
-            if (foundSep != std::string::npos) {
-                filename.erase(foundSep, std::string::npos);
-            }
-        }
-        
-        QString hashKeyStr(filename.c_str());
-        
-        //prepend the 2 digits of the containing directory
-        {
-            if (path.size() > 0) {
-                if (path[path.size() - 1] == '\\' || path[path.size() -1] == '/') {
-                    path.erase(path.size() - 1, 1);
-                }
-                
-                std::size_t foundSep = path.find_last_of('/');
-                if (foundSep == std::string::npos) {
-                    foundSep = path.find_last_of('\\');
-                }
-                assert(foundSep != std::string::npos);
-                std::string enclosingDirName = path.substr(foundSep + 1, std::string::npos);
-                hashKeyStr.prepend(enclosingDirName.c_str());
-            }
-        }
-        
-        
-        U64 hashKey = hashKeyStr.toULongLong(0,16); //< to hex (base 16)
-        if (hashKey == hash) {
-            return true;
-        } else {
-            return false;
-        }
-        
-    }
-#endif
-    
+
 };
 
 
@@ -512,6 +761,9 @@ public:
     , _entryLock(QReadWriteLock::Recursive)
     , _requestedStorage(eStorageModeNone)
     , _removeBackingFileBeforeDestruction(false)
+    , _renderTimeUs()
+    , _cacheAccessCount(0)
+    , _cacheInflation(0.)
     {
     }
 
@@ -534,6 +786,9 @@ public:
     , _entryLock(QReadWriteLock::Recursive)
     , _requestedStorage(storage)
     , _removeBackingFileBeforeDestruction(false)
+    , _renderTimeUs()
+    , _cacheAccessCount(0)
+    , _cacheInflation(0.)
     {
     }
 
@@ -584,44 +839,52 @@ public:
                 }
             }
             QWriteLocker k(&_entryLock);
-            allocate(_params->getElementsCount(),_requestedStorage,_requestedPath);
+            allocate(_params->getElementsCount(),_requestedStorage);
             onMemoryAllocated(false);
         }
         
         if (_cache) {
-            _cache->notifyEntryAllocated( getTime(),size(),_data.getStorageMode() );
+            _cache->notifyEntryAllocated( getHashKey(), getTime(),size(),_data.getStorageMode() );
+        }
+        Natron::CacheStats* holderStats = _key.getCacheHolderStats();
+        if (holderStats) {
+            holderStats->addBytesAllocated( size() );
         }
     }
     
     /**
-     * @brief To be called for disk-cached entries when restoring them from a file.
-     * The file-path will be the one passed to the constructor
+     * @brief To be called for disk-cached entries when restoring them from a previous session.
+     * @param location The location of the entry data in the segment files of the cache
+     * WARNING: This function throws a std::runtime_error if the location is not valid any longer.
      **/
-    void restoreMetaDataFromFile(std::size_t size)
+    void restoreMetaDataFromDisk(const CacheSegmentLocation& location, std::size_t size)
     {
         if (!_cache || _requestedStorage != Natron::eStorageModeDisk) {
             return;
         }
         
-        assert(!_requestedPath.empty());
-        
         {
             QWriteLocker k(&_entryLock);
             
-            restoreBufferFromFile(_requestedPath);
+            CacheSegmentStore* store = _cache->getSegmentStore();
+            CacheSegmentLocation reserved = location;
+            if ( !store->reserve(&reserved) ) {
+                throw std::runtime_error("Cache restore, the entry location in the cache segment files is invalid");
+            }
+            _data.restoreFromStore( store, reserved, size / sizeof(DataType) );
             
             onMemoryAllocated(true);
 
         }
         
         if (_cache) {
-            _cache->notifyEntryStorageChanged(Natron::eStorageModeNone, Natron::eStorageModeDisk, getTime(),size);
+            _cache->notifyEntryStorageChanged(getHashKey(), Natron::eStorageModeNone, Natron::eStorageModeDisk, getTime(),size);
         }
     }
 
     /**
      * @brief Called right away once the buffer is allocated. Used in debug mode to initialize image with a default color.
-     * @param diskRestoration If true, this is called by restoreMetaDataFromFile() and the memory is in fact not allocated, this should
+     * @param diskRestoration If true, this is called by restoreMetaDataFromDisk() and the memory is in fact not allocated, this should
      * just restore meta-data
      **/
     virtual void onMemoryAllocated(bool /*diskRestoration*/)
@@ -634,8 +897,8 @@ public:
         return _key;
     }
     
-    const std::string& getFilePath() const {
-        return _data.getFilePath();
+    const CacheSegmentLocation& getDiskLocation() const {
+        return _data.getDiskLocation();
     }
 
     typename AbstractCacheEntry<KeyType>::hash_type getHashKey() const OVERRIDE FINAL
@@ -643,50 +906,129 @@ public:
         return _key.getHash();
     }
 
-    std::string generateStringFromHash(const std::string & path,U64 hashKey) const
+    /** @brief This function is called by the get() function of the Cache when the entry is
+     * living only in the disk portion of the cache. No locking is required here because the
+     * caller is already preventing other threads to call this function.
+     * WARNING: This function throws a std::runtime_error if the data could not be read.
+     **/
+    void reloadFromDisk() const
     {
-        std::string name(path);
-
-        if ( path.empty() ) {
-            QDir subfolder( path.c_str() );
-            if ( !subfolder.exists() ) {
-                std::cout << "(" << std::hex <<
-                    this << ") " <<   "Something is wrong in cache... couldn't find : " << path << std::endl;
-                throw std::invalid_argument(path);
-            }
+        {
+            QWriteLocker k(&_entryLock);
+            _data.reloadFromStore();
+        }
+        if (_cache) {
+            _cache->notifyEntryStorageChanged( getHashKey(), Natron::eStorageModeDisk, Natron::eStorageModeRAM,getTime(), size() );
         }
-        QString hashKeyStr = QString::number(hashKey,16); //< hex is base 16
-        for (int i = 0; i < 2; ++i) {
-            if (i >= hashKeyStr.size()) {
-                break;
+    }
+
+    /**
+     * @brief Writes the data of an entry stored on disk to the segment files. Unlike deallocate() the data stays in RAM.
+     * This is EXPENSIVE: it is called by the write-back thread of the cache and never under a lock of the cache.
+     * @returns False if the data could not be written, in which case the chunk of the entry is released.
+     **/
+    bool writeToDisk() const
+    {
+        QWriteLocker k(&_entryLock);
+
+        return _data.flush();
+    }
+
+    /**
+     * @brief Forces the data to be written again to disk by the next writeToDisk() or deallocate(). Called by the cache
+     * when the entry may have been modified while it was written by the write-back thread.
+     **/
+    void invalidateWrittenData() const
+    {
+        QWriteLocker k(&_entryLock);
+
+        _data.setDirty();
+    }
+
+    /**
+     * @brief Returns the size in bytes of the elements the data is made of, used to compress it.
+     * e.g: an image of floating point pixels stored in a buffer of bytes returns sizeof(float).
+     **/
+    virtual std::size_t getCompressionElementSize() const
+    {
+        return sizeof(DataType);
+    }
+
+    /**
+     * @brief Compresses the data of the entry in RAM. This is called by the cache when the entry is evicted
+     * from its memory portion. No other thread may be using the entry.
+     * @returns False if the data does not compress well enough, in which case the entry is left untouched.
+     **/
+    bool compress()
+    {
+        std::size_t sz = size();
+        std::size_t compressedSize;
+        {
+            QWriteLocker k(&_entryLock);
+            if ( !_data.compress( getCompressionElementSize() ) ) {
+                return false;
             }
-            name.push_back(hashKeyStr[i].toLatin1());
+            compressedSize = _data.getCompressedSize();
         }
-        name.append("/");
-        int i = 2;
-        while (i < hashKeyStr.size()) {
-            name.push_back(hashKeyStr[i].toLatin1());
-            ++i;
+        if (_cache) {
+            ///Like for entries moved to disk, the whole size of the entry is no longer accounted in RAM
+            _cache->notifyEntryCompressed(getHashKey(), sz, compressedSize);
         }
-        
-        name.append("." NATRON_CACHE_FILE_EXT);
 
-        return name;
+        return true;
     }
 
-    /** @brief This function is called by the get() function of the Cache when the entry is
-     * living only in the disk portion of the cache. No locking is required here because the
-     * caller is already preventing other threads to call this function.
+    /**
+     * @brief Decompresses the data of an entry compressed with compress(). This is called by the get() function of the Cache
+     * when the entry is living only in the compressed portion of the cache.
+     * WARNING: This function throws a std::runtime_error if the data could not be decompressed.
      **/
-    void reOpenFileMapping() const
+    void decompress()
     {
+        std::size_t compressedSize;
         {
             QWriteLocker k(&_entryLock);
-            _data.reOpenFileMapping();
+            compressedSize = _data.getCompressedSize();
+            try {
+                _data.decompress();
+            } catch (...) {
+                k.unlock();
+                ///The data of an entry stored on disk can still be read back from disk
+                notifyCompressedDataReleased(compressedSize, isStoredOnDisk() ? Natron::eStorageModeDisk : Natron::eStorageModeNone);
+                throw;
+            }
         }
         if (_cache) {
-            _cache->notifyEntryStorageChanged( Natron::eStorageModeDisk, Natron::eStorageModeRAM,getTime(), size() );
+            _cache->notifyEntryDecompressed(getHashKey(), size(), compressedSize);
+        }
+    }
+
+    /**
+     * @brief Frees the data compressed with compress(). The data of an entry stored on disk can then be read back
+     * with reloadFromDisk(), otherwise the data is lost.
+     **/
+    void releaseCompressed()
+    {
+        std::size_t compressedSize;
+        {
+            QWriteLocker k(&_entryLock);
+            if ( !_data.isCompressed() ) {
+                return;
+            }
+            compressedSize = _data.getCompressedSize();
+            _data.dropCompressed();
         }
+        notifyCompressedDataReleased(compressedSize, isStoredOnDisk() ? Natron::eStorageModeDisk : Natron::eStorageModeNone);
+    }
+
+    /**
+     * @brief Returns the size in bytes of the data compressed with compress(), 0 if the entry is not compressed.
+     **/
+    std::size_t getCompressedSize() const
+    {
+        QReadLocker k(&_entryLock);
+
+        return _data.getCompressedSize();
     }
 
     /**
@@ -694,6 +1036,15 @@ public:
      **/
     void deallocate()
     {
+        if ( _data.isCompressed() ) {
+            std::size_t compressedSize;
+            {
+                QWriteLocker k(&_entryLock);
+                compressedSize = _data.getCompressedSize();
+                _data.dropCompressed();
+            }
+            notifyCompressedDataReleased(compressedSize, Natron::eStorageModeNone);
+        }
         std::size_t sz = size();
         bool dataAllocated = _data.isAllocated();
         double time = getTime();
@@ -705,11 +1056,11 @@ public:
         if (_cache) {
             if ( isStoredOnDisk() ) {
                 if (dataAllocated) {
-                    _cache->notifyEntryStorageChanged( Natron::eStorageModeRAM, Natron::eStorageModeDisk, time, sz );
+                    _cache->notifyEntryStorageChanged( getHashKey(), Natron::eStorageModeRAM, Natron::eStorageModeDisk, time, sz );
                 }
             } else {
                 if (dataAllocated) {
-                    _cache->notifyEntryDestroyed(time, sz, Natron::eStorageModeRAM);
+                    _cache->notifyEntryDestroyed(getHashKey(), time, sz, Natron::eStorageModeRAM);
                 }
             }
         }
@@ -752,7 +1103,7 @@ public:
     }
 
     /**
-     * @brief An entry stored on disk is effectively destroyed when its backing file is removed.
+     * @brief An entry stored on disk is effectively destroyed when its chunk in the segment files is released.
      **/
     void removeAnyBackingFile() const
     {
@@ -761,20 +1112,19 @@ public:
         }
         
         bool isAlloc = _data.isAllocated();
-        bool hasRemovedFile;
+        std::size_t compressedSize = _data.getCompressedSize();
         {
             QWriteLocker k(&_entryLock);
-            hasRemovedFile = _data.removeAnyBackingFile();
+            _data.removeAnyBackingFile();
         }
         
-        if (hasRemovedFile) {
-            _cache->backingFileClosed();
-        }
-        if ( isAlloc ) {
-            _cache->notifyEntryDestroyed(getTime(), _params->getElementsCount() * sizeof(DataType),Natron::eStorageModeRAM);
+        if (compressedSize > 0) {
+            notifyCompressedDataReleased(compressedSize, Natron::eStorageModeNone);
+        } else if ( isAlloc ) {
+            _cache->notifyEntryDestroyed(getHashKey(), getTime(), _params->getElementsCount() * sizeof(DataType),Natron::eStorageModeRAM);
         } else {
             ///size() will return 0 at this point, we have to recompute it
-            _cache->notifyEntryDestroyed(getTime(), _params->getElementsCount() * sizeof(DataType),Natron::eStorageModeDisk);
+            _cache->notifyEntryDestroyed(getHashKey(), getTime(), _params->getElementsCount() * sizeof(DataType),Natron::eStorageModeDisk);
         }
     }
     
@@ -796,6 +1146,62 @@ public:
         return _params;
     }
 
+    /**
+     * @brief Adds to the time spent rendering the data of this entry. Each thread rendering a part of the entry
+     * adds its own time, so this is the CPU time it would take to render the entry again.
+     **/
+    void addRenderTime(double seconds)
+    {
+        _renderTimeUs.add( (U64)(std::max(0., seconds) * 1e6) );
+
+        if (_cache) {
+            _cache->notifyEntryRenderTimeChanged(getHashKey(), _params->getElementsCount() * sizeof(DataType), getRenderTime());
+        }
+    }
+
+    /**
+     * @brief Returns the time spent rendering the data of this entry. This does not take any lock, so that the cache
+     * can compute the eviction priority of the entry under the lock of its shard, @see getEvictionPriority().
+     **/
+    double getRenderTime() const
+    {
+        return _renderTimeUs.get() / 1e6;
+    }
+
+    /**
+     * @brief Called by the cache whenever the entry is inserted or found with the current inflation value
+     * of the shard holding the entry, @see getEvictionPriority().
+     * Must be called under the lock of the shard.
+     **/
+    void onAccessedByCache(double inflation)
+    {
+        ++_cacheAccessCount;
+        _cacheInflation = inflation;
+    }
+
+    /**
+     * @brief Returns the number of times the entry was inserted or found in the cache.
+     * Must be called under the lock of the shard holding the entry.
+     **/
+    unsigned int getCacheAccessCount() const
+    {
+        return _cacheAccessCount;
+    }
+
+    /**
+     * @brief Returns the GreedyDual-Size-Frequency priority of the entry: the inflation value of the shard at the last access
+     * plus the number of accesses times the render time per byte. Entries with the lowest priority are evicted first, and
+     * the inflation value of the shard is raised to the priority of each evicted entry so that entries that are not
+     * accessed any longer eventually get evicted even if they are expensive.
+     * Must be called under the lock of the shard holding the entry.
+     **/
+    double getEvictionPriority() const
+    {
+        double size = std::max( (double)1., (double)_params->getElementsCount() * sizeof(DataType) );
+
+        return _cacheInflation + _cacheAccessCount * getRenderTime() / size;
+    }
+
 protected:
 
 
@@ -805,27 +1211,37 @@ protected:
         size_t oldSize = size();
         _data.reallocate(elemCount);
         if (_cache) {
-            _cache->notifyEntrySizeChanged( oldSize,size());
+            _cache->notifyEntrySizeChanged( getHashKey(), oldSize,size());
         }
     }
 
+    /**
+     * @brief Makes this entry reference the data of other instead of its own, @see Buffer::share().
+     * The caller must hold the locks of both entries.
+     **/
+    bool shareBuffer(const CacheEntryHelper<DataType,KeyType,ParamsType>& other)
+    {
+        return _data.share(other._data);
+    }
+
     void swapBuffer(CacheEntryHelper<DataType,KeyType,ParamsType>& other) {
         
         size_t oldSize = size();
         _data.swap(other._data);
         if (_cache) {
-            _cache->notifyEntrySizeChanged( oldSize,size());
+            _cache->notifyEntrySizeChanged( getHashKey(), oldSize,size());
         }
     }
 
 private:
 
-    static bool fileExists(const std::string& filename)
+    void notifyCompressedDataReleased(std::size_t compressedSize,
+                                      Natron::StorageModeEnum newStorage) const
     {
-        std::ifstream f(filename.c_str());
-        bool ret = f.good();
-        f.close();
-        return ret;
+        if (_cache) {
+            _cache->notifyCompressedEntryReleased(getHashKey(), getTime(), _params->getElementsCount() * sizeof(DataType),
+                                                  compressedSize, newStorage);
+        }
     }
 
     /** @brief This function is called in allocateMeory(...) and before the object is exposed
@@ -834,56 +1250,22 @@ private:
      * it is private.
      **/
     void allocate( U64 count,
-                   Natron::StorageModeEnum storage,
-                   std::string path = std::string() )
+                   Natron::StorageModeEnum storage)
     {
-        std::string fileName;
-        
+        CacheSegmentStore* store = 0;
         if (storage == Natron::eStorageModeDisk) {
-            
-            typename AbstractCacheEntry<KeyType>::hash_type hashKey = getHashKey();
-            try {
-                fileName = generateStringFromHash(path,hashKey);
-            } catch (const std::invalid_argument & e) {
-                std::cout << "Path is empty but required for disk caching: " << e.what() << std::endl;
+            if (!_cache) {
+                std::cout << "A cache is required for disk caching" << std::endl;
                 return;
             }
-            
-            assert(!fileName.empty());
-            //Check if the filename already exists, if so append a 0-based index after the hash (separated by a '_')
-            //and try again
-            int index = 0;
-            if (fileExists(fileName)) {
-                fileName.insert(fileName.size() - 4,"_0");
-            }
-            while (fileExists(fileName)) {
-                ++index;
-                std::stringstream ss;
-                ss << index;
-                fileName.replace(fileName.size() - 1,std::string::npos,ss.str());
-            }
-#ifdef DEBUG
-            if (!CacheAPI::checkFileNameMatchesHash(fileName, hashKey)) {
-                qDebug() << "WARNING: Cache entry filename is not the same as the serialized hash key";
-            }
-#endif
+            store = _cache->getSegmentStore();
         }
-        _data.allocate(count, storage, fileName);
-    }
-
-    /** @brief This function is called in allocateMeory() and before the object is exposed
-     * to other threads. Hence this function doesn't need locking mechanism at all.
-     * We must ensure that this function is called ONLY by allocateMemory(), that's why
-     * it is private.
-     **/
-    void restoreBufferFromFile(const std::string & path)
-    {
-        
-        if (!fileExists(path)) {
-            throw std::runtime_error("Cache restore, no such file: " + path);
+        ///The entries that are not in the cache are the temporary images of the renders: they live in the arena of the render
+        boost::shared_ptr<RenderArena> arena;
+        if (!_cache) {
+            arena = RenderArena::getCurrent();
         }
-        _data.restoreBufferFromFile(path);
-       
+        _data.allocate(count, storage, store, arena);
     }
 
 protected:
@@ -896,6 +1278,11 @@ protected:
     mutable QReadWriteLock _entryLock;
     Natron::StorageModeEnum _requestedStorage;
     bool _removeBackingFileBeforeDestruction;
+    CacheStatsCounter _renderTimeUs; //< in microseconds, lock-free
+
+    ///Protected by the lock of the cache shard holding the entry
+    unsigned int _cacheAccessCount;
+    double _cacheInflation;
 };
 }
 
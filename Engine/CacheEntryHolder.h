@@ -26,6 +26,12 @@
 // ***** END PYTHON BLOCK *****
 
 #include <string>
+
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/shared_ptr.hpp>
+#endif
+
+#include "Engine/CacheStats.h"
 #include "Engine/EngineFwd.h"
 
 /**
@@ -37,6 +43,7 @@ class CacheEntryHolder {
 public:
 
     CacheEntryHolder()
+    : _cacheStats(new Natron::CacheStats)
     {
     
     }
@@ -53,6 +60,18 @@ public:
      **/
     virtual std::string getCacheID() const = 0;
     
+    /**
+     * @brief The telemetry of the cache entries owned by this holder. The keys of the entries reference it
+     * so that the caches can record it even after the holder is destroyed.
+     **/
+    const boost::shared_ptr<Natron::CacheStats>& getCacheStats() const
+    {
+        return _cacheStats;
+    }
+    
+private:
+    
+    boost::shared_ptr<Natron::CacheStats> _cacheStats;
 };
 
 
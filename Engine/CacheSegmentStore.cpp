@@ -0,0 +1,682 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "CacheSegmentStore.h"
+
+#ifdef __NATRON_WIN32__
+# include <windows.h>
+#else // unix
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>        // pread, pwrite, ftruncate
+#include <cerrno>
+#endif
+#include <algorithm>
+#include <map>
+#include <set>
+#include <sstream>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QStringList>
+#include <QtCore/QMutex>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QDebug>
+
+#include "Global/Macros.h"
+
+#if defined(__NATRON_UNIX__)
+typedef int SegmentFileHandle;
+#define NATRON_INVALID_SEGMENT_HANDLE -1
+#elif defined(__NATRON_WIN32__)
+typedef HANDLE SegmentFileHandle;
+#define NATRON_INVALID_SEGMENT_HANDLE INVALID_HANDLE_VALUE
+#else
+#error Only Unix or Windows systems can use cache segment files.
+#endif
+
+using namespace Natron;
+
+namespace {
+
+struct SegmentFile
+{
+    SegmentFileHandle handle;
+    std::map<U64,U64> freeExtents; //< offset -> size of all free extents of the segment
+    U64 freeSize; //< sum of the sizes of freeExtents
+
+    SegmentFile()
+    : handle(NATRON_INVALID_SEGMENT_HANDLE)
+    , freeExtents()
+    , freeSize(0)
+    {
+    }
+};
+
+typedef std::map<int,SegmentFile*> SegmentsMap;
+
+///Free extents of all segments sorted by size, then segment, then offset so that lower_bound() returns the best fit
+typedef std::set<std::pair<U64,std::pair<int,U64> > > ExtentsBySize;
+
+} // anon namespace
+
+namespace Natron {
+
+struct CacheSegmentStorePrivate
+{
+    //Protected by allocatorMutex and filesLock: both must be held to modify them, any of them to read them
+    std::string directoryPath;
+    unsigned int generation;
+    SegmentsMap segments;
+
+    //Protected by allocatorMutex
+    ExtentsBySize freeBySize;
+    U64 allocatedSize;
+
+    const U64 segmentSize;
+
+    mutable QMutex allocatorMutex;
+
+    //Held for reading during reads and writes, for writing when segment files are opened or closed
+    mutable QReadWriteLock filesLock;
+
+    CacheSegmentStorePrivate(const std::string & directoryPath,
+                             U64 segmentSize)
+    : directoryPath(directoryPath)
+    , generation(0)
+    , segments()
+    , freeBySize()
+    , allocatedSize(0)
+    , segmentSize(segmentSize)
+    , allocatorMutex()
+    , filesLock()
+    {
+        if ( !this->directoryPath.empty() && (this->directoryPath[this->directoryPath.size() - 1] != '/') ) {
+            this->directoryPath.push_back('/');
+        }
+    }
+
+    std::string getSegmentFilePath(int index) const
+    {
+        return directoryPath + CacheSegmentStore::getSegmentFileName(index);
+    }
+
+    /**
+     * @brief Opens the file of the segment at the given index. If create is true the file must not exist yet
+     * and is created with the size of a segment, otherwise the file must exist.
+     **/
+    bool openSegmentFile(int index, bool create, SegmentFileHandle* handle) const;
+
+    void closeSegmentFile(SegmentFileHandle handle) const;
+
+    bool resizeSegmentFile(SegmentFileHandle handle, U64 size) const;
+
+    /**
+     * @brief Creates a new segment with an index not used by any file in the directory. allocatorMutex must be held.
+     **/
+    SegmentFile* createSegment(int* index);
+
+    /**
+     * @brief Opens the existing segment with the given index. allocatorMutex must be held.
+     **/
+    SegmentFile* openExistingSegment(int index);
+
+    void insertFreeExtent(int index, SegmentFile* segment, U64 offset, U64 size);
+
+    void removeFreeExtent(int index, SegmentFile* segment, std::map<U64,U64>::iterator it);
+
+    void closeAllSegments();
+};
+
+} // namespace Natron
+
+bool
+CacheSegmentStorePrivate::openSegmentFile(int index,
+                                          bool create,
+                                          SegmentFileHandle* handle) const
+{
+    std::string path = getSegmentFilePath(index);
+
+#if defined(__NATRON_UNIX__)
+    int flags = O_RDWR;
+    if (create) {
+        ///O_EXCL: never share a segment with another process using the same cache directory
+        flags |= O_CREAT | O_EXCL;
+    }
+    *handle = ::open(path.c_str(), flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+#elif defined(__NATRON_WIN32__)
+    DWORD creation = create ? CREATE_NEW : OPEN_EXISTING;
+#ifdef UNICODE
+    std::wstring wpath = Natron::s2ws(path);
+    *handle = ::CreateFile(wpath.c_str(), GENERIC_READ | GENERIC_WRITE,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE, 0, creation, FILE_ATTRIBUTE_NORMAL, 0);
+#else
+    *handle = ::CreateFile(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE, 0, creation, FILE_ATTRIBUTE_NORMAL, 0);
+#endif
+#endif
+
+    if (*handle == NATRON_INVALID_SEGMENT_HANDLE) {
+        return false;
+    }
+
+    if (create) {
+        ///Size the file once: the file system only allocates the blocks that are actually written
+        if ( !resizeSegmentFile(*handle, segmentSize) ) {
+            closeSegmentFile(*handle);
+            *handle = NATRON_INVALID_SEGMENT_HANDLE;
+            std::remove( path.c_str() );
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void
+CacheSegmentStorePrivate::closeSegmentFile(SegmentFileHandle handle) const
+{
+#if defined(__NATRON_UNIX__)
+    ::close(handle);
+#elif defined(__NATRON_WIN32__)
+    ::CloseHandle(handle);
+#endif
+}
+
+bool
+CacheSegmentStorePrivate::resizeSegmentFile(SegmentFileHandle handle,
+                                            U64 size) const
+{
+#if defined(__NATRON_UNIX__)
+    return ::ftruncate(handle, (off_t)size) == 0;
+#elif defined(__NATRON_WIN32__)
+    LARGE_INTEGER li;
+    li.QuadPart = (LONGLONG)size;
+    if ( !::SetFilePointerEx(handle, li, 0, FILE_BEGIN) ) {
+        return false;
+    }
+
+    return ::SetEndOfFile(handle) != 0;
+#endif
+}
+
+SegmentFile*
+CacheSegmentStorePrivate::createSegment(int* index)
+{
+    int i = 0;
+    SegmentFileHandle handle = NATRON_INVALID_SEGMENT_HANDLE;
+
+    ///Files of other processes or of previous sessions may exist in the directory, skip them.
+    ///Give up after a few failures, the directory is probably not writable
+    int nFailures = 0;
+    while (nFailures < 4) {
+        if ( ( segments.find(i) != segments.end() ) ||
+             QFile::exists( QString::fromUtf8( getSegmentFilePath(i).c_str() ) ) ) {
+            ++i;
+            continue;
+        }
+        if ( openSegmentFile(i, true, &handle) ) {
+            break;
+        }
+        ++nFailures;
+        ++i;
+    }
+    if (handle == NATRON_INVALID_SEGMENT_HANDLE) {
+        return 0;
+    }
+
+    SegmentFile* segment = new SegmentFile;
+    segment->handle = handle;
+    {
+        QWriteLocker k(&filesLock);
+        segments.insert( std::make_pair(i, segment) );
+    }
+    insertFreeExtent(i, segment, 0, segmentSize);
+    *index = i;
+
+    return segment;
+}
+
+SegmentFile*
+CacheSegmentStorePrivate::openExistingSegment(int index)
+{
+    SegmentsMap::iterator found = segments.find(index);
+
+    if ( found != segments.end() ) {
+        return found->second;
+    }
+
+    SegmentFileHandle handle;
+    if ( !openSegmentFile(index, false, &handle) ) {
+        return 0;
+    }
+
+    SegmentFile* segment = new SegmentFile;
+    segment->handle = handle;
+    {
+        QWriteLocker k(&filesLock);
+        segments.insert( std::make_pair(index, segment) );
+    }
+    insertFreeExtent(index, segment, 0, segmentSize);
+
+    return segment;
+}
+
+void
+CacheSegmentStorePrivate::insertFreeExtent(int index,
+                                           SegmentFile* segment,
+                                           U64 offset,
+                                           U64 size)
+{
+    ///Merge with the following extent
+    std::map<U64,U64>::iterator next = segment->freeExtents.find(offset + size);
+    if ( next != segment->freeExtents.end() ) {
+        size += next->second;
+        removeFreeExtent(index, segment, next);
+    }
+
+    ///Merge with the preceding extent
+    std::map<U64,U64>::iterator prev = segment->freeExtents.lower_bound(offset);
+    if ( prev != segment->freeExtents.begin() ) {
+        --prev;
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            size += prev->second;
+            removeFreeExtent(index, segment, prev);
+        }
+    }
+
+    segment->freeExtents.insert( std::make_pair(offset, size) );
+    segment->freeSize += size;
+    freeBySize.insert( std::make_pair( size, std::make_pair(index, offset) ) );
+}
+
+void
+CacheSegmentStorePrivate::removeFreeExtent(int index,
+                                           SegmentFile* segment,
+                                           std::map<U64,U64>::iterator it)
+{
+    freeBySize.erase( std::make_pair( it->second, std::make_pair(index, it->first) ) );
+    segment->freeSize -= it->second;
+    segment->freeExtents.erase(it);
+}
+
+void
+CacheSegmentStorePrivate::closeAllSegments()
+{
+    for (SegmentsMap::iterator it = segments.begin(); it != segments.end(); ++it) {
+        closeSegmentFile(it->second->handle);
+        delete it->second;
+    }
+    segments.clear();
+    freeBySize.clear();
+    allocatedSize = 0;
+}
+
+CacheSegmentStore::CacheSegmentStore(const std::string & directoryPath,
+                                     U64 segmentSize)
+    : _imp( new CacheSegmentStorePrivate(directoryPath, segmentSize) )
+{
+}
+
+CacheSegmentStore::~CacheSegmentStore()
+{
+    {
+        QMutexLocker k(&_imp->allocatorMutex);
+        QWriteLocker k2(&_imp->filesLock);
+        _imp->closeAllSegments();
+    }
+    delete _imp;
+}
+
+std::string
+CacheSegmentStore::getDirectoryPath() const
+{
+    QMutexLocker k(&_imp->allocatorMutex);
+
+    return _imp->directoryPath;
+}
+
+void
+CacheSegmentStore::reset(const std::string & directoryPath)
+{
+    QMutexLocker k(&_imp->allocatorMutex);
+    QWriteLocker k2(&_imp->filesLock);
+
+    _imp->closeAllSegments();
+    ++_imp->generation;
+    _imp->directoryPath = directoryPath;
+    if ( !_imp->directoryPath.empty() && (_imp->directoryPath[_imp->directoryPath.size() - 1] != '/') ) {
+        _imp->directoryPath.push_back('/');
+    }
+}
+
+bool
+CacheSegmentStore::allocate(U64 size,
+                            CacheSegmentLocation* location)
+{
+    U64 chunkSize = getChunkSize(size);
+
+    if (chunkSize > _imp->segmentSize) {
+        return false;
+    }
+
+    QMutexLocker k(&_imp->allocatorMutex);
+
+    if ( _imp->directoryPath.empty() ) {
+        return false;
+    }
+
+    ///Best fit: the smallest free extent that can hold the chunk
+    ExtentsBySize::iterator found = _imp->freeBySize.lower_bound( std::make_pair( chunkSize, std::make_pair(-1, (U64)0) ) );
+    int index;
+    SegmentFile* segment;
+    U64 offset;
+    if ( found != _imp->freeBySize.end() ) {
+        index = found->second.first;
+        offset = found->second.second;
+        SegmentsMap::iterator foundSegment = _imp->segments.find(index);
+        assert( foundSegment != _imp->segments.end() );
+        segment = foundSegment->second;
+    } else {
+        segment = _imp->createSegment(&index);
+        if (!segment) {
+            qDebug() << "Failed to create a cache segment file in" << _imp->directoryPath.c_str();
+
+            return false;
+        }
+        offset = 0;
+    }
+
+    std::map<U64,U64>::iterator extent = segment->freeExtents.find(offset);
+    assert( extent != segment->freeExtents.end() && extent->second >= chunkSize );
+    U64 extentSize = extent->second;
+    _imp->removeFreeExtent(index, segment, extent);
+    if (extentSize > chunkSize) {
+        _imp->insertFreeExtent(index, segment, offset + chunkSize, extentSize - chunkSize);
+    }
+
+    _imp->allocatedSize += chunkSize;
+
+    location->segment = index;
+    location->offset = offset;
+    location->capacity = chunkSize;
+    location->generation = _imp->generation;
+
+    return true;
+} // allocate
+
+void
+CacheSegmentStore::release(const CacheSegmentLocation & location)
+{
+    if ( !location.isValid() ) {
+        return;
+    }
+
+    QMutexLocker k(&_imp->allocatorMutex);
+
+    if (location.generation != _imp->generation) {
+        ///The chunk belongs to segments that were closed by reset()
+        return;
+    }
+    SegmentsMap::iterator found = _imp->segments.find(location.segment);
+    if ( found == _imp->segments.end() ) {
+        return;
+    }
+    SegmentFile* segment = found->second;
+
+    _imp->insertFreeExtent(location.segment, segment, location.offset, location.capacity);
+    _imp->allocatedSize -= std::min(_imp->allocatedSize, location.capacity);
+
+    if (segment->freeSize == _imp->segmentSize) {
+        ///No chunk is used in the segment any longer: give the disk space back to the file system.
+        ///Nobody may read or write in the segment at this point since it has no chunk allocated.
+        if ( !_imp->resizeSegmentFile(segment->handle, 0) || !_imp->resizeSegmentFile(segment->handle, _imp->segmentSize) ) {
+            qDebug() << "Failed to shrink cache segment" << location.segment;
+        }
+    }
+}
+
+bool
+CacheSegmentStore::reserve(CacheSegmentLocation* location)
+{
+    if ( !location->isValid() || (location->offset + location->capacity > _imp->segmentSize) ) {
+        return false;
+    }
+
+    QMutexLocker k(&_imp->allocatorMutex);
+
+    SegmentFile* segment = _imp->openExistingSegment(location->segment);
+    if (!segment) {
+        return false;
+    }
+
+    ///Find the free extent containing the chunk
+    std::map<U64,U64>::iterator extent = segment->freeExtents.upper_bound(location->offset);
+    if ( extent == segment->freeExtents.begin() ) {
+        return false;
+    }
+    --extent;
+    U64 extentOffset = extent->first;
+    U64 extentSize = extent->second;
+    if (extentOffset + extentSize < location->offset + location->capacity) {
+        ///Overlaps a chunk already in use
+        return false;
+    }
+
+    _imp->removeFreeExtent(location->segment, segment, extent);
+    if (location->offset > extentOffset) {
+        _imp->insertFreeExtent(location->segment, segment, extentOffset, location->offset - extentOffset);
+    }
+    U64 chunkEnd = location->offset + location->capacity;
+    if (extentOffset + extentSize > chunkEnd) {
+        _imp->insertFreeExtent(location->segment, segment, chunkEnd, extentOffset + extentSize - chunkEnd);
+    }
+
+    _imp->allocatedSize += location->capacity;
+    location->generation = _imp->generation;
+
+    return true;
+} // reserve
+
+bool
+CacheSegmentStore::write(const CacheSegmentLocation & location,
+                         const void* data,
+                         U64 size)
+{
+    assert(size <= location.capacity);
+
+    QReadLocker k(&_imp->filesLock);
+
+    if (location.generation != _imp->generation) {
+        return false;
+    }
+    SegmentsMap::const_iterator found = _imp->segments.find(location.segment);
+    if ( found == _imp->segments.end() ) {
+        return false;
+    }
+    SegmentFileHandle handle = found->second->handle;
+
+    const char* src = (const char*)data;
+    U64 offset = location.offset;
+    while (size > 0) {
+#if defined(__NATRON_UNIX__)
+        ssize_t written = ::pwrite(handle, src, (size_t)size, (off_t)offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+        if (written == 0) {
+            return false;
+        }
+#elif defined(__NATRON_WIN32__)
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof(OVERLAPPED));
+        ov.Offset = (DWORD)(offset & 0xFFFFFFFF);
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD toWrite = (DWORD)std::min( size, (U64)0x40000000 );
+        DWORD written = 0;
+        if ( !::WriteFile(handle, src, toWrite, &written, &ov) || (written == 0) ) {
+            return false;
+        }
+#endif
+        src += written;
+        offset += written;
+        size -= written;
+    }
+
+    return true;
+} // write
+
+bool
+CacheSegmentStore::read(const CacheSegmentLocation & location,
+                        void* data,
+                        U64 size) const
+{
+    assert(size <= location.capacity);
+
+    QReadLocker k(&_imp->filesLock);
+
+    if (location.generation != _imp->generation) {
+        return false;
+    }
+    SegmentsMap::const_iterator found = _imp->segments.find(location.segment);
+    if ( found == _imp->segments.end() ) {
+        return false;
+    }
+    SegmentFileHandle handle = found->second->handle;
+
+    char* dst = (char*)data;
+    U64 offset = location.offset;
+    while (size > 0) {
+#if defined(__NATRON_UNIX__)
+        ssize_t nRead = ::pread(handle, dst, (size_t)size, (off_t)offset);
+        if (nRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+        if (nRead == 0) {
+            ///Unexpected end of file
+            return false;
+        }
+#elif defined(__NATRON_WIN32__)
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof(OVERLAPPED));
+        ov.Offset = (DWORD)(offset & 0xFFFFFFFF);
+        ov.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD toRead = (DWORD)std::min( size, (U64)0x40000000 );
+        DWORD nRead = 0;
+        if ( !::ReadFile(handle, dst, toRead, &nRead, &ov) || (nRead == 0) ) {
+            return false;
+        }
+#endif
+        dst += nRead;
+        offset += nRead;
+        size -= nRead;
+    }
+
+    return true;
+} // read
+
+void
+CacheSegmentStore::removeUnusedSegmentFiles()
+{
+    QMutexLocker k(&_imp->allocatorMutex);
+
+    if ( _imp->directoryPath.empty() ) {
+        return;
+    }
+
+    QDir directory( QString::fromUtf8( _imp->directoryPath.c_str() ) );
+    QStringList filters;
+    filters << QString("segment*." NATRON_CACHE_FILE_EXT);
+    QStringList files = directory.entryList(filters, QDir::Files);
+    for (int i = 0; i < files.size(); ++i) {
+        QString indexStr = files[i].mid(7, files[i].size() - 8 - (int)std::strlen(NATRON_CACHE_FILE_EXT) );
+        bool ok;
+        int index = indexStr.toInt(&ok);
+        if ( !ok || ( _imp->segments.find(index) != _imp->segments.end() ) ) {
+            continue;
+        }
+        directory.remove(files[i]);
+    }
+}
+
+int
+CacheSegmentStore::getSegmentsCount() const
+{
+    QMutexLocker k(&_imp->allocatorMutex);
+
+    return (int)_imp->segments.size();
+}
+
+U64
+CacheSegmentStore::getAllocatedSize() const
+{
+    QMutexLocker k(&_imp->allocatorMutex);
+
+    return _imp->allocatedSize;
+}
+
+U64
+CacheSegmentStore::getChunkSize(U64 size)
+{
+    const U64 blockSize = NATRON_CACHE_SEGMENT_BLOCK_SIZE;
+    U64 nBlocks = std::max( (U64)1, (size + blockSize - 1) / blockSize );
+
+    if (nBlocks <= NATRON_CACHE_SEGMENT_SIZE_CLASSES_PER_POW2) {
+        return nBlocks * blockSize;
+    }
+
+    ///Round up to the next size class: the classes between 2^n and 2^(n+1) blocks are spaced by 2^n / N blocks
+    U64 pow2 = 1;
+    while (pow2 * 2 <= nBlocks) {
+        pow2 *= 2;
+    }
+    U64 step = pow2 / NATRON_CACHE_SEGMENT_SIZE_CLASSES_PER_POW2;
+    nBlocks = ( (nBlocks + step - 1) / step ) * step;
+
+    return nBlocks * blockSize;
+}
+
+std::string
+CacheSegmentStore::getSegmentFileName(int index)
+{
+    std::stringstream ss;
+
+    ss << "segment" << index << "." NATRON_CACHE_FILE_EXT;
+
+    return ss.str();
+}
@@ -0,0 +1,162 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NATRON_ENGINE_CACHESEGMENTSTORE_H
+#define NATRON_ENGINE_CACHESEGMENTSTORE_H
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <string>
+
+#include "Global/GlobalDefines.h"
+#include "Engine/EngineFwd.h"
+
+///The size of a segment file of the disk portion of a cache
+#define NATRON_CACHE_SEGMENT_SIZE (1024ULL * 1024ULL * 1024ULL)
+
+///Chunks allocated in the segments are multiples of this size
+#define NATRON_CACHE_SEGMENT_BLOCK_SIZE (64ULL * 1024ULL)
+
+///Number of size classes between 2 consecutive powers of 2: a chunk wastes at most 1/N of its size
+#define NATRON_CACHE_SEGMENT_SIZE_CLASSES_PER_POW2 8
+
+namespace Natron {
+
+/**
+ * @brief The location of a chunk of data in the segment files of a CacheSegmentStore.
+ **/
+struct CacheSegmentLocation
+{
+    int segment; //< index of the segment file, -1 if the location is invalid
+    U64 offset; //< offset in bytes of the chunk in the segment file
+    U64 capacity; //< size in bytes of the chunk, it may be larger than the data it holds
+    unsigned int generation; //< the generation of the store this chunk was allocated from, @see CacheSegmentStore::reset
+
+    CacheSegmentLocation()
+    : segment(-1)
+    , offset(0)
+    , capacity(0)
+    , generation(0)
+    {
+    }
+
+    bool isValid() const
+    {
+        return segment >= 0;
+    }
+};
+
+struct CacheSegmentStorePrivate;
+
+/**
+ * @brief Stores the disk portion of a cache in a few large segment files rather than one file per entry.
+ * Segment files are NATRON_CACHE_SEGMENT_SIZE bytes large and are created on demand. Each entry gets a chunk whose size
+ * is rounded up to a size class, the chunk is taken from the smallest free extent that can hold it and freed extents
+ * are merged with their free neighbours. The index of the chunks lives in memory and the data is transfered
+ * with positioned reads and writes, hence the number of file descriptors and mappings opened does not
+ * depend on the number of entries in the cache.
+ *
+ * This class is MT-safe.
+ **/
+class CacheSegmentStore
+{
+public:
+
+    CacheSegmentStore(const std::string & directoryPath,
+                      U64 segmentSize = NATRON_CACHE_SEGMENT_SIZE);
+
+    ~CacheSegmentStore();
+
+    /**
+     * @brief Returns the directory containing the segment files.
+     **/
+    std::string getDirectoryPath() const;
+
+    /**
+     * @brief Closes all segment files and forgets all chunks. Locations allocated before this call are no longer valid:
+     * reading or writing them fails and releasing them is a no-op.
+     * @param directoryPath The directory where to store the segment files from now on.
+     **/
+    void reset(const std::string & directoryPath);
+
+    /**
+     * @brief Allocates a chunk of at least size bytes. Returns false if no chunk could be allocated, e.g: because the size
+     * is larger than a segment or because a segment file could not be created.
+     **/
+    bool allocate(U64 size, CacheSegmentLocation* location) WARN_UNUSED_RETURN;
+
+    /**
+     * @brief Marks the chunk as free so that it may be re-used by another allocation.
+     **/
+    void release(const CacheSegmentLocation & location);
+
+    /**
+     * @brief Marks a chunk that was allocated in a previous session as used. The segment file must already exist.
+     * On success, the generation of the location is updated to the current generation of the store.
+     * Returns false if the chunk is not free or its segment file does not exist.
+     **/
+    bool reserve(CacheSegmentLocation* location) WARN_UNUSED_RETURN;
+
+    /**
+     * @brief Writes size bytes of data at the given location. size must be lower or equal to the capacity of the location.
+     **/
+    bool write(const CacheSegmentLocation & location, const void* data, U64 size) WARN_UNUSED_RETURN;
+
+    /**
+     * @brief Reads size bytes at the given location into data. size must be lower or equal to the capacity of the location.
+     **/
+    bool read(const CacheSegmentLocation & location, void* data, U64 size) const WARN_UNUSED_RETURN;
+
+    /**
+     * @brief Removes the segment files of the directory that are not opened by this store, e.g: segments of a previous
+     * session that no restored entry references.
+     **/
+    void removeUnusedSegmentFiles();
+
+    /**
+     * @brief Returns the number of segment files currently opened.
+     **/
+    int getSegmentsCount() const;
+
+    /**
+     * @brief Returns the sum of the capacities of all chunks in use.
+     **/
+    U64 getAllocatedSize() const;
+
+    /**
+     * @brief Returns the capacity of the chunk that would be allocated for size bytes.
+     **/
+    static U64 getChunkSize(U64 size);
+
+    /**
+     * @brief Returns the file name of the segment at the given index.
+     **/
+    static std::string getSegmentFileName(int index);
+
+private:
+
+    CacheSegmentStorePrivate* _imp;
+};
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_CACHESEGMENTSTORE_H
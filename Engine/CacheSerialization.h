@@ -66,24 +66,26 @@ template<typename EntryType>
 void Cache<EntryType>::save(CacheTOC* tableOfContents)
 {
     clearInMemoryPortion(false);
-    QMutexLocker l(&_lock);     // must be locked
-
-    for (CacheIterator it = _diskCache.begin(); it != _diskCache.end(); ++it) {
-        std::list<EntryTypePtr> & listOfValues  = getValueFromIterator(it);
-        for (typename std::list<EntryTypePtr>::const_iterator it2 = listOfValues.begin(); it2 != listOfValues.end(); ++it2) {
-            if ( (*it2)->isStoredOnDisk() ) {
-                SerializedEntry serialization;
-                serialization.hash = (*it2)->getHashKey();
-                serialization.params = (*it2)->getParams();
-                serialization.key = (*it2)->getKey();
-                serialization.size = (*it2)->dataSize();
-                serialization.filePath = (*it2)->getFilePath();
-                tableOfContents->push_back(serialization);
-#ifdef DEBUG
-                if (!CacheAPI::checkFileNameMatchesHash(serialization.filePath, serialization.hash)) {
-                    qDebug() << "WARNING: Cache entry filename is not the same as the serialized hash key";
+    for (unsigned int i = 0; i < _nShards; ++i) {
+        CacheShard & shard = _shards[i];
+        QMutexLocker l(&shard.lock);     // must be locked
+
+        for (CacheIterator it = shard.diskCache.begin(); it != shard.diskCache.end(); ++it) {
+            std::list<EntryTypePtr> & listOfValues  = getValueFromIterator(it);
+            for (typename std::list<EntryTypePtr>::const_iterator it2 = listOfValues.begin(); it2 != listOfValues.end(); ++it2) {
+                if ( (*it2)->isStoredOnDisk() ) {
+                    SerializedEntry serialization;
+                    serialization.hash = (*it2)->getHashKey();
+                    serialization.params = (*it2)->getParams();
+                    serialization.key = (*it2)->getKey();
+                    serialization.size = (*it2)->dataSize();
+                    serialization.location = (*it2)->getDiskLocation();
+                    serialization.renderTime = (*it2)->getRenderTime();
+                    if ( !serialization.location.isValid() ) {
+                        continue;
+                    }
+                    tableOfContents->push_back(serialization);
                 }
-#endif
             }
         }
     }
@@ -99,6 +101,9 @@ void Cache<EntryType>::restore(const CacheTOC & tableOfContents)
     ///so that the memory freeing (which might be expensive for large images) doesn't happen while under the lock
     std::list<EntryTypePtr> entriesToBeDeleted;
 
+    std::string cachePath = getCachePath().toStdString();
+    cachePath += '/';
+
     for (typename CacheTOC::const_iterator it =
          tableOfContents.begin(); it != tableOfContents.end(); ++it) {
         if ( it->hash != it->key.getHash() ) {
@@ -114,31 +119,34 @@ void Cache<EntryType>::restore(const CacheTOC & tableOfContents)
             qDebug() << "WARNING: serialized hash key different than the restored one";
         }
 
-#ifdef DEBUG
-        if (!checkFileNameMatchesHash(it->filePath, it->hash)) {
-            qDebug() << "WARNING: Cache entry filename is not the same as the serialized hash key";
-        }
-#endif
-
         EntryType* value = NULL;
 
         Natron::StorageModeEnum storage = Natron::eStorageModeDisk;
 
         try {
-            value = new EntryType(it->key,it->params,this,storage,it->filePath);
+            value = new EntryType(it->key,it->params,this,storage,cachePath);
 
             ///This will not put the entry back into RAM, instead we just insert back the entry into the disk cache
-            value->restoreMetaDataFromFile(it->size);
+            value->restoreMetaDataFromDisk(it->location, it->size);
+            if (it->renderTime > 0.) {
+                value->addRenderTime(it->renderTime);
+            }
         } catch (const std::exception & e) {
             qDebug() << e.what();
+            delete value;
             continue;
         }
 
         {
-            QMutexLocker locker(&_lock);
-            sealEntry(EntryTypePtr(value), false);
+            EntryTypePtr entry(value);
+            CacheShard & shard = getShard( entry->getHashKey() );
+            QMutexLocker locker(&shard.lock);
+            sealEntry(shard, entry, false);
         }
     }
+
+    ///Segment files that no restored entry references only waste disk space
+    getSegmentStore()->removeUnusedSegmentFiles();
 }
 
 template<typename EntryType>
@@ -148,14 +156,16 @@ struct Cache<EntryType>::SerializedEntry
     typename EntryType::key_type key;
     ParamsTypePtr params;
     std::size_t size; //< the data size in bytes
-    std::string filePath; //< we need to serialize it as several entries can have the same hash, hence we index them
+    CacheSegmentLocation location; //< where the data lives in the segment files
+    double renderTime; //< the time it took to render the entry, used by the cost-aware eviction policy
 
     SerializedEntry()
     : hash(0)
     , key()
     , params()
     , size(0)
-    , filePath()
+    , location()
+    , renderTime(0.)
     {
 
     }
@@ -168,7 +178,10 @@ struct Cache<EntryType>::SerializedEntry
         ar & boost::serialization::make_nvp("Key",key);
         ar & boost::serialization::make_nvp("Params",params);
         ar & boost::serialization::make_nvp("Size",size);
-        ar & boost::serialization::make_nvp("Filename",filePath);
+        ar & boost::serialization::make_nvp("Segment",location.segment);
+        ar & boost::serialization::make_nvp("Offset",location.offset);
+        ar & boost::serialization::make_nvp("Capacity",location.capacity);
+        ar & boost::serialization::make_nvp("RenderTime",renderTime);
     }
 
     template<class Archive>
@@ -179,7 +192,10 @@ struct Cache<EntryType>::SerializedEntry
         ar & boost::serialization::make_nvp("Key",key);
         ar & boost::serialization::make_nvp("Params",params);
         ar & boost::serialization::make_nvp("Size",size);
-        ar & boost::serialization::make_nvp("Filename",filePath);
+        ar & boost::serialization::make_nvp("Segment",location.segment);
+        ar & boost::serialization::make_nvp("Offset",location.offset);
+        ar & boost::serialization::make_nvp("Capacity",location.capacity);
+        ar & boost::serialization::make_nvp("RenderTime",renderTime);
     }
 
     BOOST_SERIALIZATION_SPLIT_MEMBER()
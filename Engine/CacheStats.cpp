@@ -0,0 +1,137 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "CacheStats.h"
+
+#include <QtCore/QMutex>
+
+#include "Engine/Timer.h" // gettimeofday
+
+using namespace Natron;
+
+void
+CacheStatsSnapshot::operator+=(const CacheStatsSnapshot & other)
+{
+    hits += other.hits;
+    misses += other.misses;
+    downscaledHits += other.downscaledHits;
+    bytesAllocated += other.bytesAllocated;
+    evictions += other.evictions;
+    demotionsToDisk += other.demotionsToDisk;
+    getLockWaits += other.getLockWaits;
+    getLockWaitTimeUs += other.getLockWaitTimeUs;
+}
+
+void
+CacheStatsSnapshot::getFields(std::vector<std::pair<std::string, U64> >* fields) const
+{
+    fields->clear();
+    fields->push_back( std::make_pair(std::string("hits"), hits) );
+    fields->push_back( std::make_pair(std::string("misses"), misses) );
+    fields->push_back( std::make_pair(std::string("downscaledHits"), downscaledHits) );
+    fields->push_back( std::make_pair(std::string("bytesAllocated"), bytesAllocated) );
+    fields->push_back( std::make_pair(std::string("evictions"), evictions) );
+    fields->push_back( std::make_pair(std::string("demotionsToDisk"), demotionsToDisk) );
+    fields->push_back( std::make_pair(std::string("getLockWaits"), getLockWaits) );
+    fields->push_back( std::make_pair(std::string("getLockWaitTimeUs"), getLockWaitTimeUs) );
+}
+
+void
+CacheStatsSnapshot::writeJSON(std::ostream & os,
+                              const std::string & indent) const
+{
+    std::vector<std::pair<std::string, U64> > fields;
+
+    getFields(&fields);
+    os << "{\n";
+    for (std::size_t i = 0; i < fields.size(); ++i) {
+        os << indent << "    \"" << fields[i].first << "\": " << fields[i].second;
+        if (i + 1 < fields.size()) {
+            os << ',';
+        }
+        os << '\n';
+    }
+    os << indent << '}';
+}
+
+CacheStatsSnapshot
+CacheStats::getSnapshot() const
+{
+    CacheStatsSnapshot ret;
+
+    ret.hits = _hits.get();
+    ret.misses = _misses.get();
+    ret.downscaledHits = _downscaledHits.get();
+    ret.bytesAllocated = _bytesAllocated.get();
+    ret.evictions = _evictions.get();
+    ret.demotionsToDisk = _demotionsToDisk.get();
+    ret.getLockWaits = _getLockWaits.get();
+    ret.getLockWaitTimeUs = _getLockWaitTimeUs.get();
+
+    return ret;
+}
+
+void
+CacheStats::reset()
+{
+    _hits.reset();
+    _misses.reset();
+    _downscaledHits.reset();
+    _bytesAllocated.reset();
+    _evictions.reset();
+    _demotionsToDisk.reset();
+    _getLockWaits.reset();
+    _getLockWaitTimeUs.reset();
+}
+
+CacheStatsMutexLocker::CacheStatsMutexLocker(QMutex* mutex,
+                                             CacheStats* cacheStats,
+                                             CacheStats* holderStats)
+    : _mutex(mutex)
+{
+    ///Only time the lock when it is contended so that the uncontended path stays as cheap as a QMutexLocker
+    if ( _mutex->tryLock() ) {
+        return;
+    }
+    timeval start, end;
+    gettimeofday(&start, 0);
+    _mutex->lock();
+    gettimeofday(&end, 0);
+
+    qint64 waitUs = (qint64)(end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+    if (waitUs < 0) {
+        waitUs = 0;
+    }
+    if (cacheStats) {
+        cacheStats->addGetLockWait(waitUs);
+    }
+    if (holderStats) {
+        holderStats->addGetLockWait(waitUs);
+    }
+}
+
+CacheStatsMutexLocker::~CacheStatsMutexLocker()
+{
+    _mutex->unlock();
+}
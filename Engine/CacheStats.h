@@ -0,0 +1,229 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NATRON_ENGINE_CACHESTATS_H
+#define NATRON_ENGINE_CACHESTATS_H
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "Global/GlobalDefines.h"
+#include "Global/Macros.h"
+
+class QMutex;
+
+namespace Natron {
+
+/**
+ * @brief A 64 bits counter that can be incremented concurrently without a lock.
+ * QAtomicInt is only 32 bits, which is not enough to count bytes.
+ **/
+class CacheStatsCounter
+{
+public:
+
+    CacheStatsCounter()
+    : _value(0)
+    {
+    }
+
+    void add(U64 value)
+    {
+#ifdef _MSC_VER
+        _InterlockedExchangeAdd64( (volatile __int64*)&_value, (__int64)value );
+#else
+        __sync_fetch_and_add(&_value, value);
+#endif
+    }
+
+    U64 get() const
+    {
+#ifdef _MSC_VER
+        return (U64)_InterlockedExchangeAdd64( (volatile __int64*)&_value, 0 );
+#else
+        return __sync_fetch_and_add(const_cast<volatile U64*>(&_value), 0);
+#endif
+    }
+
+    void reset()
+    {
+#ifdef _MSC_VER
+        _InterlockedExchange64( (volatile __int64*)&_value, 0 );
+#else
+        __sync_lock_test_and_set(&_value, 0);
+#endif
+    }
+
+private:
+
+    // non copyable
+    CacheStatsCounter(const CacheStatsCounter &);
+    void operator=(const CacheStatsCounter &);
+
+    volatile U64 _value;
+};
+
+/**
+ * @brief The values of the counters of a CacheStats at a given time.
+ **/
+struct CacheStatsSnapshot
+{
+    U64 hits; //< lookups that found an image that could be used
+    U64 misses; //< lookups that did not find any image that could be used
+    U64 downscaledHits; //< hits on an image of a higher resolution that had to be downscaled
+    U64 bytesAllocated; //< memory allocated for new entries
+    U64 evictions; //< entries evicted from the memory portion
+    U64 demotionsToDisk; //< evicted entries moved to the disk portion
+    U64 getLockWaits; //< lookups that had to wait for another lookup of the same shard
+    U64 getLockWaitTimeUs; //< time in microseconds spent waiting for another lookup of the same shard
+
+    CacheStatsSnapshot()
+    : hits(0)
+    , misses(0)
+    , downscaledHits(0)
+    , bytesAllocated(0)
+    , evictions(0)
+    , demotionsToDisk(0)
+    , getLockWaits(0)
+    , getLockWaitTimeUs(0)
+    {
+    }
+
+    void operator+=(const CacheStatsSnapshot & other);
+
+    /**
+     * @brief Returns the counters as (name, value) pairs, always in the same order.
+     **/
+    void getFields(std::vector<std::pair<std::string, U64> >* fields) const;
+
+    /**
+     * @brief Writes the counters as a JSON object, every line but the first one being prefixed by indent.
+     **/
+    void writeJSON(std::ostream & os, const std::string & indent) const;
+};
+
+/**
+ * @brief Cache telemetry, always recorded. Each cache has one, and so does each CacheEntryHolder for the entries
+ * it owns. All counters are atomic so that recording does not add any lock to the cache.
+ * This class is MT-safe.
+ **/
+class CacheStats
+{
+public:
+
+    CacheStats()
+    {
+    }
+
+    void addHit()
+    {
+        _hits.add(1);
+    }
+
+    void addMiss()
+    {
+        _misses.add(1);
+    }
+
+    /**
+     * @brief Counts a hit, already counted with addHit(), on an image that had to be downscaled
+     **/
+    void addDownscaledHit()
+    {
+        _downscaledHits.add(1);
+    }
+
+    void addBytesAllocated(U64 size)
+    {
+        _bytesAllocated.add(size);
+    }
+
+    void addEviction()
+    {
+        _evictions.add(1);
+    }
+
+    void addDemotionToDisk()
+    {
+        _demotionsToDisk.add(1);
+    }
+
+    void addGetLockWait(U64 timeUs)
+    {
+        _getLockWaits.add(1);
+        _getLockWaitTimeUs.add(timeUs);
+    }
+
+    CacheStatsSnapshot getSnapshot() const;
+
+    void reset();
+
+private:
+
+    // non copyable
+    CacheStats(const CacheStats &);
+    void operator=(const CacheStats &);
+
+    CacheStatsCounter _hits;
+    CacheStatsCounter _misses;
+    CacheStatsCounter _downscaledHits;
+    CacheStatsCounter _bytesAllocated;
+    CacheStatsCounter _evictions;
+    CacheStatsCounter _demotionsToDisk;
+    CacheStatsCounter _getLockWaits;
+    CacheStatsCounter _getLockWaitTimeUs;
+};
+
+/**
+ * @brief Locks the mutex until destroyed, like QMutexLocker. If the mutex is already locked the time spent
+ * waiting for it is added to the given stats, which may be NULL.
+ **/
+class CacheStatsMutexLocker
+{
+public:
+
+    CacheStatsMutexLocker(QMutex* mutex,
+                          CacheStats* cacheStats,
+                          CacheStats* holderStats);
+
+    ~CacheStatsMutexLocker();
+
+private:
+
+    // non copyable
+    CacheStatsMutexLocker(const CacheStatsMutexLocker &);
+    void operator=(const CacheStatsMutexLocker &);
+
+    QMutex* _mutex;
+};
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_CACHESTATS_H
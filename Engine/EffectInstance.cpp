@@ -51,6 +51,7 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 #include "Engine/AppManager.h"
 #include "Engine/BlockingBackgroundRender.h"
 #include "Engine/DiskCacheNode.h"
+#include "Engine/Hash64.h"
 #include "Engine/Image.h"
 #include "Engine/ImageParams.h"
 #include "Engine/KnobFile.h"
@@ -63,10 +64,12 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 #include "Engine/OutputSchedulerThread.h"
 #include "Engine/PluginMemory.h"
 #include "Engine/Project.h"
+#include "Engine/RenderArena.h"
 #include "Engine/RenderStats.h"
 #include "Engine/RotoContext.h"
 #include "Engine/RotoDrawableItem.h"
 #include "Engine/Settings.h"
+#include "Engine/SharedImageCache.h"
 #include "Engine/Timer.h"
 #include "Engine/Transform.h"
 #include "Engine/ViewerInstance.h"
@@ -229,6 +232,7 @@ EffectInstance::setParallelRenderArgsTLS(double time,
     args.tilesSupported = getNode()->getCurrentSupportTiles();
     args.viewerProgressReportEnabled = viewerProgressReportEnabled;
     args.stats = stats;
+    args.arena = RenderArena::getCurrent();
     ++args.validArgs;
 }
 
@@ -1280,8 +1284,8 @@ EffectInstance::getImageFromCacheAndConvertIfNeeded(bool useCache,
         isCached = !useDiskCache ? Natron::getImageFromCache(key, &cachedImages) : Natron::getImageFromDiskCache(key, &cachedImages);
     }
 
-    if (stats && stats->isInDepthProfilingEnabled() && !isCached) {
-        stats->addCacheInfosForNode(getNode(), true, false);
+    if (!isCached) {
+        recordCacheAccess(useDiskCache, true, false, stats);
     }
 
     if (isCached) {
@@ -1404,11 +1408,54 @@ EffectInstance::getImageFromCacheAndConvertIfNeeded(bool useCache,
                 dstRoi.intersect(imgToConvertBounds, &dstRoi);
                 
                 if (imgToConvertBounds.area() > 1) {
-                    imageToConvert->downscaleMipMap( rod,
-                                                     dstRoi,
-                                                     imageToConvert->getMipMapLevel(), img->getMipMapLevel(),
-                                                     useCache && imageToConvert->usesBitMap(),
-                                                     img.get() );
+                    bool copyBitMap = useCache && imageToConvert->usesBitMap();
+                    std::vector<Natron::Image*> levels(downscaleLevels, (Natron::Image*)0);
+                    levels.back() = img.get();
+
+                    /*
+                     The levels in between are computed anyway: keep them in the cache as well so that zooming in
+                     again finds them instead of downscaling the original image again. Their bitmap tells which pixels
+                     are valid, hence this is only done for cached images.
+                     */
+                    std::list<ImagePtr> intermediateLevels;
+                    if (copyBitMap) {
+                        for (int i = 1; i < downscaleLevels; ++i) {
+                            unsigned int level = imageToConvert->getMipMapLevel() + i;
+                            bool levelIsCached = false;
+                            for (ImageList::iterator it = cachedImages.begin(); it != cachedImages.end(); ++it) {
+                                if ( (*it)->getMipMapLevel() == level ) {
+                                    levelIsCached = true;
+                                    break;
+                                }
+                            }
+                            if (levelIsCached) {
+                                continue;
+                            }
+
+                            RectI levelRoi = dstRoi.downscalePowerOfTwoSmallestEnclosing(i);
+                            RectI levelBounds;
+                            rod.toPixelEnclosing(level, imageToConvert->getPixelAspectRatio(), &levelBounds);
+                            levelBounds.merge(levelRoi);
+
+                            boost::shared_ptr<ImageParams> levelParams = Image::makeParams( oldParams->getCost(),
+                                                                                            rod,
+                                                                                            levelBounds,
+                                                                                            oldParams->getPixelAspectRatio(),
+                                                                                            level,
+                                                                                            oldParams->isRodProjectFormat(),
+                                                                                            oldParams->getComponents(),
+                                                                                            oldParams->getBitDepth(),
+                                                                                            oldParams->getFramesNeeded() );
+                            ImagePtr levelImg;
+                            getOrCreateFromCacheInternal(key, levelParams, useCache, useDiskCache, &levelImg);
+                            if ( levelImg && levelImg->usesBitMap() && levelImg->getBounds().contains(levelRoi) ) {
+                                levels[i - 1] = levelImg.get();
+                                intermediateLevels.push_back(levelImg);
+                            }
+                        }
+                    }
+
+                    imageToConvert->buildMipMapPyramid(dstRoi, copyBitMap, levels);
                 } else {
                     img->pasteFrom(*imageToConvert, imgToConvertBounds);
                 }
@@ -1418,24 +1465,191 @@ EffectInstance::getImageFromCacheAndConvertIfNeeded(bool useCache,
 
             *image = imageToConvert;
             //assert(imageToConvert->getBounds().contains(bounds));
-            if ( stats && stats->isInDepthProfilingEnabled() ) {
-                stats->addCacheInfosForNode(getNode(), false, true);
-            }
+            recordCacheAccess(useDiskCache, false, true, stats);
         } else if (*image) { //  else if (imageToConvert && !*image)
             ///Ensure the image is allocated
             (*image)->allocateMemory();
 
-            if ( stats && stats->isInDepthProfilingEnabled() ) {
-                stats->addCacheInfosForNode(getNode(), false, false);
-            }
+            recordCacheAccess(useDiskCache, false, false, stats);
         } else {
-            if ( stats && stats->isInDepthProfilingEnabled() ) {
-                stats->addCacheInfosForNode(getNode(), true, false);
-            }
+            recordCacheAccess(useDiskCache, true, false, stats);
         }
     } // isCached
+
+    ///Another process rendering the same graph may have rendered it already
+    if ( !*image && useCache && !useDiskCache && boundsParam && nodePrefComps.isConvertibleTo(components) &&
+         ( getSizeOfForBitDepth(nodePrefDepth) >= getSizeOfForBitDepth(bitdepth) ) && getNode()->isHashContentBased() ) {
+        getImageFromSharedCache(key, mipMapLevel, *boundsParam, nodePrefDepth, nodePrefComps, image);
+    }
 } // EffectInstance::getImageFromCacheAndConvertIfNeeded
 
+void
+EffectInstance::recordCacheAccess(bool useDiskCache,
+                                  bool isCacheMiss,
+                                  bool hasDownscaled,
+                                  const boost::shared_ptr<RenderStats> & stats) const
+{
+    Natron::CacheStats* nodeStats = getNode()->getCacheStats().get();
+
+    if (isCacheMiss) {
+        nodeStats->addMiss();
+    } else {
+        nodeStats->addHit();
+        if (hasDownscaled) {
+            nodeStats->addDownscaledHit();
+            appPTR->notifyImageCacheDownscaledHit(useDiskCache);
+        }
+    }
+    if ( stats && stats->isInDepthProfilingEnabled() ) {
+        stats->addCacheInfosForNode(getNode(), isCacheMiss, hasDownscaled);
+    }
+}
+
+/**
+ * @brief The images of the shared cache are identified by their key and by what is not part of it
+ * but would prevent from using them as is.
+ **/
+static U64
+getSharedImageCacheHash(const ImageKey & key,
+                        unsigned int mipMapLevel,
+                        Natron::ImageBitDepthEnum bitdepth,
+                        const Natron::ImageComponents & components)
+{
+    Hash64 hash;
+
+    hash.append( key.getHash() );
+    hash.append(mipMapLevel);
+    hash.append( (int)bitdepth );
+    Hash64_appendQString( &hash, QString( components.getComponentsGlobalName().c_str() ) );
+    hash.computeHash();
+
+    return hash.value();
+}
+
+void
+EffectInstance::getImageFromSharedCache(const Natron::ImageKey & key,
+                                        unsigned int mipMapLevel,
+                                        const RectI & bounds,
+                                        Natron::ImageBitDepthEnum bitdepth,
+                                        const Natron::ImageComponents & components,
+                                        boost::shared_ptr<Natron::Image>* image)
+{
+    SharedImageCache* sharedCache = appPTR->getSharedImageCache();
+
+    if (!sharedCache) {
+        return;
+    }
+    U64 hash = getSharedImageCacheHash(key, mipMapLevel, bitdepth, components);
+    SharedImageCacheEntryInfo info;
+    if ( !sharedCache->find(hash, &info) ) {
+        return;
+    }
+
+    RectI imgBounds(info.bounds[0], info.bounds[1], info.bounds[2], info.bounds[3]);
+    RectD rod(info.rod[0], info.rod[1], info.rod[2], info.rod[3]);
+    if ( !imgBounds.contains(bounds) ) {
+        return;
+    }
+    if (info.isRodProjectFormat) {
+        Format projectFormat;
+        getRenderFormat(&projectFormat);
+        if ( projectFormat.toCanonicalFormat() != rod ) {
+            return;
+        }
+    }
+    std::size_t size = (std::size_t)imgBounds.area() * components.getNumComponents() * getSizeOfForBitDepth(bitdepth);
+    if (info.size != size) {
+        return;
+    }
+
+    boost::shared_ptr<ImageParams> params = Image::makeParams(0,
+                                                              rod,
+                                                              imgBounds,
+                                                              info.par,
+                                                              mipMapLevel,
+                                                              info.isRodProjectFormat,
+                                                              components,
+                                                              bitdepth,
+                                                              std::map<int, std::map<int, std::vector<RangeD> > >() );
+    ImagePtr img;
+    if ( Natron::getImageFromCacheOrCreate(key, params, &img) ) {
+        ///Another thread created it in the meantime, it is being rendered by that thread
+        return;
+    }
+    if (!img) {
+        return;
+    }
+
+    ///The image can be found in the node cache from now on: the renders needing it wait until it is filled, as if it
+    ///was being rendered, see Implementation::waitForImageBeingRendered()
+    Implementation::IBRPtr ibr = _imp->markImageAsBeingRendered(img);
+    bool ok;
+    try {
+        img->allocateMemory();
+        {
+            Image::WriteAccess acc = img->getWriteRights();
+            unsigned char* pixels = acc.pixelAt(imgBounds.x1, imgBounds.y1);
+            ok = pixels && sharedCache->read(hash, pixels, size);
+        }
+        if (ok) {
+            img->markForRendered(imgBounds);
+        }
+    } catch (...) {
+        appPTR->removeFromNodeCache(img);
+        _imp->unmarkImageAsBeingRendered(ibr, true);
+        throw;
+    }
+    if (!ok) {
+        ///Remove it before the waiting renders fall back on the cache look-up
+        appPTR->removeFromNodeCache(img);
+        _imp->unmarkImageAsBeingRendered(ibr, true);
+
+        return;
+    }
+    _imp->unmarkImageAsBeingRendered(ibr, false);
+    *image = img;
+}
+
+void
+EffectInstance::insertImageInSharedCache(const boost::shared_ptr<Natron::Image> & image) const
+{
+    SharedImageCache* sharedCache = appPTR->getSharedImageCache();
+
+    if (!sharedCache || !image->usesBitMap()) {
+        return;
+    }
+
+    RectI imgBounds = image->getBounds();
+    std::list<RectI> restToRender;
+    image->getRestToRender(imgBounds, restToRender);
+    if ( !restToRender.empty() ) {
+        ///Only share images that are entirely rendered
+        return;
+    }
+
+    boost::shared_ptr<ImageParams> params = image->getParams();
+    const RectD & rod = params->getRoD();
+    SharedImageCacheEntryInfo info;
+    info.size = (std::size_t)imgBounds.area() * image->getComponentsCount() * getSizeOfForBitDepth( image->getBitDepth() );
+    info.par = params->getPixelAspectRatio();
+    info.rod[0] = rod.x1;
+    info.rod[1] = rod.y1;
+    info.rod[2] = rod.x2;
+    info.rod[3] = rod.y2;
+    info.bounds[0] = imgBounds.x1;
+    info.bounds[1] = imgBounds.y1;
+    info.bounds[2] = imgBounds.x2;
+    info.bounds[3] = imgBounds.y2;
+    info.isRodProjectFormat = params->isRodProjectFormat();
+
+    U64 hash = getSharedImageCacheHash(image->getKey(), image->getMipMapLevel(), image->getBitDepth(), image->getComponents());
+    Image::ReadAccess acc = image->getReadRights();
+    const unsigned char* pixels = acc.pixelAt(imgBounds.x1, imgBounds.y1);
+    if (pixels) {
+        sharedCache->insert(hash, pixels, info);
+    }
+}
+
 void
 EffectInstance::tryConcatenateTransforms(double time,
                                          int view,
@@ -1726,7 +1940,9 @@ EffectInstance::Implementation::tiledRenderingFunctor(EffectInstance::Implementa
         appPTR->getAppTLS()->copyTLS(callingThread, curThread);
     }
     
-    
+    ///The temporary images of the tile are allocated in the arena of the render of the frame
+    const ParallelRenderArgs* frameArgs = _publicInterface->getParallelRenderArgsTLS();
+    RenderArenaSetter arenaSetter( frameArgs ? frameArgs->arena : boost::shared_ptr<RenderArena>() );
     
     return tiledRenderingFunctor(specificData,
                                  args.renderFullScaleThenDownscale,
@@ -2033,11 +2249,8 @@ EffectInstance::Implementation::renderHandler(const EffectDataTLSPtr& tls,
                                               const Natron::ImagePremultiplicationEnum originalImagePremultiplication,
                                               ImagePlanesToRender & planes)
 {
-    boost::shared_ptr<TimeLapse> timeRecorder;
-
-    if (tls->frameArgs.stats) {
-        timeRecorder.reset( new TimeLapse() );
-    }
+    ///Always measured: the cache uses the render time to decide which images to evict first
+    TimeLapse timeRecorder;
 
     const EffectInstance::PlaneToRender & firstPlane = planes.planes.begin()->second;
     const double time = tls->currentRenderArgs.time;
@@ -2100,7 +2313,7 @@ EffectInstance::Implementation::renderHandler(const EffectDataTLSPtr& tls,
                 it->second.renderMappedImage->markForRendered(renderMappedRectToRender);
                 
                 if ( tls->frameArgs.stats && tls->frameArgs.stats->isInDepthProfilingEnabled() ) {
-                    tls->frameArgs.stats->addRenderInfosForNode( _publicInterface->getNode(),  NodePtr(), it->first.getComponentsGlobalName(), renderMappedRectToRender, timeRecorder->getTimeSinceCreation() );
+                    tls->frameArgs.stats->addRenderInfosForNode( _publicInterface->getNode(),  NodePtr(), it->first.getComponentsGlobalName(), renderMappedRectToRender, timeRecorder.getTimeSinceCreation() );
                 }
             }
 
@@ -2117,7 +2330,7 @@ EffectInstance::Implementation::renderHandler(const EffectDataTLSPtr& tls,
                     it->second.renderMappedImage->markForRendered(renderMappedRectToRender);
                     
                     if ( tls->frameArgs.stats && tls->frameArgs.stats->isInDepthProfilingEnabled() ) {
-                        tls->frameArgs.stats->addRenderInfosForNode( _publicInterface->getNode(),  tls->currentRenderArgs.identityInput->getNode(), it->first.getComponentsGlobalName(), renderMappedRectToRender, timeRecorder->getTimeSinceCreation() );
+                        tls->frameArgs.stats->addRenderInfosForNode( _publicInterface->getNode(),  tls->currentRenderArgs.identityInput->getNode(), it->first.getComponentsGlobalName(), renderMappedRectToRender, timeRecorder.getTimeSinceCreation() );
                     }
                 }
 
@@ -2174,7 +2387,7 @@ EffectInstance::Implementation::renderHandler(const EffectDataTLSPtr& tls,
                     }
 
                     if ( tls->frameArgs.stats && tls->frameArgs.stats->isInDepthProfilingEnabled() ) {
-                        tls->frameArgs.stats->addRenderInfosForNode( _publicInterface->getNode(),  tls->currentRenderArgs.identityInput->getNode(), it->first.getComponentsGlobalName(), renderMappedRectToRender, timeRecorder->getTimeSinceCreation() );
+                        tls->frameArgs.stats->addRenderInfosForNode( _publicInterface->getNode(),  tls->currentRenderArgs.identityInput->getNode(), it->first.getComponentsGlobalName(), renderMappedRectToRender, timeRecorder.getTimeSinceCreation() );
                     }
                 }
 
@@ -2293,7 +2506,12 @@ EffectInstance::Implementation::renderHandler(const EffectDataTLSPtr& tls,
     for (std::map<ImageComponents, EffectInstance::PlaneToRender>::const_iterator it = outputPlanes.begin(); it != outputPlanes.end(); ++it) {
         bool unPremultRequired = unPremultIfNeeded && it->second.tmpImage->getComponentsCount() == 4 && it->second.renderMappedImage->getComponentsCount() == 3;
 
-        if ( tls->frameArgs.doNansHandling && it->second.tmpImage->checkForNaNs(actionArgs.roi) ) {
+        int nbNaNs = 0, nbInfinities = 0;
+        bool hasNaNs = tls->frameArgs.doNansHandling && it->second.tmpImage->checkForNaNs(actionArgs.roi, &nbNaNs, &nbInfinities);
+        if ( (nbNaNs || nbInfinities) && tls->frameArgs.stats && tls->frameArgs.stats->isInDepthProfilingEnabled() ) {
+            tls->frameArgs.stats->addNonFiniteValuesForNode(_publicInterface->getNode(), nbNaNs, nbInfinities);
+        }
+        if (hasNaNs) {
             QString warning( _publicInterface->getNode()->getScriptName_mt_safe().c_str() );
             warning.append(": ");
             warning.append( tr("rendered rectangle (") );
@@ -2348,10 +2566,8 @@ EffectInstance::Implementation::renderHandler(const EffectDataTLSPtr& tls,
                 }
                 
                 if (mappedOriginalInputImage) {
-                    it->second.tmpImage->copyUnProcessedChannels(renderMappedRectToRender, planes.outputPremult, originalImagePremultiplication, processChannels, mappedOriginalInputImage);
-                    if (useMaskMix) {
-                        it->second.tmpImage->applyMaskMix(renderMappedRectToRender, maskImage.get(), mappedOriginalInputImage.get(), doMask, false, mix);
-                    }
+                    it->second.tmpImage->copyUnProcessedChannelsAndApplyMaskMix(renderMappedRectToRender, planes.outputPremult, originalImagePremultiplication, processChannels, mappedOriginalInputImage,
+                                                                                useMaskMix, maskImage.get(), doMask, false, mix);
                 }
                 if ( ( it->second.fullscaleImage->getComponents() != it->second.tmpImage->getComponents() ) ||
                     ( it->second.fullscaleImage->getBitDepth() != it->second.tmpImage->getBitDepth() ) ) {
@@ -2382,6 +2598,15 @@ EffectInstance::Implementation::renderHandler(const EffectDataTLSPtr& tls,
             } else { // if (renderFullScaleThenDownscale) {
                 
                 
+                ///The input images have the depth the plug-in renders in: if the downscaled image is stored in another depth
+                ///(e.g: the cache stores images as half), copy the unprocessed channels and mix before the conversion
+                const bool mixBeforeConversion = ( it->second.tmpImage != it->second.downscaleImage ) &&
+                                                 ( it->second.tmpImage->getBitDepth() != it->second.downscaleImage->getBitDepth() );
+                if (mixBeforeConversion) {
+                    it->second.tmpImage->copyUnProcessedChannelsAndApplyMaskMix(actionArgs.roi, planes.outputPremult, originalImagePremultiplication, processChannels, originalInputImage,
+                                                                                useMaskMix, maskImage.get(), doMask, false, mix);
+                }
+
                 ///Copy the rectangle rendered in the downscaled image
                 if (it->second.tmpImage != it->second.downscaleImage) {
                     if ( ( it->second.downscaleImage->getComponents() != it->second.tmpImage->getComponents() ) ||
@@ -2404,9 +2629,9 @@ EffectInstance::Implementation::renderHandler(const EffectDataTLSPtr& tls,
                     }
                 }
 
-                it->second.downscaleImage->copyUnProcessedChannels(actionArgs.roi, planes.outputPremult, originalImagePremultiplication, processChannels, originalInputImage);
-                if (useMaskMix) {
-                    it->second.downscaleImage->applyMaskMix(actionArgs.roi, maskImage.get(), originalInputImage.get(), doMask, false, mix);
+                if (!mixBeforeConversion) {
+                    it->second.downscaleImage->copyUnProcessedChannelsAndApplyMaskMix(actionArgs.roi, planes.outputPremult, originalImagePremultiplication, processChannels, originalInputImage,
+                                                                                      useMaskMix, maskImage.get(), doMask, false, mix);
                 }
                 it->second.downscaleImage->markForRendered(downscaledRectToRender);
                 
@@ -2415,10 +2640,19 @@ EffectInstance::Implementation::renderHandler(const EffectDataTLSPtr& tls,
         } // if (it->second.isAllocatedOnTheFly) {
 
         if ( tls->frameArgs.stats && tls->frameArgs.stats->isInDepthProfilingEnabled() ) {
-            tls->frameArgs.stats->addRenderInfosForNode( _publicInterface->getNode(),  NodePtr(), it->first.getComponentsGlobalName(), renderMappedRectToRender, timeRecorder->getTimeSinceCreation() );
+            tls->frameArgs.stats->addRenderInfosForNode( _publicInterface->getNode(),  NodePtr(), it->first.getComponentsGlobalName(), renderMappedRectToRender, timeRecorder.getTimeSinceCreation() );
         }
     } // for (std::map<ImageComponents,PlaneToRender>::const_iterator it = outputPlanes.begin(); it != outputPlanes.end(); ++it) {
 
+    ///Let the cache know how long it takes to render these images again
+    double renderTime = timeRecorder.getTimeSinceCreation();
+    _publicInterface->getNode()->addRenderCostSample( renderTime, (U64)renderMappedRectToRender.area() );
+    for (std::map<ImageComponents, EffectInstance::PlaneToRender>::const_iterator it = outputPlanes.begin(); it != outputPlanes.end(); ++it) {
+        it->second.fullscaleImage->addRenderTime(renderTime);
+        if (it->second.downscaleImage != it->second.fullscaleImage) {
+            it->second.downscaleImage->addRenderTime(renderTime);
+        }
+    }
 
     return eRenderingFunctorRetOK;
 } // tiledRenderingFunctor
@@ -2451,6 +2685,8 @@ EffectInstance::allocateImagePlaneAndSetInThreadLocalStorage(const Natron::Image
         useCache = false;
     }
     const ImagePtr & img = firstPlane.fullscaleImage->usesBitMap() ? firstPlane.fullscaleImage : firstPlane.downscaleImage;
+    ///The plug-in renders in the depth of the temporary images, which is not the one of the cached images if they are stored as half
+    const Natron::ImageBitDepthEnum renderDepth = firstPlane.tmpImage->getBitDepth();
     boost::shared_ptr<ImageParams> params = img->getParams();
     EffectInstance::PlaneToRender p;
     bool ok = allocateImagePlane(img->getKey(), tls->currentRenderArgs.rod, tls->currentRenderArgs.renderWindowPixel, tls->currentRenderArgs.renderWindowPixel, false, params->getFramesNeeded(), plane, img->getBitDepth(), img->getPixelAspectRatio(), img->getMipMapLevel(), false, false, useCache, &p.fullscaleImage, &p.downscaleImage);
@@ -2461,22 +2697,22 @@ EffectInstance::allocateImagePlaneAndSetInThreadLocalStorage(const Natron::Image
         p.isAllocatedOnTheFly = true;
         
         /*
-         * Allocate a temporary image for rendering only if using cache
+         * Allocate a temporary image for rendering only if using cache or if the plug-in does not render in the depth of the image
          */
-        if (useCache) {
+        if ( useCache || ( renderDepth != p.renderMappedImage->getBitDepth() ) ) {
             p.tmpImage.reset( new Image(p.renderMappedImage->getComponents(),
                                         p.renderMappedImage->getRoD(),
                                         tls->currentRenderArgs.renderWindowPixel,
                                         p.renderMappedImage->getMipMapLevel(),
                                         p.renderMappedImage->getPixelAspectRatio(),
-                                        p.renderMappedImage->getBitDepth(),
+                                        renderDepth,
                                         false) );
         } else {
             p.tmpImage = p.renderMappedImage;
         }
         tls->currentRenderArgs.outputPlanes.insert( std::make_pair(plane, p) );
         
-        return p.downscaleImage;
+        return renderDepth != p.downscaleImage->getBitDepth() ? p.tmpImage : p.downscaleImage;
     }
 
   
@@ -3814,6 +4050,17 @@ EffectInstance::isDuringPaintStrokeCreationThreadLocal() const
     return getNode()->isDuringPaintStrokeCreation();
 }
 
+bool
+EffectInstance::isDraftRenderThreadLocal() const
+{
+    EffectDataTLSPtr tls = _imp->tlsData->getTLSData();
+    if (tls && tls->frameArgs.validArgs) {
+        return tls->frameArgs.draftMode;
+    }
+
+    return false;
+}
+
 void
 EffectInstance::redrawOverlayInteract()
 {
@@ -3863,6 +4110,7 @@ EffectInstance::onKnobValueChanged_public(KnobI* k,
                                                       true,
                                                       false,
                                                       false,
+                                                      Natron::eRenderPriorityInteractive,
                                                       0,
                                                       node,
                                                       0, // request
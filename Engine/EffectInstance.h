@@ -498,6 +498,31 @@ public:
                                              const boost::shared_ptr<RenderStats> & stats,
                                              boost::shared_ptr<Natron::Image>* image);
 
+    /**
+     * @brief Looks-up the image in the cache shared with other processes and copies it to the node cache if found.
+     * @see SharedImageCache
+     **/
+    void getImageFromSharedCache(const Natron::ImageKey & key,
+                                 unsigned int mipMapLevel,
+                                 const RectI & bounds,
+                                 Natron::ImageBitDepthEnum bitdepth,
+                                 const Natron::ImageComponents & components,
+                                 boost::shared_ptr<Natron::Image>* image);
+
+    /**
+     * @brief Copies a fully rendered image to the cache shared with other processes.
+     **/
+    void insertImageInSharedCache(const boost::shared_ptr<Natron::Image> & image) const;
+
+    /**
+     * @brief Records the outcome of a cache look-up in the cache telemetry of the node and of the cache, and in the
+     * render stats if in-depth profiling is enabled.
+     **/
+    void recordCacheAccess(bool useDiskCache,
+                           bool isCacheMiss,
+                           bool hasDownscaled,
+                           const boost::shared_ptr<RenderStats> & stats) const;
+
 
     /**
      * @brief This function is to be called by getImage() when the plug-ins renders more planes than the ones suggested
@@ -590,6 +615,27 @@ public:
                                                  const boost::shared_ptr<Natron::Node> & treeRoot,
                                                  FrameRequestMap & request);
 
+    /**
+     * @brief Returns true if a tile of a render window can be pulled through the tree on its own, tileRequest being the request pass
+     * computed for the tile: all nodes upstream of treeRoot that are not identities must support tiles and the region each of them
+     * has to render for the tile, clipped to its RoD, may not exceed the tile by more than maxMargin on each side. Nodes that need
+     * large neighbourhoods (e.g: blurs) or that shrink their input make the whole render window be rendered at once instead.
+     * Implem is in ParallelRenderArgs.cpp
+     **/
+    static bool canStreamTiles(const FrameRequestMap & tileRequest,
+                               const boost::shared_ptr<Natron::Node> & treeRoot,
+                               const RectD & canonicalTile,
+                               double maxMargin);
+
+    /**
+     * @brief Makes the nodes rendering with frameRequest, the request pass of the whole render window, fetch from their inputs only
+     * what the tile of tileRequest needs. The NodeFrameRequest objects referenced by the thread-local storage of the nodes are modified
+     * in place, hence this must only be called between the renders of two tiles.
+     * Implem is in ParallelRenderArgs.cpp
+     **/
+    static void setRequestPassForTile(const FrameRequestMap & tileRequest,
+                                      const FrameRequestMap & frameRequest);
+
     // Implem is in ParallelRenderArgs.cpp
     static Natron::EffectInstance::RenderRoIRetCode treeRecurseFunctor(bool isRenderFunctor,
                                                                        const boost::shared_ptr<Natron::Node> & node,
@@ -1140,6 +1186,15 @@ public:
         return false;
     }
 
+    /**
+     * @brief Hint given to the cache admission policy about how expensive the output of the effect is to render again,
+     * @see Node::shouldCacheOutput
+     **/
+    virtual Natron::CacheAdmissionHintEnum getCacheAdmissionHint() const
+    {
+        return Natron::eCacheAdmissionHintDefault;
+    }
+
     virtual Natron::PluginOpenGLRenderSupport supportsOpenGLRender() const
     {
         return Natron::ePluginOpenGLRenderSupportNone;
@@ -1193,6 +1248,11 @@ public:
 
     bool isDuringPaintStrokeCreationThreadLocal() const;
 
+    /**
+     * @brief Returns true if the current render of this thread is a draft render, i.e: the user is scrubbing the timeline
+     **/
+    bool isDraftRenderThreadLocal() const;
+
     struct PlaneToRender
     {
         //Points to the fullscale image if render scale is not supported by the plug-in, or downscaleImage otherwise
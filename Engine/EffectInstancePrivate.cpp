@@ -341,10 +341,8 @@ EffectInstance::Implementation::Implementation(EffectInstance* publicInterface)
     , pluginMemoryChunks()
     , supportsRenderScale(eSupportsMaybe)
     , actionsCache(appPTR->getHardwareIdealThreadCount() * 2)
-#if NATRON_ENABLE_TRIMAP
     , imagesBeingRenderedMutex()
     , imagesBeingRendered()
-#endif
     , componentsAvailableMutex()
     , componentsAvailableDirty(true)
     , outputComponentsAvailable()
@@ -448,39 +446,46 @@ EffectInstance::Implementation::setDuringInteractAction(bool b)
 }
 
 
-#if NATRON_ENABLE_TRIMAP
-void
+EffectInstance::Implementation::IBRPtr
 EffectInstance::Implementation::markImageAsBeingRendered(const boost::shared_ptr<Natron::Image> & img)
 {
-    if ( !img->usesBitMap() ) {
-        return;
+    ///Only the cached images may be needed by other renders
+    if ( !img->usesBitMap() || !img->getCacheAPI() ) {
+        return IBRPtr();
     }
+    ImageBeingRenderedKey key( img->getKey().getHash(), img->getMipMapLevel(), img->getComponents() );
     QMutexLocker k(&imagesBeingRenderedMutex);
-    IBRMap::iterator found = imagesBeingRendered.find(img);
+    IBRMap::iterator found = imagesBeingRendered.find(key);
     if ( found != imagesBeingRendered.end() ) {
-        ++(found->second->refCount);
-    } else {
-        IBRPtr ibr(new Implementation::ImageBeingRendered);
+        if (found->second->image == img) {
+            QMutexLocker kk(&found->second->lock);
+            ++(found->second->refCount);
+
+            return found->second;
+        }
+        ///The image was removed from the cache and created again while another render was rendering it:
+        ///they cannot share their renders, the other one has to finish with its own image
+        IBRPtr ibr( new ImageBeingRendered(img, key) );
         ++ibr->refCount;
-        imagesBeingRendered.insert( std::make_pair(img, ibr) );
+
+        return ibr;
     }
-}
+    IBRPtr ibr( new ImageBeingRendered(img, key) );
+    ++ibr->refCount;
+    imagesBeingRendered.insert( std::make_pair(key, ibr) );
 
+    return ibr;
+}
 
+#if NATRON_ENABLE_TRIMAP
 bool
 EffectInstance::Implementation::waitForImageBeingRenderedElsewhereAndUnmark(const RectI & roi,
-                                                                            const boost::shared_ptr<Natron::Image> & img)
+                                                                            const IBRPtr & ibr)
 {
-    if ( !img->usesBitMap() ) {
+    if (!ibr) {
         return true;
     }
-    IBRPtr ibr;
-    {
-        QMutexLocker k(&imagesBeingRenderedMutex);
-        IBRMap::iterator found = imagesBeingRendered.find(img);
-        assert( found != imagesBeingRendered.end() );
-        ibr = found->second;
-    }
+    const ImagePtr & img = ibr->image;
     std::list<RectI> restToRender;
     bool isBeingRenderedElseWhere = false;
     img->getRestToRender_trimap(roi, restToRender, &isBeingRenderedElseWhere);
@@ -499,51 +504,76 @@ EffectInstance::Implementation::waitForImageBeingRenderedElsewhereAndUnmark(cons
     ///Everything should be rendered now.
     bool hasFailed;
     {
-        QMutexLocker k(&imagesBeingRenderedMutex);
-        IBRMap::iterator found = imagesBeingRendered.find(img);
-        assert( found != imagesBeingRendered.end() );
-
         QMutexLocker kk(&ibr->lock);
         hasFailed = ab || ibr->renderFailed || isBeingRenderedElseWhere;
 
         // If it crashes here, that is probably because ibr->refCount == 1, but in this case isBeingRenderedElseWhere should be false.
         // If this assert is triggered, please investigate, this is a serious bug in the trimap system.
         assert(ab || !isBeingRenderedElseWhere || ibr->renderFailed);
-        --ibr->refCount;
-        found->second->cond.wakeAll();
-        if ( ( found != imagesBeingRendered.end() ) && !ibr->refCount ) {
-            imagesBeingRendered.erase(found);
-        }
     }
+    unmarkImageAsBeingRendered(ibr, false);
 
     return !hasFailed;
 }
-
+#endif // if NATRON_ENABLE_TRIMAP
 
 void
-EffectInstance::Implementation::unmarkImageAsBeingRendered(const boost::shared_ptr<Natron::Image> & img,
+EffectInstance::Implementation::unmarkImageAsBeingRendered(const IBRPtr & ibr,
                                                            bool renderFailed)
 {
-    if ( !img->usesBitMap() ) {
+    if (!ibr) {
         return;
     }
     QMutexLocker k(&imagesBeingRenderedMutex);
-    IBRMap::iterator found = imagesBeingRendered.find(img);
-    assert( found != imagesBeingRendered.end() );
-
-    QMutexLocker kk(&found->second->lock);
+    QMutexLocker kk(&ibr->lock);
     if (renderFailed) {
-        found->second->renderFailed = true;
+        ibr->renderFailed = true;
     }
-    found->second->cond.wakeAll();
-    --found->second->refCount;
-    if (!found->second->refCount) {
-        kk.unlock(); // < unlock before erase which is going to delete the lock
-        imagesBeingRendered.erase(found);
+    --ibr->refCount;
+    if (!ibr->refCount) {
+        ibr->done = true;
+        IBRMap::iterator found = imagesBeingRendered.find(ibr->key);
+        if ( ( found != imagesBeingRendered.end() ) && (found->second == ibr) ) {
+            imagesBeingRendered.erase(found);
+        }
     }
+    ibr->cond.wakeAll();
 }
 
-#endif // if NATRON_ENABLE_TRIMAP
+ImagePtr
+EffectInstance::Implementation::waitForImageBeingRendered(const EffectDataTLSPtr & tls,
+                                                          const ImageKey & key,
+                                                          unsigned int mipMapLevel,
+                                                          const ImageComponents & components)
+{
+    IBRPtr ibr;
+    {
+        QMutexLocker k(&imagesBeingRenderedMutex);
+        IBRMap::iterator found = imagesBeingRendered.find( ImageBeingRenderedKey(key.getHash(), mipMapLevel, components) );
+        if ( found == imagesBeingRendered.end() ) {
+            return ImagePtr();
+        }
+        ibr = found->second;
+    }
+    ///The thread rendering the image may need it again, e.g: to paint over it: waiting for itself would never end
+    if ( ibr->renderThread == QThread::currentThread() ) {
+        return ImagePtr();
+    }
+    QMutexLocker kk(&ibr->lock);
+    while (!ibr->done) {
+        ///The render of the image may take long: give up if the render needing it is aborted meanwhile
+        if ( !ibr->cond.wait(&ibr->lock, NATRON_IMAGE_BEING_RENDERED_ABORT_CHECK_MS) ) {
+            kk.unlock();
+            const bool ab = aborted(tls);
+            kk.relock();
+            if (ab && !ibr->done) {
+                return ImagePtr();
+            }
+        }
+    }
+
+    return ibr->renderFailed ? ImagePtr() : ibr->image;
+}
 
 
 
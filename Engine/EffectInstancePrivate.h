@@ -33,6 +33,7 @@
 
 #include <QtCore/QWaitCondition>
 #include <QtCore/QMutex>
+#include <QtCore/QThread>
 
 #include "Global/GlobalDefines.h"
 
@@ -40,6 +41,9 @@
 #include "Engine/TLSHolder.h"
 #include "Engine/EngineFwd.h"
 
+///How often a render waiting for an image being rendered elsewhere checks whether it was aborted, in milliseconds
+#define NATRON_IMAGE_BEING_RENDERED_ABORT_CHECK_MS 50
+
 namespace Natron {
 
 struct ActionKey
@@ -184,25 +188,73 @@ struct EffectInstance::Implementation
     /// Mt-Safe actions cache
     ActionsCache actionsCache;
 
-#if NATRON_ENABLE_TRIMAP
-    ///Store all images being rendered to avoid 2 threads rendering the same portion of an image
+    /**
+     * @brief Identifies an image of this node: the images with the same key may differ by their mipmap level and
+     * components, see EffectInstance::getImageFromCacheAndConvertIfNeeded()
+     **/
+    struct ImageBeingRenderedKey
+    {
+        U64 hash;
+        unsigned int mipMapLevel;
+        ImageComponents components;
+
+        ImageBeingRenderedKey(U64 hash,
+                              unsigned int mipMapLevel,
+                              const ImageComponents & components)
+        : hash(hash)
+        , mipMapLevel(mipMapLevel)
+        , components(components)
+        {
+        }
+
+        bool operator<(const ImageBeingRenderedKey & other) const
+        {
+            if (hash != other.hash) {
+                return hash < other.hash;
+            }
+            if (mipMapLevel != other.mipMapLevel) {
+                return mipMapLevel < other.mipMapLevel;
+            }
+
+            return components < other.components;
+        }
+    };
+
+    /**
+     * @brief An image of this node being rendered, shared like a future by the renders that need it: a render that
+     * needs an image another render is rendering waits for it and takes the rendered image directly instead of rendering it
+     * again. Renders that cannot be aborted rather share the rendering of the image with the trimap: each of them renders the
+     * portions not being rendered elsewhere and waits for the others, see waitForImageBeingRenderedElsewhereAndUnmark().
+     **/
     struct ImageBeingRendered
     {
         QWaitCondition cond;
         QMutex lock;
-        int refCount;
+        int refCount; //< the number of renders rendering the image
         bool renderFailed;
-
-        ImageBeingRendered() : cond(), lock(), refCount(0), renderFailed(false)
+        bool done; //< set when the last render of the image is done: image is the result, unless renderFailed
+        ImagePtr image;
+        ImageBeingRenderedKey key;
+        const QThread* renderThread; //< the thread of the first render of the image
+
+        ImageBeingRendered(const ImagePtr & image,
+                           const ImageBeingRenderedKey & key)
+        : cond()
+        , lock()
+        , refCount(0)
+        , renderFailed(false)
+        , done(false)
+        , image(image)
+        , key(key)
+        , renderThread( QThread::currentThread() )
         {
         }
     };
 
     QMutex imagesBeingRenderedMutex;
     typedef boost::shared_ptr<ImageBeingRendered> IBRPtr;
-    typedef std::map<ImagePtr, IBRPtr > IBRMap;
+    typedef std::map<ImageBeingRenderedKey, IBRPtr > IBRMap;
     IBRMap imagesBeingRendered;
-#endif
 
     ///A cache for components available
     mutable QMutex componentsAvailableMutex;
@@ -219,13 +271,55 @@ struct EffectInstance::Implementation
 
     void setDuringInteractAction(bool b);
 
+    /**
+     * @brief Marks a cached image as being rendered by the calling thread, so that the other renders of the image wait
+     * for it. Returns NULL if the image is not cached, in which case it is not shared.
+     **/
+    IBRPtr markImageAsBeingRendered(const boost::shared_ptr<Image> & img);
+
 #if NATRON_ENABLE_TRIMAP
-    void markImageAsBeingRendered(const boost::shared_ptr<Image> & img);
+    bool waitForImageBeingRenderedElsewhereAndUnmark(const RectI & roi, const IBRPtr & ibr);
+#endif
 
-    bool waitForImageBeingRenderedElsewhereAndUnmark(const RectI & roi, const boost::shared_ptr<Image> & img);
+    /**
+     * @brief Ends the render of an image marked by markImageAsBeingRendered(): once all its renders are done, the
+     * renders waiting for it take the image, or render it themselves if the render failed.
+     **/
+    void unmarkImageAsBeingRendered(const IBRPtr & ibr, bool renderFailed);
 
-    void unmarkImageAsBeingRendered(const boost::shared_ptr<Image> & img, bool renderFailed);
-#endif
+    /**
+     * @brief If another render is rendering the image of this node with the given key, mipmap level and components, waits
+     * for it to be done and returns the rendered image. Returns NULL if the image is not being rendered, if its
+     * render failed, if it is being rendered by the calling thread, or if the render of the caller, described by tls,
+     * was aborted while waiting.
+     **/
+    ImagePtr waitForImageBeingRendered(const EffectDataTLSPtr & tls, const ImageKey & key, unsigned int mipMapLevel, const ImageComponents & components);
+
+    /**
+     * @brief The images of the planes a render marked as being rendered. The destructor unmarks those still marked as
+     * failed, e.g: if the render throws, so that their waiters never wait forever.
+     **/
+    class ScopedImagesBeingRendered
+    {
+        Implementation* _imp;
+
+    public:
+
+        std::map<ImageComponents, IBRPtr> images;
+
+        ScopedImagesBeingRendered(Implementation* imp)
+        : _imp(imp)
+        , images()
+        {
+        }
+
+        ~ScopedImagesBeingRendered()
+        {
+            for (std::map<ImageComponents, IBRPtr>::iterator it = images.begin(); it != images.end(); ++it) {
+                _imp->unmarkImageAsBeingRendered(it->second, true);
+            }
+        }
+    };
     /**
      * @brief This function sets on the thread storage given in parameter all the arguments which
      * are used to render an image.
@@ -31,8 +31,6 @@
 #include <stdexcept>
 #include <fstream>
 
-#include <QtCore/QThreadPool>
-#include <QtConcurrentMap> // QtCore on Qt4, QtConcurrent on Qt5
 #include <QtCore/QReadWriteLock>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QtConcurrentRun>
@@ -68,6 +66,7 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 #include "Engine/RotoContext.h"
 #include "Engine/RotoDrawableItem.h"
 #include "Engine/Settings.h"
+#include "Engine/TaskScheduler.h"
 #include "Engine/Timer.h"
 #include "Engine/Transform.h"
 #include "Engine/ViewerInstance.h"
@@ -466,6 +465,9 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
         }
 
         if (identity) {
+            ///Nothing is rendered: the output is free to compute again, @see Node::shouldCacheOutput
+            getNode()->addRenderCostSample(0., 0);
+
             ///The effect is an identity but it has no inputs
             if (inputNbIdentity == -1) {
                 return eRenderRoIRetCodeOk;
@@ -717,6 +719,19 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
     getPreferredDepthAndComponents(-1, &outputClipPrefComps, &outputDepth);
     assert( !outputClipPrefComps.empty() );
 
+    /*
+     * If the project caches images as half, the images rendered in float are stored as half in the cache: the plug-in
+     * still renders in a float temporary image which is converted when copied to the cached image, and the output
+     * is converted back to float at the end of this function. Nodes painting over their own image render directly in
+     * the cached image hence they always keep its depth.
+     */
+    Natron::ImageBitDepthEnum cacheDepth = args.bitdepth;
+    Natron::ImageBitDepthEnum cachePrefDepth = outputDepth;
+    if ( createInCache && (args.bitdepth == Natron::eImageBitDepthFloat) && (outputDepth == Natron::eImageBitDepthFloat) &&
+         !isPaintingOverItselfEnabled() && getApp()->getProject()->isCachingImagesAsHalf() ) {
+        cacheDepth = cachePrefDepth = Natron::eImageBitDepthHalf;
+    }
+
 
     boost::shared_ptr<ImagePlanesToRender> planesToRender(new ImagePlanesToRender);
     boost::shared_ptr<FramesNeededMap> framesNeeded(new FramesNeededMap);
@@ -756,11 +771,25 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
                 int nLookups = draftModeSupported && tls->frameArgs.draftMode ? 2 : 1;
                 
                 for (int n = 0; n < nLookups; ++n) {
+                    ///If another render is rendering this image, take it once it is rendered instead of rendering it again.
+                    ///The renders using the trimap do not wait: they render the portions of the image not rendered elsewhere.
+                    if ( createInCache && !isPaintingOverItselfEnabled() &&
+                         (tls->frameArgs.canAbort || !tls->frameArgs.isRenderResponseToUserInteraction) ) {
+                        ImagePtr rendered = _imp->waitForImageBeingRendered(tls, n == 0 ? nonDraftKey : key, renderMappedMipMapLevel, *components);
+                        if ( !rendered && _imp->aborted(tls) ) {
+                            return eRenderRoIRetCodeAborted;
+                        }
+                        if ( rendered && (rendered->getBitDepth() == cachePrefDepth) && rendered->getComponents().isConvertibleTo(*it) &&
+                             ( getSizeOfForBitDepth( rendered->getBitDepth() ) >= getSizeOfForBitDepth(cacheDepth) ) ) {
+                            plane.fullscaleImage = rendered;
+                            break;
+                        }
+                    }
                     getImageFromCacheAndConvertIfNeeded(createInCache, useDiskCacheNode, n == 0 ? nonDraftKey : key, renderMappedMipMapLevel,
                                                         renderFullScaleThenDownscale ? &upscaledImageBounds : &downscaledImageBounds,
                                                         &rod,
-                                                        args.bitdepth, *it,
-                                                        outputDepth,
+                                                        cacheDepth, *it,
+                                                        cachePrefDepth,
                                                         *components,
                                                         args.inputImagesList,
                                                         tls->frameArgs.stats,
@@ -901,8 +930,11 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
             EffectInstance::Implementation::IBRPtr ibr;
             {
                 QMutexLocker k(&_imp->imagesBeingRenderedMutex);
-                EffectInstance::Implementation::IBRMap::const_iterator found = _imp->imagesBeingRendered.find(isPlaneCached);
-                if ( ( found != _imp->imagesBeingRendered.end() ) && found->second->refCount ) {
+                EffectInstance::Implementation::IBRMap::const_iterator found =
+                    _imp->imagesBeingRendered.find( EffectInstance::Implementation::ImageBeingRenderedKey( isPlaneCached->getKey().getHash(),
+                                                                                                          isPlaneCached->getMipMapLevel(),
+                                                                                                          isPlaneCached->getComponents() ) );
+                if ( ( found != _imp->imagesBeingRendered.end() ) && (found->second->image == isPlaneCached) && found->second->refCount ) {
                     ibr = found->second;
                 }
             }
@@ -1151,8 +1183,8 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
             getImageFromCacheAndConvertIfNeeded(createInCache, useDiskCacheNode, key, renderMappedMipMapLevel,
                                                 renderFullScaleThenDownscale ? &upscaledImageBounds : &downscaledImageBounds,
                                                 &rod,
-                                                args.bitdepth, it->first,
-                                                outputDepth, *components,
+                                                cacheDepth, it->first,
+                                                cachePrefDepth, *components,
                                                 args.inputImagesList, tls->frameArgs.stats, &it->second.fullscaleImage);
 
             ///We must retrieve from the cache exactly the originally retrieved image, otherwise we might have to call  renderInputImagesForRoI
@@ -1262,7 +1294,7 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
 
             if (!it->second.fullscaleImage) {
                 ///The image is not cached
-                allocateImagePlane(key, rod, downscaledImageBounds, upscaledImageBounds, isProjectFormat, *framesNeeded, *components, args.bitdepth, par, args.mipMapLevel, renderFullScaleThenDownscale, useDiskCacheNode, createInCache, &it->second.fullscaleImage, &it->second.downscaleImage);
+                allocateImagePlane(key, rod, downscaledImageBounds, upscaledImageBounds, isProjectFormat, *framesNeeded, *components, cacheDepth, par, args.mipMapLevel, renderFullScaleThenDownscale, useDiskCacheNode, createInCache, &it->second.fullscaleImage, &it->second.downscaleImage);
             } else {
                 /*
                  * There might be a situation  where the RoD of the cached image
@@ -1317,7 +1349,7 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
                 if ( renderFullScaleThenDownscale && (it->second.fullscaleImage->getMipMapLevel() == 0) ) {
                     RectI bounds;
                     rod.toPixelEnclosing(args.mipMapLevel, par, &bounds);
-                    it->second.downscaleImage.reset( new Natron::Image(*components, rod, downscaledImageBounds, args.mipMapLevel, it->second.fullscaleImage->getPixelAspectRatio(), outputDepth, true) );
+                    it->second.downscaleImage.reset( new Natron::Image(*components, rod, downscaledImageBounds, args.mipMapLevel, it->second.fullscaleImage->getPixelAspectRatio(), it->second.fullscaleImage->getBitDepth(), true) );
                     
                     it->second.fullscaleImage->downscaleMipMap( rod, it->second.fullscaleImage->getBounds(), 0, args.mipMapLevel, true, it->second.downscaleImage.get() );
                 }
@@ -1347,14 +1379,11 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
     if (!hasSomethingToRender && !planesToRender->isBeingRenderedElsewhere) {
         renderAborted = _imp->aborted(tls);
     } else {
-#if NATRON_ENABLE_TRIMAP
-        ///Only use trimap system if the render cannot be aborted.
-        if (!tls->frameArgs.canAbort && tls->frameArgs.isRenderResponseToUserInteraction) {
-            for (std::map<ImageComponents, EffectInstance::PlaneToRender>::iterator it = planesToRender->planes.begin(); it != planesToRender->planes.end(); ++it) {
-                _imp->markImageAsBeingRendered(renderFullScaleThenDownscale ? it->second.fullscaleImage : it->second.downscaleImage);
-            }
+        ///Let the other renders of the planes wait for this one, see waitForImageBeingRendered()
+        EffectInstance::Implementation::ScopedImagesBeingRendered imagesBeingRendered( _imp.get() );
+        for (std::map<ImageComponents, EffectInstance::PlaneToRender>::iterator it = planesToRender->planes.begin(); it != planesToRender->planes.end(); ++it) {
+            imagesBeingRendered.images[it->first] = _imp->markImageAsBeingRendered(renderFullScaleThenDownscale ? it->second.fullscaleImage : it->second.downscaleImage);
         }
-#endif
 
         if (hasSomethingToRender) {
             
@@ -1419,32 +1448,38 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
         } // if (hasSomethingToRender) {
 
         renderAborted = _imp->aborted(tls);
-#if NATRON_ENABLE_TRIMAP
 
-        if (!tls->frameArgs.canAbort && tls->frameArgs.isRenderResponseToUserInteraction) {
-            ///Only use trimap system if the render cannot be aborted.
-            ///If we were aborted after all (because the node got deleted) then return a NULL image and empty the cache
-            ///of this image
-            for (std::map<ImageComponents, EffectInstance::PlaneToRender>::iterator it = planesToRender->planes.begin(); it != planesToRender->planes.end(); ++it) {
-                if (!renderAborted) {
-                    if ( (renderRetCode == eRenderRoIStatusRenderFailed) || !planesToRender->isBeingRenderedElsewhere ) {
-                        _imp->unmarkImageAsBeingRendered(renderFullScaleThenDownscale ? it->second.fullscaleImage : it->second.downscaleImage,
-                                                         renderRetCode == eRenderRoIStatusRenderFailed);
-                    } else {
-                        if ( !_imp->waitForImageBeingRenderedElsewhereAndUnmark(roi,
-                                                                                renderFullScaleThenDownscale ? it->second.fullscaleImage : it->second.downscaleImage) ) {
-                            renderAborted = true;
-                        }
-                    }
-                } else {
+        ///If we were aborted after all (because the node got deleted) then return a NULL image and empty the cache
+        ///of this image
+        bool abortedWithTrimap = false;
+        for (std::map<ImageComponents, EffectInstance::PlaneToRender>::iterator it = planesToRender->planes.begin(); it != planesToRender->planes.end(); ++it) {
+            EffectInstance::Implementation::IBRPtr ibr;
+            ibr.swap(imagesBeingRendered.images[it->first]);
+            if (renderAborted) {
+#if NATRON_ENABLE_TRIMAP
+                if (!tls->frameArgs.canAbort && tls->frameArgs.isRenderResponseToUserInteraction) {
                     appPTR->removeFromNodeCache(renderFullScaleThenDownscale ? it->second.fullscaleImage : it->second.downscaleImage);
-                    _imp->unmarkImageAsBeingRendered(renderFullScaleThenDownscale ? it->second.fullscaleImage : it->second.downscaleImage, true);
-
-                    return eRenderRoIRetCodeAborted;
+                    abortedWithTrimap = true;
                 }
+#endif
+                _imp->unmarkImageAsBeingRendered(ibr, true);
+                continue;
+            }
+#if NATRON_ENABLE_TRIMAP
+            ///Only use trimap system if the render cannot be aborted.
+            if ( !tls->frameArgs.canAbort && tls->frameArgs.isRenderResponseToUserInteraction &&
+                 (renderRetCode != eRenderRoIStatusRenderFailed) && planesToRender->isBeingRenderedElsewhere ) {
+                if ( !_imp->waitForImageBeingRenderedElsewhereAndUnmark(roi, ibr) ) {
+                    renderAborted = true;
+                }
+                continue;
             }
-        }
 #endif
+            _imp->unmarkImageAsBeingRendered(ibr, renderRetCode == eRenderRoIStatusRenderFailed);
+        }
+        if (abortedWithTrimap) {
+            return eRenderRoIRetCodeAborted;
+        }
     } // if (!hasSomethingToRender && !planesToRender->isBeingRenderedElsewhere) {
 
 
@@ -1520,6 +1555,12 @@ EffectInstance::renderRoI(const RenderRoIArgs & args,
             }
         }
         
+        ///Share what we rendered with the other processes rendering the same graph
+        if ( hasSomethingToRender && createInCache && !useDiskCacheNode &&
+             (renderRetCode != eRenderRoIStatusRenderFailed) && getNode()->isHashContentBased() ) {
+            insertImageInSharedCache(it->second.fullscaleImage);
+        }
+        
         //We have to return the downscale image, so make sure it has been computed
         if ( (renderRetCode != eRenderRoIStatusRenderFailed) &&
             renderFullScaleThenDownscale &&
@@ -1646,9 +1687,10 @@ EffectInstance::renderRoIInternal(double time,
         ///If the plug-in is eRenderSafetyFullySafeFrame that means it wants the host to perform SMP aka slice up the RoI into chunks
         ///but if the effect doesn't support tiles it won't work.
         ///Also check that the number of threads indicating by the settings are appropriate for this render mode.
+        ///The tiles are run by the TaskScheduler, which never starts more threads than it has even when the renders of
+        ///the inputs also split their tiles: there is no need to fall back to a single thread when all of them are busy.
         if ( !frameArgs.tilesSupported || (nbThreads == -1) || (nbThreads == 1) ||
             ( (nbThreads == 0) && (appPTR->getHardwareIdealThreadCount() == 1) ) ||
-            ( QThreadPool::globalInstance()->activeThreadCount() >= QThreadPool::globalInstance()->maxThreadCount() ) ||
             isRotoPaintNode() ) {
             safety = eRenderSafetyFullySafe;
         }
@@ -1723,29 +1765,40 @@ EffectInstance::renderRoIInternal(double time,
             tiledArgs->compsNeeded = compsNeeded;
 
 
+            std::vector<EffectInstance::RenderingFunctorRetEnum> ret( planesToRender->rectsToRender.size() );
 #ifdef NATRON_HOSTFRAMETHREADING_SEQUENTIAL
-            std::vector<EffectInstance::RenderingFunctorRetEnum> ret( tiledData.size() );
             int i = 0;
             for (std::list<RectToRender>::const_iterator it = planesToRender->rectsToRender.begin(); it != planesToRender->rectsToRender.end(); ++it, ++i) {
-                ret[i] = tiledRenderingFunctor(tiledArgs,
-                                               *it,
-                                               currentThread);
+                ret[i] = _imp->tiledRenderingFunctor(*tiledArgs,
+                                                     *it,
+                                                     currentThread);
             }
-            std::vector<EffectInstance::RenderingFunctorRetEnum>::const_iterator it2;
 
 #else
 
-
-            QFuture<RenderingFunctorRetEnum> ret = QtConcurrent::mapped( planesToRender->rectsToRender,
-                                                                        boost::bind(&EffectInstance::Implementation::tiledRenderingFunctor,
-                                                                                    _imp.get(),
-                                                                                    *tiledArgs,
-                                                                                    _1,
-                                                                                    currentThread) );
-            ret.waitForFinished();
-            QFuture<EffectInstance::RenderingFunctorRetEnum>::const_iterator it2;
+            {
+                ///This thread renders the tiles that no thread of the scheduler took
+                TaskGroup tiles( appPTR->getTaskScheduler() );
+                int i = 0;
+                for (std::list<RectToRender>::const_iterator it = planesToRender->rectsToRender.begin(); it != planesToRender->rectsToRender.end(); ++it, ++i) {
+                    tiles.run( boost::function<RenderingFunctorRetEnum ()>( boost::bind(&EffectInstance::Implementation::tiledRenderingFunctor,
+                                                                                        _imp.get(),
+                                                                                        boost::ref(*tiledArgs),
+                                                                                        boost::cref(*it),
+                                                                                        currentThread) ),
+                               &ret[i] );
+                }
+                try {
+                    tiles.wait();
+                } catch (const std::exception & e) {
+                    ///A tile that threw did not store its result: the whole render fails
+                    qDebug() << getScriptName_mt_safe().c_str() << ": exception while rendering a tile:" << e.what();
+                    renderStatus = eRenderingFunctorRetFailed;
+                }
+            }
 
 #endif
+            std::vector<EffectInstance::RenderingFunctorRetEnum>::const_iterator it2;
             for (it2 = ret.begin(); it2 != ret.end(); ++it2) {
                 if ( (*it2) == EffectInstance::eRenderingFunctorRetFailed ) {
                     renderStatus = eRenderingFunctorRetFailed;
@@ -80,6 +80,10 @@ SOURCES += \
     Bezier.cpp \
     BezierCP.cpp \
     BlockingBackgroundRender.cpp \
+    CacheAccessTrace.cpp \
+    CacheCompression.cpp \
+    CacheSegmentStore.cpp \
+    CacheStats.cpp \
     CLArgs.cpp \
     CoonsRegularization.cpp \
     Curve.cpp \
@@ -117,6 +121,7 @@ SOURCES += \
     Log.cpp \
     Lut.cpp \
     MemoryFile.cpp \
+    MemoryPressure.cpp \
     Node.cpp \
     NodeGroup.cpp \
     NodeGroupWrapper.cpp \
@@ -147,6 +152,7 @@ SOURCES += \
     PySideCompat.cpp \
     RectD.cpp \
     RectI.cpp \
+    RenderArena.cpp \
     RenderStats.cpp \
     RotoContext.cpp \
     RotoDrawableItem.cpp \
@@ -158,8 +164,11 @@ SOURCES += \
     RotoWrapper.cpp \
     ScriptObject.cpp \
     Settings.cpp \
+    SharedImageCache.cpp \
+    SIMD.cpp \
     StandardPaths.cpp \
     StringAnimationManager.cpp \
+    TaskScheduler.cpp \
     TextureRect.cpp \
     TimeLine.cpp \
     Timer.cpp \
@@ -226,7 +235,11 @@ HEADERS += \
     Cache.h \
     CacheEntry.h \
     CacheEntryHolder.h \
+    CacheAccessTrace.h \
+    CacheCompression.h \
+    CacheSegmentStore.h \
     CacheSerialization.h \
+    CacheStats.h \
     CoonsRegularization.h \
     Curve.h \
     CurveSerialization.h \
@@ -252,6 +265,7 @@ HEADERS += \
     GlobalFunctionsWrapper.h \
     GroupInput.h \
     GroupOutput.h \
+    Half.h \
     Hash64.h \
     HistogramCPU.h \
     ImageInfo.h \
@@ -276,6 +290,7 @@ HEADERS += \
     LRUHashTable.h \
     Lut.h \
     MemoryFile.h \
+    MemoryPressure.h \
     MergingEnum.h \
     Node.h \
     NodeGroup.h \
@@ -313,6 +328,7 @@ HEADERS += \
     RectDSerialization.h \
     RectI.h \
     RectISerialization.h \
+    RenderArena.h \
     RenderStats.h \
     RotoContext.h \
     RotoContextPrivate.h \
@@ -331,9 +347,12 @@ HEADERS += \
     RotoWrapper.h \
     ScriptObject.h \
     Settings.h \
+    SharedImageCache.h \
+    SIMD.h \
     Singleton.h \
     StandardPaths.h \
     StringAnimationManager.h \
+    TaskScheduler.h \
     TextureRect.h \
     TextureRectSerialization.h \
     ThreadStorage.h \
@@ -195,6 +195,9 @@ class OfxParamOverlayInteract;
 class OutputEffectInstance;
 class Plugin;
 class Project;
+class RenderArena;
+class SharedImageCache;
+class TaskScheduler;
 namespace Color {
 class Lut;
 }
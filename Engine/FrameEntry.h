@@ -80,6 +80,13 @@ public:
 
     const U8* pixelAt(int x, int y ) const WARN_UNUSED_RETURN;
 
+    ///Textures are made of 4 components pixels, either 8 bits or floating point: shuffling 4 bytes elements
+    ///gathers either the channels or the bytes of the floats
+    virtual std::size_t getCompressionElementSize() const OVERRIDE FINAL
+    {
+        return 4;
+    }
+
     void copy(const FrameEntry& other);
 
     void setAborted(bool aborted) {
@@ -32,6 +32,8 @@
 
 #include "Engine/AppManager.h"
 #include "Engine/AppInstanceWrapper.h"
+#include "Engine/CacheStats.h"
+#include "Engine/MemoryPressure.h"
 #include "Global/MemoryInfo.h"
 #include "Engine/EngineFwd.h"
 
@@ -160,6 +162,43 @@ public:
         return appPTR->getHardwareIdealThreadCount();
     }
     
+    inline unsigned long long getMemoryLimit() const
+    {
+        return appPTR->getMemoryPressureState().totalRAM;
+    }
+    
+    inline unsigned long long getAvailableMemory() const
+    {
+        return appPTR->getMemoryPressureState().availableRAM;
+    }
+    
+    inline int getMemoryPressureLevel() const
+    {
+        return (int)appPTR->getMemoryPressureState().level;
+    }
+    
+    inline unsigned long long getNodeCacheMemoryBudget() const
+    {
+        return appPTR->getNodeCacheMemoryBudget();
+    }
+    
+    inline unsigned long long getViewerCacheMemoryBudget() const
+    {
+        return appPTR->getViewerCacheMemoryBudget();
+    }
+    
+    inline std::map<std::string, Natron::CacheStatsSnapshot> getCacheStats() const
+    {
+        std::map<std::string, Natron::CacheStatsSnapshot> ret;
+        appPTR->getCachesStats(&ret);
+        return ret;
+    }
+    
+    inline void resetCacheStats()
+    {
+        appPTR->resetCachesStats();
+    }
+    
     inline App*
     getInstance(int idx) const
     {
@@ -0,0 +1,173 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NATRON_ENGINE_HALF_H
+#define NATRON_ENGINE_HALF_H
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <cstring> // memcpy
+
+namespace Natron {
+/**
+ * @brief A 16-bit IEEE 754 floating point sample, the storage type of eImageBitDepthHalf images.
+ * Like OpenEXR's half, it converts implicitly from and to float so that the image processing templates can be
+ * instantiated with it: the arithmetic is made in float and rounded back to the nearest half when stored.
+ * The conversions give the same results as the F16C instructions used by the SIMD row kernels:
+ * round to nearest even, overflow to infinity, NaNs stay NaNs and are made quiet.
+ **/
+class Half
+{
+public:
+
+    Half()
+        : _h(0)
+    {
+    }
+
+    Half(float f)
+        : _h( floatToHalf(f) )
+    {
+    }
+
+    operator float() const
+    {
+        return halfToFloat(_h);
+    }
+
+    Half & operator+=(float f)
+    {
+        _h = floatToHalf(halfToFloat(_h) + f);
+
+        return *this;
+    }
+
+    Half & operator-=(float f)
+    {
+        _h = floatToHalf(halfToFloat(_h) - f);
+
+        return *this;
+    }
+
+    Half & operator*=(float f)
+    {
+        _h = floatToHalf(halfToFloat(_h) * f);
+
+        return *this;
+    }
+
+    Half & operator/=(float f)
+    {
+        _h = floatToHalf(halfToFloat(_h) / f);
+
+        return *this;
+    }
+
+    unsigned short bits() const
+    {
+        return _h;
+    }
+
+    void setBits(unsigned short bits)
+    {
+        _h = bits;
+    }
+
+    static float halfToFloat(unsigned short h)
+    {
+        const unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+        unsigned int exponent = (h >> 10) & 0x1f;
+        unsigned int mantissa = h & 0x3ff;
+        unsigned int bits;
+
+        if ( (exponent != 0) && (exponent != 0x1f) ) {
+            // normal: rebias the exponent from 15 to 127
+            bits = sign | ( (exponent + 112) << 23 ) | (mantissa << 13);
+        } else if (exponent == 0x1f) {
+            // infinity or quiet NaN
+            bits = sign | 0x7f800000 | (mantissa << 13) | (mantissa ? 0x400000 : 0);
+        } else if (mantissa == 0) {
+            bits = sign;
+        } else {
+            // subnormal: normalize it, every half is a normal float
+            exponent = 1;
+            while ( !(mantissa & 0x400) ) {
+                mantissa <<= 1;
+                --exponent;
+            }
+            bits = sign | ( (exponent + 112) << 23 ) | ( (mantissa & 0x3ff) << 13 );
+        }
+        float f;
+        std::memcpy( &f, &bits, sizeof(f) );
+
+        return f;
+    }
+
+    static unsigned short floatToHalf(float f)
+    {
+        unsigned int bits;
+
+        std::memcpy( &bits, &f, sizeof(bits) );
+        const unsigned short sign = (unsigned short)( (bits >> 16) & 0x8000 );
+        const unsigned int absBits = bits & 0x7fffffff;
+
+        if (absBits >= 0x7f800000) {
+            // infinity or NaN, which keeps its most significant mantissa bits and is made quiet
+            return (unsigned short)( sign | 0x7c00 | ( absBits > 0x7f800000 ? ( 0x200 | ( (absBits >> 13) & 0x3ff ) ) : 0 ) );
+        }
+        if (absBits >= 0x477ff000) {
+            // rounds above 65504, the largest half
+            return (unsigned short)(sign | 0x7c00);
+        }
+        unsigned int rounded;
+        unsigned int remainder;
+        unsigned int halfway;
+        if (absBits >= 0x38800000) {
+            // normal half: rebias the exponent from 127 to 15, a carry of the rounding goes to the exponent
+            rounded = (absBits - 0x38000000) >> 13;
+            remainder = absBits & 0x1fff;
+            halfway = 0x1000;
+        } else if (absBits > 0x33000000) {
+            // subnormal half, in units of 2^-24
+            const unsigned int shift = 126 - (absBits >> 23);
+            const unsigned int mantissa = (absBits & 0x7fffff) | 0x800000;
+            rounded = mantissa >> shift;
+            remainder = mantissa & ( (1u << shift) - 1 );
+            halfway = 1u << (shift - 1);
+        } else {
+            // rounds to 0
+            return sign;
+        }
+        if ( (remainder > halfway) || ( (remainder == halfway) && (rounded & 1) ) ) {
+            ++rounded;
+        }
+
+        return (unsigned short)(sign | rounded);
+    }
+
+private:
+
+    unsigned short _h;
+};
+} // namespace Natron
+
+#endif // NATRON_ENGINE_HALF_H
@@ -27,178 +27,300 @@
 #include <algorithm> // min, max
 
 #include <QDebug>
+#if !defined(SBK_RUN) && !defined(Q_MOC_RUN)
+GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_OFF
+// /usr/local/include/boost/bind/arg.hpp:37:9: warning: unused typedef 'boost_static_assert_typedef_37' [-Wunused-local-typedef]
+#include <boost/bind.hpp>
+GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
+#endif
 
 #include "Engine/AppManager.h"
+#include "Engine/SIMD.h"
+#include "Engine/TaskScheduler.h"
 
 using namespace Natron;
 
-#define BM_GET(i,j) &_map[( i - _bounds.bottom() ) * _bounds.width() + ( j - _bounds.left() )]
-
 #define PIXEL_UNAVAILABLE 2
 
-template <int trimap>
-RectI minimalNonMarkedBbox_internal(const RectI& roi, const RectI& _bounds,const std::vector<char>& _map,
-                                    bool* isBeingRenderedElsewhere)
+///Image operations on fewer bytes than this are not worth being split between threads, see Image::processRowBands
+#define NATRON_IMAGE_MT_MIN_BYTES (4 * 1024 * 1024)
+
+///The minimum number of rows of the bands processed by each thread
+#define NATRON_IMAGE_MT_MIN_ROWS 16
+
+///The state of a tile of the bitmap whose pixels do not all have the same state
+#define BITMAP_TILE_MIXED 3
+
+///The bit of a state in the masks of states returned by Bitmap::getStatesInRect
+#define BITMAP_STATE_BIT(state) ( 1 << (state) )
+
+void
+Bitmap::initialize(const RectI & bounds)
 {
-    RectI bbox;
-    assert(_bounds.contains(roi));
-    bbox = roi;
-    
-    //find bottom
-    for (int i = bbox.bottom(); i < bbox.top(); ++i) {
-        const char* buf = BM_GET(i, bbox.left());
-        
-        if (trimap) {
-            
-            const char* lineEnd = buf + bbox.width();
-            bool metUnavailablePixel = false;
-            while (buf < lineEnd) {
-                if (!*buf) {
-                    buf = 0;
-                    break;
-                } else if (*buf == PIXEL_UNAVAILABLE) {
-                    metUnavailablePixel = true;
-                }
-                ++buf;
-            }
-            if (!buf) {
-                break;
-            } else if (metUnavailablePixel) {
-                *isBeingRenderedElsewhere = true; //< only flag if the whole row is not 0
-                ++bbox.y1;
+    _bounds = bounds;
+    if ( _bounds.isNull() ) {
+        _tilesX = _tilesY = 0;
+    } else {
+        _tilesX = (_bounds.width() + NATRON_BITMAP_TILE_SIZE - 1) / NATRON_BITMAP_TILE_SIZE;
+        _tilesY = (_bounds.height() + NATRON_BITMAP_TILE_SIZE - 1) / NATRON_BITMAP_TILE_SIZE;
+    }
+    _tiles.assign(_tilesX * _tilesY, 0);
+    _mixedTiles.clear();
+}
+
+void
+Bitmap::setTo1()
+{
+    std::fill(_tiles.begin(), _tiles.end(), 1);
+    _mixedTiles.clear();
+}
+
+RectI
+Bitmap::getTileRect(int tx,
+                    int ty) const
+{
+    RectI ret;
+
+    ret.x1 = _bounds.x1 + tx * NATRON_BITMAP_TILE_SIZE;
+    ret.y1 = _bounds.y1 + ty * NATRON_BITMAP_TILE_SIZE;
+    ret.x2 = std::min(ret.x1 + NATRON_BITMAP_TILE_SIZE, _bounds.x2);
+    ret.y2 = std::min(ret.y1 + NATRON_BITMAP_TILE_SIZE, _bounds.y2);
+
+    return ret;
+}
+
+unsigned char
+Bitmap::getStatesInRect(const RectI & rect) const
+{
+    assert( _bounds.contains(rect) && !rect.isNull() );
+    const unsigned char allStates = BITMAP_STATE_BIT(0) | BITMAP_STATE_BIT(1) | BITMAP_STATE_BIT(PIXEL_UNAVAILABLE);
+    unsigned char states = 0;
+    int tx1 = (rect.x1 - _bounds.x1) / NATRON_BITMAP_TILE_SIZE;
+    int tx2 = (rect.x2 - 1 - _bounds.x1) / NATRON_BITMAP_TILE_SIZE;
+    int ty1 = (rect.y1 - _bounds.y1) / NATRON_BITMAP_TILE_SIZE;
+    int ty2 = (rect.y2 - 1 - _bounds.y1) / NATRON_BITMAP_TILE_SIZE;
+
+    for (int ty = ty1; ty <= ty2; ++ty) {
+        for (int tx = tx1; tx <= tx2; ++tx) {
+            int index = ty * _tilesX + tx;
+            char state = _tiles[index];
+            if (state != BITMAP_TILE_MIXED) {
+                states |= BITMAP_STATE_BIT(state);
             } else {
-                ++bbox.y1;
-            }
-        } else {
-            
-            const char* lineEnd = buf + bbox.width();
-            while (buf < lineEnd) {
-                if (!*buf || *buf == PIXEL_UNAVAILABLE) {
-                    buf = 0;
-                    break;
+                MixedTilesMap::const_iterator found = _mixedTiles.find(index);
+                assert( found != _mixedTiles.end() );
+                RectI tileRect = getTileRect(tx, ty);
+                RectI r;
+                rect.intersect(tileRect, &r);
+                int tileW = tileRect.width();
+                for (int y = r.y1; y < r.y2; ++y) {
+                    const char* pix = &found->second.pixels[(y - tileRect.y1) * tileW + (r.x1 - tileRect.x1)];
+                    const char* end = pix + r.width();
+                    for (; pix < end; ++pix) {
+                        states |= BITMAP_STATE_BIT(*pix);
+                    }
                 }
-                ++buf;
             }
-            if (!buf) {
-                break;
-            } else {
-                ++bbox.y1;
+            if (states == allStates) {
+                return states;
             }
         }
     }
-    
-    //find top (will do zero iteration if the bbox is already empty)
-    for (int i = bbox.top() - 1; i >= bbox.bottom(); --i) {
-        const char* buf = BM_GET(i, bbox.left());
-        
-        if (trimap) {
-            
-            const char* lineEnd = buf + bbox.width();
-            bool metUnavailablePixel = false;
-            while (buf < lineEnd) {
-                if (!*buf) {
-                    buf = 0;
-                    break;
-                } else if (*buf == PIXEL_UNAVAILABLE) {
-                    metUnavailablePixel = true;
-                }
-                ++buf;
+
+    return states;
+}
+
+bool
+Bitmap::getUniformTilesStatesInRect(const RectI & rect,
+                                    unsigned char* states) const
+{
+    assert( _bounds.contains(rect) && !rect.isNull() );
+    int tx1 = (rect.x1 - _bounds.x1) / NATRON_BITMAP_TILE_SIZE;
+    int tx2 = (rect.x2 - 1 - _bounds.x1) / NATRON_BITMAP_TILE_SIZE;
+    int ty1 = (rect.y1 - _bounds.y1) / NATRON_BITMAP_TILE_SIZE;
+    int ty2 = (rect.y2 - 1 - _bounds.y1) / NATRON_BITMAP_TILE_SIZE;
+
+    *states = 0;
+    for (int ty = ty1; ty <= ty2; ++ty) {
+        for (int tx = tx1; tx <= tx2; ++tx) {
+            char state = _tiles[ty * _tilesX + tx];
+            if (state == BITMAP_TILE_MIXED) {
+                return false;
             }
-            if (!buf) {
-                break;
-            } else if (metUnavailablePixel) {
-                *isBeingRenderedElsewhere = true; //< only flag if the whole row is not 0
-                --bbox.y2;
-            } else {
-                --bbox.y2;
+            *states |= BITMAP_STATE_BIT(state);
+        }
+    }
+
+    return true;
+}
+
+int
+Bitmap::countRowsWithout(const RectI & rect,
+                         bool rows,
+                         bool fromStart,
+                         unsigned char stopStates,
+                         unsigned char* skippedStates,
+                         unsigned char* stopRowStates) const
+{
+    *skippedStates = 0;
+    *stopRowStates = 0;
+    if ( rect.isNull() ) {
+        return 0;
+    }
+
+    const int start = rows ? rect.y1 : rect.x1;
+    const int end = rows ? rect.y2 : rect.x2;
+    const int origin = rows ? _bounds.y1 : _bounds.x1;
+    int count = 0;
+
+    while (count < end - start) {
+        ///All the rows of a band that does not cross a tile boundary intersect the same tiles
+        int bandStart, bandEnd;
+        if (fromStart) {
+            bandStart = start + count;
+            bandEnd = std::min(end, origin + ( (bandStart - origin) / NATRON_BITMAP_TILE_SIZE + 1 ) * NATRON_BITMAP_TILE_SIZE);
+        } else {
+            bandEnd = end - count;
+            bandStart = std::max(start, origin + ( (bandEnd - 1 - origin) / NATRON_BITMAP_TILE_SIZE ) * NATRON_BITMAP_TILE_SIZE);
+        }
+        RectI band = rows ? RectI(rect.x1, bandStart, rect.x2, bandEnd) : RectI(bandStart, rect.y1, bandEnd, rect.y2);
+        unsigned char states;
+
+        if ( getUniformTilesStatesInRect(band, &states) ) {
+            ///All rows of the band have the same states, skip them at once
+            if (states & stopStates) {
+                *stopRowStates = states;
+
+                return count;
             }
-            
+            *skippedStates |= states;
+            count += bandEnd - bandStart;
         } else {
-            
-            const char* lineEnd = buf + bbox.width();
-            while (buf < lineEnd) {
-                if (!*buf || *buf == PIXEL_UNAVAILABLE) {
-                    buf = 0;
-                    break;
+            for (int i = 0; i < bandEnd - bandStart; ++i) {
+                int row = fromStart ? bandStart + i : bandEnd - 1 - i;
+                RectI line = rows ? RectI(rect.x1, row, rect.x2, row + 1) : RectI(row, rect.y1, row + 1, rect.y2);
+                states = getStatesInRect(line);
+                if (states & stopStates) {
+                    *stopRowStates = states;
+
+                    return count;
                 }
-                ++buf;
-            }
-            if (!buf) {
-                break;
-            } else {
-                --bbox.y2;
+                *skippedStates |= states;
+                ++count;
             }
         }
     }
-    
-    // avoid making bbox.width() iterations for nothing
-    if ( bbox.isNull() ) {
-        return bbox;
-    }
-    
-    //find left
-    for (int j = bbox.left(); j < bbox.right(); ++j) {
-        const char* pix = BM_GET(bbox.bottom(), j);
 
-        bool metUnavailablePixel = false;
+    return count;
+} // countRowsWithout
 
-        for (int i = bbox.bottom(); i < bbox.top(); ++i, pix += _bounds.width()) {
-            if (!*pix) {
-                pix = 0;
-                break;
+char
+Bitmap::getFirstStateInLine(const RectI & line,
+                            bool row,
+                            unsigned char states) const
+{
+    assert( _bounds.contains(line) && !line.isNull() );
+    const int start = row ? line.x1 : line.y1;
+    const int end = row ? line.x2 : line.y2;
+    const int origin = row ? _bounds.x1 : _bounds.y1;
+
+    for (int pos = start; pos < end;) {
+        ///The part of the line within the same tile
+        int segmentEnd = std::min(end, origin + ( (pos - origin) / NATRON_BITMAP_TILE_SIZE + 1 ) * NATRON_BITMAP_TILE_SIZE);
+        int tx = ( (row ? pos : line.x1) - _bounds.x1 ) / NATRON_BITMAP_TILE_SIZE;
+        int ty = ( (row ? line.y1 : pos) - _bounds.y1 ) / NATRON_BITMAP_TILE_SIZE;
+        int index = ty * _tilesX + tx;
+        char state = _tiles[index];
+        if (state != BITMAP_TILE_MIXED) {
+            if ( states & BITMAP_STATE_BIT(state) ) {
+                return state;
             }
-            
-            else if (*pix == PIXEL_UNAVAILABLE) {
-                if (trimap) {
-                    metUnavailablePixel = true;
-                } else {
-                    pix = 0;
-                    break;
+        } else {
+            MixedTilesMap::const_iterator found = _mixedTiles.find(index);
+            assert( found != _mixedTiles.end() );
+            RectI tileRect = getTileRect(tx, ty);
+            int tileW = tileRect.width();
+            for (int p = pos; p < segmentEnd; ++p) {
+                int x = row ? p : line.x1;
+                int y = row ? line.y1 : p;
+                char pix = found->second.pixels[(y - tileRect.y1) * tileW + (x - tileRect.x1)];
+                if ( states & BITMAP_STATE_BIT(pix) ) {
+                    return pix;
                 }
             }
-            
-        }
-        if (pix) {
-            ++bbox.x1;
-            if (trimap && metUnavailablePixel) {
-                *isBeingRenderedElsewhere = true; //< only flag is the whole column is not 0
-            }
-        } else {
-            break;
         }
+        pos = segmentEnd;
     }
-    
-    //find right
-    for (int j = bbox.right() - 1; j >= bbox.left(); --j) {
-        const char* pix = BM_GET(bbox.bottom(), j);
 
-        bool metUnavailablePixel = false;
+    return -1;
+}
 
-        for (int i = bbox.bottom(); i < bbox.top(); ++i, pix += _bounds.width()) {
-            if (!*pix) {
-                pix = 0;
-                break;
-            }
+bool
+Bitmap::stopsOnPixelUnavailable(const RectI & rect,
+                                bool rows,
+                                bool fromStart,
+                                int count,
+                                unsigned char stopRowStates) const
+{
+    if ( !(stopRowStates & BITMAP_STATE_BIT(PIXEL_UNAVAILABLE)) ) {
+        return false;
+    } else if ( !(stopRowStates & BITMAP_STATE_BIT(1)) ) {
+        return true;
+    }
 
-            else if (*pix == PIXEL_UNAVAILABLE) {
-                if (trimap) {
-                    metUnavailablePixel = true;
-                } else {
-                    pix = 0;
-                    break;
-                }
-            }
+    ///The row holds both states: it is scanned from its left (bottom for a column) up to the first of them
+    RectI line;
+    if (rows) {
+        int y = fromStart ? rect.y1 + count : rect.y2 - 1 - count;
+        line = RectI(rect.x1, y, rect.x2, y + 1);
+    } else {
+        int x = fromStart ? rect.x1 + count : rect.x2 - 1 - count;
+        line = RectI(x, rect.y1, x + 1, rect.y2);
+    }
 
-        }
-        if (pix) {
-            --bbox.x2;
-            if (trimap && metUnavailablePixel) {
-                *isBeingRenderedElsewhere = true; //< only flag is the whole column is not 0
-            }
+    return getFirstStateInLine( line, rows, BITMAP_STATE_BIT(1) | BITMAP_STATE_BIT(PIXEL_UNAVAILABLE) ) == PIXEL_UNAVAILABLE;
+}
 
-        } else {
-            break;
-        }
+RectI
+Bitmap::minimalNonMarkedBbox_internal(const RectI& roi,
+                                      bool trimap,
+                                      bool* isBeingRenderedElsewhere) const
+{
+    RectI bbox;
+    assert(_bounds.contains(roi));
+    bbox = roi;
+    
+    ///Without the trimap, pixels being rendered elsewhere are considered not rendered
+    const unsigned char stopStates = trimap ? BITMAP_STATE_BIT(0) : ( BITMAP_STATE_BIT(0) | BITMAP_STATE_BIT(PIXEL_UNAVAILABLE) );
+    unsigned char skippedStates, stopRowStates;
+    
+    //find bottom
+    bbox.y1 += countRowsWithout(bbox, true, true, stopStates, &skippedStates, &stopRowStates);
+    if ( trimap && (skippedStates & BITMAP_STATE_BIT(PIXEL_UNAVAILABLE)) ) {
+        *isBeingRenderedElsewhere = true; //< only flag if the whole row is not 0
+    }
+    
+    //find top (will do zero iteration if the bbox is already empty)
+    bbox.y2 -= countRowsWithout(bbox, true, false, stopStates, &skippedStates, &stopRowStates);
+    if ( trimap && (skippedStates & BITMAP_STATE_BIT(PIXEL_UNAVAILABLE)) ) {
+        *isBeingRenderedElsewhere = true; //< only flag if the whole row is not 0
+    }
+    
+    // avoid making bbox.width() iterations for nothing
+    if ( bbox.isNull() ) {
+        return bbox;
+    }
+    
+    //find left
+    bbox.x1 += countRowsWithout(bbox, false, true, stopStates, &skippedStates, &stopRowStates);
+    if ( trimap && (skippedStates & BITMAP_STATE_BIT(PIXEL_UNAVAILABLE)) ) {
+        *isBeingRenderedElsewhere = true; //< only flag is the whole column is not 0
+    }
+    
+    //find right
+    bbox.x2 -= countRowsWithout(bbox, false, false, stopStates, &skippedStates, &stopRowStates);
+    if ( trimap && (skippedStates & BITMAP_STATE_BIT(PIXEL_UNAVAILABLE)) ) {
+        *isBeingRenderedElsewhere = true; //< only flag is the whole column is not 0
     }
     
     return bbox;
@@ -206,10 +328,11 @@ RectI minimalNonMarkedBbox_internal(const RectI& roi, const RectI& _bounds,const
 }
 
 
-template <int trimap>
 void
-minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std::vector<char>& _map,
-                               std::list<RectI>& ret,bool* isBeingRenderedElsewhere)
+Bitmap::minimalNonMarkedRects_internal(const RectI & roi,
+                                       bool trimap,
+                                       std::list<RectI>& ret,
+                                       bool* isBeingRenderedElsewhere) const
 {
     ///Any out of bounds portion is pushed to the rectangles to render
     RectI intersection;
@@ -244,7 +367,7 @@ minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std
         return;
     }
     
-    RectI bboxM = minimalNonMarkedBbox_internal<trimap>(intersection, _bounds, _map, isBeingRenderedElsewhere);
+    RectI bboxM = minimalNonMarkedBbox_internal(intersection, trimap, isBeingRenderedElsewhere);
     assert((trimap && isBeingRenderedElsewhere) || (!trimap && !isBeingRenderedElsewhere));
     
     //#define NATRON_BITMAP_DISABLE_OPTIMIZATION
@@ -278,45 +401,22 @@ minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std
     // CXXXXXXXXXXDDD
     // AAAAAAAAAAAAAA
     
+    ///Without the trimap, pixels being rendered elsewhere are considered not rendered
+    const unsigned char stopStates = trimap ? ( BITMAP_STATE_BIT(1) | BITMAP_STATE_BIT(PIXEL_UNAVAILABLE) ) : BITMAP_STATE_BIT(1);
+    unsigned char skippedStates, stopRowStates;
+    int count;
+    
     // First, find if there's an "A" rectangle, and push it to the result
     //find bottom
     RectI bboxX = bboxM;
     RectI bboxA = bboxX;
     bboxA.set_top( bboxX.bottom() );
-    for (int i = bboxX.bottom(); i < bboxX.top(); ++i) {
-        const char* buf = BM_GET(i, bboxX.left());
-        if (trimap) {
-            const char* lineEnd = buf + bboxX.width();
-            bool metUnavailablePixel = false;
-            while (buf < lineEnd) {
-                if (*buf == 1) {
-                    buf = 0;
-                    break;
-                } else if (*buf == PIXEL_UNAVAILABLE && trimap) {
-                    buf = 0;
-                    metUnavailablePixel = true;
-                    break;
-                }
-                ++buf;
-            }
-            if (buf) {
-                ++bboxX.y1;
-                bboxA.y2 = bboxX.y1;
-            } else {
-                if (metUnavailablePixel) {
-                    *isBeingRenderedElsewhere = true;
-                }
-                break;
-            }
-        } else {
-            if ( !memchr( buf, 1, bboxX.width() ) ) {
-                ++bboxX.y1;
-                bboxA.y2 = bboxX.y1;
-            } else {
-                break;
-            }
-        }
+    count = countRowsWithout(bboxX, true, true, stopStates, &skippedStates, &stopRowStates);
+    if ( trimap && stopsOnPixelUnavailable(bboxX, true, true, count, stopRowStates) ) {
+        *isBeingRenderedElsewhere = true;
     }
+    bboxX.y1 += count;
+    bboxA.y2 = bboxX.y1;
     if ( !bboxA.isNull() ) { // empty boxes should not be pushed
         ret.push_back(bboxA);
     }
@@ -325,111 +425,39 @@ minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std
     //find top
     RectI bboxB = bboxX;
     bboxB.set_bottom( bboxX.top() );
-    for (int i = bboxX.top() - 1; i >= bboxX.bottom(); --i) {
-        const char* buf = BM_GET(i, bboxX.left());
-        
-        if (trimap) {
-            const char* lineEnd = buf + bboxX.width();
-            bool metUnavailablePixel = false;
-            while (buf < lineEnd) {
-                if (*buf == 1) {
-                    buf = 0;
-                    break;
-                } else if (*buf == PIXEL_UNAVAILABLE && trimap) {
-                    buf = 0;
-                    metUnavailablePixel = true;
-                    break;
-                }
-                ++buf;
-            }
-            if (buf) {
-                --bboxX.y2;
-                bboxB.y1 = bboxX.y2;
-            } else {
-                if (metUnavailablePixel) {
-                    *isBeingRenderedElsewhere = true;
-                }
-                break;
-            }
-        } else {
-            if ( !memchr( buf, 1, bboxX.width() ) ) {
-                --bboxX.y2;
-                bboxB.y1 = bboxX.y2;
-            } else {
-                break;
-            }
-            
-        }
+    count = countRowsWithout(bboxX, true, false, stopStates, &skippedStates, &stopRowStates);
+    if ( trimap && stopsOnPixelUnavailable(bboxX, true, false, count, stopRowStates) ) {
+        *isBeingRenderedElsewhere = true;
     }
+    bboxX.y2 -= count;
+    bboxB.y1 = bboxX.y2;
     if ( !bboxB.isNull() ) { // empty boxes should not be pushed
         ret.push_back(bboxB);
     }
     
-	//find left
-	RectI bboxC = bboxX;
-	bboxC.set_right( bboxX.left() );
-	if (bboxX.bottom() < bboxX.top()) {
-		for (int j = bboxX.left(); j < bboxX.right(); ++j) {
-			const char* pix = BM_GET(bboxX.bottom(), j);
-
-			bool metUnavailablePixel = false;
-
-			for (int i = bboxX.bottom(); i < bboxX.top(); ++i, pix += _bounds.width()) {
-				if (*pix == 1) {
-					pix = 0;
-					break;
-				} else if (trimap && *pix == PIXEL_UNAVAILABLE) {
-					pix = 0;
-					metUnavailablePixel = true;
-					break;
-				}
-			}
-			if (pix) {
-                ++bboxX.x1;
-                bboxC.x2 = bboxX.x1;
-			} else {
-				if (metUnavailablePixel) {
-					*isBeingRenderedElsewhere = true;
-				}
-				break;
-			}
-		}
-	}
+    //find left
+    RectI bboxC = bboxX;
+    bboxC.set_right( bboxX.left() );
+    count = countRowsWithout(bboxX, false, true, stopStates, &skippedStates, &stopRowStates);
+    if ( trimap && stopsOnPixelUnavailable(bboxX, false, true, count, stopRowStates) ) {
+        *isBeingRenderedElsewhere = true;
+    }
+    bboxX.x1 += count;
+    bboxC.x2 = bboxX.x1;
     if ( !bboxC.isNull() ) { // empty boxes should not be pushed
         ret.push_back(bboxC);
     }
 
-	//find right
-	RectI bboxD = bboxX;
-	bboxD.set_left( bboxX.right() );
-	if (bboxX.bottom() < bboxX.top()) {
-		for (int j = bboxX.right() - 1; j >= bboxX.left(); --j) {
-			const char* pix = BM_GET(bboxX.bottom(), j);
-
-			bool metUnavailablePixel = false;
-
-			for (int i = bboxX.bottom(); i < bboxX.top(); ++i, pix += _bounds.width()) {
-				if (*pix == 1) {
-					pix = 0;
-					break;
-				} else if (trimap && *pix == PIXEL_UNAVAILABLE) {
-					pix = 0;
-					metUnavailablePixel = true;
-					break;
-				}
-			}
-			if (pix) {
-                --bboxX.x2;
-                bboxD.x1 = bboxX.x2;
-			} else {
-				if (metUnavailablePixel) {
-					*isBeingRenderedElsewhere = true;
-				}
-				break;
-			}
-		}
-	}
-	if ( !bboxD.isNull() ) { // empty boxes should not be pushed
+    //find right
+    RectI bboxD = bboxX;
+    bboxD.set_left( bboxX.right() );
+    count = countRowsWithout(bboxX, false, false, stopStates, &skippedStates, &stopRowStates);
+    if ( trimap && stopsOnPixelUnavailable(bboxX, false, false, count, stopRowStates) ) {
+        *isBeingRenderedElsewhere = true;
+    }
+    bboxX.x2 -= count;
+    bboxD.x1 = bboxX.x2;
+    if ( !bboxD.isNull() ) { // empty boxes should not be pushed
         ret.push_back(bboxD);
     }
     
@@ -454,7 +482,9 @@ minimalNonMarkedRects_internal(const RectI & roi,const RectI& _bounds, const std
     assert( bboxD.bottom() == bboxX.bottom() );
     
     // get the bounding box of what's left (the X rectangle in the drawing above)
-    bboxX = minimalNonMarkedBbox_internal<trimap>(bboxX,_bounds,_map,isBeingRenderedElsewhere);
+    if ( !bboxX.isNull() ) {
+        bboxX = minimalNonMarkedBbox_internal(bboxX, trimap, isBeingRenderedElsewhere);
+    }
     
     if ( !bboxX.isNull() ) { // empty boxes should not be pushed
         ret.push_back(bboxX);
@@ -472,9 +502,9 @@ Bitmap::minimalNonMarkedBbox(const RectI & roi) const
         if (!roi.intersect(_dirtyZone, &realRoi)) {
             return RectI();
         }
-        return minimalNonMarkedBbox_internal<0>(realRoi, _bounds, _map, NULL);
+        return minimalNonMarkedBbox_internal(realRoi, false, NULL);
     } else {
-        return minimalNonMarkedBbox_internal<0>(roi, _bounds, _map, NULL);
+        return minimalNonMarkedBbox_internal(roi, false, NULL);
     }
 }
 
@@ -486,9 +516,9 @@ Bitmap::minimalNonMarkedRects(const RectI & roi,std::list<RectI>& ret) const
         if (!roi.intersect(_dirtyZone, &realRoi)) {
             return;
         }
-        minimalNonMarkedRects_internal<0>(realRoi, _bounds, _map,ret , NULL);
+        minimalNonMarkedRects_internal(realRoi, false, ret , NULL);
     } else {
-        minimalNonMarkedRects_internal<0>(roi, _bounds, _map,ret , NULL);
+        minimalNonMarkedRects_internal(roi, false, ret , NULL);
     }
 }
 
@@ -502,9 +532,9 @@ Bitmap::minimalNonMarkedBbox_trimap(const RectI & roi,bool* isBeingRenderedElsew
             *isBeingRenderedElsewhere = false;
             return RectI();
         }
-        return minimalNonMarkedBbox_internal<1>(realRoi, _bounds, _map, isBeingRenderedElsewhere);
+        return minimalNonMarkedBbox_internal(realRoi, true, isBeingRenderedElsewhere);
     } else {
-        return minimalNonMarkedBbox_internal<1>(roi, _bounds, _map, isBeingRenderedElsewhere);
+        return minimalNonMarkedBbox_internal(roi, true, isBeingRenderedElsewhere);
     }
 }
 
@@ -518,77 +548,131 @@ Bitmap::minimalNonMarkedRects_trimap(const RectI & roi,std::list<RectI>& ret,boo
             *isBeingRenderedElsewhere = false;
             return;
         }
-        minimalNonMarkedRects_internal<1>(realRoi, _bounds, _map ,ret , isBeingRenderedElsewhere);
+        minimalNonMarkedRects_internal(realRoi, true, ret , isBeingRenderedElsewhere);
     } else {
-        minimalNonMarkedRects_internal<1>(roi, _bounds, _map ,ret , isBeingRenderedElsewhere);
+        minimalNonMarkedRects_internal(roi, true, ret , isBeingRenderedElsewhere);
     }
 } 
 #endif
 
 void
-Natron::Bitmap::markForRendered(const RectI & roi)
+Bitmap::setPixels(int tileIndex,
+                  const RectI & tileRect,
+                  const RectI & rect,
+                  char state)
+{
+    int tileArea = (int)tileRect.area();
+    MixedTile & tile = _mixedTiles[tileIndex];
+
+    if (_tiles[tileIndex] != BITMAP_TILE_MIXED) {
+        ///The tile was uniform, give its state to each of its pixels
+        char tileState = _tiles[tileIndex];
+        tile.pixels.assign(tileArea, tileState);
+        tile.count[0] = tile.count[1] = tile.count[PIXEL_UNAVAILABLE] = 0;
+        tile.count[(int)tileState] = tileArea;
+        _tiles[tileIndex] = BITMAP_TILE_MIXED;
+    }
+
+    int tileW = tileRect.width();
+    for (int y = rect.y1; y < rect.y2; ++y) {
+        char* pix = &tile.pixels[(y - tileRect.y1) * tileW + (rect.x1 - tileRect.x1)];
+        char* end = pix + rect.width();
+        for (; pix < end; ++pix) {
+            --tile.count[(int)*pix];
+            *pix = state;
+        }
+    }
+    tile.count[(int)state] += (int)rect.area();
+
+    if (tile.count[(int)state] == tileArea) {
+        ///The tile is uniform again
+        _mixedTiles.erase(tileIndex);
+        _tiles[tileIndex] = state;
+    }
+}
+
+void
+Bitmap::fill(const RectI & roi,
+             char state)
 {
-    char* buf = BM_GET(roi.bottom(), roi.left());
-    int w = _bounds.width();
-    int roiw = roi.width();
-    for (int i = roi.y1; i < roi.y2; ++i, buf += w) {
-        memset( buf, 1, roiw);
+    RectI rect;
+
+    if ( !roi.intersect(_bounds, &rect) ) {
+        return;
+    }
+    int tx1 = (rect.x1 - _bounds.x1) / NATRON_BITMAP_TILE_SIZE;
+    int tx2 = (rect.x2 - 1 - _bounds.x1) / NATRON_BITMAP_TILE_SIZE;
+    int ty1 = (rect.y1 - _bounds.y1) / NATRON_BITMAP_TILE_SIZE;
+    int ty2 = (rect.y2 - 1 - _bounds.y1) / NATRON_BITMAP_TILE_SIZE;
+
+    for (int ty = ty1; ty <= ty2; ++ty) {
+        for (int tx = tx1; tx <= tx2; ++tx) {
+            int index = ty * _tilesX + tx;
+            RectI tileRect = getTileRect(tx, ty);
+            RectI r;
+            rect.intersect(tileRect, &r);
+            if (r == tileRect) {
+                if (_tiles[index] == BITMAP_TILE_MIXED) {
+                    _mixedTiles.erase(index);
+                }
+                _tiles[index] = state;
+            } else if (_tiles[index] != state) {
+                setPixels(index, tileRect, r, state);
+            }
+        }
     }
 }
 
+void
+Natron::Bitmap::markForRendered(const RectI & roi)
+{
+    fill(roi, 1);
+}
+
 #if NATRON_ENABLE_TRIMAP
 void
 Natron::Bitmap::markForRendering(const RectI & roi)
 {
-    char* buf = BM_GET(roi.bottom(), roi.left());
-    int w = _bounds.width();
-    int roiw = roi.width();
-    for (int i = roi.y1; i < roi.y2; ++i, buf += w) {
-        memset( buf, PIXEL_UNAVAILABLE , roiw );
-    }
+    fill(roi, PIXEL_UNAVAILABLE);
 }
 #endif
 
 void
 Natron::Bitmap::clear(const RectI& roi)
 {
-    char* buf = BM_GET(roi.bottom(), roi.left());
-    int w = _bounds.width();
-    int roiw = roi.width();
-    for (int i = roi.y1; i < roi.y2; ++i, buf += w) {
-        memset( buf, 0 , roiw );
-    }
+    fill(roi, 0);
 }
 
 void
 Natron::Bitmap::swap(Bitmap& other)
 {
-    _map.swap(other._map);
-    _bounds = other._bounds;
+    std::swap(_bounds, other._bounds);
+    std::swap(_tilesX, other._tilesX);
+    std::swap(_tilesY, other._tilesY);
+    _tiles.swap(other._tiles);
+    _mixedTiles.swap(other._mixedTiles);
     _dirtyZone.clear();//merge(other._dirtyZone);
     _dirtyZoneSet = false;
 }
 
-const char*
-Natron::Bitmap::getBitmapAt(int x,
-                            int y) const
+char
+Natron::Bitmap::getPixel(int x,
+                         int y) const
 {
-    if ( ( x >= _bounds.left() ) && ( x < _bounds.right() ) && ( y >= _bounds.bottom() ) && ( y < _bounds.top() ) ) {
-        return BM_GET(y,x);
-    } else {
-        return NULL;
-    }
-}
+    assert( ( x >= _bounds.left() ) && ( x < _bounds.right() ) && ( y >= _bounds.bottom() ) && ( y < _bounds.top() ) );
+    int tx = (x - _bounds.x1) / NATRON_BITMAP_TILE_SIZE;
+    int ty = (y - _bounds.y1) / NATRON_BITMAP_TILE_SIZE;
+    int index = ty * _tilesX + tx;
+    char state = _tiles[index];
 
-char*
-Natron::Bitmap::getBitmapAt(int x,
-                            int y)
-{
-    if ( ( x >= _bounds.left() ) && ( x < _bounds.right() ) && ( y >= _bounds.bottom() ) && ( y < _bounds.top() ) ) {
-        return BM_GET(y,x);
-    } else {
-        return NULL;
+    if (state != BITMAP_TILE_MIXED) {
+        return state;
     }
+    MixedTilesMap::const_iterator found = _mixedTiles.find(index);
+    assert( found != _mixedTiles.end() );
+    RectI tileRect = getTileRect(tx, ty);
+
+    return found->second.pixels[(y - tileRect.y1) * tileRect.width() + (x - tileRect.x1)];
 }
 
 #ifdef DEBUG
@@ -600,16 +684,12 @@ Image::printUnrenderedPixels(const RectI& roi) const
     }
     QReadLocker k(&_entryLock);
     
-    const char* bm = _bitmap.getBitmapAt(roi.x1, roi.y1);
-    int roiw = roi.x2 - roi.x1;
-    int boundsW = _bitmap.getBounds().width();
-    
-    for (int y = roi.y1; y < roi.y2; ++y,
-         bm += (boundsW - roiw)) {
-        for (int x = roi.x1; x < roi.x2; ++x,++bm) {
-            if (*bm == 0) {
+    for (int y = roi.y1; y < roi.y2; ++y) {
+        for (int x = roi.x1; x < roi.x2; ++x) {
+            char bm = _bitmap.getPixel(x, y);
+            if (bm == 0) {
                 qDebug() << '(' << x << ',' << y << ") = 0";
-            } else if (*bm == PIXEL_UNAVAILABLE) {
+            } else if (bm == PIXEL_UNAVAILABLE) {
                 qDebug() << '(' << x << ',' << y << ") = PIXEL_UNAVAILABLE";
             }
         }
@@ -794,7 +874,7 @@ Image::pasteFromForDepth(const Natron::Image & srcImg,
     ///Cannot copy images with different bit depth, this is not the purpose of this function.
     ///@see convert
     assert( getBitDepth() == srcImg.getBitDepth() );
-    assert( (getBitDepth() == eImageBitDepthByte && sizeof(PIX) == 1) || (getBitDepth() == eImageBitDepthShort && sizeof(PIX) == 2) || (getBitDepth() == eImageBitDepthFloat && sizeof(PIX) == 4) );
+    assert( (getBitDepth() == eImageBitDepthByte && sizeof(PIX) == 1) || (getBitDepth() == eImageBitDepthShort && sizeof(PIX) == 2) || (getBitDepth() == eImageBitDepthHalf && sizeof(PIX) == 2) || (getBitDepth() == eImageBitDepthFloat && sizeof(PIX) == 4) );
     // NOTE: before removing the following asserts, please explain why an empty image may happen
     
     QWriteLocker k(&_entryLock);
@@ -831,8 +911,22 @@ Image::pasteFromForDepth(const Natron::Image & srcImg,
     }
     // now we're safe: both images contain the area in roi
     
-    int srcRowElements = components * srcBounds.width();
-    int dstRowElements = components * bounds.width();
+    if ( (roi == bounds) && (srcBounds == bounds) && sharePixelsFrom(srcImg) ) {
+        return;
+    }
+    
+    makeWritable();
+    processRowBands( roi, components * sizeof(PIX), boost::bind(&Image::pasteRowsForDepth<PIX>, this, boost::cref(srcImg), _1) );
+}
+
+template<typename PIX>
+void
+Image::pasteRowsForDepth(const Natron::Image & srcImg,
+                         const RectI & roi)
+{
+    int components = getComponents().getNumComponents();
+    int srcRowElements = components * srcImg._bounds.width();
+    int dstRowElements = components * _bounds.width();
     
     const PIX* src = (const PIX*)srcImg.pixelAt(roi.x1, roi.y1);
     PIX* dst = (PIX*)pixelAt(roi.x1, roi.y1);
@@ -847,6 +941,61 @@ Image::pasteFromForDepth(const Natron::Image & srcImg,
     }
 }
 
+void
+Image::processRowBands(const RectI & roi,
+                       std::size_t pixelBytes,
+                       const boost::function<void (const RectI &)> & func)
+{
+    if ( roi.isNull() ) {
+        return;
+    }
+    
+    int nThreads = 1;
+    if ( ( (double)roi.area() * pixelBytes >= NATRON_IMAGE_MT_MIN_BYTES ) && appPTR ) {
+        int nThreadsToRender, nThreadsPerEffect;
+        appPTR->getNThreadsSettings(&nThreadsToRender, &nThreadsPerEffect);
+        if (nThreadsToRender != -1) {
+            nThreads = appPTR->getNThreadsPerImageOperation();
+            if (nThreads == 0) {
+                nThreads = appPTR->getHardwareIdealThreadCount();
+            }
+            ///Do not split in more bands than there are threads available, counting the calling thread
+            nThreads = std::min( nThreads, appPTR->getTaskScheduler()->getIdleThreadCount() + 1 );
+            nThreads = std::min(nThreads, roi.height() / NATRON_IMAGE_MT_MIN_ROWS);
+        }
+    }
+    
+    if (nThreads <= 1) {
+        func(roi);
+        
+        return;
+    }
+    
+    std::vector<RectI> bands(nThreads);
+    const int bandHeight = (roi.height() + nThreads - 1) / nThreads;
+    for (int i = 0; i < nThreads; ++i) {
+        bands[i] = RectI( roi.x1, roi.y1 + i * bandHeight, roi.x2, std::min(roi.y1 + (i + 1) * bandHeight, roi.y2) );
+    }
+    
+    ///The calling thread processes the bands that no thread of the scheduler took
+    TaskGroup group( appPTR->getTaskScheduler() );
+    for (int i = 0; i < nThreads; ++i) {
+        group.run( boost::bind(func, bands[i]) );
+    }
+    group.wait();
+}
+
+bool
+Image::sharePixelsFrom(const Natron::Image & other)
+{
+    if ( (&other == this) || (other._bounds != _bounds) || ( other.getComponents() != getComponents() ) ||
+         ( other.getBitDepth() != getBitDepth() ) ) {
+        return false;
+    }
+
+    return shareBuffer(other);
+}
+
 void
 Image::setRoD(const RectD& rod)
 {
@@ -929,9 +1078,7 @@ Image::resizeInternal(const Image* srcImg,
             std::size_t memsize = a * pixelSize;
             memset(pix, 0, memsize);
             if (setBitmapTo1 && (*outputImage)->usesBitMap()) {
-                char* bm = wacc.bitmapAt(aRect.x1, aRect.y1);
-                assert(bm);
-                memset(bm, 1, a);
+                (*outputImage)->_bitmap.markForRendered(aRect);
             }
         }
         if (!cRect.isNull()) {
@@ -941,9 +1088,7 @@ Image::resizeInternal(const Image* srcImg,
             std::size_t memsize = a * pixelSize;
             memset(pix, 0, memsize);
             if (setBitmapTo1 && (*outputImage)->usesBitMap()) {
-                char* bm = (char*)wacc.bitmapAt(cRect.x1, cRect.y1);
-                assert(bm);
-                memset(bm, 1, a);
+                (*outputImage)->_bitmap.markForRendered(cRect);
             }
         }
         if (!bRect.isNull()) {
@@ -955,13 +1100,11 @@ Image::resizeInternal(const Image* srcImg,
             int bw = bRect.width();
             std::size_t rectRowSize = bw * pixelSize;
             
-            char* bm = (setBitmapTo1 && (*outputImage)->usesBitMap()) ? wacc.bitmapAt(bRect.x1, bRect.y1) : 0;
             for (int y = bRect.y1; y < bRect.y2; ++y, pix += rowsize) {
                 memset(pix, 0, rectRowSize);
-                if (bm) {
-                    memset(bm, 1, bw);
-                    bm += mw;
-                }
+            }
+            if (setBitmapTo1 && (*outputImage)->usesBitMap()) {
+                (*outputImage)->_bitmap.markForRendered(bRect);
             }
         }
         if (!dRect.isNull()) {
@@ -973,13 +1116,11 @@ Image::resizeInternal(const Image* srcImg,
             int dw = dRect.width();
             std::size_t rectRowSize = dw * pixelSize;
             
-            char* bm = (setBitmapTo1 && (*outputImage)->usesBitMap()) ? wacc.bitmapAt(dRect.x1, dRect.y1) : 0;
             for (int y = dRect.y1; y < dRect.y2; ++y, pix += rowsize) {
                 memset(pix, 0, rectRowSize);
-                if (bm) {
-                    memset(bm, 1, dw);
-                    bm += mw;
-                }
+            }
+            if (setBitmapTo1 && (*outputImage)->usesBitMap()) {
+                (*outputImage)->_bitmap.markForRendered(dRect);
             }
         }
         
@@ -995,7 +1136,7 @@ Image::resizeInternal(const Image* srcImg,
             (*outputImage)->pasteFromForDepth<unsigned short>(*srcImg, srcBounds, srcImg->usesBitMap(), false);
             break;
         case eImageBitDepthHalf:
-            assert(false);
+            (*outputImage)->pasteFromForDepth<Half>(*srcImg, srcBounds, srcImg->usesBitMap(), false);
             break;
         case eImageBitDepthFloat:
             (*outputImage)->pasteFromForDepth<float>(*srcImg, srcBounds, srcImg->usesBitMap(), false);
@@ -1007,6 +1148,43 @@ Image::resizeInternal(const Image* srcImg,
 
 }
 
+RectI
+Image::getGrownBounds(const RectI& bounds,
+                      const RectI& newBounds,
+                      const RectI& rodBounds)
+{
+    RectI merge = newBounds;
+    merge.merge(bounds);
+    if ( bounds.isNull() || bounds.contains(newBounds) ) {
+        return merge;
+    }
+    
+    RectI grown = merge;
+    const int growX = bounds.width() / 2;
+    const int growY = bounds.height() / 2;
+    if (merge.x1 < bounds.x1) {
+        grown.x1 = std::min(merge.x1, bounds.x1 - growX);
+    }
+    if (merge.x2 > bounds.x2) {
+        grown.x2 = std::max(merge.x2, bounds.x2 + growX);
+    }
+    if (merge.y1 < bounds.y1) {
+        grown.y1 = std::min(merge.y1, bounds.y1 - growY);
+    }
+    if (merge.y2 > bounds.y2) {
+        grown.y2 = std::max(merge.y2, bounds.y2 + growY);
+    }
+    grown = grown.roundPowerOfTwoSmallestEnclosing(NATRON_BITMAP_TILE_SIZE_LEVEL);
+    
+    ///Never grow outside of the region of definition, but always contain the requested bounds
+    if ( !grown.intersect(rodBounds, &grown) ) {
+        return merge;
+    }
+    grown.merge(merge);
+    
+    return grown;
+}
+
 bool
 Image::copyAndResizeIfNeeded(const RectI& newBounds, bool fillWithBlackAndTransparant, bool setBitmapTo1, boost::shared_ptr<Image>* output)
 {
@@ -1019,6 +1197,11 @@ Image::copyAndResizeIfNeeded(const RectI& newBounds, bool fillWithBlackAndTransp
     
     RectI merge = newBounds;
     merge.merge(_bounds);
+    if ( usesBitMap() && !setBitmapTo1 ) {
+        RectI rodBounds;
+        _rod.toPixelEnclosing(getMipMapLevel(), _par, &rodBounds);
+        merge = getGrownBounds(_bounds, newBounds, rodBounds);
+    }
     
     resizeInternal(this, _bounds, merge, fillWithBlackAndTransparant, setBitmapTo1, usesBitMap(), output);
     return true;
@@ -1037,6 +1220,11 @@ Image::ensureBounds(const RectI& newBounds, bool fillWithBlackAndTransparant, bo
     
     RectI merge = newBounds;
     merge.merge(_bounds);
+    if ( usesBitMap() && !setBitmapTo1 ) {
+        RectI rodBounds;
+        _rod.toPixelEnclosing(getMipMapLevel(), _par, &rodBounds);
+        merge = getGrownBounds(_bounds, newBounds, rodBounds);
+    }
     
     ImagePtr tmpImg;
     resizeInternal(this, _bounds, merge, fillWithBlackAndTransparant, setBitmapTo1, false, &tmpImg);
@@ -1072,7 +1260,7 @@ Image::pasteFrom(const Natron::Image & src,
         pasteFromForDepth<unsigned short>(src, srcRoi, copyBitmap, true);
         break;
     case eImageBitDepthHalf:
-        assert(false);
+        pasteFromForDepth<Half>(src, srcRoi, copyBitmap, true);
         break;
     case eImageBitDepthFloat:
         pasteFromForDepth<float>(src, srcRoi, copyBitmap, true);
@@ -1090,7 +1278,7 @@ Image::fillForDepthForComponents(const RectI & roi_,
                                  float b,
                                  float a)
 {
-    assert( (getBitDepth() == eImageBitDepthByte && sizeof(PIX) == 1) || (getBitDepth() == eImageBitDepthShort && sizeof(PIX) == 2) || (getBitDepth() == eImageBitDepthFloat && sizeof(PIX) == 4) );
+    assert( (getBitDepth() == eImageBitDepthByte && sizeof(PIX) == 1) || (getBitDepth() == eImageBitDepthShort && sizeof(PIX) == 2) || (getBitDepth() == eImageBitDepthHalf && sizeof(PIX) == 2) || (getBitDepth() == eImageBitDepthFloat && sizeof(PIX) == 4) );
     
     RectI roi = roi_;
     bool doInteresect = roi.intersect(_bounds, &roi);
@@ -1162,18 +1350,25 @@ Image::fill(const RectI & roi,
     
     QWriteLocker k(&_entryLock);
     
+    RectI intersection;
+    if ( !roi.intersect(_bounds, &intersection) ) {
+        return;
+    }
+    std::size_t pixelBytes = getComponentsCount() * getSizeOfForBitDepth( getBitDepth() );
+    
+    makeWritable();
     switch ( getBitDepth() ) {
     case eImageBitDepthByte:
-        fillForDepth<unsigned char, 255>(roi, r, g, b, a);
+        processRowBands( intersection, pixelBytes, boost::bind(&Image::fillForDepth<unsigned char, 255>, this, _1, r, g, b, a) );
         break;
     case eImageBitDepthShort:
-        fillForDepth<unsigned short, 65535>(roi, r, g, b, a);
+        processRowBands( intersection, pixelBytes, boost::bind(&Image::fillForDepth<unsigned short, 65535>, this, _1, r, g, b, a) );
         break;
     case eImageBitDepthHalf:
-        assert(false);
+        processRowBands( intersection, pixelBytes, boost::bind(&Image::fillForDepth<Half, 1>, this, _1, r, g, b, a) );
         break;
     case eImageBitDepthFloat:
-        fillForDepth<float, 1>(roi, r, g, b, a);
+        processRowBands( intersection, pixelBytes, boost::bind(&Image::fillForDepth<float, 1>, this, _1, r, g, b, a) );
         break;
     case eImageBitDepthNone:
         break;
@@ -1188,6 +1383,14 @@ Image::fillZero(const RectI& roi)
     if (!roi.intersect(_bounds, &intersection)) {
         return;
     }
+    makeWritable();
+    processRowBands( intersection, getComponentsCount() * getSizeOfForBitDepth( getBitDepth() ),
+                     boost::bind(&Image::fillZeroRows, this, _1) );
+}
+
+void
+Image::fillZeroRows(const RectI& intersection)
+{
     std::size_t rowSize =  getComponents().getNumComponents();
     switch ( getBitDepth() ) {
         case eImageBitDepthByte:
@@ -1241,10 +1444,17 @@ Image::fillBoundsZero()
     
     std::size_t roiMemSize = rowSize * _bounds.width() * _bounds.height();
     
+    makeWritable();
     char* dstPixels = (char*)pixelAt(_bounds.x1, _bounds.y1);
     memset(dstPixels, 0, roiMemSize);
 }
 
+void
+Image::makeWritable()
+{
+    _data.writable();
+}
+
 unsigned char*
 Image::pixelAt(int x,
                int y)
@@ -1256,7 +1466,7 @@ Image::pixelAt(int x,
     } else {
         int compDataSize = getSizeOfForBitDepth( getBitDepth() ) * compsCount;
         
-        unsigned char* ret =  (unsigned char*)this->_data.writable();
+        unsigned char* ret =  (unsigned char*)this->_data.getData();
         if (!ret) {
             return 0;
         }
@@ -1411,6 +1621,7 @@ Image::halveRoIForDepth(const RectI & roi,
 {
     assert( (getBitDepth() == eImageBitDepthByte && sizeof(PIX) == 1) ||
            (getBitDepth() == eImageBitDepthShort && sizeof(PIX) == 2) ||
+           (getBitDepth() == eImageBitDepthHalf && sizeof(PIX) == 2) ||
            (getBitDepth() == eImageBitDepthFloat && sizeof(PIX) == 4) );
 
     ///handle case where there is only 1 column/row
@@ -1424,12 +1635,15 @@ Image::halveRoIForDepth(const RectI & roi,
     /// Take the lock for both bitmaps since we're about to read/write from them!
     QWriteLocker k1(&output->_entryLock);
     QReadLocker k2(&_entryLock);
+    output->makeWritable();
 
     ///The source rectangle, intersected to this image region of definition in pixels
     const RectI &srcBounds = _bounds;
     const RectI &dstBounds = output->_bounds;
+#ifndef NDEBUG
     const RectI &srcBmBounds = _bitmap.getBounds();
     const RectI &dstBmBounds = output->_bitmap.getBounds();
+#endif
     assert(!copyBitMap || usesBitMap());
     assert(!usesBitMap() ||(srcBmBounds == srcBounds && dstBmBounds == dstBounds));
 
@@ -1457,9 +1671,7 @@ Image::halveRoIForDepth(const RectI & roi,
   
     
     const PIX* const srcPixels      = (const PIX*)pixelAt(srcBounds.x1,   srcBounds.y1);
-    const char* const srcBmPixels   = _bitmap.getBitmapAt(srcBmBounds.x1, srcBmBounds.y1);
     PIX* const dstPixels          = (PIX*)output->pixelAt(dstBounds.x1,   dstBounds.y1);
-    char* const dstBmPixels = output->_bitmap.getBitmapAt(dstBmBounds.x1, dstBmBounds.y1);
 
     int srcRowSize = srcBounds.width() * nComponents;
     int dstRowSize = dstBounds.width() * nComponents;
@@ -1468,17 +1680,9 @@ Image::halveRoIForDepth(const RectI & roi,
     const PIX* const srcData = srcPixels - (srcBounds.x1 * nComponents + srcRowSize * srcBounds.y1);
     PIX* const dstData       = dstPixels - (dstBounds.x1 * nComponents + dstRowSize * dstBounds.y1);
 
-    const int srcBmRowSize = srcBmBounds.width();
-    const int dstBmRowSize = dstBmBounds.width();
-
-    const char* const srcBmData = srcBmPixels - (srcBmBounds.x1 + srcBmRowSize * srcBmBounds.y1);
-    char* const dstBmData       = dstBmPixels - (dstBmBounds.x1 + dstBmRowSize * dstBmBounds.y1);
-
     for (int y = dstRoI.y1; y < dstRoI.y2; ++y) {
         const PIX* const srcLineStart    = srcData + y * 2 * srcRowSize;
         PIX* const dstLineStart          = dstData + y     * dstRowSize;
-        const char* const srcBmLineStart = srcBmData + y * 2 * srcBmRowSize;
-        char* const dstBmLineStart       = dstBmData + y     * dstBmRowSize;
 
         // The current dst row, at y, covers the src rows y*2 (thisRow) and y*2+1 (nextRow).
         // Check that if are within srcBounds.
@@ -1491,9 +1695,7 @@ Image::halveRoIForDepth(const RectI & roi,
         
         for (int x = dstRoI.x1; x < dstRoI.x2; ++x) {
             const PIX* const srcPixStart    = srcLineStart   + x * 2 * nComponents;
-            const char* const srcBmPixStart = srcBmLineStart + x * 2;
             PIX* const dstPixStart          = dstLineStart   + x * nComponents;
-            char* const dstBmPixStart       = dstBmLineStart + x;
 
             // The current dst col, at y, covers the src cols x*2 (thisCol) and x*2+1 (nextCol).
             // Check that if are within srcBounds.
@@ -1510,9 +1712,6 @@ Image::halveRoIForDepth(const RectI & roi,
                 for (int k = 0; k < nComponents; ++k) {
                     dstPixStart[k] = 0;
                 }
-                if (copyBitMap) {
-                    dstBmPixStart[0] = 0;
-                }
                 continue;
             }
 
@@ -1520,52 +1719,22 @@ Image::halveRoIForDepth(const RectI & roi,
                 ///a b
                 ///c d
 
-                const PIX a = (pickThisCol && pickThisRow) ? *(srcPixStart + k) : 0;
-                const PIX b = (pickNextCol && pickThisRow) ? *(srcPixStart + k + nComponents) : 0;
-                const PIX c = (pickThisCol && pickNextRow) ? *(srcPixStart + k + srcRowSize): 0;
-                const PIX d = (pickNextCol && pickNextRow) ? *(srcPixStart + k + srcRowSize  + nComponents)  : 0;
+                const PIX a = (pickThisCol && pickThisRow) ? *(srcPixStart + k) : PIX(0);
+                const PIX b = (pickNextCol && pickThisRow) ? *(srcPixStart + k + nComponents) : PIX(0);
+                const PIX c = (pickThisCol && pickNextRow) ? *(srcPixStart + k + srcRowSize) : PIX(0);
+                const PIX d = (pickNextCol && pickNextRow) ? *(srcPixStart + k + srcRowSize  + nComponents) : PIX(0);
                 
                 assert(sumW == 2 || (sumW == 1 && ((a == 0 && c == 0) || (b == 0 && d == 0))));
                 assert(sumH == 2 || (sumH == 1 && ((a == 0 && b == 0) || (c == 0 && d == 0))));
                 dstPixStart[k] = (a + b + c + d) / sum;
             }
-            
-            if (copyBitMap) {
-                ///a b
-                ///c d
-
-                char a = (pickThisCol && pickThisRow) ? *(srcBmPixStart) : 0;
-                char b = (pickNextCol && pickThisRow) ? *(srcBmPixStart + 1) : 0;
-                char c = (pickThisCol && pickNextRow) ? *(srcBmPixStart + srcBmRowSize): 0;
-                char d = (pickNextCol && pickNextRow) ? *(srcBmPixStart + srcBmRowSize  + 1)  : 0;
-#if NATRON_ENABLE_TRIMAP
-                /*
-                 The only correct solution is to convert pixels being rendered to 0 otherwise the caller
-                 would have to wait for the original fullscale image render to be finished and then re-downscale again.
-                 */
-                if (a == PIXEL_UNAVAILABLE) {
-                    a = 0;
-                }
-                if (b == PIXEL_UNAVAILABLE) {
-                    b = 0;
-                }
-                if (c == PIXEL_UNAVAILABLE) {
-                    c = 0;
-                }
-                if (d == PIXEL_UNAVAILABLE) {
-                    d = 0;
-                }
-#endif
-                assert(sumW == 2 || (sumW == 1 && ((a == 0 && c == 0) || (b == 0 && d == 0))));
-                assert(sumH == 2 || (sumH == 1 && ((a == 0 && b == 0) || (c == 0 && d == 0))));
-                assert(a + b + c + d <= sum); // bitmaps are 0 or 1
-                // the following is an integer division, the result can be 0 or 1
-                dstBmPixStart[0] = (a + b + c + d) / sum;
-                assert(dstBmPixStart[0] == 0 || dstBmPixStart[0] == 1);
-            }
         }
     }
 
+    if (copyBitMap) {
+        output->_bitmap.halveBitmapPortion(dstRoI, _bitmap);
+    }
+
 } // halveRoIForDepth
 
 // code proofread and fixed by @devernay on 8/8/2014
@@ -1582,7 +1751,7 @@ Image::halveRoI(const RectI & roi,
         halveRoIForDepth<unsigned short,65535>(roi,copyBitMap, output);
         break;
     case eImageBitDepthHalf:
-        assert(false);
+        halveRoIForDepth<Half,1>(roi,copyBitMap,output);
         break;
     case eImageBitDepthFloat:
         halveRoIForDepth<float,1>(roi,copyBitMap,output);
@@ -1607,6 +1776,7 @@ Image::halve1DImageForDepth(const RectI & roi,
     /// Take the lock for both bitmaps since we're about to read/write from them!
     QWriteLocker k1(&output->_entryLock);
     QReadLocker k2(&_entryLock);
+    output->makeWritable();
 
     
     const RectI & srcBounds = _bounds;
@@ -1665,7 +1835,7 @@ Image::halve1DImage(const RectI & roi,
         halve1DImageForDepth<unsigned short, 65535>(roi, output);
         break;
     case eImageBitDepthHalf:
-        assert(false);
+        halve1DImageForDepth<Half, 1>(roi, output);
         break;
     case eImageBitDepthFloat:
         halve1DImageForDepth<float, 1>(roi, output);
@@ -1689,60 +1859,91 @@ Image::downscaleMipMap(const RectD& dstRod,
 
     assert(_bounds.x1 <= roi.x1 && roi.x2 <= _bounds.x2 &&
            _bounds.y1 <= roi.y1 && roi.y2 <= _bounds.y2);
-    double par = getPixelAspectRatio();
+//    double par = getPixelAspectRatio();
 //    RectD roiCanonical;
 //    roi.toCanonical(fromLevel, par , dstRod, &roiCanonical);
 //    RectI dstRoI;
 //    roiCanonical.toPixelEnclosing(toLevel, par , &dstRoI);
     unsigned int downscaleLvls = toLevel - fromLevel;
 
-    assert(!copyBitMap || _bitmap.getBitmap());
+    assert(!copyBitMap || usesBitMap());
     
+#ifndef NDEBUG
     RectI dstRoI  = roi.downscalePowerOfTwoSmallestEnclosing(downscaleLvls);
-    
-    ImagePtr tmpImg( new Natron::Image( getComponents(), dstRod, dstRoI, toLevel, par, getBitDepth() , true) );
-
-    buildMipMapLevel( dstRod, roi, downscaleLvls, copyBitMap, tmpImg.get() );
 
     // check that the downscaled mipmap is inside the output image (it may not be equal to it)
     assert(dstRoI.x1 >= output->_bounds.x1);
     assert(dstRoI.x2 <= output->_bounds.x2);
     assert(dstRoI.y1 >= output->_bounds.y1);
     assert(dstRoI.y2 <= output->_bounds.y2);
+#endif
 
-    ///Now copy the result of tmpImg into the output image
-    output->pasteFrom(*tmpImg, dstRoI, copyBitMap);
+    ///The mipmap is written directly in the output image
+    buildMipMapLevel( dstRod, roi, downscaleLvls, copyBitMap, output );
 }
 
 
 bool
-Image::checkForNaNs(const RectI& roi)
+Image::checkForNaNs(const RectI& roi,
+                    int* nbNaNs,
+                    int* nbInfinities)
 {
+    if (nbNaNs) {
+        *nbNaNs = 0;
+    }
+    if (nbInfinities) {
+        *nbInfinities = 0;
+    }
     if (getBitDepth() != eImageBitDepthFloat) {
         return false;
     }
  
     QWriteLocker k(&_entryLock);
     
-    unsigned int compsCount = getComponentsCount();
-
-    bool hasnan = false;
-    for (int y = roi.y1; y < roi.y2; ++y) {
-        
-        float* pix = (float*)pixelAt(roi.x1, y);
-        float* const end = pix +  compsCount * roi.width();
-        
-        for (;pix < end; ++pix) {
-            // we remove NaNs, but infinity values should pose no problem
-            // (if they do, please explain here which ones)
-            if (*pix != *pix) { // check for NaN
-                *pix = 1.;
-                hasnan = true;
-            }
-        }
+    RectI intersection;
+    if ( !roi.intersect(_bounds, &intersection) ) {
+        return false;
+    }
+    
+    QAtomicInt nans(0), infinities(0);
+    makeWritable();
+    processRowBands( intersection, getComponentsCount() * sizeof(float),
+                     boost::bind(&Image::checkForNaNsRows, this, _1, &nans, &infinities) );
+    
+    int nbNaNsFound = nans.fetchAndAddRelaxed(0);
+    if (nbNaNs) {
+        *nbNaNs = nbNaNsFound;
+    }
+    if (nbInfinities) {
+        *nbInfinities = infinities.fetchAndAddRelaxed(0);
     }
 
-    return hasnan;
+    return nbNaNsFound > 0;
+}
+
+void
+Image::checkForNaNsRows(const RectI& roi,
+                        QAtomicInt* nbNaNs,
+                        QAtomicInt* nbInfinities)
+{
+    const int compsCount = getComponentsCount();
+    const int rowElements = _bounds.width() * compsCount;
+    const int n = roi.width() * compsCount;
+    float* pix = (float*)pixelAt(roi.x1, roi.y1);
+    int nans = 0;
+    int infinities = 0;
+
+    // we remove NaNs, but infinity values should pose no problem
+    // (if they do, please explain here which ones)
+    for (int y = roi.y1; y < roi.y2; ++y, pix += rowElements) {
+        SIMD::replaceNaNs(pix, n, &nans, &infinities);
+    }
+    if (nans) {
+        nbNaNs->fetchAndAddRelaxed(nans);
+    }
+    if (infinities) {
+        nbInfinities->fetchAndAddRelaxed(infinities);
+    }
 }
 
 // code proofread and fixed by @devernay on 8/8/2014
@@ -1754,7 +1955,7 @@ Image::upscaleMipMapForDepth(const RectI & roi,
                              Natron::Image* output) const
 {
     assert( getBitDepth() == output->getBitDepth() );
-    assert( (getBitDepth() == eImageBitDepthByte && sizeof(PIX) == 1) || (getBitDepth() == eImageBitDepthShort && sizeof(PIX) == 2) || (getBitDepth() == eImageBitDepthFloat && sizeof(PIX) == 4) );
+    assert( (getBitDepth() == eImageBitDepthByte && sizeof(PIX) == 1) || (getBitDepth() == eImageBitDepthShort && sizeof(PIX) == 2) || (getBitDepth() == eImageBitDepthHalf && sizeof(PIX) == 2) || (getBitDepth() == eImageBitDepthFloat && sizeof(PIX) == 4) );
 
     ///You should not call this function with a level equal to 0.
     assert(fromLevel > toLevel);
@@ -1781,6 +1982,7 @@ Image::upscaleMipMapForDepth(const RectI & roi,
     
     QWriteLocker k1(&output->_entryLock);
     QReadLocker k2(&_entryLock);
+    output->makeWritable();
     
     int srcRowSize = _bounds.width() * components;
     int dstRowSize = output->_bounds.width() * components;
@@ -1842,7 +2044,7 @@ Image::upscaleMipMap(const RectI & roi,
         upscaleMipMapForDepth<unsigned short, 65535>(roi, fromLevel, toLevel, output);
         break;
     case eImageBitDepthHalf:
-        assert(false);
+        upscaleMipMapForDepth<Half,1>(roi, fromLevel, toLevel, output);
         break;
     case eImageBitDepthFloat:
         upscaleMipMapForDepth<float,1>(roi, fromLevel, toLevel, output);
@@ -1861,11 +2063,12 @@ Image::scaleBoxForDepth(const RectI & roi,
                         Natron::Image* output) const
 {
     assert( getBitDepth() == output->getBitDepth() );
-    assert( (getBitDepth() == eImageBitDepthByte && sizeof(PIX) == 1) || (getBitDepth() == eImageBitDepthShort && sizeof(PIX) == 2) || (getBitDepth() == eImageBitDepthFloat && sizeof(PIX) == 4) );
+    assert( (getBitDepth() == eImageBitDepthByte && sizeof(PIX) == 1) || (getBitDepth() == eImageBitDepthShort && sizeof(PIX) == 2) || (getBitDepth() == eImageBitDepthHalf && sizeof(PIX) == 2) || (getBitDepth() == eImageBitDepthFloat && sizeof(PIX) == 4) );
 
     
     QWriteLocker k1(&output->_entryLock);
     QReadLocker k2(&_entryLock);
+    output->makeWritable();
     
     ///The destination rectangle
     const RectI & dstBounds = output->_bounds;
@@ -2095,7 +2298,7 @@ Image::scaleBox(const RectI & roi,
         scaleBoxForDepth<unsigned short>(roi, output);
         break;
     case eImageBitDepthHalf:
-        assert(false);
+        scaleBoxForDepth<Half>(roi, output);
         break;
     case eImageBitDepthFloat:
         scaleBoxForDepth<float>(roi, output);
@@ -2105,9 +2308,263 @@ Image::scaleBox(const RectI & roi,
     }
 }
 
-// code proofread and fixed by @devernay on 8/8/2014
+namespace {
+
+///The pixels of a level of the pyramid built by Image::buildMipMapPyramid()
+template <typename PIX>
+struct MipMapPyramidLevel
+{
+    RectI bounds; //< the pixels of the level that can be read by the next level
+    PIX* pixels; //< the pixel (bounds.x1, bounds.y1) if the level is in an image
+    int rowElements; //< the number of elements between 2 rows
+    std::vector<PIX> rows; //< otherwise the 2 rows needed by the next level, indexed by the parity of y
+
+    PIX* row(int y)
+    {
+        if (pixels) {
+            return pixels + (y - bounds.y1) * rowElements;
+        }
+
+        return &rows[(y & 1) * rowElements];
+    }
+};
+
+///The generic box filter of Image::halveRoIForDepth() on the pixels that have their 4 source pixels
+template <typename PIX>
 void
-Image::buildMipMapLevel(const RectD& dstRoD,
+halveRowsInterior(const PIX* row0,
+                  const PIX* row1,
+                  PIX* dst,
+                  int n,
+                  int nComps)
+{
+    for (int i = 0; i < n; ++i, row0 += 2 * nComps, row1 += 2 * nComps, dst += nComps) {
+        for (int k = 0; k < nComps; ++k) {
+            dst[k] = (row0[k] + row0[k + nComps] + row1[k] + row1[k + nComps]) / 4;
+        }
+    }
+}
+
+template <>
+void
+halveRowsInterior<float>(const float* row0,
+                         const float* row1,
+                         float* dst,
+                         int n,
+                         int nComps)
+{
+    SIMD::halveRows(row0, row1, dst, n, nComps);
+}
+
+/**
+ * @brief Computes the pixels [x1, x2[ of a row of a level from the rows row0 and row1 (which are NULL outside of the
+ * bounds) of the previous level. These point to the pixel srcX1 and have pixels up to srcX2.
+ * This gives the same result as Image::halveRoIForDepth().
+ **/
+template <typename PIX>
+void
+halveRow(const PIX* row0,
+         const PIX* row1,
+         int srcX1,
+         int srcX2,
+         PIX* dst,
+         int x1,
+         int x2,
+         int nComps)
+{
+    // The pixels that have their 2 source columns are contiguous, only the first and last ones may not
+    int interiorX1 = x1;
+    while ( interiorX1 < x2 && (interiorX1 * 2 < srcX1) ) {
+        ++interiorX1;
+    }
+    int interiorX2 = x2;
+    while ( interiorX2 > interiorX1 && ( (interiorX2 - 1) * 2 + 1 >= srcX2 ) ) {
+        --interiorX2;
+    }
+    if (row0 && row1 && interiorX1 < interiorX2) {
+        halveRowsInterior<PIX>(row0 + (interiorX1 * 2 - srcX1) * nComps, row1 + (interiorX1 * 2 - srcX1) * nComps,
+                               dst + (interiorX1 - x1) * nComps, interiorX2 - interiorX1, nComps);
+    } else {
+        interiorX1 = interiorX2 = x2;
+    }
+
+    const int sumH = (int)(row0 != 0) + (int)(row1 != 0);
+    assert(sumH == 1 || sumH == 2);
+    for (int x = x1; x < x2; ++x) {
+        if (x == interiorX1) {
+            x = interiorX2 - 1;
+            continue;
+        }
+        PIX* const dstPix = dst + (x - x1) * nComps;
+        const int srcx = x * 2;
+        const bool pickThisCol = srcX1 <= (srcx + 0) && (srcx + 0) < srcX2;
+        const bool pickNextCol = srcX1 <= (srcx + 1) && (srcx + 1) < srcX2;
+        const int sum = ( (int)pickThisCol + (int)pickNextCol ) * sumH;
+        assert(0 < sum && sum <= 4);
+        const int offset = (srcx - srcX1) * nComps;
+        for (int k = 0; k < nComps; ++k) {
+            ///a b
+            ///c d
+            const PIX a = (pickThisCol && row0) ? row0[offset + k] : PIX(0);
+            const PIX b = (pickNextCol && row0) ? row0[offset + k + nComps] : PIX(0);
+            const PIX c = (pickThisCol && row1) ? row1[offset + k] : PIX(0);
+            const PIX d = (pickNextCol && row1) ? row1[offset + k + nComps] : PIX(0);
+            dstPix[k] = (a + b + c + d) / sum;
+        }
+    }
+}
+
+/**
+ * @brief Computes the row y of the level i of the pyramid. The rows of the previous level it needs are computed first:
+ * each row of a level is needed by exactly one row of the next level and the rows are requested in order, which is why
+ * 2 rows are enough for the levels that are not kept.
+ **/
+template <typename PIX>
+void
+computeMipMapRow(std::vector<MipMapPyramidLevel<PIX> >& levels,
+                 std::size_t i,
+                 int y,
+                 int nComps)
+{
+    MipMapPyramidLevel<PIX>& src = levels[i - 1];
+    MipMapPyramidLevel<PIX>& dst = levels[i];
+    const PIX* srcRows[2] = {0, 0};
+
+    for (int j = 0; j < 2; ++j) {
+        const int srcy = y * 2 + j;
+        if ( (src.bounds.y1 <= srcy) && (srcy < src.bounds.y2) ) {
+            if (i > 1) {
+                computeMipMapRow(levels, i - 1, srcy, nComps);
+            }
+            srcRows[j] = src.row(srcy);
+        }
+    }
+    halveRow<PIX>(srcRows[0], srcRows[1], src.bounds.x1, src.bounds.x2, dst.row(y), dst.bounds.x1, dst.bounds.x2, nComps);
+}
+
+} // anon namespace
+
+template <typename PIX>
+void
+Image::buildMipMapPyramidForDepth(const std::vector<RectI> & rois,
+                                  const std::vector<Natron::Image*>& levels) const
+{
+    assert( (getBitDepth() == eImageBitDepthByte && sizeof(PIX) == 1) ||
+           (getBitDepth() == eImageBitDepthShort && sizeof(PIX) == 2) ||
+           (getBitDepth() == eImageBitDepthHalf && sizeof(PIX) == 2) ||
+           (getBitDepth() == eImageBitDepthFloat && sizeof(PIX) == 4) );
+
+    const int nComps = getComponentsCount();
+    std::vector<MipMapPyramidLevel<PIX> > pyramid( levels.size() + 1 );
+
+    pyramid[0].bounds = _bounds;
+    pyramid[0].pixels = (PIX*)pixelAt(_bounds.x1, _bounds.y1);
+    pyramid[0].rowElements = _bounds.width() * nComps;
+    for (std::size_t i = 1; i < pyramid.size(); ++i) {
+        MipMapPyramidLevel<PIX>& level = pyramid[i];
+        level.bounds = rois[i];
+        if (levels[i - 1]) {
+            level.pixels = (PIX*)levels[i - 1]->pixelAt(rois[i].x1, rois[i].y1);
+            level.rowElements = levels[i - 1]->_bounds.width() * nComps;
+            assert(level.pixels);
+        } else {
+            level.pixels = 0;
+            level.rowElements = rois[i].width() * nComps;
+            level.rows.resize(2 * level.rowElements);
+        }
+    }
+
+    const std::size_t lastLevel = levels.size();
+    for (int y = rois[lastLevel].y1; y < rois[lastLevel].y2; ++y) {
+        computeMipMapRow<PIX>(pyramid, lastLevel, y, nComps);
+    }
+}
+
+void
+Image::buildMipMapPyramid(const RectI & roi,
+                          bool copyBitMap,
+                          const std::vector<Natron::Image*>& levels) const
+{
+    assert( !levels.empty() && levels.back() );
+    assert(!copyBitMap || usesBitMap());
+
+    ///The roi of each level, the roi of the previous level halved to its smallest enclosing rectangle
+    std::vector<RectI> rois(levels.size() + 1);
+    if ( !roi.intersect(_bounds, &rois[0]) ) {
+        return;
+    }
+    bool is1D = false;
+    for (std::size_t i = 1; i < rois.size(); ++i) {
+        is1D |= rois[i - 1].width() == 1 || rois[i - 1].height() == 1;
+        rois[i] = rois[i - 1].downscalePowerOfTwoSmallestEnclosing(1);
+        assert( !levels[i - 1] || ( levels[i - 1]->getBounds().contains(rois[i]) &&
+                                    levels[i - 1]->getComponents() == getComponents() &&
+                                    levels[i - 1]->getBitDepth() == getBitDepth() ) );
+    }
+
+    if (is1D) {
+        ///halve1DImage() does not follow the same rules as halveRoI(): keep building such pyramids a level at a time
+        boost::shared_ptr<Natron::Image> previous;
+        for (std::size_t i = 1; i < rois.size(); ++i) {
+            boost::shared_ptr<Natron::Image> level( new Natron::Image( getComponents(), getRoD(), rois[i], getMipMapLevel() + i,
+                                                                       getPixelAspectRatio(), getBitDepth(), true) );
+            const Natron::Image* src = previous ? previous.get() : this;
+            src->halveRoI(rois[i - 1], copyBitMap, level.get());
+            if (levels[i - 1]) {
+                levels[i - 1]->pasteFrom(*level, rois[i], copyBitMap);
+            }
+            previous = level;
+        }
+
+        return;
+    }
+
+    {
+        /// Take the lock of all the images since we're about to read/write from them!
+        std::list<boost::shared_ptr<QWriteLocker> > outputLocks;
+        for (std::size_t i = 0; i < levels.size(); ++i) {
+            if (levels[i]) {
+                outputLocks.push_back( boost::shared_ptr<QWriteLocker>( new QWriteLocker(&levels[i]->_entryLock) ) );
+                levels[i]->makeWritable();
+            }
+        }
+        QReadLocker k(&_entryLock);
+
+        switch ( getBitDepth() ) {
+        case eImageBitDepthByte:
+            buildMipMapPyramidForDepth<unsigned char>(rois, levels);
+            break;
+        case eImageBitDepthShort:
+            buildMipMapPyramidForDepth<unsigned short>(rois, levels);
+            break;
+        case eImageBitDepthHalf:
+            buildMipMapPyramidForDepth<Half>(rois, levels);
+            break;
+        case eImageBitDepthFloat:
+            buildMipMapPyramidForDepth<float>(rois, levels);
+            break;
+        case eImageBitDepthNone:
+            break;
+        }
+
+        if (copyBitMap) {
+            ///The bitmaps are small: they are still halved a level at a time
+            Natron::Bitmap previous;
+            Natron::Bitmap current;
+            for (std::size_t i = 1; i < rois.size(); ++i) {
+                current.initialize(rois[i]);
+                current.halveBitmapPortion(rois[i], i == 1 ? _bitmap : previous);
+                if (levels[i - 1] && levels[i - 1]->usesBitMap()) {
+                    levels[i - 1]->_bitmap.copyBitmapPortion(rois[i], current);
+                }
+                previous.swap(current);
+            }
+        }
+    }
+} // buildMipMapPyramid
+
+void
+Image::buildMipMapLevel(const RectD& /*dstRoD*/,
                         const RectI & roi,
                         unsigned int level,
                         bool copyBitMap,
@@ -2128,44 +2585,10 @@ Image::buildMipMapLevel(const RectD& dstRoD,
         return;
     }
 
-    const Natron::Image* srcImg = this;
-    Natron::Image* dstImg = NULL;
-    bool mustFreeSrc = false;
-    RectI previousRoI = roi;
-    ///Build all the mipmap levels until we reach the one we are interested in
-    for (unsigned int i = 1; i <= level; ++i) {
-        ///Halve the smallest enclosing po2 rect as we need to render a minimum of the renderWindow
-        RectI halvedRoI = previousRoI.downscalePowerOfTwoSmallestEnclosing(1);
-
-        ///Allocate an image with half the size of the source image
-        dstImg = new Natron::Image( getComponents(), dstRoD, halvedRoI, getMipMapLevel() + i, getPixelAspectRatio(),getBitDepth() , true);
-
-        ///Half the source image into dstImg.
-        ///We pass the closestPo2 roi which might not be the entire size of the source image
-        ///If the source image'sroi was originally a po2.
-        srcImg->halveRoI(previousRoI, copyBitMap, dstImg);
-
-        ///Clean-up, we should use shared_ptrs for safety
-        if (mustFreeSrc) {
-            delete srcImg;
-        }
-
-        ///Switch for next pass
-        previousRoI = halvedRoI;
-        srcImg = dstImg;
-        mustFreeSrc = true;
-
-    }
-
-    assert(srcImg->getBounds() == lastLevelRoI);
-
-    ///Finally copy the last mipmap level into output.
-    output->pasteFrom( *srcImg, srcImg->getBounds() , copyBitMap);
-
-    ///Clean-up, we should use shared_ptrs for safety
-    if (mustFreeSrc) {
-        delete srcImg;
-    }
+    ///Only the last level is kept: the other ones are never allocated entirely
+    std::vector<Natron::Image*> levels(level, (Natron::Image*)0);
+    levels.back() = output;
+    buildMipMapPyramid(roi, copyBitMap, levels);
 } // buildMipMapLevel
 
 double
@@ -2189,26 +2612,6 @@ Image::getLevelFromScale(double s)
 
 
 
-void
-Image::copyBitmapRowPortion(int x1, int x2,int y, const Image& other)
-{
-    _bitmap.copyRowPortion(x1, x2, y, other._bitmap);
-}
-
-void
-Bitmap::copyRowPortion(int x1,int x2,int y,const Bitmap& other)
-{
-    const char* srcBitmap = other.getBitmapAt(x1, y);
-    char* dstBitmap = getBitmapAt(x1, y);
-    const char* end = dstBitmap + (x2 - x1);
-    while (dstBitmap < end) {
-        *dstBitmap = /**srcBitmap == PIXEL_UNAVAILABLE ? 0 : */*srcBitmap;
-        ++dstBitmap;
-        ++srcBitmap;
-    }
-    
-}
-
 void
 Image::copyBitmapPortion(const RectI& roi, const Image& other)
 {
@@ -2222,27 +2625,134 @@ Bitmap::copyBitmapPortion(const RectI& roi, const Bitmap& other)
     assert(roi.x1 >= _bounds.x1 && roi.x2 <= _bounds.x2 && roi.y1 >= _bounds.y1 && roi.y2 <= _bounds.y2);
     assert(roi.x1 >= other._bounds.x1 && roi.x2 <= other._bounds.x2 && roi.y1 >= other._bounds.y1 && roi.y2 <= other._bounds.y2);
     
-    int srcRowSize = other._bounds.width();
-    int dstRowSize = _bounds.width();
+    if ( roi.isNull() ) {
+        return;
+    }
+    int tx1 = (roi.x1 - _bounds.x1) / NATRON_BITMAP_TILE_SIZE;
+    int tx2 = (roi.x2 - 1 - _bounds.x1) / NATRON_BITMAP_TILE_SIZE;
+    int ty1 = (roi.y1 - _bounds.y1) / NATRON_BITMAP_TILE_SIZE;
+    int ty2 = (roi.y2 - 1 - _bounds.y1) / NATRON_BITMAP_TILE_SIZE;
+    
+    for (int ty = ty1; ty <= ty2; ++ty) {
+        for (int tx = tx1; tx <= tx2; ++tx) {
+            RectI r;
+            roi.intersect(getTileRect(tx, ty), &r);
+            
+            unsigned char states = other.getStatesInRect(r);
+            bool uniform = false;
+            for (char state = 0; state <= PIXEL_UNAVAILABLE; ++state) {
+                if (states == BITMAP_STATE_BIT(state)) {
+                    fill(r, state);
+                    uniform = true;
+                    break;
+                }
+            }
+            if (uniform) {
+                continue;
+            }
+            
+            ///Copy the runs of pixels with the same state
+            for (int y = r.y1; y < r.y2; ++y) {
+                int runStart = r.x1;
+                char runState = other.getPixel(r.x1, y);
+                for (int x = r.x1 + 1; x <= r.x2; ++x) {
+                    char state = x < r.x2 ? other.getPixel(x, y) : -1;
+                    if (state != runState) {
+                        fill(RectI(runStart, y, x, y + 1), runState);
+                        runStart = x;
+                        runState = state;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void
+Bitmap::halveBitmapPortion(const RectI& roi, const Bitmap& other)
+{
+    RectI rect;
     
-    const char* srcBitmap = other.getBitmapAt(roi.x1, roi.y1);
-    char* dstBitmap = getBitmapAt(roi.x1, roi.y1);
+    if ( !roi.intersect(_bounds, &rect) ) {
+        return;
+    }
+    int tx1 = (rect.x1 - _bounds.x1) / NATRON_BITMAP_TILE_SIZE;
+    int tx2 = (rect.x2 - 1 - _bounds.x1) / NATRON_BITMAP_TILE_SIZE;
+    int ty1 = (rect.y1 - _bounds.y1) / NATRON_BITMAP_TILE_SIZE;
+    int ty2 = (rect.y2 - 1 - _bounds.y1) / NATRON_BITMAP_TILE_SIZE;
     
-    for (int y = roi.y1; y < roi.y2; ++y,
-         srcBitmap += srcRowSize,
-         dstBitmap += dstRowSize) {
-        
-        const char* srcCur = srcBitmap;
-        const char* srcEnd = srcBitmap + roi.width();
-        char* dstCur = dstBitmap;
-        while (srcCur < srcEnd) {
-            *dstCur = /**srcCur == PIXEL_UNAVAILABLE ? 0 : */*srcCur;
-            ++srcCur;
-            ++dstCur;
+    for (int ty = ty1; ty <= ty2; ++ty) {
+        for (int tx = tx1; tx <= tx2; ++tx) {
+            RectI r;
+            rect.intersect(getTileRect(tx, ty), &r);
+            
+            /*
+             The only correct solution is to convert pixels being rendered to 0 otherwise the caller
+             would have to wait for the original fullscale image render to be finished and then re-downscale again.
+             */
+            RectI srcRect;
+            if ( !RectI(r.x1 * 2, r.y1 * 2, r.x2 * 2, r.y2 * 2).intersect(other._bounds, &srcRect) ) {
+                fill(r, 0);
+                continue;
+            }
+            unsigned char states = other.getStatesInRect(srcRect);
+            if ( states == BITMAP_STATE_BIT(1) ) {
+                fill(r, 1);
+                continue;
+            } else if ( !(states & BITMAP_STATE_BIT(1)) ) {
+                fill(r, 0);
+                continue;
+            }
+            
+            ///A pixel is rendered only if the pixels it covers within the bounds of other are all rendered
+            for (int y = r.y1; y < r.y2; ++y) {
+                for (int x = r.x1; x < r.x2; ++x) {
+                    RectI srcPix;
+                    char state = 0;
+                    if ( RectI(x * 2, y * 2, x * 2 + 2, y * 2 + 2).intersect(other._bounds, &srcPix) &&
+                         ( other.getStatesInRect(srcPix) == BITMAP_STATE_BIT(1) ) ) {
+                        state = 1;
+                    }
+                    fill(RectI(x, y, x + 1, y + 1), state);
+                }
+            }
         }
     }
 }
 
+namespace {
+
+///Premultiplies or unpremultiplies a row of n RGBA pixels with the SIMD kernels, only float images are vectorized
+template <typename PIX, bool doPremult>
+bool
+premultRowSIMD(PIX* /*pixels*/,
+               int /*n*/)
+{
+    return false;
+}
+
+template <>
+bool
+premultRowSIMD<float, true>(float* pixels,
+                            int n)
+{
+    SIMD::premultRGBA(pixels, n);
+
+    return true;
+}
+
+template <>
+bool
+premultRowSIMD<float, false>(float* pixels,
+                             int n)
+{
+    SIMD::unpremultRGBA(pixels, n);
+
+    return true;
+}
+
+} // anon namespace
+
 template <typename PIX, bool doPremult>
 void
 Image::premultInternal(const RectI& roi)
@@ -2260,6 +2770,10 @@ Image::premultInternal(const RectI& roi)
     
     PIX* dstPix = (PIX*)acc.pixelAt(renderWindow.x1, renderWindow.y1);
     for (int y = renderWindow.y1; y < renderWindow.y2; ++y, dstPix += (srcRowElements - (renderWindow.x2 - renderWindow.x1) * 4)) {
+        if ( premultRowSIMD<PIX, doPremult>( dstPix, renderWindow.width() ) ) {
+            dstPix += renderWindow.width() * 4;
+            continue;
+        }
         for (int x = renderWindow.x1; x < renderWindow.x2; ++x, dstPix += 4) {
             for (int c = 0; c < 3; ++c) {
                 if (doPremult) {
@@ -2290,6 +2804,9 @@ Image::premultForDepth(const RectI& roi)
         case Natron::eImageBitDepthShort:
             premultInternal<unsigned short, doPremult>(roi);
             break;
+        case Natron::eImageBitDepthHalf:
+            premultInternal<Half, doPremult>(roi);
+            break;
         case Natron::eImageBitDepthFloat:
             premultInternal<float, doPremult>(roi);
             break;
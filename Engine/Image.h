@@ -27,6 +27,7 @@
 
 #include <list>
 #include <map>
+#include <vector>
 #include <algorithm> // min, max
 #include <bitset>
 
@@ -36,7 +37,13 @@ CLANG_DIAG_OFF(deprecated)
 #include <QtCore/QHash>
 CLANG_DIAG_ON(deprecated)
 #include <QtCore/QReadWriteLock>
+#include <QtCore/QAtomicInt>
 
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/function.hpp>
+#endif
+
+#include "Engine/Half.h"
 #include "Engine/ImageKey.h"
 #include "Engine/ImageComponents.h"
 #include "Engine/ImageParams.h"
@@ -45,6 +52,10 @@ CLANG_DIAG_ON(deprecated)
 #include "Engine/OutputSchedulerThread.h"
 #include "Engine/EngineFwd.h"
 
+///The side of the square tiles of pixels whose render state is stored by a Bitmap, as a power of 2
+#define NATRON_BITMAP_TILE_SIZE_LEVEL 6
+#define NATRON_BITMAP_TILE_SIZE (1 << NATRON_BITMAP_TILE_SIZE_LEVEL)
+
 
 namespace Natron {
 
@@ -60,12 +71,23 @@ namespace Natron {
         }
     };
     
+    /**
+     * @brief The render state of each pixel of an image: not rendered (0), rendered (1) or being rendered
+     * by another thread (2, only with the trimap).
+     * The state is stored per tile of NATRON_BITMAP_TILE_SIZE x NATRON_BITMAP_TILE_SIZE pixels: a tile whose pixels
+     * all have the same state only takes 1 byte. Only the tiles partially covered by a call to markForRendered,
+     * markForRendering or clear keep a state per pixel, until they become uniform again.
+     * All the functions below thus run in O(tiles), except on the few tiles that are not uniform.
+     **/
     class Bitmap
     {
     public:
         Bitmap(const RectI & bounds)
-        : _bounds(bounds)
-        , _map( bounds.area() )
+        : _bounds()
+        , _tilesX(0)
+        , _tilesY(0)
+        , _tiles()
+        , _mixedTiles()
         , _dirtyZone()
         , _dirtyZoneSet(false)
         {
@@ -73,39 +95,42 @@ namespace Natron {
             // "identities" images (i.e: images that are just a link to another image). See EffectInstance :
             // "!!!Note that if isIdentity is true it will allocate an empty image object with 0 bytes of data."
             //assert(!rod.isNull());
-            std::fill(_map.begin(), _map.end(), 0);
+            initialize(bounds);
         }
 
         Bitmap()
         : _bounds()
-        , _map()
+        , _tilesX(0)
+        , _tilesY(0)
+        , _tiles()
+        , _mixedTiles()
         , _dirtyZone()
         , _dirtyZoneSet(false)
         {
         }
         
-        void initialize(const RectI & bounds)
-        {
-            _bounds = bounds;
-            _map.resize( _bounds.area() );
-
-            std::fill(_map.begin(), _map.end(), 0);
-        }
+        void initialize(const RectI & bounds);
 
         ~Bitmap()
         {
         }
 
         
-        void setTo1()
-        {
-            std::fill(_map.begin(),_map.end(),1);
-        }
+        void setTo1();
 
         const RectI & getBounds() const
         {
             return _bounds;
         }
+        
+        /**
+         * @brief Returns the memory taken by the state of the tiles. This does not account the transient
+         * per pixel state of the tiles that are partially rendered.
+         **/
+        std::size_t getTilesMemorySize() const
+        {
+            return _tiles.size();
+        }
 
 #if NATRON_ENABLE_TRIMAP
         void minimalNonMarkedRects_trimap(const RectI & roi,std::list<RectI>& ret,bool* isBeingRenderedElsewhere) const;
@@ -128,31 +153,78 @@ namespace Natron {
         
         void swap(Natron::Bitmap& other);
 
-        const char* getBitmap() const
-        {
-            return &_map.front();
-        }
-
-        char* getBitmap()
-        {
-            return &_map.front();
-        }
-
-        const char* getBitmapAt(int x,int y) const;
-        char* getBitmapAt(int x,int y);
-        
-        void copyRowPortion(int x1,int x2,int y,const Bitmap& other);
+        ///Returns the state of the pixel, which must be within the bounds
+        char getPixel(int x,int y) const;
         
         void copyBitmapPortion(const RectI& roi, const Bitmap& other);
         
+        /**
+         * @brief Sets the state of the pixels of roi from the state of the pixels of other at twice the resolution:
+         * a pixel is rendered only if all the pixels of other it covers are rendered.
+         **/
+        void halveBitmapPortion(const RectI& roi, const Bitmap& other);
+        
         void setDirtyZone(const RectI& zone) {
             _dirtyZone = zone;
             _dirtyZoneSet = true;
         }
         
     private:
+        
+        ///The state of a tile whose pixels do not all have the same state
+        struct MixedTile
+        {
+            std::vector<char> pixels; //< one byte per pixel of the tile, clipped to the bounds
+            int count[3]; //< the number of pixels for each state
+        };
+        
+        typedef std::map<int, MixedTile> MixedTilesMap;
+        
+        RectI getTileRect(int tx, int ty) const;
+        
+        ///Returns a mask with the bit (1 << state) set for each state met in rect
+        unsigned char getStatesInRect(const RectI & rect) const;
+        
+        /**
+         * @brief Returns true if all the tiles intersecting rect are uniform, in which case states is set to the
+         * same mask as getStatesInRect(rect).
+         **/
+        bool getUniformTilesStatesInRect(const RectI & rect, unsigned char* states) const;
+        
+        /**
+         * @brief Returns the number of consecutive rows (or columns if rows is false) of rect, starting from its bottom (left)
+         * if fromStart is true or from its top (right) otherwise, that contain none of the states in stopStates.
+         * skippedStates is set to the states met in these rows and stopRowStates to the states met in the first row
+         * that was not skipped, or 0 if all rows were skipped.
+         **/
+        int countRowsWithout(const RectI & rect, bool rows, bool fromStart, unsigned char stopStates,
+                             unsigned char* skippedStates, unsigned char* stopRowStates) const;
+
+        /**
+         * @brief Returns the state of the first pixel of line, a row scanned from its left if row is true or a column
+         * scanned from its bottom otherwise, whose state is in states, or -1 if there is none.
+         **/
+        char getFirstStateInLine(const RectI & line, bool row, unsigned char states) const;
+
+        /**
+         * @brief Returns true if the scan of the minimalNonMarkedRects_trimap() rectangles stopped on a pixel being rendered
+         * elsewhere, i.e: if the first pixel rendered or being rendered in the row where countRowsWithout() stopped is being
+         * rendered. count and stopRowStates are the results of countRowsWithout() for the same rect, rows and fromStart.
+         **/
+        bool stopsOnPixelUnavailable(const RectI & rect, bool rows, bool fromStart, int count, unsigned char stopRowStates) const;
+
+        RectI minimalNonMarkedBbox_internal(const RectI& roi, bool trimap, bool* isBeingRenderedElsewhere) const;
+        
+        void minimalNonMarkedRects_internal(const RectI & roi, bool trimap, std::list<RectI>& ret, bool* isBeingRenderedElsewhere) const;
+        
+        void fill(const RectI & roi, char state);
+        
+        void setPixels(int tileIndex, const RectI & tileRect, const RectI & rect, char state);
+        
         RectI _bounds;
-        std::vector<char> _map;
+        int _tilesX, _tilesY;
+        std::vector<char> _tiles; //< the state of each tile, or NATRON_BITMAP_TILE_MIXED
+        MixedTilesMap _mixedTiles;
 
         /**
          * This represents the zone that has potentially something to render. In minimalNonMarkedRects
@@ -232,6 +304,8 @@ namespace Natron {
         /**
          * @brief Resizes this image so it contains newBounds, copying all the content of the current bounds of the image into
          * a new buffer. This is not thread-safe and should be called only while under an ImageLocker
+         * If the image uses a bitmap that is not set to 1 in the grown area, it is resized to getGrownBounds() so that the
+         * next resizes are less likely.
          **/
         bool ensureBounds(const RectI& newBounds, bool fillWithBlackAndTransparant = false, bool setBitmapTo1 = false);
         
@@ -241,6 +315,14 @@ namespace Natron {
          **/
         bool copyAndResizeIfNeeded(const RectI& newBounds, bool fillWithBlackAndTransparant, bool setBitmapTo1, boost::shared_ptr<Image>* output);
         
+        /**
+         * @brief Returns the bounds to which an image of the given bounds is resized so that it contains newBounds:
+         * each side that must move grows by at least half the size of the image, rounded to the tiles of the bitmap and
+         * clipped to rodBounds. An image rendered piece by piece (e.g: by the viewer) is thus reallocated a logarithmic
+         * number of times instead of once per piece, and the pixels it was not asked for are simply marked as not rendered.
+         **/
+        static RectI getGrownBounds(const RectI& bounds, const RectI& newBounds, const RectI& rodBounds);
+        
     private:
         
         static void resizeInternal(const Image* srcImg,
@@ -285,13 +367,19 @@ namespace Natron {
             std::size_t dt = dataSize();
             
             bool got = _entryLock.tryLockForRead();
-            dt += _bitmap.getBounds().area();
+            dt += _bitmap.getTilesMemorySize();
             if (got) {
                 _entryLock.unlock();
             }
             return dt;
         }
 
+        ///The buffer is made of bytes but the pixel components may be larger
+        virtual std::size_t getCompressionElementSize() const OVERRIDE FINAL
+        {
+            return getSizeOfForBitDepth(_bitDepth);
+        }
+
 
         ///Overriden from BufferableObject
         virtual std::size_t sizeInRAM() const OVERRIDE FINAL
@@ -386,12 +474,6 @@ namespace Natron {
                 assert(img);
                 return img->pixelAt(x, y);
             }
-            
-            const char* bitmapAt(int x, int y) const
-            {
-                assert(img);
-                return img->getBitmapAt(x, y);
-            }
         };
         
         /**
@@ -409,6 +491,7 @@ namespace Natron {
             , img(img)
             {
                 img->lockForWrite();
+                img->makeWritable();
             }
             
             WriteAccess(const WriteAccess& other)
@@ -431,12 +514,6 @@ namespace Natron {
             {
                 return img->pixelAt(x, y);
             }
-            
-            char* bitmapAt(int x, int y) const
-            {
-                assert(img);
-                return img->getBitmapAt(x, y);
-            }
         };
         
         ReadAccess getReadRights() const
@@ -459,24 +536,20 @@ namespace Natron {
          * of an image.
          **/
         
-        const char* getBitmapAt(int x,
-                                int y) const
-        {
-            return this->_bitmap.getBitmapAt(x,y);
-        }
-        
-        char* getBitmapAt(int x,
-                          int y)
-        {
-            return this->_bitmap.getBitmapAt(x,y);
-        }
-        
         /**
          * @brief Access pixels. The pointer must be cast to the appropriate type afterwards.
+         * The pixels may be shared with another image (@see sharePixelsFrom): they may be written to only once makeWritable()
+         * was called.
          **/
         unsigned char* pixelAt(int x,int y);
         const unsigned char* pixelAt(int x,int y) const;
         
+        /**
+         * @brief Copies the pixels if they are shared with another image, so that they can be written to.
+         * This must be called under the write lock of the image, before writing to the pixels.
+         **/
+        void makeWritable();
+        
         /**
          * @brief Locks the image for read/write access. 
          * There can be a deadlock situation in the following situation: 
@@ -704,6 +777,8 @@ namespace Natron {
         /**
      * @brief Copies the content of the portion defined by roi of the other image pixels into this image.
      * The internal bitmap will be copied aswell
+     * If roi covers both images and they have the same bounds, the pixels are shared instead of copied: they are
+     * copied only when one of the 2 images is written to.
      **/
         void pasteFrom(const Natron::Image & src, const RectI & srcRoi, bool copyBitmap = true);
 
@@ -725,6 +800,15 @@ namespace Natron {
      **/
         void upscaleMipMap(const RectI & roi, unsigned int fromLevel, unsigned int toLevel, Natron::Image* output) const;
 
+        /**
+     * @brief Computes the mipmaps of the roi of this image for the levels 1 to levels.size(), relative to the mipmap level
+     * of this image, in a single pass: levels[i] receives the level i + 1. The levels that are NULL are not kept, they only
+     * hold the 2 rows needed by the next level, but the last one must be set. Each image must contain the roi of its level,
+     * that is the roi halved i + 1 times to its smallest enclosing rectangle.
+     * The result is the same as calling halveRoI() for each level but this image is read only once.
+     **/
+        void buildMipMapPyramid(const RectI & roi, bool copyBitMap, const std::vector<Natron::Image*>& levels) const;
+
         /**
      * @brief Scales the roi of this image to the size of the output image.
      * This is used internally by buildMipMapLevel when the image is a NPOT.
@@ -797,6 +881,15 @@ namespace Natron {
                              bool requiresUnpremult,
                              Natron::Image* dstImg) const;
         
+        ///The conversion of convertToFormatCommon() without the locks and the bitmap, on a band of rows
+        void convertToFormatForRows(const RectI & renderWindow,
+                                    Natron::ViewerColorSpaceEnum srcColorSpace,
+                                    Natron::ViewerColorSpaceEnum dstColorSpace,
+                                    int channelForAlpha,
+                                    bool useAlpha0,
+                                    bool requiresUnpremult,
+                                    Natron::Image* dstImg) const;
+        
         template <typename PIX, bool doPremult>
         void premultInternal(const RectI& roi);
         template <bool doPremult>
@@ -825,11 +918,26 @@ namespace Natron {
                           float mix);
 
         /**
-         * @brief returns true if image contains NaNs or infinite values, and fix them.
-         */
-        bool checkForNaNs(const RectI& roi) WARN_UNUSED_RETURN;
+         * @brief Same as copyUnProcessedChannels() followed by applyMaskMix() with the same roi and original image, if
+         * useMaskMix is true. Both are applied one band of rows at a time so that the second pass finds the pixels
+         * still in the CPU cache instead of reading the whole roi again from memory.
+         **/
+        void copyUnProcessedChannelsAndApplyMaskMix(const RectI& roi,
+                                                    Natron::ImagePremultiplicationEnum outputPremult,
+                                                    Natron::ImagePremultiplicationEnum originalImagePremult,
+                                                    std::bitset<4> processChannels,
+                                                    const boost::shared_ptr<Image>& originalImage,
+                                                    bool useMaskMix,
+                                                    const Image* maskImg,
+                                                    bool masked,
+                                                    bool maskInvert,
+                                                    float mix);
 
-        void copyBitmapRowPortion(int x1, int x2,int y, const Image& other);
+        /**
+         * @brief returns true if the float image contains NaNs in roi, and converts them to 1. Infinite values are left untouched.
+         * If not NULL, nbNaNs and nbInfinities are set to the number of NaN and infinite values found.
+         */
+        bool checkForNaNs(const RectI& roi, int* nbNaNs = 0, int* nbInfinities = 0) WARN_UNUSED_RETURN;
 
         void copyBitmapPortion(const RectI& roi, const Image& other);
         
@@ -926,6 +1034,10 @@ namespace Natron {
         void buildMipMapLevel(const RectD& dstRoD,const RectI & roiCanonical, unsigned int level, bool copyBitMap,
                               Natron::Image* output) const;
 
+        template <typename PIX>
+        void buildMipMapPyramidForDepth(const std::vector<RectI> & rois,
+                                        const std::vector<Natron::Image*>& levels) const;
+
 
         /**
      * @brief Halve the given roi of this image into output.
@@ -954,6 +1066,30 @@ namespace Natron {
         template<typename PIX>
         void pasteFromForDepth(const Natron::Image & src, const RectI & srcRoi, bool copyBitmap = true, bool takeSrcLock = true);
 
+        /**
+         * @brief If other has the same bounds, components and bit depth as this image, makes this image reference the
+         * pixels of other instead of its own (copy-on-write). The caller must hold the locks of both images.
+         * @returns False if the pixels could not be shared, in which case this image is left untouched.
+         **/
+        bool sharePixelsFrom(const Natron::Image & other);
+
+        /**
+         * @brief Calls func on bands of rows covering roi, whose pixels take pixelBytes bytes. Above a size threshold, the bands
+         * are processed in parallel by the TaskScheduler of the application with at most its idle threads, the
+         * calling thread taking its share of the bands. Otherwise func is called once on roi in the calling thread.
+         * The caller must hold the locks of the images func reads and writes, and func must not take them. The image written to
+         * by func must have been made writable beforehand, @see makeWritable.
+         **/
+        static void processRowBands(const RectI & roi, std::size_t pixelBytes,
+                                    const boost::function<void (const RectI &)> & func);
+
+        template<typename PIX>
+        void pasteRowsForDepth(const Natron::Image & src, const RectI & roi);
+
+        void fillZeroRows(const RectI & roi);
+
+        void checkForNaNsRows(const RectI & roi, QAtomicInt* nbNaNs, QAtomicInt* nbInfinities);
+
         template <typename PIX, int maxValue>
         void fillForDepth(const RectI & roi,float r,float g,float b,float a);
         
@@ -1000,6 +1136,7 @@ namespace Natron {
     template<> inline unsigned char clampIfInt(float v) { return (unsigned char)clamp<float>(v, 0, 255); }
     template<> inline unsigned short clampIfInt(float v) { return (unsigned short)clamp<float>(v, 0, 65535); }
     template<> inline float clampIfInt(float v) { return v; }
+    template<> inline Half clampIfInt(float v) { return Half(v); }
     
     typedef boost::shared_ptr<Natron::Image> ImagePtr;
     typedef std::list<ImagePtr> ImageList;
@@ -25,15 +25,21 @@
 #include "Image.h"
 
 #include <algorithm> // min, max
+#include <cstring> // memcpy
+#include <vector>
 
 #include <QDebug>
 #ifndef Q_MOC_RUN
 GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_OFF
+// /usr/local/include/boost/bind/arg.hpp:37:9: warning: unused typedef 'boost_static_assert_typedef_37' [-Wunused-local-typedef]
+#include <boost/bind.hpp>
 #include <boost/math/special_functions/fpclassify.hpp>
 GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 #endif
 #include "Engine/AppManager.h"
+#include "Engine/Half.h"
 #include "Engine/Lut.h"
+#include "Engine/SIMD.h"
 
 using namespace Natron;
 
@@ -104,6 +110,55 @@ convertPixelDepth(float pix)
 {
     return pix;
 }
+
+template <>
+Half
+convertPixelDepth(unsigned char pix)
+{
+    return Half( Color::intToFloat<256>(pix) );
+}
+
+template <>
+Half
+convertPixelDepth(unsigned short pix)
+{
+    return Half( Color::intToFloat<65536>(pix) );
+}
+
+template <>
+Half
+convertPixelDepth(float pix)
+{
+    return Half(pix);
+}
+
+template <>
+unsigned char
+convertPixelDepth(Half pix)
+{
+    return (unsigned char)Color::floatToInt<256>(pix);
+}
+
+template <>
+unsigned short
+convertPixelDepth(Half pix)
+{
+    return (unsigned short)Color::floatToInt<65536>(pix);
+}
+
+template <>
+float
+convertPixelDepth(Half pix)
+{
+    return pix;
+}
+
+template <>
+Half
+convertPixelDepth(Half pix)
+{
+    return pix;
+}
 }
 
 static const Natron::Color::Lut*
@@ -130,7 +185,314 @@ lutFromColorspace(Natron::ViewerColorSpaceEnum cs)
     return lut;
 }
 
-///Fast version when components are the same
+namespace {
+
+///convertPixelDepth() for the n samples of a row, using the SIMD kernels
+template <typename SRCPIX,typename DSTPIX>
+void
+convertPixelDepthRow(const SRCPIX* from,
+                     DSTPIX* to,
+                     int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = convertPixelDepth<SRCPIX, DSTPIX>(from[i]);
+    }
+}
+
+template <>
+void
+convertPixelDepthRow(const unsigned char* from,
+                     float* to,
+                     int n)
+{
+    SIMD::convertUint8ToFloat(from, to, n);
+}
+
+template <>
+void
+convertPixelDepthRow(const unsigned short* from,
+                     float* to,
+                     int n)
+{
+    SIMD::convertUint16ToFloat(from, to, n);
+}
+
+template <>
+void
+convertPixelDepthRow(const float* from,
+                     unsigned char* to,
+                     int n)
+{
+    SIMD::convertFloatToUint8(from, to, n);
+}
+
+template <>
+void
+convertPixelDepthRow(const float* from,
+                     unsigned short* to,
+                     int n)
+{
+    SIMD::convertFloatToUint16(from, to, n);
+}
+
+template <>
+void
+convertPixelDepthRow(const unsigned char* from,
+                     unsigned short* to,
+                     int n)
+{
+    SIMD::convertUint8ToUint16(from, to, n);
+}
+
+template <>
+void
+convertPixelDepthRow(const unsigned short* from,
+                     unsigned char* to,
+                     int n)
+{
+    SIMD::convertUint16ToUint8(from, to, n);
+}
+
+template <>
+void
+convertPixelDepthRow(const unsigned char* from,
+                     unsigned char* to,
+                     int n)
+{
+    std::memcpy( to, from, n * sizeof(unsigned char) );
+}
+
+template <>
+void
+convertPixelDepthRow(const unsigned short* from,
+                     unsigned short* to,
+                     int n)
+{
+    std::memcpy( to, from, n * sizeof(unsigned short) );
+}
+
+template <>
+void
+convertPixelDepthRow(const float* from,
+                     float* to,
+                     int n)
+{
+    std::memcpy( to, from, n * sizeof(float) );
+}
+
+template <>
+void
+convertPixelDepthRow(const Half* from,
+                     float* to,
+                     int n)
+{
+    SIMD::convertHalfToFloat( (const unsigned short*)from, to, n );
+}
+
+template <>
+void
+convertPixelDepthRow(const float* from,
+                     Half* to,
+                     int n)
+{
+    SIMD::convertFloatToHalf( from, (unsigned short*)to, n );
+}
+
+template <>
+void
+convertPixelDepthRow(const Half* from,
+                     Half* to,
+                     int n)
+{
+    std::memcpy( to, from, n * sizeof(Half) );
+}
+
+///The conversions between half and the integer depths go through float, a chunk at a time
+template <typename SRCPIX,typename DSTPIX>
+void
+convertPixelDepthRowThroughFloat(const SRCPIX* from,
+                                 DSTPIX* to,
+                                 int n)
+{
+    float buf[1024];
+
+    for (int i = 0; i < n; i += 1024) {
+        const int count = std::min(1024, n - i);
+        convertPixelDepthRow<SRCPIX, float>(from + i, buf, count);
+        convertPixelDepthRow<float, DSTPIX>(buf, to + i, count);
+    }
+}
+
+template <>
+void
+convertPixelDepthRow(const unsigned char* from,
+                     Half* to,
+                     int n)
+{
+    convertPixelDepthRowThroughFloat<unsigned char, Half>(from, to, n);
+}
+
+template <>
+void
+convertPixelDepthRow(const unsigned short* from,
+                     Half* to,
+                     int n)
+{
+    convertPixelDepthRowThroughFloat<unsigned short, Half>(from, to, n);
+}
+
+template <>
+void
+convertPixelDepthRow(const Half* from,
+                     unsigned char* to,
+                     int n)
+{
+    convertPixelDepthRowThroughFloat<Half, unsigned char>(from, to, n);
+}
+
+template <>
+void
+convertPixelDepthRow(const Half* from,
+                     unsigned short* to,
+                     int n)
+{
+    convertPixelDepthRowThroughFloat<Half, unsigned short>(from, to, n);
+}
+
+///Converts n samples of the given depth in the colorspace of lut (or linear if NULL) to linear float
+template <typename SRCPIX>
+void
+toLinearFloatRow(const Natron::Color::Lut* lut,
+                 const SRCPIX* from,
+                 float* to,
+                 int n);
+
+template <>
+void
+toLinearFloatRow(const Natron::Color::Lut* lut,
+                 const unsigned char* from,
+                 float* to,
+                 int n)
+{
+    if (lut) {
+        lut->fromColorSpaceUint8ToLinearFloatFast(from, to, n);
+    } else {
+        SIMD::convertUint8ToFloat(from, to, n);
+    }
+}
+
+template <>
+void
+toLinearFloatRow(const Natron::Color::Lut* lut,
+                 const unsigned short* from,
+                 float* to,
+                 int n)
+{
+    if (lut) {
+        lut->fromColorSpaceUint16ToLinearFloatFast(from, to, n);
+    } else {
+        SIMD::convertUint16ToFloat(from, to, n);
+    }
+}
+
+template <>
+void
+toLinearFloatRow(const Natron::Color::Lut* lut,
+                 const float* from,
+                 float* to,
+                 int n)
+{
+    if (lut) {
+        lut->fromColorSpaceFloatToLinearFloat(from, to, n);
+    } else {
+        std::memcpy( to, from, n * sizeof(float) );
+    }
+}
+
+template <>
+void
+toLinearFloatRow(const Natron::Color::Lut* lut,
+                 const Half* from,
+                 float* to,
+                 int n)
+{
+    SIMD::convertHalfToFloat( (const unsigned short*)from, to, n );
+    if (lut) {
+        lut->fromColorSpaceFloatToLinearFloat(to, to, n);
+    }
+}
+
+///Converts n linear float samples to the given depth in the colorspace of lut (or linear if NULL).
+///Bytes are not handled here: they need error diffusion
+template <typename DSTPIX>
+void
+fromLinearFloatRow(const Natron::Color::Lut* lut,
+                   const float* from,
+                   DSTPIX* to,
+                   int n);
+
+template <>
+void
+fromLinearFloatRow(const Natron::Color::Lut* lut,
+                   const float* from,
+                   unsigned short* to,
+                   int n)
+{
+    if (lut) {
+        lut->toColorSpaceUint16FromLinearFloatFast(from, to, n);
+    } else {
+        SIMD::convertFloatToUint16(from, to, n);
+    }
+}
+
+template <>
+void
+fromLinearFloatRow(const Natron::Color::Lut* lut,
+                   const float* from,
+                   float* to,
+                   int n)
+{
+    if (lut) {
+        lut->toColorSpaceFloatFromLinearFloat(from, to, n);
+    } else {
+        std::memcpy( to, from, n * sizeof(float) );
+    }
+}
+
+template <>
+void
+fromLinearFloatRow(const Natron::Color::Lut* lut,
+                   const float* from,
+                   Half* to,
+                   int n)
+{
+    if (!lut) {
+        SIMD::convertFloatToHalf( from, (unsigned short*)to, n );
+
+        return;
+    }
+    float buf[1024];
+    for (int i = 0; i < n; i += 1024) {
+        const int count = std::min(1024, n - i);
+        lut->toColorSpaceFloatFromLinearFloat(from + i, buf, count);
+        SIMD::convertFloatToHalf( buf, (unsigned short*)to + i, count );
+    }
+}
+
+template <>
+void
+fromLinearFloatRow(const Natron::Color::Lut* /*lut*/,
+                   const float* /*from*/,
+                   unsigned char* /*to*/,
+                   int /*n*/)
+{
+    assert(false);
+}
+
+} // anon namespace
+
+///Fast version when components are the same.
+///Each row is converted at once with the SIMD kernels, only the error diffusion to bytes is serial.
 template <typename SRCPIX,typename DSTPIX,int srcMaxValue,int dstMaxValue>
 void
 Image::convertToFormatInternal_sameComps(const RectI & renderWindow,
@@ -148,7 +510,6 @@ Image::convertToFormatInternal_sameComps(const RectI & renderWindow,
     }
 
     Natron::ImageBitDepthEnum dstDepth = dstImg.getBitDepth();
-    Natron::ImageBitDepthEnum srcDepth = srcImg.getBitDepth();
     int nComp = (int)srcImg.getComponentsCount();
     const Natron::Color::Lut* const srcLut_ = lutFromColorspace(srcColorSpace);
     const Natron::Color::Lut* const dstLut_ = lutFromColorspace(dstColorSpace);
@@ -160,82 +521,70 @@ Image::convertToFormatInternal_sameComps(const RectI & renderWindow,
     if (intersection.isNull()) {
         return;
     }
-    for (int y = 0; y < intersection.height(); ++y) {
-        // coverity[dont_call]
-        int start = rand() % intersection.width();
-        const SRCPIX* srcPixels = (const SRCPIX*)srcImg.pixelAt(intersection.x1 + start, intersection.y1 + y);
-        DSTPIX* dstPixels = (DSTPIX*)dstImg.pixelAt(intersection.x1 + start, intersection.y1 + y);
-        const SRCPIX* srcStart = srcPixels;
-        DSTPIX* dstStart = dstPixels;
+    const int width = intersection.width();
+    const int rowSize = width * nComp;
 
-        for (int backward = 0; backward < 2; ++backward) {
-            int x = backward ? start - 1 : start;
-            int end = backward ? -1 : intersection.width();
-            unsigned error[3] = {
-                0x80,0x80,0x80
-            };
+    if (!srcLut && !dstLut) {
+        ///Every sample is converted on its own, without error diffusion
+        for (int y = 0; y < intersection.height(); ++y) {
+            const SRCPIX* srcPixels = (const SRCPIX*)srcImg.pixelAt(intersection.x1, intersection.y1 + y);
+            DSTPIX* dstPixels = (DSTPIX*)dstImg.pixelAt(intersection.x1, intersection.y1 + y);
+            convertPixelDepthRow<SRCPIX, DSTPIX>(srcPixels, dstPixels, rowSize);
+        }
+    } else {
+        std::vector<float> linearRow(rowSize);
+        std::vector<unsigned short> uint8xxRow(dstDepth == eImageBitDepthByte ? rowSize : 0);
 
-            while ( x != end && x >= 0 && x < intersection.width() ) {
-                for (int k = 0; k < nComp; ++k) {
-#                 ifdef DEBUG
-                    assert(srcPixels[k] == srcPixels[k]); // check for NaN
-#                 endif
-                    DSTPIX pix;
-                    if ( k == 3 || (!srcLut && !dstLut) ) {
-                         pix = convertPixelDepth<SRCPIX, DSTPIX>(srcPixels[k]);
-                    } else {
-                        float pixFloat;
+        for (int y = 0; y < intersection.height(); ++y) {
+            // coverity[dont_call]
+            int start = rand() % width;
+            const SRCPIX* srcPixels = (const SRCPIX*)srcImg.pixelAt(intersection.x1, intersection.y1 + y);
+            DSTPIX* dstPixels = (DSTPIX*)dstImg.pixelAt(intersection.x1, intersection.y1 + y);
 
-                        if (srcLut) {
-                            if (srcDepth == eImageBitDepthByte) {
-                                pixFloat = srcLut->fromColorSpaceUint8ToLinearFloatFast(srcPixels[k]);
-                            } else if (srcDepth == eImageBitDepthShort) {
-                                pixFloat = srcLut->fromColorSpaceUint16ToLinearFloatFast(srcPixels[k]);
-                            } else {
-                                pixFloat = srcLut->fromColorSpaceFloatToLinearFloat(srcPixels[k]);
-                            }
-                        } else {
-                            pixFloat = convertPixelDepth<SRCPIX, float>(srcPixels[k]);
-                        }
+            toLinearFloatRow<SRCPIX>(srcLut, srcPixels, &linearRow[0], rowSize);
 
-                        if (dstDepth == eImageBitDepthByte) {
-                            ///small increase in perf we use Luts. This should be anyway the most used case.
-                            error[k] = (error[k] & 0xff) + ( dstLut ? dstLut->toColorSpaceUint8xxFromLinearFloatFast(pixFloat) :
-                                                             Color::floatToInt<0xff01>(pixFloat) );
-                            pix = error[k] >> 8;
-                        } else if (dstDepth == eImageBitDepthShort) {
-                            pix = dstLut ? dstLut->toColorSpaceUint16FromLinearFloatFast(pixFloat) :
-                                  convertPixelDepth<float, DSTPIX>(pixFloat);
-                        } else {
-                            if (dstLut) {
-                                pixFloat = dstLut->toColorSpaceFloatFromLinearFloat(pixFloat);
+            if (dstDepth == eImageBitDepthByte) {
+                ///small increase in perf we use Luts. This should be anyway the most used case.
+                if (dstLut) {
+                    dstLut->toColorSpaceUint8xxFromLinearFloatFast(&linearRow[0], &uint8xxRow[0], rowSize);
+                } else {
+                    SIMD::convertFloatToUint8xx(&linearRow[0], &uint8xxRow[0], rowSize);
+                }
+                ///error diffusion, starting at a random position of the row to avoid patterns
+                for (int backward = 0; backward < 2; ++backward) {
+                    int x = backward ? start - 1 : start;
+                    int end = backward ? -1 : width;
+                    int step = backward ? -1 : 1;
+                    unsigned error[3] = {
+                        0x80,0x80,0x80
+                    };
+
+                    for (; x != end; x += step) {
+                        const int index = x * nComp;
+                        for (int k = 0; k < nComp; ++k) {
+                            if (k == 3) {
+                                dstPixels[index + k] = convertPixelDepth<SRCPIX, DSTPIX>(srcPixels[index + k]);
+                            } else {
+                                error[k] = (error[k] & 0xff) + uint8xxRow[index + k];
+                                dstPixels[index + k] = error[k] >> 8;
                             }
-                            pix = convertPixelDepth<float, DSTPIX>(pixFloat);
                         }
                     }
-                    dstPixels[k] =  pix;
-#                 ifdef DEBUG
-                    assert(dstPixels[k] == dstPixels[k]); // check for NaN
-#                 endif
                 }
-
-                if (backward) {
-                    --x;
-                    srcPixels -= nComp;
-                    dstPixels -= nComp;
-                } else {
-                    ++x;
-                    srcPixels += nComp;
-                    dstPixels += nComp;
+            } else {
+                fromLinearFloatRow<DSTPIX>(dstLut, &linearRow[0], dstPixels, rowSize);
+                ///the alpha channel is never converted to another colorspace
+                if (nComp == 4) {
+                    for (int x = 3; x < rowSize; x += 4) {
+                        dstPixels[x] = convertPixelDepth<SRCPIX, DSTPIX>(srcPixels[x]);
+                    }
                 }
             }
-            srcPixels = srcStart - nComp;
-            dstPixels = dstStart - nComp;
         }
+    }
 
-        if (copyBitmap) {
-            dstImg.copyBitmapRowPortion(intersection.x1, intersection.x2, intersection.y1 + y, srcImg);
-        }
+    if (copyBitmap) {
+        dstImg.copyBitmapPortion(intersection, srcImg);
     }
 } // convertToFormatInternal_sameComps
 
@@ -304,6 +653,31 @@ Image::convertToFormatInternalForColorSpace(const RectI & renderWindow,
         return;
     }
     
+    ///Extracting a single channel, e.g: a mask out of an RGBA image for a plug-in: only the depth of the channel is converted,
+    ///so the channel is copied row by row without the error diffusion of the loop below
+    if (dstNComps == 1) {
+        const int channel = srcNComps == 1 ? 0 : channelForAlpha;
+        assert(channel >= 0 && channel < srcNComps);
+        const int srcRowElements = srcImg._bounds.width() * srcNComps;
+        const int dstRowElements = dstImg._bounds.width();
+        const SRCPIX* srcPixels = (const SRCPIX*)srcImg.pixelAt(renderWindow.x1, renderWindow.y1) + channel;
+        DSTPIX* dstPixels = (DSTPIX*)dstImg.pixelAt(renderWindow.x1, renderWindow.y1);
+        const int width = renderWindow.width();
+        
+        for ( int y = 0; y < renderWindow.height();
+             ++y, srcPixels += srcRowElements, dstPixels += dstRowElements ) {
+            for (int x = 0; x < width; ++x) {
+                dstPixels[x] = convertPixelDepth<SRCPIX, DSTPIX>(srcPixels[x * srcNComps]);
+            }
+        }
+        
+        if (copyBitmap) {
+            dstImg.copyBitmapPortion(renderWindow, srcImg);
+        }
+        
+        return;
+    }
+    
     const Natron::Color::Lut* const srcLut = useColorspaces ? lutFromColorspace((Natron::ViewerColorSpaceEnum)srcColorSpace) : 0;
     const Natron::Color::Lut* const dstLut = useColorspaces ? lutFromColorspace((Natron::ViewerColorSpaceEnum)dstColorSpace) : 0;
     
@@ -346,11 +720,11 @@ Image::convertToFormatInternalForColorSpace(const RectI & renderWindow,
                             break;
                         case 3:
                             // RGB is opaque, so no alpha, unless channelForAlpha is 0-2
-                            pix = convertPixelDepth<SRCPIX, DSTPIX>(channelForAlpha == -1 ? 0. : srcPixels[channelForAlpha]);
+                            pix = convertPixelDepth<SRCPIX, DSTPIX>(channelForAlpha == -1 ? SRCPIX(0) : srcPixels[channelForAlpha]);
                             break;
                         case 2:
                             // XY is opaque unless channelForAlpha is  0-1
-                            pix = convertPixelDepth<SRCPIX, DSTPIX>(channelForAlpha == -1 ? 0. : srcPixels[channelForAlpha]);
+                            pix = convertPixelDepth<SRCPIX, DSTPIX>(channelForAlpha == -1 ? SRCPIX(0) : srcPixels[channelForAlpha]);
                             break;
                         case 1:
                             // just copy alpha disregarding channelForAlpha
@@ -389,7 +763,7 @@ Image::convertToFormatInternalForColorSpace(const RectI & renderWindow,
                         }
                         
                         for (int k = 0; k < 3 && k < dstNComps; ++k) {
-                            SRCPIX sourcePixel = k < srcNComps ? srcPixels[k] : 0.;
+                            SRCPIX sourcePixel = k < srcNComps ? srcPixels[k] : SRCPIX(0);
                             DSTPIX pix;
                             if (!useColorspaces || (!srcLut && !dstLut)) {
                                 if (dstMaxValue == 255) {
@@ -433,7 +807,7 @@ Image::convertToFormatInternalForColorSpace(const RectI & renderWindow,
                                     pix = error[k] >> 8;
                                     
                                 } else if (dstMaxValue == 65535) {
-                                    pix = dstLut ? dstLut->toColorSpaceUint16FromLinearFloatFast(pixFloat) :
+                                    pix = dstLut ? DSTPIX( dstLut->toColorSpaceUint16FromLinearFloatFast(pixFloat) ) :
                                     convertPixelDepth<float, DSTPIX>(pixFloat);
                                     
                                 } else {
@@ -703,6 +1077,32 @@ Image::convertToFormatCommon(const RectI & renderWindow,
     
     assert( _bounds.contains(renderWindow) &&  dstImg->_bounds.contains(renderWindow) );
     
+    RectI intersection;
+    if ( !renderWindow.intersect(_bounds, &intersection) || !intersection.intersect(dstImg->_bounds, &intersection) ) {
+        return;
+    }
+    if (copyBitmap) {
+        dstImg->copyBitmapPortion(intersection, *this);
+    }
+    
+    dstImg->makeWritable();
+    processRowBands( intersection, dstImg->getComponentsCount() * getSizeOfForBitDepth( dstImg->getBitDepth() ),
+                     boost::bind(&Image::convertToFormatForRows, this, _1, srcColorSpace, dstColorSpace, channelForAlpha, useAlpha0,
+                                 requiresUnpremult, dstImg) );
+}
+
+void
+Image::convertToFormatForRows(const RectI & renderWindow,
+                              Natron::ViewerColorSpaceEnum srcColorSpace,
+                              Natron::ViewerColorSpaceEnum dstColorSpace,
+                              int channelForAlpha,
+                              bool useAlpha0,
+                              bool requiresUnpremult,
+                              Natron::Image* dstImg) const
+{
+    ///The bitmap is copied once by convertToFormatCommon()
+    const bool copyBitmap = false;
+    
     if ( dstImg->getComponents().getNumComponents() == getComponents().getNumComponents() ) {
         switch ( dstImg->getBitDepth() ) {
             case eImageBitDepthByte: {
@@ -719,6 +1119,9 @@ Image::convertToFormatCommon(const RectI & renderWindow,
                                                                                                      dstColorSpace,copyBitmap);
                         break;
                     case eImageBitDepthHalf:
+                        convertToFormatInternal_sameComps<Half, unsigned char, 1, 255>(renderWindow,*this, *dstImg,
+                                                                                       srcColorSpace,
+                                                                                       dstColorSpace,copyBitmap);
                         break;
                     case eImageBitDepthFloat:
                         convertToFormatInternal_sameComps<float, unsigned char, 1, 255>(renderWindow,*this, *dstImg,
@@ -745,6 +1148,9 @@ Image::convertToFormatCommon(const RectI & renderWindow,
                                                                                                         dstColorSpace,copyBitmap);
                         break;
                     case eImageBitDepthHalf:
+                        convertToFormatInternal_sameComps<Half, unsigned short, 1, 65535>(renderWindow,*this, *dstImg,
+                                                                                          srcColorSpace,
+                                                                                          dstColorSpace,copyBitmap);
                         break;
                     case eImageBitDepthFloat:
                         convertToFormatInternal_sameComps<float, unsigned short, 1, 65535>(renderWindow,*this, *dstImg,
@@ -757,8 +1163,34 @@ Image::convertToFormatCommon(const RectI & renderWindow,
                 break;
             }
 
-            case eImageBitDepthHalf:
+            case eImageBitDepthHalf: {
+                switch ( getBitDepth() ) {
+                    case eImageBitDepthByte:
+                        convertToFormatInternal_sameComps<unsigned char, Half, 255, 1>(renderWindow,*this, *dstImg,
+                                                                                       srcColorSpace,
+                                                                                       dstColorSpace,copyBitmap);
+                        break;
+                    case eImageBitDepthShort:
+                        convertToFormatInternal_sameComps<unsigned short, Half, 65535, 1>(renderWindow,*this, *dstImg,
+                                                                                          srcColorSpace,
+                                                                                          dstColorSpace,copyBitmap);
+                        break;
+                    case eImageBitDepthHalf:
+                        ///Same as a copy
+                        convertToFormatInternal_sameComps<Half, Half, 1, 1>(renderWindow,*this, *dstImg,
+                                                                            srcColorSpace,
+                                                                            dstColorSpace,copyBitmap);
+                        break;
+                    case eImageBitDepthFloat:
+                        convertToFormatInternal_sameComps<float, Half, 1, 1>(renderWindow,*this, *dstImg,
+                                                                             srcColorSpace,
+                                                                             dstColorSpace,copyBitmap);
+                        break;
+                    case eImageBitDepthNone:
+                        break;
+                }
                 break;
+            }
 
             case eImageBitDepthFloat: {
                 switch ( getBitDepth() ) {
@@ -773,6 +1205,9 @@ Image::convertToFormatCommon(const RectI & renderWindow,
                                                                                            dstColorSpace,copyBitmap);
                         break;
                     case eImageBitDepthHalf:
+                        convertToFormatInternal_sameComps<Half, float, 1, 1>(renderWindow,*this, *dstImg,
+                                                                             srcColorSpace,
+                                                                             dstColorSpace,copyBitmap);
                         break;
                     case eImageBitDepthFloat:
                         ///Same as a copy
@@ -811,6 +1246,12 @@ Image::convertToFormatCommon(const RectI & renderWindow,
                                                                                                    copyBitmap,requiresUnpremult);
                         break;
                     case eImageBitDepthHalf:
+                        convertToFormatInternalForDepth<Half, unsigned char, 1, 255>(renderWindow,*this, *dstImg,
+                                                                                     srcColorSpace,
+                                                                                     dstColorSpace,
+                                                                                     channelForAlpha,
+                                                                                     useAlpha0,
+                                                                                     copyBitmap,requiresUnpremult);
                         break;
                     case eImageBitDepthFloat:
                         convertToFormatInternalForDepth<float, unsigned char, 1, 255>(renderWindow,*this, *dstImg,
@@ -847,6 +1288,12 @@ Image::convertToFormatCommon(const RectI & renderWindow,
                         
                         break;
                     case eImageBitDepthHalf:
+                        convertToFormatInternalForDepth<Half, unsigned short, 1, 65535>(renderWindow,*this, *dstImg,
+                                                                                        srcColorSpace,
+                                                                                        dstColorSpace,
+                                                                                        channelForAlpha,
+                                                                                        useAlpha0,
+                                                                                        copyBitmap,requiresUnpremult);
                         break;
                     case eImageBitDepthFloat:
                         convertToFormatInternalForDepth<float, unsigned short, 1, 65535>(renderWindow,*this, *dstImg,
@@ -861,8 +1308,45 @@ Image::convertToFormatCommon(const RectI & renderWindow,
                 }
                 break;
             }
-            case eImageBitDepthHalf:
+            case eImageBitDepthHalf: {
+                switch ( getBitDepth() ) {
+                    case eImageBitDepthByte:
+                        convertToFormatInternalForDepth<unsigned char, Half, 255, 1>(renderWindow,*this, *dstImg,
+                                                                                     srcColorSpace,
+                                                                                     dstColorSpace,
+                                                                                     channelForAlpha,
+                                                                                     useAlpha0,
+                                                                                     copyBitmap,requiresUnpremult);
+                        break;
+                    case eImageBitDepthShort:
+                        convertToFormatInternalForDepth<unsigned short, Half, 65535, 1>(renderWindow,*this, *dstImg,
+                                                                                        srcColorSpace,
+                                                                                        dstColorSpace,
+                                                                                        channelForAlpha,
+                                                                                        useAlpha0,
+                                                                                        copyBitmap,requiresUnpremult);
+                        break;
+                    case eImageBitDepthHalf:
+                        convertToFormatInternalForDepth<Half, Half, 1, 1>(renderWindow,*this, *dstImg,
+                                                                          srcColorSpace,
+                                                                          dstColorSpace,
+                                                                          channelForAlpha,
+                                                                          useAlpha0,
+                                                                          copyBitmap,requiresUnpremult);
+                        break;
+                    case eImageBitDepthFloat:
+                        convertToFormatInternalForDepth<float, Half, 1, 1>(renderWindow,*this, *dstImg,
+                                                                           srcColorSpace,
+                                                                           dstColorSpace,
+                                                                           channelForAlpha,
+                                                                           useAlpha0,
+                                                                           copyBitmap,requiresUnpremult);
+                        break;
+                    case eImageBitDepthNone:
+                        break;
+                }
                 break;
+            }
             case eImageBitDepthFloat: {
                 switch ( getBitDepth() ) {
                     case eImageBitDepthByte:
@@ -883,6 +1367,12 @@ Image::convertToFormatCommon(const RectI & renderWindow,
                         
                         break;
                     case eImageBitDepthHalf:
+                        convertToFormatInternalForDepth<Half, float, 1, 1>(renderWindow,*this, *dstImg,
+                                                                           srcColorSpace,
+                                                                           dstColorSpace,
+                                                                           channelForAlpha,
+                                                                           useAlpha0,
+                                                                           copyBitmap,requiresUnpremult);
                         break;
                     case eImageBitDepthFloat:
                         convertToFormatInternalForDepth<float, float, 1, 1>(renderWindow,*this, *dstImg,
@@ -24,12 +24,66 @@
 
 #include "Image.h"
 
+#include <algorithm> // min, max
+
 #include <QDebug>
 
+#include "Engine/SIMD.h"
+
 //#define NATRON_COPY_CHANNELS_UNPREMULT
 
+///Size in bytes of the bands of rows processed at once by copyUnProcessedChannelsAndApplyMaskMix, small enough to stay in the L2 cache
+#define NATRON_POST_RENDER_BAND_SIZE (128 * 1024)
+
 using namespace Natron;
 
+namespace {
+
+///Copies the unprocessed channels of a row of n pixels which all have an original pixel, with the SIMD kernels.
+///Only float RGBA images are vectorized.
+template <typename PIX, int srcNComps, int dstNComps>
+struct CopyChannelsRowSIMD
+{
+    static const bool supported = false;
+
+    static void copy(PIX* /*dst*/,
+                     const PIX* /*src*/,
+                     int /*n*/,
+                     bool /*doR*/,
+                     bool /*doG*/,
+                     bool /*doB*/,
+                     bool /*doA*/,
+                     bool /*premult*/,
+                     bool /*originalPremult*/)
+    {
+    }
+};
+
+#ifndef NATRON_COPY_CHANNELS_UNPREMULT
+template <>
+struct CopyChannelsRowSIMD<float, 4, 4>
+{
+    static const bool supported = true;
+
+    static void copy(float* dst,
+                     const float* src,
+                     int n,
+                     bool doR,
+                     bool doG,
+                     bool doB,
+                     bool doA,
+                     bool premult,
+                     bool originalPremult)
+    {
+        const bool doChannel[4] = { doR, doG, doB, doA };
+
+        SIMD::copyUnProcessedChannelsRGBA(dst, src, n, doChannel, premult, originalPremult);
+    }
+};
+#endif
+
+} // anon namespace
+
 template <typename PIX, int maxValue, int srcNComps, int dstNComps, bool doR, bool doG, bool doB, bool doA, bool premult, bool originalPremult>
 void
 Image::copyUnProcessedChannelsForPremult(const std::bitset<4> processChannels,
@@ -52,6 +106,14 @@ Image::copyUnProcessedChannelsForPremult(const std::bitset<4> processChannels,
     for (int y = roi.y1; y < roi.y2; ++y, dst_pixels += (dstRowElements - (roi.x2 - roi.x1) * dstNComps)) {
         for (int x = roi.x1; x < roi.x2; ++x, dst_pixels += dstNComps) {
             const PIX* src_pixels = originalImage ? (const PIX*)acc.pixelAt(x, y) : 0;
+            if ( src_pixels && CopyChannelsRowSIMD<PIX, srcNComps, dstNComps>::supported ) {
+                ///the rest of the row that is inside the original image is copied at once
+                const int n = std::min(roi.x2, originalImage->_bounds.x2) - x;
+                CopyChannelsRowSIMD<PIX, srcNComps, dstNComps>::copy(dst_pixels, src_pixels, n, doR, doG, doB, doA, premult, originalPremult);
+                x += n - 1;
+                dst_pixels += (n - 1) * dstNComps;
+                continue;
+            }
             PIX srcA = src_pixels ? maxValue : 0; /* be opaque for anything that doesn't contain alpha */
             if ((srcNComps == 1 || srcNComps == 4) && src_pixels) {
 #             ifdef DEBUG
@@ -187,6 +249,14 @@ Image::copyUnProcessedChannelsForPremult(const bool premult,
     for (int y = roi.y1; y < roi.y2; ++y, dst_pixels += (dstRowElements - (roi.x2 - roi.x1) * dstNComps)) {
         for (int x = roi.x1; x < roi.x2; ++x, dst_pixels += dstNComps) {
             const PIX* src_pixels = originalImage ? (const PIX*)acc.pixelAt(x, y) : 0;
+            if ( src_pixels && CopyChannelsRowSIMD<PIX, srcNComps, dstNComps>::supported ) {
+                ///the rest of the row that is inside the original image is copied at once
+                const int n = std::min(roi.x2, originalImage->_bounds.x2) - x;
+                CopyChannelsRowSIMD<PIX, srcNComps, dstNComps>::copy(dst_pixels, src_pixels, n, doR, doG, doB, doA, premult, originalPremult);
+                x += n - 1;
+                dst_pixels += (n - 1) * dstNComps;
+                continue;
+            }
             PIX srcA = src_pixels ? maxValue : 0; /* be opaque for anything that doesn't contain alpha */
             if ((srcNComps == 1 || srcNComps == 4) && src_pixels) {
 #             ifdef DEBUG
@@ -554,6 +624,17 @@ Image::copyUnProcessedChannels(const RectI& roi,
 
     bool premult = (outputPremult == eImagePremultiplicationPremultiplied);
     bool originalPremult = (originalImagePremult == eImagePremultiplicationPremultiplied);
+    
+    if ( originalImage && (originalImage.get() != this) && processChannels.none() && (premult == originalPremult) &&
+         (intersected == _bounds) ) {
+        ///No channel was processed: the whole image is a copy of the original image, reference its pixels instead
+        QReadLocker k2(&originalImage->_entryLock);
+        if ( sharePixelsFrom(*originalImage) ) {
+            return;
+        }
+    }
+    
+    makeWritable();
     switch (getBitDepth()) {
         case eImageBitDepthByte:
             copyUnProcessedChannelsForDepth<unsigned char, 255>(premult, roi, processChannels, originalImage, originalPremult);
@@ -561,6 +642,9 @@ Image::copyUnProcessedChannels(const RectI& roi,
         case eImageBitDepthShort:
             copyUnProcessedChannelsForDepth<unsigned short, 65535>(premult, roi, processChannels, originalImage, originalPremult);
             break;
+        case eImageBitDepthHalf:
+            copyUnProcessedChannelsForDepth<Half, 1>(premult, roi, processChannels, originalImage, originalPremult);
+            break;
         case eImageBitDepthFloat:
             copyUnProcessedChannelsForDepth<float, 1>(premult, roi, processChannels, originalImage, originalPremult);
             break;
@@ -568,3 +652,38 @@ Image::copyUnProcessedChannels(const RectI& roi,
             return;
     }
 }
+
+void
+Image::copyUnProcessedChannelsAndApplyMaskMix(const RectI& roi,
+                                              const Natron::ImagePremultiplicationEnum outputPremult,
+                                              const Natron::ImagePremultiplicationEnum originalImagePremult,
+                                              const std::bitset<4> processChannels,
+                                              const ImagePtr& originalImage,
+                                              const bool useMaskMix,
+                                              const Image* maskImg,
+                                              const bool masked,
+                                              const bool maskInvert,
+                                              const float mix)
+{
+    RectI realRoI;
+    if ( !useMaskMix || !originalImage || !canCallCopyUnProcessedChannels(processChannels) || !roi.intersect(_bounds, &realRoI) ) {
+        ///at most one of the two passes does something
+        copyUnProcessedChannels(roi, outputPremult, originalImagePremult, processChannels, originalImage);
+        if (useMaskMix) {
+            applyMaskMix(roi, maskImg, originalImage.get(), masked, maskInvert, mix);
+        }
+
+        return;
+    }
+
+    ///the lock is recursive: both passes take it again for each band
+    QWriteLocker k(&_entryLock);
+    const int rowSize = realRoI.width() * getComponentsCount() * getSizeOfForBitDepth( getBitDepth() );
+    const int bandHeight = std::max(1, NATRON_POST_RENDER_BAND_SIZE / std::max(1, rowSize));
+
+    for (int y = realRoI.y1; y < realRoI.y2; y += bandHeight) {
+        RectI band( realRoI.x1, y, realRoI.x2, std::min(y + bandHeight, realRoI.y2) );
+        copyUnProcessedChannels(band, outputPremult, originalImagePremult, processChannels, originalImage);
+        applyMaskMix(band, maskImg, originalImage.get(), masked, maskInvert, mix);
+    }
+}
@@ -24,8 +24,46 @@
 
 #include "Image.h"
 
+#include <algorithm> // min, max
+#include <vector>
+
+#include "Engine/SIMD.h"
+
 using namespace Natron;
 
+namespace {
+
+///Mixes a row of n pixels with the SIMD kernels. Only float images with the same components on both sides
+///are vectorized.
+template <typename PIX, int srcNComps, int dstNComps>
+struct MaskMixRowSIMD
+{
+    static const bool supported = false;
+
+    static void mix(PIX* /*dst*/,
+                    const PIX* /*src*/,
+                    const float* /*alpha*/,
+                    int /*n*/)
+    {
+    }
+};
+
+template <int nComps>
+struct MaskMixRowSIMD<float, nComps, nComps>
+{
+    static const bool supported = true;
+
+    static void mix(float* dst,
+                    const float* src,
+                    const float* alpha,
+                    int n)
+    {
+        SIMD::maskMix(dst, src, alpha, n, nComps);
+    }
+};
+
+} // anon namespace
+
 template<int srcNComps, int dstNComps, typename PIX, int maxValue, bool masked, bool maskInvert>
 void
 Image::applyMaskMixForMaskInvert(const RectI& roi,
@@ -33,9 +71,14 @@ Image::applyMaskMixForMaskInvert(const RectI& roi,
                                  const Image* originalImg,
                                  float mix)
 {
+    typedef MaskMixRowSIMD<PIX, srcNComps, dstNComps> SIMDRow;
+
     PIX* dst_pixels = (PIX*)pixelAt(roi.x1, roi.y1);
     
     unsigned int dstRowElements = _bounds.width() * getComponentsCount();
+
+    ///the alpha of each pixel of the row, when the row is mixed at once by SIMDRow
+    std::vector<float> alphaRow(SIMDRow::supported ? roi.width() : 0);
     
     for (int y = roi.y1; y < roi.y2; ++y,
          dst_pixels += (dstRowElements - (roi.x2 - roi.x1) * dstNComps)) { // 1 row stride minus what was done at previous iteration
@@ -43,30 +86,11 @@ Image::applyMaskMixForMaskInvert(const RectI& roi,
         for (int x = roi.x1; x < roi.x2; ++x,
              dst_pixels += dstNComps) {
             
-            const PIX* src_pixels = originalImg ? (const PIX*)originalImg->pixelAt(x,y) : 0;
-            
-            float maskScale = 1.f;
-            if (!masked) {
-                // just mix
-                float alpha = mix;
-                if (src_pixels) {
-                    for (int c = 0; c < dstNComps; ++c) {
-                        if (c < srcNComps) {
-                            float v = float(dst_pixels[c]) * alpha + (1.f - alpha) * float(src_pixels[c]);
-                            dst_pixels[c] = clampIfInt<PIX>(v);
-                        }
-                        
-                    }
-                } else {
-                    for (int c = 0; c < dstNComps; ++c) {
-                        float v = float(dst_pixels[c]) * alpha;
-                        dst_pixels[c] = clampIfInt<PIX>(v);
-                    }
-                }
-                
-            } else {
+            float alpha = mix;
+            if (masked) {
                 const PIX* maskPixels = maskImg ? (const PIX*)maskImg->pixelAt(x,y) : 0;
                 // figure the scale factor from that pixel
+                float maskScale;
                 if (maskPixels == 0) {
                     maskScale = maskInvert ? 1.f : 0.f;
                 } else {
@@ -75,25 +99,46 @@ Image::applyMaskMixForMaskInvert(const RectI& roi,
                         maskScale = 1.f - maskScale;
                     }
                 }
-                float alpha = mix * maskScale;
-                if (src_pixels) {
-                    for (int c = 0; c < dstNComps; ++c) {
-                        if (c < srcNComps) {
-                            float v = float(dst_pixels[c]) * alpha + (1.f - alpha) * float(src_pixels[c]);
-                            dst_pixels[c] = clampIfInt<PIX>(v);
-                        }
-                        
-                    }
-                } else {
-                    for (int c = 0; c < dstNComps; ++c) {
-                        float v = float(dst_pixels[c]) * alpha;
+                alpha = mix * maskScale;
+            }
+            if (SIMDRow::supported) {
+                alphaRow[x - roi.x1] = alpha;
+                continue;
+            }
+
+            const PIX* src_pixels = originalImg ? (const PIX*)originalImg->pixelAt(x,y) : 0;
+            if (src_pixels) {
+                for (int c = 0; c < dstNComps; ++c) {
+                    if (c < srcNComps) {
+                        float v = float(dst_pixels[c]) * alpha + (1.f - alpha) * float(src_pixels[c]);
                         dst_pixels[c] = clampIfInt<PIX>(v);
                     }
+                    
+                }
+            } else {
+                for (int c = 0; c < dstNComps; ++c) {
+                    float v = float(dst_pixels[c]) * alpha;
+                    dst_pixels[c] = clampIfInt<PIX>(v);
                 }
             }
-            
-            
-            
+        }
+
+        if (SIMDRow::supported) {
+            ///the pixels of the row outside of the original image are only scaled by alpha
+            PIX* dstRow = dst_pixels - roi.width() * dstNComps;
+            const float* alphas = alphaRow.empty() ? 0 : &alphaRow[0];
+            int srcX1 = roi.x2;
+            int srcX2 = roi.x2;
+            if ( originalImg && (y >= originalImg->_bounds.y1) && (y < originalImg->_bounds.y2) ) {
+                srcX1 = std::min( std::max(roi.x1, originalImg->_bounds.x1), roi.x2 );
+                srcX2 = std::max( srcX1, std::min(roi.x2, originalImg->_bounds.x2) );
+            }
+            SIMDRow::mix(dstRow, 0, alphas, srcX1 - roi.x1);
+            if (srcX1 < srcX2) {
+                SIMDRow::mix( dstRow + (srcX1 - roi.x1) * dstNComps, (const PIX*)originalImg->pixelAt(srcX1, y),
+                              alphas + (srcX1 - roi.x1), srcX2 - srcX1 );
+            }
+            SIMDRow::mix(dstRow + (srcX2 - roi.x1) * dstNComps, 0, alphas + (srcX2 - roi.x1), roi.x2 - srcX2);
         }
     }
 }
@@ -149,6 +194,9 @@ Image::applyMaskMixForDstComponents(const RectI& roi,
         case eImageBitDepthShort:
             applyMaskMixForDepth<srcNComps,dstNComps, unsigned short , 65535>(roi, maskImg, originalImg, masked, maskInvert, mix);
             break;
+        case eImageBitDepthHalf:
+            applyMaskMixForDepth<srcNComps,dstNComps, Half, 1>(roi, maskImg, originalImg, masked, maskInvert, mix);
+            break;
         case eImageBitDepthFloat:
             applyMaskMixForDepth<srcNComps,dstNComps, float, 1>(roi, maskImg, originalImg, masked, maskInvert, mix);
             break;
@@ -213,6 +261,7 @@ Image::applyMaskMix(const RectI& roi,
     if (maskImg) {
         maskLock.reset(new QReadLocker(&maskImg->_entryLock));
     }
+    makeWritable();
     RectI realRoI;
     roi.intersect(_bounds, &realRoI);
     
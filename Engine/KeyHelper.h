@@ -60,15 +60,16 @@ public:
      * @brief Constructs an empty key. This constructor is used by boost::serialization.
      **/
     KeyHelper()
-        : _holderID(), _hash(), _hashComputed(false)
+        : _holderID(), _holderStats(), _hash(), _hashComputed(false)
     {
     }
 
     KeyHelper(const CacheEntryHolder* holder)
-    : _holderID(), _hash(), _hashComputed(false)
+    : _holderID(), _holderStats(), _hash(), _hashComputed(false)
     {
         if (holder) {
             _holderID = holder->getCacheID();
+            _holderStats = holder->getCacheStats();
         }
     }
 
@@ -84,6 +85,7 @@ public:
      **/
     KeyHelper(const KeyHelper & other)
         : _holderID( other.getCacheHolderID() )
+        , _holderStats(other._holderStats)
         , _hash( other.getHash() )
         , _hashComputed(true)
     {
@@ -112,6 +114,14 @@ public:
     {
         return _holderID;
     }
+    
+    /**
+     * @brief The telemetry of the holder of the entry, NULL for entries restored from a previous session.
+     **/
+    Natron::CacheStats* getCacheHolderStats() const
+    {
+        return _holderStats.get();
+    }
 
 
 protected:
@@ -132,6 +142,7 @@ private:
 
 protected:
     std::string _holderID;
+    boost::shared_ptr<Natron::CacheStats> _holderStats;
 
 private:
     mutable hash_type _hash;
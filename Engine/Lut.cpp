@@ -29,6 +29,7 @@
 #include <stdexcept>
 
 #include "Engine/RectI.h"
+#include "Engine/SIMD.h"
 
 /*
  * The to_byte* and from_byte* functions implement and generalize the algorithm
@@ -315,6 +316,64 @@ Lut::fromColorSpaceUint16ToLinearFloatFast(unsigned short v) const
     return v32f_prev + (v - v16u_prev) * (v32f_next - v32f_prev) / (v16u_next - v16u_prev);
 }
 
+void
+Lut::toColorSpaceUint8xxFromLinearFloatFast(const float* from,
+                                             unsigned short* to,
+                                             int n) const
+{
+    assert(init_);
+    SIMD::lookupHipartToUint16(toFunc_hipart_to_uint8xx, from, to, n);
+}
+
+void
+Lut::toColorSpaceUint16FromLinearFloatFast(const float* from,
+                                           unsigned short* to,
+                                           int n) const
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = toColorSpaceUint16FromLinearFloatFast(from[i]);
+    }
+}
+
+void
+Lut::toColorSpaceFloatFromLinearFloat(const float* from,
+                                      float* to,
+                                      int n) const
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = _toFunc(from[i]);
+    }
+}
+
+void
+Lut::fromColorSpaceUint8ToLinearFloatFast(const unsigned char* from,
+                                          float* to,
+                                          int n) const
+{
+    assert(init_);
+    SIMD::lookupUint8ToFloat(fromFunc_uint8_to_float, from, to, n);
+}
+
+void
+Lut::fromColorSpaceUint16ToLinearFloatFast(const unsigned short* from,
+                                           float* to,
+                                           int n) const
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = fromColorSpaceUint16ToLinearFloatFast(from[i]);
+    }
+}
+
+void
+Lut::fromColorSpaceFloatToLinearFloat(const float* from,
+                                      float* to,
+                                      int n) const
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = _fromFunc(from[i]);
+    }
+}
+
 void
 Lut::fillTables() const
 {
@@ -338,6 +397,7 @@ Lut::fillTables() const
         int i = hipart(f);
         toFunc_hipart_to_uint8xx[i] = Color::charToUint8xx(b);
     }
+    toFunc_hipart_to_uint8xx[0x10000] = 0;
 }
 
 #ifdef DEAD_CODE
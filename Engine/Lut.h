@@ -130,7 +130,7 @@ class Lut
 
     /// the fast lookup tables are mutable, because they are automatically initialized post-construction,
     /// and never change afterwards
-    mutable unsigned short toFunc_hipart_to_uint8xx[0x10000];         /// contains  2^16 = 65536 values between 0-255
+    mutable unsigned short toFunc_hipart_to_uint8xx[0x10000 + 1];         /// contains  2^16 = 65536 values between 0-255, plus one unused entry for SIMD::lookupHipartToUint16()
     mutable float fromFunc_uint8_to_float[256];         /// values between 0-1.f
     mutable bool init_;         ///< false if the tables are not yet initialized
     mutable QMutex _lock;         ///< protects init_
@@ -223,6 +223,16 @@ public:
      */
     float fromColorSpaceUint16ToLinearFloatFast(unsigned short v) const;
 
+    /* @brief The same functions as above, for the n values of a buffer, e.g: a row of an image.
+     * The Uint8 and Uint8xx versions use SIMD kernels.
+     */
+    void toColorSpaceUint8xxFromLinearFloatFast(const float* from, unsigned short* to, int n) const;
+    void toColorSpaceUint16FromLinearFloatFast(const float* from, unsigned short* to, int n) const;
+    void toColorSpaceFloatFromLinearFloat(const float* from, float* to, int n) const;
+    void fromColorSpaceUint8ToLinearFloatFast(const unsigned char* from, float* to, int n) const;
+    void fromColorSpaceUint16ToLinearFloatFast(const unsigned short* from, float* to, int n) const;
+    void fromColorSpaceFloatToLinearFloat(const float* from, float* to, int n) const;
+
 
     /////@TODO the following functions expects a float input buffer, one could extend it to cover all bitdepths.
 
@@ -0,0 +1,401 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "MemoryPressure.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <QtCore/QMutex>
+
+#include "Global/MemoryInfo.h"
+#include "Engine/Timer.h" // gettimeofday
+
+#define NATRON_CGROUP_MOUNT_POINT "/sys/fs/cgroup"
+
+using namespace Natron;
+
+namespace {
+
+bool
+readFile(const std::string & filePath,
+         std::string* content)
+{
+    std::ifstream file( filePath.c_str() );
+
+    if ( !file.is_open() ) {
+        return false;
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    *content = ss.str();
+
+    return true;
+}
+
+/**
+ * @brief Reads the file of the given cgroup. Inside a cgroup namespace (e.g: a container) the cgroup of the process
+ * is the root of the mounted hierarchy even though /proc/self/cgroup may list a deeper path.
+ **/
+bool
+readCgroupFile(const std::string & hierarchy,
+               const std::string & cgroupPath,
+               const std::string & fileName,
+               std::string* content)
+{
+    if ( !cgroupPath.empty() && readFile(hierarchy + cgroupPath + "/" + fileName, content) ) {
+        return true;
+    }
+
+    return readFile(hierarchy + "/" + fileName, content);
+}
+
+} // anon namespace
+
+namespace Natron {
+
+struct MemoryPressurePrivate
+{
+    mutable QMutex lock; //< protects all fields below
+    double ramToKeepFree;
+    std::string v2Path, v1Path;
+    MemoryPressureState state;
+    bool hasState;
+    timeval lastRefresh;
+    bool inEpisode; //< true from the time the caches were shrunk until the pressure is gone
+    Natron::MemoryPressureLevelEnum episodeLevel; //< the level at which the caches were last shrunk
+    double lastShrinkTime;
+
+    MemoryPressurePrivate(double ramToKeepFree)
+    : lock()
+    , ramToKeepFree(ramToKeepFree)
+    , v2Path()
+    , v1Path()
+    , state()
+    , hasState(false)
+    , lastRefresh()
+    , inEpisode(false)
+    , episodeLevel(Natron::eMemoryPressureLevelNone)
+    , lastShrinkTime(0.)
+    {
+    }
+
+    void readState(MemoryPressureState* state) const;
+};
+
+} // namespace Natron
+
+void
+MemoryPressurePrivate::readState(MemoryPressureState* state) const
+{
+    state->totalRAM = getSystemTotalRAM_conditionnally();
+    state->availableRAM = std::min( (U64)getAmountFreePhysicalRAM(), state->totalRAM );
+    state->cgroupLimit = 0;
+    state->someAvg10 = state->fullAvg10 = -1.;
+
+#ifdef __NATRON_LINUX__
+    std::string content;
+    U64 limit = 0, usage = 0;
+    bool hasUsage = false;
+    bool hasPressure = false;
+    if ( !v2Path.empty() ) {
+        const std::string hierarchy(NATRON_CGROUP_MOUNT_POINT);
+        if ( readCgroupFile(hierarchy, v2Path, "memory.max", &content) && MemoryPressure::parseLimit(content, &limit) ) {
+            hasUsage = readCgroupFile(hierarchy, v2Path, "memory.current", &content) && MemoryPressure::parseLimit(content, &usage);
+            // The page cache is accounted in the usage but is reclaimed before the limit is hit
+            if ( hasUsage && readCgroupFile(hierarchy, v2Path, "memory.stat", &content) ) {
+                usage -= std::min( usage, MemoryPressure::parseStat(content, "inactive_file") );
+            }
+        }
+        hasPressure = readCgroupFile(hierarchy, v2Path, "memory.pressure", &content) &&
+                      MemoryPressure::parsePressure(content, &state->someAvg10, &state->fullAvg10);
+    } else if ( !v1Path.empty() ) {
+        const std::string hierarchy(NATRON_CGROUP_MOUNT_POINT "/memory");
+        if ( readCgroupFile(hierarchy, v1Path, "memory.limit_in_bytes", &content) && MemoryPressure::parseLimit(content, &limit) ) {
+            hasUsage = readCgroupFile(hierarchy, v1Path, "memory.usage_in_bytes", &content) && MemoryPressure::parseLimit(content, &usage);
+            if ( hasUsage && readCgroupFile(hierarchy, v1Path, "memory.stat", &content) ) {
+                usage -= std::min( usage, MemoryPressure::parseStat(content, "total_inactive_file") );
+            }
+        }
+    }
+    if ( !hasPressure && readFile("/proc/pressure/memory", &content) ) {
+        hasPressure = MemoryPressure::parsePressure(content, &state->someAvg10, &state->fullAvg10);
+    }
+
+    // cgroup v1 reports a huge number when there is no limit
+    if ( (limit > 0) && (limit < state->totalRAM) ) {
+        state->cgroupLimit = limit;
+        state->totalRAM = limit;
+        if (hasUsage) {
+            state->availableRAM = std::min( state->availableRAM, limit - std::min(usage, limit) );
+        } else {
+            state->availableRAM = std::min(state->availableRAM, limit);
+        }
+    }
+#endif // __NATRON_LINUX__
+
+    state->level = MemoryPressure::computeLevel(*state, ramToKeepFree);
+}
+
+MemoryPressure::MemoryPressure(double ramToKeepFree)
+    : _imp( new MemoryPressurePrivate(ramToKeepFree) )
+{
+#ifdef __NATRON_LINUX__
+    std::string content;
+    if ( readFile("/proc/self/cgroup", &content) ) {
+        parseProcCgroup(content, &_imp->v2Path, &_imp->v1Path);
+    }
+#endif
+}
+
+MemoryPressure::~MemoryPressure()
+{
+    delete _imp;
+}
+
+void
+MemoryPressure::setRamToKeepFree(double ramToKeepFree)
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->ramToKeepFree = ramToKeepFree;
+}
+
+bool
+MemoryPressure::refreshState(MemoryPressureState* state)
+{
+    QMutexLocker k(&_imp->lock);
+    timeval now;
+
+    gettimeofday(&now, 0);
+    if (_imp->hasState) {
+        double elapsedMs = (now.tv_sec - _imp->lastRefresh.tv_sec) * 1000. + (now.tv_usec - _imp->lastRefresh.tv_usec) / 1000.;
+        if ( (elapsedMs >= 0.) && (elapsedMs < NATRON_MEMORY_PRESSURE_POLL_INTERVAL_MS) ) {
+            *state = _imp->state;
+
+            return false;
+        }
+    }
+    _imp->readState(&_imp->state);
+    _imp->state.time = now.tv_sec * 1000. + now.tv_usec / 1000.;
+    _imp->hasState = true;
+    _imp->lastRefresh = now;
+    *state = _imp->state;
+
+    return true;
+}
+
+MemoryPressureState
+MemoryPressure::getState() const
+{
+    {
+        QMutexLocker k(&_imp->lock);
+        if (_imp->hasState) {
+            return _imp->state;
+        }
+    }
+    MemoryPressureState state;
+    const_cast<MemoryPressure*>(this)->refreshState(&state);
+
+    return state;
+}
+
+MemoryBudgetActionEnum
+MemoryPressure::getBudgetAction(const MemoryPressureState & state)
+{
+    QMutexLocker k(&_imp->lock);
+
+    if (state.level == eMemoryPressureLevelNone) {
+        if ( _imp->inEpisode && !isPressureGone(state) ) {
+            return eMemoryBudgetActionNone;
+        }
+        _imp->inEpisode = false;
+
+        return eMemoryBudgetActionGrow;
+    }
+    if ( _imp->inEpisode && (state.level <= _imp->episodeLevel) &&
+         (state.time - _imp->lastShrinkTime < NATRON_MEMORY_PRESSURE_SHRINK_COOLDOWN_MS) ) {
+        ///The memory freed by the last shrink is not reflected by the averages yet
+        return eMemoryBudgetActionNone;
+    }
+    _imp->inEpisode = true;
+    _imp->episodeLevel = state.level;
+    _imp->lastShrinkTime = state.time;
+
+    return eMemoryBudgetActionShrink;
+}
+
+void
+MemoryPressure::parseProcCgroup(const std::string & content,
+                                std::string* v2Path,
+                                std::string* v1Path)
+{
+    std::istringstream ss(content);
+    std::string line;
+
+    v2Path->clear();
+    v1Path->clear();
+    // Each line is "hierarchy-ID:controller-list:cgroup-path"
+    while ( std::getline(ss, line) ) {
+        std::size_t firstColon = line.find(':');
+        std::size_t secondColon = firstColon == std::string::npos ? std::string::npos : line.find(':', firstColon + 1);
+        if (secondColon == std::string::npos) {
+            continue;
+        }
+        std::string id = line.substr(0, firstColon);
+        std::string controllers = line.substr(firstColon + 1, secondColon - firstColon - 1);
+        std::string path = line.substr(secondColon + 1);
+        if ( (id == "0") && controllers.empty() ) {
+            *v2Path = path;
+        } else {
+            std::istringstream cs(controllers);
+            std::string controller;
+            while ( std::getline(cs, controller, ',') ) {
+                if (controller == "memory") {
+                    *v1Path = path;
+                }
+            }
+        }
+    }
+    // On hybrid systems the memory controller is in the v1 hierarchy
+    if ( !v1Path->empty() ) {
+        v2Path->clear();
+    }
+} // parseProcCgroup
+
+bool
+MemoryPressure::parseLimit(const std::string & content,
+                           U64* limit)
+{
+    std::istringstream ss(content);
+    std::string value;
+
+    if ( !(ss >> value) ) {
+        return false;
+    }
+    if (value == "max") {
+        *limit = 0;
+
+        return true;
+    }
+    std::istringstream vs(value);
+    U64 v;
+    if ( !(vs >> v) ) {
+        return false;
+    }
+    *limit = v;
+
+    return true;
+}
+
+bool
+MemoryPressure::parsePressure(const std::string & content,
+                              double* someAvg10,
+                              double* fullAvg10)
+{
+    std::istringstream ss(content);
+    std::string line;
+    bool found = false;
+
+    // "some avg10=0.00 avg60=0.00 avg300=0.00 total=0" and the same for "full"
+    while ( std::getline(ss, line) ) {
+        std::istringstream ls(line);
+        std::string type, avg10;
+        if ( !(ls >> type >> avg10) || (avg10.compare(0, 6, "avg10=") != 0) ) {
+            continue;
+        }
+        std::istringstream vs( avg10.substr(6) );
+        double v;
+        if ( !(vs >> v) ) {
+            continue;
+        }
+        if (type == "some") {
+            *someAvg10 = v;
+            found = true;
+        } else if (type == "full") {
+            *fullAvg10 = v;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+U64
+MemoryPressure::parseStat(const std::string & content,
+                          const std::string & key)
+{
+    std::istringstream ss(content);
+    std::string name;
+    U64 value;
+
+    while (ss >> name >> value) {
+        if (name == key) {
+            return value;
+        }
+    }
+
+    return 0;
+}
+
+MemoryPressureLevelEnum
+MemoryPressure::computeLevel(const MemoryPressureState & state,
+                             double ramToKeepFree)
+{
+    U64 toKeepFree = state.totalRAM * ramToKeepFree;
+
+    if ( (state.availableRAM <= toKeepFree) || (state.fullAvg10 >= NATRON_MEMORY_PRESSURE_FULL_AVG10_CRITICAL) ) {
+        return eMemoryPressureLevelCritical;
+    }
+    if ( (state.availableRAM <= toKeepFree * 2) || (state.someAvg10 >= NATRON_MEMORY_PRESSURE_SOME_AVG10_MODERATE) ) {
+        return eMemoryPressureLevelModerate;
+    }
+
+    return eMemoryPressureLevelNone;
+}
+
+bool
+MemoryPressure::isPressureGone(const MemoryPressureState & state)
+{
+    return state.level == eMemoryPressureLevelNone &&
+           state.someAvg10 < NATRON_MEMORY_PRESSURE_SOME_AVG10_MODERATE * NATRON_MEMORY_PRESSURE_HYSTERESIS &&
+           state.fullAvg10 < NATRON_MEMORY_PRESSURE_FULL_AVG10_CRITICAL * NATRON_MEMORY_PRESSURE_HYSTERESIS;
+}
+
+U64
+MemoryPressure::computeAmountToFree(const MemoryPressureState & state,
+                                    double ramToKeepFree,
+                                    U64 cachesSize)
+{
+    U64 toKeepFree = state.totalRAM * ramToKeepFree;
+    double batch = state.level == eMemoryPressureLevelCritical ? NATRON_MEMORY_PRESSURE_CRITICAL_BATCH : NATRON_MEMORY_PRESSURE_MODERATE_BATCH;
+    U64 toFree = cachesSize * batch;
+
+    if (state.availableRAM < toKeepFree) {
+        toFree += toKeepFree - state.availableRAM;
+    }
+
+    return std::min(toFree, cachesSize);
+}
@@ -0,0 +1,179 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NATRON_ENGINE_MEMORYPRESSURE_H
+#define NATRON_ENGINE_MEMORYPRESSURE_H
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <string>
+
+#include "Global/GlobalDefines.h"
+#include "Global/Enums.h"
+#include "Global/Macros.h"
+
+///The memory state is read from the system at most once per this interval
+#define NATRON_MEMORY_PRESSURE_POLL_INTERVAL_MS 100
+
+///Percentage of the last 10 seconds during which some tasks stalled on memory above which the pressure is moderate
+#define NATRON_MEMORY_PRESSURE_SOME_AVG10_MODERATE 10.
+///Percentage of the last 10 seconds during which all tasks stalled on memory above which the pressure is critical
+#define NATRON_MEMORY_PRESSURE_FULL_AVG10_CRITICAL 10.
+
+///Fraction of the RAM used by the caches freed at once under moderate and critical pressure,
+///in addition to what is missing to keep the requested RAM free
+#define NATRON_MEMORY_PRESSURE_MODERATE_BATCH 0.1
+#define NATRON_MEMORY_PRESSURE_CRITICAL_BATCH 0.25
+
+///Fraction of their maximum size the caches budgets grow back at each poll once the pressure is gone
+#define NATRON_MEMORY_PRESSURE_RECOVERY_STEP 0.02
+
+///Once the caches were shrunk, they are shrunk again only if the pressure gets worse or if it is still there after this
+///many milliseconds: the PSI averages cover the last 10 seconds and stay above the thresholds long after the memory was freed
+#define NATRON_MEMORY_PRESSURE_SHRINK_COOLDOWN_MS 10000.
+
+///The pressure is gone, and the caches budgets may grow back, once the PSI averages fall below this fraction of the thresholds
+#define NATRON_MEMORY_PRESSURE_HYSTERESIS 0.5
+
+namespace Natron {
+
+enum MemoryBudgetActionEnum
+{
+    eMemoryBudgetActionNone = 0, //< leave the caches budgets as they are
+    eMemoryBudgetActionShrink, //< free a batch of the caches, @see computeAmountToFree
+    eMemoryBudgetActionGrow //< the pressure is gone, give the memory back to the caches progressively
+};
+
+/**
+ * @brief A snapshot of the memory available to the process, @see MemoryPressure
+ **/
+struct MemoryPressureState
+{
+    U64 totalRAM; //< the RAM the process may use: the system RAM, or the memory limit of its cgroup if lower
+    U64 availableRAM; //< the RAM that can still be allocated before reaching totalRAM
+    U64 cgroupLimit; //< the memory limit of the cgroup of the process, 0 if it has none
+    double someAvg10; //< PSI: percentage of the last 10 seconds during which some tasks stalled on memory, -1 if unknown
+    double fullAvg10; //< PSI: percentage of the last 10 seconds during which all tasks stalled on memory, -1 if unknown
+    Natron::MemoryPressureLevelEnum level;
+    double time; //< when the state was read, in milliseconds
+
+    MemoryPressureState()
+    : totalRAM(0)
+    , availableRAM(0)
+    , cgroupLimit(0)
+    , someAvg10(-1.)
+    , fullAvg10(-1.)
+    , level(Natron::eMemoryPressureLevelNone)
+    , time(0.)
+    {
+    }
+};
+
+struct MemoryPressurePrivate;
+
+/**
+ * @brief Monitors the memory available to the process. Unlike getAmountFreePhysicalRAM() this takes into account the
+ * memory limit of the cgroup (v1 or v2) the process runs in, e.g: in a container, and the Linux pressure stall
+ * information (PSI) which tells whether tasks are already waiting on memory reclaim.
+ * On other systems only the system RAM is considered.
+ *
+ * This class is MT-safe.
+ **/
+class MemoryPressure
+{
+public:
+
+    /**
+     * @brief Finds the cgroup of the process. ramToKeepFree is the fraction of the total RAM below which
+     * the available RAM is considered critical.
+     **/
+    MemoryPressure(double ramToKeepFree);
+
+    ~MemoryPressure();
+
+    void setRamToKeepFree(double ramToKeepFree);
+
+    /**
+     * @brief Reads the memory state from the system, unless it was read less than
+     * NATRON_MEMORY_PRESSURE_POLL_INTERVAL_MS ago.
+     * @returns True if the state was read, false if it was read too recently in which case state is the last state read.
+     **/
+    bool refreshState(MemoryPressureState* state);
+
+    /**
+     * @brief Returns the last state read.
+     **/
+    MemoryPressureState getState() const;
+
+    /**
+     * @brief Returns what to do with the caches budgets for a state returned by refreshState().
+     * The caches are shrunk once per pressure episode, then again only if the level gets worse or after
+     * NATRON_MEMORY_PRESSURE_SHRINK_COOLDOWN_MS. The episode ends once the pressure is gone with hysteresis,
+     * @see isPressureGone
+     **/
+    Natron::MemoryBudgetActionEnum getBudgetAction(const MemoryPressureState & state);
+
+    /**
+     * @brief Parses the content of /proc/self/cgroup.
+     * @param v2Path Set to the path of the cgroup in the unified (v2) hierarchy, or empty.
+     * @param v1Path Set to the path of the cgroup in the v1 memory hierarchy, or empty.
+     **/
+    static void parseProcCgroup(const std::string & content, std::string* v2Path, std::string* v1Path);
+
+    /**
+     * @brief Parses a memory limit file (memory.max or memory.limit_in_bytes).
+     * @returns False if the content is not a limit, "max" is parsed as 0 (no limit).
+     **/
+    static bool parseLimit(const std::string & content, U64* limit) WARN_UNUSED_RETURN;
+
+    /**
+     * @brief Parses a PSI file (/proc/pressure/memory or memory.pressure).
+     **/
+    static bool parsePressure(const std::string & content, double* someAvg10, double* fullAvg10) WARN_UNUSED_RETURN;
+
+    /**
+     * @brief Returns the value of the given key of a memory.stat file, or 0.
+     **/
+    static U64 parseStat(const std::string & content, const std::string & key);
+
+    static Natron::MemoryPressureLevelEnum computeLevel(const MemoryPressureState & state, double ramToKeepFree);
+
+    /**
+     * @brief Returns true if the level is none and the PSI averages are below NATRON_MEMORY_PRESSURE_HYSTERESIS
+     * of the thresholds, so that a pressure oscillating around a threshold does not shrink and grow the caches in turn.
+     **/
+    static bool isPressureGone(const MemoryPressureState & state);
+
+    /**
+     * @brief Returns the number of bytes the caches, which use cachesSize bytes, should free for a state whose level is not none:
+     * a batch of the caches, plus what is missing to keep the requested RAM free.
+     **/
+    static U64 computeAmountToFree(const MemoryPressureState & state, double ramToKeepFree, U64 cachesSize);
+
+private:
+
+    MemoryPressurePrivate* _imp;
+};
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_MEMORYPRESSURE_H
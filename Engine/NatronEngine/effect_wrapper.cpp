@@ -474,6 +474,47 @@ static PyObject* Sbk_EffectFunc_getAvailableLayers(PyObject* self)
     return pyResult;
 }
 
+static PyObject* Sbk_EffectFunc_getCacheStats(PyObject* self)
+{
+    ::Effect* cppSelf = 0;
+    SBK_UNUSED(cppSelf)
+    if (!Shiboken::Object::isValid(self))
+        return 0;
+    cppSelf = ((::Effect*)Shiboken::Conversions::cppPointer(SbkNatronEngineTypes[SBK_EFFECT_IDX], (SbkObject*)self));
+    PyObject* pyResult = 0;
+
+    // Call function/method
+    {
+
+        if (!PyErr_Occurred()) {
+            // getCacheStats()const
+            // Begin code injection
+
+            Natron::CacheStatsSnapshot stats = cppSelf->getCacheStats();
+            std::vector<std::pair<std::string, U64> > fields;
+            stats.getFields(&fields);
+
+            PyObject* ret = PyDict_New();
+            for (std::size_t i = 0; i < fields.size(); ++i) {
+                PyObject* pyValue = PyLong_FromUnsignedLongLong(fields[i].second);
+                PyDict_SetItemString(ret, fields[i].first.c_str(), pyValue);
+                Py_DECREF(pyValue);
+            }
+            return ret;
+
+            // End of code injection
+
+
+        }
+    }
+
+    if (PyErr_Occurred() || !pyResult) {
+        Py_XDECREF(pyResult);
+        return 0;
+    }
+    return pyResult;
+}
+
 static PyObject* Sbk_EffectFunc_getColor(PyObject* self)
 {
     ::Effect* cppSelf = 0;
@@ -1397,6 +1438,7 @@ static PyMethodDef Sbk_Effect_methods[] = {
     {"disconnectInput", (PyCFunction)Sbk_EffectFunc_disconnectInput, METH_O},
     {"endChanges", (PyCFunction)Sbk_EffectFunc_endChanges, METH_NOARGS},
     {"getAvailableLayers", (PyCFunction)Sbk_EffectFunc_getAvailableLayers, METH_NOARGS},
+    {"getCacheStats", (PyCFunction)Sbk_EffectFunc_getCacheStats, METH_NOARGS},
     {"getColor", (PyCFunction)Sbk_EffectFunc_getColor, METH_NOARGS},
     {"getCurrentTime", (PyCFunction)Sbk_EffectFunc_getCurrentTime, METH_NOARGS},
     {"getInput", (PyCFunction)Sbk_EffectFunc_getInput, METH_O},
@@ -30,7 +30,9 @@
 #include <stdexcept>
 #include <bitset>
 
+#include <QtCore/QDateTime>
 #include <QtCore/QDebug>
+#include <QtCore/QFileInfo>
 #include <QtCore/QReadWriteLock>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QWaitCondition>
@@ -46,6 +48,7 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 #include "Engine/AppInstance.h"
 #include "Engine/AppManager.h"
 #include "Engine/BackDrop.h"
+#include "Engine/Curve.h"
 #include "Engine/DiskCacheNode.h"
 #include "Engine/Dot.h"
 #include "Engine/EffectInstance.h"
@@ -82,6 +85,16 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 ///at most every...
 #define NATRON_RENDER_GRAPHS_HINTS_REFRESH_RATE_SECONDS 1
 
+///The output of a node is cheap to render again if rendering a pixel of it and of all the nodes upstream takes less than this.
+///This is 10ms per megapixel
+#define NATRON_CACHE_ADMISSION_CHEAP_SECONDS_PER_PIXEL 1e-8
+
+///While the user scrubs the timeline, frames are unlikely to be rendered again: the threshold above is multiplied by this
+#define NATRON_CACHE_ADMISSION_SCRUBBING_FACTOR 4.
+
+///Weight of the last sample in the moving average of the render cost of a node
+#define NATRON_RENDER_COST_SAMPLE_WEIGHT 0.2
+
 using namespace Natron;
 using std::make_pair;
 using std::cout; using std::endl;
@@ -227,6 +240,9 @@ struct Node::Implementation
     , renderInstancesSharedMutex(QMutex::Recursive)
     , knobsAge(0)
     , knobsAgeMutex()
+    , hash()
+    , hashContentBased(false)
+    , fileReloadCount(0)
     , masterNodeMutex()
     , masterNode()
     , nodeLinks()
@@ -250,7 +266,6 @@ struct Node::Implementation
     , maskSelectors()
     , rotoContext()
     , imagesBeingRenderedMutex()
-    , imageBeingRenderedCond()
     , imagesBeingRendered()
     , supportedDepths()
     , isMultiInstance(false)
@@ -294,6 +309,8 @@ struct Node::Implementation
     , mustComputeInputRelatedData(true)
     , duringPaintStrokeCreation(false)
     , lastStrokeMovementMutex()
+    , renderCostMutex()
+    , renderCostPerPixel(-1.)
     , strokeBitmapCleared(false)
     , useAlpha0ToConvertFromRGBToRGBA(false)
     , isBeingDestroyed(false)
@@ -415,6 +432,8 @@ struct Node::Implementation
     U64 knobsAge; //< the age of the knobs in this effect. It gets incremented every times the liveInstance has its evaluate() function called.
     mutable QReadWriteLock knobsAgeMutex; //< protects knobsAge and hash
     Hash64 hash; //< recomputed everytime knobsAge is changed.
+    bool hashContentBased; //< true if hash does not depend on knobsAge nor on the node's name, @see isHashContentBased. Protected by knobsAgeMutex
+    U64 fileReloadCount; //< incremented by onFileReloaded(), part of the content-based hash. Protected by knobsAgeMutex
     
     mutable QMutex masterNodeMutex; //< protects masterNode and nodeLinks
     boost::weak_ptr<Node> masterNode; //< this points to the master when the node is a clone
@@ -453,8 +472,9 @@ struct Node::Implementation
     boost::shared_ptr<RotoContext> rotoContext; //< valid when the node has a rotoscoping context (i.e: paint context)
     
     mutable QMutex imagesBeingRenderedMutex;
-    QWaitCondition imageBeingRenderedCond;
-    std::list< boost::shared_ptr<Image> > imagesBeingRendered; ///< a list of all the images being rendered simultaneously
+    ///The images being rendered simultaneously, each with the condition its waiters wait on so that unlocking an image
+    ///only wakes up the threads waiting for that image
+    std::map<boost::shared_ptr<Image>, boost::shared_ptr<QWaitCondition> > imagesBeingRendered;
     
     std::list <Natron::ImageBitDepthEnum> supportedDepths;
     
@@ -519,6 +539,9 @@ struct Node::Implementation
     
     bool duringPaintStrokeCreation; // protected by lastStrokeMovementMutex
     mutable QMutex lastStrokeMovementMutex;
+
+    mutable QMutex renderCostMutex;
+    double renderCostPerPixel; //< moving average of the render time of a pixel in seconds, -1 if unknown. Protected by renderCostMutex
     bool strokeBitmapCleared;
     
     
@@ -1201,6 +1224,14 @@ Node::getHashValue() const
     return _imp->hash.value();
 }
 
+bool
+Node::isHashContentBased() const
+{
+    QReadLocker l(&_imp->knobsAgeMutex);
+    
+    return _imp->hashContentBased;
+}
+
 std::string
 Node::getCacheID() const
 {
@@ -1208,6 +1239,124 @@ Node::getCacheID() const
     return _imp->cacheID;
 }
 
+static void appendStringToHash(const std::string& str, Hash64* hash)
+{
+    ///Append the size first so that 2 consecutive strings cannot produce the same sequence
+    hash->append<U64>( str.size() );
+    ::Hash64_appendQString( hash, QString::fromUtf8( str.c_str() ) );
+}
+
+static void appendCurveToHash(const Curve& curve, Hash64* hash)
+{
+    KeyFrameSet keys = curve.getKeyFrames_mt_safe();
+    hash->append<U64>( keys.size() );
+    for (KeyFrameSet::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+        hash->append( it->getTime() );
+        hash->append( it->getValue() );
+        hash->append<int>( (int)it->getInterpolation() );
+        hash->append( it->getLeftDerivative() );
+        hash->append( it->getRightDerivative() );
+    }
+}
+
+/**
+ * @brief Appends to the hash when the file read by a file parameter was last modified, so that a file rewritten on disk
+ * does not hit the images cached for its previous content, in this session or a later one.
+ * A sequence pattern does not name an existing file: the modification time of its directory is used instead, which
+ * changes when frames are added, removed or replaced by renaming.
+ **/
+static void appendFileModificationToHash(const boost::shared_ptr<Project>& project, const std::string& pattern, Hash64* hash)
+{
+    std::string filePath = pattern;
+    project->canonicalizePath(filePath);
+    QFileInfo info( QString::fromUtf8( filePath.c_str() ) );
+    if ( !info.exists() ) {
+        info = QFileInfo( info.absolutePath() );
+        if ( !info.exists() ) {
+            return;
+        }
+    }
+    hash->append<qint64>( info.lastModified().toMSecsSinceEpoch() );
+    hash->append<qint64>( info.size() );
+}
+
+/**
+ * @brief Appends to the hash the content of all parameters that may affect the render of the node: static values,
+ * animation curves and expressions. Parameters that do not trigger an evaluation (label, preview, etc...) are skipped.
+ * Returns true if at least one parameter has an expression: the result of an expression may depend on values
+ * living outside of the node, hence the content alone does not identify the output of the node.
+ **/
+static bool appendKnobsContentToHash(const boost::shared_ptr<Project>& project, const std::vector< boost::shared_ptr<KnobI> >& knobs, Hash64* hash)
+{
+    bool hasExpression = false;
+    for (std::vector< boost::shared_ptr<KnobI> >::const_iterator it = knobs.begin(); it != knobs.end(); ++it) {
+        KnobI* knob = it->get();
+        if ( !knob->getEvaluateOnChange() ||
+             dynamic_cast<KnobButton*>(knob) ||
+             dynamic_cast<KnobPage*>(knob) ||
+             dynamic_cast<KnobGroup*>(knob) ||
+             dynamic_cast<KnobSeparator*>(knob) ) {
+            continue;
+        }
+        
+        Knob<int>* isInt = dynamic_cast<Knob<int>*>(knob);
+        Knob<bool>* isBool = dynamic_cast<Knob<bool>*>(knob);
+        Knob<double>* isDouble = dynamic_cast<Knob<double>*>(knob);
+        Knob<std::string>* isString = dynamic_cast<Knob<std::string>*>(knob);
+        
+        appendStringToHash(knob->getName(), hash);
+        
+        int dims = knob->getDimension();
+        for (int i = 0; i < dims; ++i) {
+            std::string expr = knob->getExpression(i);
+            if ( !expr.empty() ) {
+                ///Do not evaluate the expression here, the hash is computed under the knobs age lock
+                hasExpression = true;
+                appendStringToHash(expr, hash);
+                continue;
+            }
+            
+            boost::shared_ptr<Curve> curve = knob->isAnimated(i) ? knob->getCurve(i) : boost::shared_ptr<Curve>();
+            if (curve) {
+                appendCurveToHash(*curve, hash);
+                if (isString) {
+                    ///Keyframes of string parameters only hold an index, append the strings themselves
+                    KeyFrameSet keys = curve->getKeyFrames_mt_safe();
+                    for (KeyFrameSet::const_iterator it2 = keys.begin(); it2 != keys.end(); ++it2) {
+                        appendStringToHash(isString->getValueAtTime(it2->getTime(), i), hash);
+                    }
+                }
+            } else if (isInt) {
+                hash->append( isInt->getValue(i, false) );
+            } else if (isBool) {
+                hash->append( isBool->getValue(i, false) );
+            } else if (isDouble) {
+                hash->append( isDouble->getValue(i, false) );
+            } else if (isString) {
+                appendStringToHash(isString->getValue(i, false), hash);
+            }
+        }
+        
+        KnobParametric* isParametric = dynamic_cast<KnobParametric*>(knob);
+        if (isParametric) {
+            for (int i = 0; i < dims; ++i) {
+                boost::shared_ptr<Curve> curve = isParametric->getParametricCurve(i);
+                if (curve) {
+                    appendCurveToHash(*curve, hash);
+                }
+            }
+        }
+        
+        ///The path alone does not identify the content of a file read by the node. The files written by the node are not
+        ///hashed: they change while it renders.
+        KnobFile* isFile = dynamic_cast<KnobFile*>(knob);
+        if (isFile) {
+            appendFileModificationToHash(project, isFile->getValue(), hash);
+        }
+    }
+    return hasExpression;
+} // appendKnobsContentToHash
+
 bool
 Node::computeHashInternal()
 {
@@ -1220,6 +1369,9 @@ Node::computeHashInternal()
         qDebug() << "Node::computeHash(): inputs not initialized";
     }
     
+    ///When enabled, 2 nodes with the same content share the same hash and a hash may come back to a previous value
+    bool contentBasedHash = appPTR->getCurrentSettings()->isContentBasedNodeHashEnabled();
+    
     U64 oldHash,newHash;
     {
         QWriteLocker l(&_imp->knobsAgeMutex);
@@ -1228,16 +1380,46 @@ Node::computeHashInternal()
         
         ///reset the hash value
         _imp->hash.reset();
+        _imp->hashContentBased = contentBasedHash;
         
-        ///append the effect's own age
-        _imp->hash.append(_imp->knobsAge);
-        
-        ///append all inputs hash
         boost::shared_ptr<RotoDrawableItem> attachedStroke = _imp->paintStroke.lock();
         NodePtr attachedStrokeContextNode;
         if (attachedStroke) {
             attachedStrokeContextNode = attachedStroke->getContext()->getNode();
         }
+        
+        if (contentBasedHash) {
+            ///Identify the effect by what it is and the content of its parameters rather than by its number of edits
+            appendStringToHash(getPluginID(), &_imp->hash);
+            _imp->hash.append( getMajorVersion() );
+            _imp->hash.append( getMinorVersion() );
+            
+            bool hasExpression = appendKnobsContentToHash(getApp()->getProject(), getKnobs(), &_imp->hash);
+            
+            ///A file reloaded by the user may have changed on disk within the resolution of its modification time
+            _imp->hash.append(_imp->fileReloadCount);
+            
+            ///Some images depend on the project format, which is not a parameter of the node
+            Format projectFormat;
+            getApp()->getProject()->getProjectDefaultFormat(&projectFormat);
+            _imp->hash.append( projectFormat.x1 );
+            _imp->hash.append( projectFormat.y1 );
+            _imp->hash.append( projectFormat.x2 );
+            _imp->hash.append( projectFormat.y2 );
+            _imp->hash.append( projectFormat.getPixelAspectRatio() );
+            
+            ///The state of the Roto items is not held by parameters: their edits are only reflected by the age.
+            ///Same thing for expressions which may reference parameters of other nodes.
+            if ( hasExpression || attachedStroke || _imp->rotoContext ) {
+                _imp->hash.append(_imp->knobsAge);
+                _imp->hashContentBased = false;
+            }
+        } else {
+            ///append the effect's own age
+            _imp->hash.append(_imp->knobsAge);
+        }
+        
+        ///append all inputs hash
         {
             ViewerInstance* isViewer = dynamic_cast<ViewerInstance*>(_imp->liveInstance.get());
             
@@ -1249,6 +1431,7 @@ Node::computeHashInternal()
                     NodePtr input = getInput(activeInput[i]);
                     if (input) {
                         _imp->hash.append(input->getHashValue() );
+                        _imp->hashContentBased &= input->isHashContentBased();
                     }
                 }
             } else {
@@ -1264,6 +1447,7 @@ Node::computeHashInternal()
                         ///Explanation: if we didn't add this, just switching inputs would produce a similar
                         ///hash.
                         _imp->hash.append(input->getHashValue() + i);
+                        _imp->hashContentBased &= input->isHashContentBased();
                     }
                 }
             }
@@ -1279,13 +1463,15 @@ Node::computeHashInternal()
         //            _imp->hash.append(rotoAge);
         //        }
         
-        ///Also append the effect's label to distinguish 2 instances with the same parameters
-        ::Hash64_appendQString( &_imp->hash, QString( getScriptName().c_str() ) );
-        
-        ///Also append the project's creation time in the hash because 2 projects openend concurrently
-        ///could reproduce the same (especially simple graphs like Viewer-Reader)
-        qint64 creationTime =  getApp()->getProject()->getProjectCreationTime();
-        _imp->hash.append(creationTime);
+        if (!contentBasedHash) {
+            ///Also append the effect's label to distinguish 2 instances with the same parameters
+            ::Hash64_appendQString( &_imp->hash, QString( getScriptName().c_str() ) );
+            
+            ///Also append the project's creation time in the hash because 2 projects openend concurrently
+            ///could reproduce the same (especially simple graphs like Viewer-Reader)
+            qint64 creationTime =  getApp()->getProject()->getProjectCreationTime();
+            _imp->hash.append(creationTime);
+        }
         
         _imp->hash.computeHash();
         
@@ -1297,10 +1483,12 @@ Node::computeHashInternal()
 
     if (hashChanged) {
         _imp->liveInstance->onNodeHashChanged(newHash);
-        if (_imp->nodeCreated && !getApp()->getProject()->isProjectClosing()) {
+        if (_imp->nodeCreated && !contentBasedHash && !getApp()->getProject()->isProjectClosing()) {
             /*
              * We changed the node hash. That means all cache entries for this node with a different hash
              * are impossible to re-create again. Just discard them all. This is done in a separate thread.
+             * With content-based hashes, a previous hash may be reached again (e.g: undo) so let the
+             * cache evict them instead.
              */
             removeAllImagesFromCacheWithMatchingIDAndDifferentKey(newHash);
         }
@@ -1992,6 +2180,18 @@ Node::incrementKnobsAge()
     computeHash();
 }
 
+void
+Node::onFileReloaded()
+{
+    {
+        QWriteLocker l(&_imp->knobsAgeMutex);
+        ++_imp->fileReloadCount;
+    }
+    ///With content-based hashes, the hash of the node may be the same as before the reload: purge the images explicitly
+    removeAllImagesFromCache(false);
+    computeHash();
+}
+
 U64
 Node::getKnobsAge() const
 {
@@ -5048,6 +5248,7 @@ Node::makePreviewImage(SequenceTime time,
                                                  true, //<isRenderUserInteraction
                                                  false, //isSequential
                                                  true, //can abort
+                                                 Natron::eRenderPriorityBackground,
                                                  0, //render Age
                                                  thisNode, // viewer requester
                                                  &request,
@@ -5108,8 +5309,10 @@ Node::makePreviewImage(SequenceTime time,
                 renderPreviewForDepth<unsigned short, 65535>(*img, elemCount, width, height,convertToSrgb, buf);
                 break;
             }
-            case Natron::eImageBitDepthHalf:
+            case Natron::eImageBitDepthHalf: {
+                renderPreviewForDepth<Natron::Half, 1>(*img, elemCount, width, height,convertToSrgb, buf);
                 break;
+            }
             case Natron::eImageBitDepthFloat: {
                 renderPreviewForDepth<float, 1>(*img, elemCount, width, height,convertToSrgb, buf);
                 break;
@@ -5868,16 +6071,16 @@ Node::lock(const boost::shared_ptr<Natron::Image> & image)
 {
     
     QMutexLocker l(&_imp->imagesBeingRenderedMutex);
-    std::list<boost::shared_ptr<Natron::Image> >::iterator it =
-    std::find(_imp->imagesBeingRendered.begin(), _imp->imagesBeingRendered.end(), image);
+    std::map<boost::shared_ptr<Natron::Image>, boost::shared_ptr<QWaitCondition> >::iterator it = _imp->imagesBeingRendered.find(image);
     
     while ( it != _imp->imagesBeingRendered.end() ) {
-        _imp->imageBeingRenderedCond.wait(&_imp->imagesBeingRenderedMutex);
-        it = std::find(_imp->imagesBeingRendered.begin(), _imp->imagesBeingRendered.end(), image);
+        ///Hold the condition: unlock() removes it from the map before we wake up
+        boost::shared_ptr<QWaitCondition> cond = it->second;
+        cond->wait(&_imp->imagesBeingRenderedMutex);
+        it = _imp->imagesBeingRendered.find(image);
     }
     ///Okay the image is not used by any other thread, claim that we want to use it
-    assert( it == _imp->imagesBeingRendered.end() );
-    _imp->imagesBeingRendered.push_back(image);
+    _imp->imagesBeingRendered.insert( std::make_pair( image, boost::shared_ptr<QWaitCondition>(new QWaitCondition) ) );
 }
 
 bool
@@ -5885,15 +6088,11 @@ Node::tryLock(const boost::shared_ptr<Natron::Image> & image)
 {
     
     QMutexLocker l(&_imp->imagesBeingRenderedMutex);
-    std::list<boost::shared_ptr<Natron::Image> >::iterator it =
-    std::find(_imp->imagesBeingRendered.begin(), _imp->imagesBeingRendered.end(), image);
-    
-    if ( it != _imp->imagesBeingRendered.end() ) {
+    if ( _imp->imagesBeingRendered.find(image) != _imp->imagesBeingRendered.end() ) {
         return false;
     }
     ///Okay the image is not used by any other thread, claim that we want to use it
-    assert( it == _imp->imagesBeingRendered.end() );
-    _imp->imagesBeingRendered.push_back(image);
+    _imp->imagesBeingRendered.insert( std::make_pair( image, boost::shared_ptr<QWaitCondition>(new QWaitCondition) ) );
     return true;
 }
 
@@ -5901,13 +6100,15 @@ void
 Node::unlock(const boost::shared_ptr<Natron::Image> & image)
 {
     QMutexLocker l(&_imp->imagesBeingRenderedMutex);
-    std::list<boost::shared_ptr<Natron::Image> >::iterator it =
-    std::find(_imp->imagesBeingRendered.begin(), _imp->imagesBeingRendered.end(), image);
+    std::map<boost::shared_ptr<Natron::Image>, boost::shared_ptr<QWaitCondition> >::iterator it = _imp->imagesBeingRendered.find(image);
     ///The image must exist, otherwise this is a bug
     assert( it != _imp->imagesBeingRendered.end() );
+    if ( it == _imp->imagesBeingRendered.end() ) {
+        return;
+    }
+    ///Notify the threads waiting for this image only
+    it->second->wakeAll();
     _imp->imagesBeingRendered.erase(it);
-    ///Notify all waiting threads that we're finished
-    _imp->imageBeingRenderedCond.wakeAll();
 }
 
 boost::shared_ptr<Natron::Image>
@@ -5916,11 +6117,11 @@ Node::getImageBeingRendered(double time,
                             int view)
 {
     QMutexLocker l(&_imp->imagesBeingRenderedMutex);
-    for (std::list<boost::shared_ptr<Natron::Image> >::iterator it = _imp->imagesBeingRendered.begin();
+    for (std::map<boost::shared_ptr<Natron::Image>, boost::shared_ptr<QWaitCondition> >::iterator it = _imp->imagesBeingRendered.begin();
          it != _imp->imagesBeingRendered.end(); ++it) {
-        const Natron::ImageKey &key = (*it)->getKey();
-        if ( (key._view == view) && ((*it)->getMipMapLevel() == mipMapLevel) && (key._time == time) ) {
-            return *it;
+        const Natron::ImageKey &key = it->first->getKey();
+        if ( (key._view == view) && (it->first->getMipMapLevel() == mipMapLevel) && (key._time == time) ) {
+            return it->first;
         }
     }
     return boost::shared_ptr<Natron::Image>();
@@ -6004,6 +6205,7 @@ Node::onInputChanged(int inputNb)
                                                  true,
                                                  false,
                                                  false,
+                                                 Natron::eRenderPriorityInteractive,
                                                  0,
                                                  shared_from_this(),
                                                  0,
@@ -7111,6 +7313,7 @@ Node::getAllKnobsKeyframes(std::list<SequenceTime>* keyframes)
 Natron::ImageBitDepthEnum
 Node::getClosestSupportedBitDepth(Natron::ImageBitDepthEnum depth)
 {
+    bool foundHalf = false;
     bool foundShort = false;
     bool foundByte = false;
     for (std::list<ImageBitDepthEnum>::const_iterator it = _imp->supportedDepths.begin(); it != _imp->supportedDepths.end(); ++it) {
@@ -7118,13 +7321,17 @@ Node::getClosestSupportedBitDepth(Natron::ImageBitDepthEnum depth)
             return depth;
         } else if (*it == eImageBitDepthFloat) {
             return eImageBitDepthFloat;
+        } else if (*it == eImageBitDepthHalf) {
+            foundHalf = true;
         } else if (*it == eImageBitDepthShort) {
             foundShort = true;
         } else if (*it == eImageBitDepthByte) {
             foundByte = true;
         }
     }
-    if (foundShort) {
+    if (foundHalf) {
+        return Natron::eImageBitDepthHalf;
+    } else if (foundShort) {
         return Natron::eImageBitDepthShort;
     } else if (foundByte) {
         return Natron::eImageBitDepthByte;
@@ -7139,6 +7346,7 @@ Node::getClosestSupportedBitDepth(Natron::ImageBitDepthEnum depth)
 Natron::ImageBitDepthEnum
 Node::getBestSupportedBitDepth() const
 {
+    bool foundHalf = false;
     bool foundShort = false;
     bool foundByte = false;
     
@@ -7153,6 +7361,7 @@ Node::getBestSupportedBitDepth() const
                 break;
 
             case Natron::eImageBitDepthHalf:
+                foundHalf = true;
                 break;
 
             case Natron::eImageBitDepthFloat:
@@ -7163,7 +7372,9 @@ Node::getBestSupportedBitDepth() const
         }
     }
     
-    if (foundShort) {
+    if (foundHalf) {
+        return Natron::eImageBitDepthHalf;
+    } else if (foundShort) {
         return Natron::eImageBitDepthShort;
     } else if (foundByte) {
         return Natron::eImageBitDepthByte;
@@ -7528,6 +7739,80 @@ static void addIdentityNodesRecursively(const Node* caller,
     }
 }
 
+void
+Node::addRenderCostSample(double seconds,
+                          U64 pixels)
+{
+    QMutexLocker k(&_imp->renderCostMutex);
+
+    if (pixels == 0) {
+        if (_imp->renderCostPerPixel < 0) {
+            _imp->renderCostPerPixel = 0.;
+        }
+
+        return;
+    }
+    double cost = seconds / pixels;
+    if (_imp->renderCostPerPixel < 0) {
+        _imp->renderCostPerPixel = cost;
+    } else {
+        _imp->renderCostPerPixel += (cost - _imp->renderCostPerPixel) * NATRON_RENDER_COST_SAMPLE_WEIGHT;
+    }
+}
+
+double
+Node::getRenderCostPerPixel() const
+{
+    QMutexLocker k(&_imp->renderCostMutex);
+
+    return _imp->renderCostPerPixel;
+}
+
+/**
+ * @brief Returns true if rendering a pixel of the output of the node and of all the nodes upstream costs less than maxCost
+ * seconds. Nodes that were never rendered are not cheap, unless their plug-in says so.
+ * @param cost [in/out] The cost of the nodes visited so far
+ **/
+static bool isCheapToRenderRecursively(const Node* node,
+                                       double maxCost,
+                                       std::list<const Node*>* markedNodes,
+                                       double* cost)
+{
+    if ( std::find(markedNodes->begin(), markedNodes->end(), node) != markedNodes->end() ) {
+        return true;
+    }
+    markedNodes->push_back(node);
+
+    switch ( node->getLiveInstance()->getCacheAdmissionHint() ) {
+    case Natron::eCacheAdmissionHintExpensive:
+
+        return false;
+    case Natron::eCacheAdmissionHintCheap:
+        break;
+    case Natron::eCacheAdmissionHintDefault: {
+        double nodeCost = node->getRenderCostPerPixel();
+        if (nodeCost < 0) {
+            return false;
+        }
+        *cost += nodeCost;
+        break;
+    }
+    }
+    if (*cost >= maxCost) {
+        return false;
+    }
+
+    int nInputs = node->getMaxInputCount();
+    for (int i = 0; i < nInputs; ++i) {
+        boost::shared_ptr<Node> input = node->getInput(i);
+        if ( input && !isCheapToRenderRecursively(input.get(), maxCost, markedNodes, cost) ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 bool
 Node::shouldCacheOutput(bool isFrameVaryingOrAnimated, double time, int view) const
 {
@@ -7544,6 +7829,10 @@ Node::shouldCacheOutput(bool isFrameVaryingOrAnimated, double time, int view) co
      * - The node is not frame varying, meaning it will always produce the same image at any time
      * - The node is a roto node and it is being edited
      * - The node does not support tiles
+     *
+     * The reasons which are only guesses of what the user is going to do next (direct input of a viewer, not frame varying,
+     * output panel opened) are ignored by the cache admission policy if the node and all the nodes upstream are
+     * cheap to render again: caching them would only push more expensive images out of the cache.
      */
 
     std::list<const Node*> outputs;
@@ -7561,8 +7850,19 @@ Node::shouldCacheOutput(bool isFrameVaryingOrAnimated, double time, int view) co
         if (sz == 1) {
           
             const Node* output = outputs.front();
-            
-            ViewerInstance* isViewer = dynamic_cast<ViewerInstance*>(output->getLiveInstance());
+
+            bool cheapToRenderAgain = false;
+            if ( appPTR->getCurrentSettings()->isCacheAdmissionPolicyEnabled() ) {
+                double maxCost = NATRON_CACHE_ADMISSION_CHEAP_SECONDS_PER_PIXEL;
+                if ( _imp->liveInstance->isDraftRenderThreadLocal() ) {
+                    maxCost *= NATRON_CACHE_ADMISSION_SCRUBBING_FACTOR;
+                }
+                std::list<const Node*> markedNodes;
+                double cost = 0.;
+                cheapToRenderAgain = isCheapToRenderRecursively(this, maxCost, &markedNodes, &cost);
+            }
+
+            ViewerInstance* isViewer = !cheapToRenderAgain ? dynamic_cast<ViewerInstance*>(output->getLiveInstance()) : 0;
             if (isViewer) {
                 int activeInputs[2];
                 isViewer->getActiveInputs(activeInputs[0], activeInputs[1]);
@@ -7574,11 +7874,11 @@ Node::shouldCacheOutput(bool isFrameVaryingOrAnimated, double time, int view) co
                 }
             }
         
-            if (!isFrameVaryingOrAnimated) {
+            if (!isFrameVaryingOrAnimated && !cheapToRenderAgain) {
                 //This image never changes, cache it once.
                 return true;
             }
-            if (output->isSettingsPanelOpened()) {
+            if ( output->isSettingsPanelOpened() && !cheapToRenderAgain ) {
                 //Output node has panel opened, meaning the user is likely to be heavily editing
                 //that output node, hence requesting this node a lot. Cache it.
                 return true;
@@ -219,6 +219,12 @@ public:
      **/
     U64 getHashValue() const;
 
+    /**
+     * @brief Returns true if the hash of the node only depends on the content of its parameters and of its inputs,
+     * in which case the same graph opened in another process has the same hash.
+     **/
+    bool isHashContentBased() const;
+
     virtual std::string getCacheID() const OVERRIDE FINAL;
 
     /**
@@ -564,6 +570,18 @@ public:
     
     bool shouldCacheOutput(bool isFrameVaryingOrAnimated, double time, int view) const;
 
+    /**
+     * @brief Records the time spent rendering pixels of the output of the node. This is used by the cache admission
+     * policy, @see shouldCacheOutput. A sample without pixels means the node was an identity.
+     **/
+    void addRenderCostSample(double seconds, U64 pixels);
+
+    /**
+     * @brief Returns the average time in seconds spent rendering a pixel of the output of the node, or -1 if
+     * the node was never rendered.
+     **/
+    double getRenderCostPerPixel() const;
+
     /**
      * @brief If the session is a GUI session, then this function sets the position of the node on the nodegraph.
      **/
@@ -801,6 +819,12 @@ public:
     
     void incrementKnobsAge_internal();
 
+    /**
+     * @brief To be called when the user asks to reload the files read by the node: removes its images from the caches and
+     * changes its hash, so that no image rendered from the previous content of the files is used again.
+     **/
+    void onFileReloaded();
+
     
     
 public:
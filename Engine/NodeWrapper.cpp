@@ -783,6 +783,15 @@ Effect::getAvailableLayers() const
     return ret;
 }
 
+Natron::CacheStatsSnapshot
+Effect::getCacheStats() const
+{
+    if (!_node) {
+        return Natron::CacheStatsSnapshot();
+    }
+    return _node->getCacheStats()->getSnapshot();
+}
+
 void
 Effect::setPagesOrder(const std::list<std::string>& pages)
 {
@@ -35,6 +35,7 @@
 #include <boost/shared_ptr.hpp>
 #endif
 
+#include "Engine/CacheStats.h"
 #include "Engine/ImageComponents.h"
 #include "Engine/Knob.h" // KnobI
 #include "Engine/NodeGroupWrapper.h" // Goup
@@ -359,6 +360,11 @@ public:
     
     std::map<ImageLayer,Effect*> getAvailableLayers() const;
     
+    /**
+     * @brief Returns the cache telemetry of the images of this node, @see CacheStats
+     **/
+    Natron::CacheStatsSnapshot getCacheStats() const;
+    
     void setPagesOrder(const std::list<std::string>& pages);
 };
 
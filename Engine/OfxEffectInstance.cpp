@@ -2909,6 +2909,17 @@ OfxEffectInstance::doesTemporalClipAccess() const
     return effectInstance()->getDescriptor().temporalAccess() && effectInstance()->temporalAccess();
 }
 
+Natron::CacheAdmissionHintEnum
+OfxEffectInstance::getCacheAdmissionHint() const
+{
+    ///Reading files may be fast on a local disk and very slow on the network: never trust the measured render cost
+    if ( isReader() ) {
+        return Natron::eCacheAdmissionHintExpensive;
+    }
+
+    return Natron::eCacheAdmissionHintDefault;
+}
+
 bool
 OfxEffectInstance::isHostChannelSelectorSupported(bool* defaultR,bool* defaultG, bool* defaultB, bool* defaultA) const
 {
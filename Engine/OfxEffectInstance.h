@@ -205,6 +205,7 @@ public:
     virtual bool supportsRenderQuality() const OVERRIDE FINAL WARN_UNUSED_RETURN;
     virtual Natron::PluginOpenGLRenderSupport supportsOpenGLRender() const OVERRIDE FINAL WARN_UNUSED_RETURN;
     virtual bool doesTemporalClipAccess() const OVERRIDE FINAL WARN_UNUSED_RETURN;
+    virtual Natron::CacheAdmissionHintEnum getCacheAdmissionHint() const OVERRIDE FINAL WARN_UNUSED_RETURN;
 
     /**
      * @brief Does this effect supports multiresolution ?
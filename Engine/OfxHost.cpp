@@ -33,18 +33,18 @@
 #include <cctype> // tolower
 #include <algorithm> // transform, min, max
 #include <string>
+#include <vector>
 
 CLANG_DIAG_OFF(deprecated-register) //'register' storage class specifier is deprecated
 #include <QtCore/QDir>
 #include <QtCore/QMutex>
-#include <QtCore/QThreadPool>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDebug>
 CLANG_DIAG_ON(deprecated-register)
 #ifdef OFX_SUPPORTS_MULTITHREAD
 #include <QtCore/QThread>
 #include <QtCore/QThreadStorage>
-#include <QtConcurrentMap> // QtCore on Qt4, QtConcurrent on Qt5
+#include <QtCore/QVector>
 GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_OFF
 // /usr/local/include/boost/bind/arg.hpp:37:9: warning: unused typedef 'boost_static_assert_typedef_37' [-Wunused-local-typedef]
 #include <boost/bind.hpp>
@@ -97,6 +97,7 @@ CLANG_DIAG_ON(unknown-pragmas)
 #include "Engine/Project.h"
 #include "Engine/Settings.h"
 #include "Engine/StandardPaths.h"
+#include "Engine/TaskScheduler.h"
 #include "Engine/TLSHolder.h"
 
 // see second answer of http://stackoverflow.com/questions/2342162/stdstring-formatting-like-sprintf
@@ -982,8 +983,8 @@ Natron::OfxHost::setThreadAsActionCaller(Natron::OfxImageEffectInstance* instanc
 
 namespace {
     
-///Using QtConcurrent doesn't work with The Foundry Furnace plug-ins because they expect fresh threads
-///to be created. As QtConcurrent's thread-pool recycles thread, it seems to make Furnace crash.
+///Using the threads of the TaskScheduler doesn't work with The Foundry Furnace plug-ins because they expect fresh threads
+///to be created. As the TaskScheduler recycles threads, it seems to make Furnace crash.
 ///We think this is because Furnace must keep an internal thread-local state that becomes then dirty
 ///if we re-use the same thread.
 
@@ -1125,19 +1126,27 @@ Natron::OfxHost::multiThread(OfxThreadFunctionV1 func,
     
     if (useThreadPool) {
         
-        std::vector<unsigned int> threadIndexes(nThreads);
-        for (unsigned int i = 0; i < nThreads; ++i) {
-            threadIndexes[i] = i;
+        /// The functions are run by the TaskScheduler shared with the renders, this thread running the ones that no other
+        /// thread took, so that at most as many functions as there are idle threads run at the same time (see the
+        /// documentation excerpt above)
+        std::vector<OfxStatus> status(nThreads, kOfxStatFailed);
+        {
+            TaskGroup group( appPTR->getTaskScheduler() );
+            for (unsigned int i = 0; i < nThreads; ++i) {
+                group.run( boost::function<OfxStatus ()>( boost::bind(::threadFunctionWrapper, func, i, nThreads, spawnerThread, customArg) ),
+                           &status[i] );
+            }
+            ///The exceptions must not go through the OFX API
+            try {
+                group.wait();
+            } catch (const std::bad_alloc &) {
+                return kOfxStatErrMemory;
+            } catch (...) {
+                return kOfxStatFailed;
+            }
         }
         
-        /// DON'T set the maximum thread count, this is a global application setting, and see the documentation excerpt above
-        //QThreadPool::globalInstance()->setMaxThreadCount(nThreads);
-        QFuture<OfxStatus> future = QtConcurrent::mapped( threadIndexes, boost::bind(::threadFunctionWrapper,func, _1, nThreads, spawnerThread, customArg) );
-        future.waitForFinished();
-        ///DON'T reset back to the original value the maximum thread count
-        //QThreadPool::globalInstance()->setMaxThreadCount(QThread::idealThreadCount());
-        
-        for (QFuture<OfxStatus>::const_iterator it = future.begin(); it != future.end(); ++it) {
+        for (std::vector<OfxStatus>::const_iterator it = status.begin(); it != status.end(); ++it) {
             OfxStatus stat = *it;
             if (stat != kOfxStatOK) {
                 return stat;
@@ -1210,8 +1219,9 @@ Natron::OfxHost::multiThreadNumCPUS(unsigned int *nCPUs) const
     if (nThreadsToRender == -1) {
         *nCPUs = 1;
     } else {
-        // activeThreadCount may be negative (for example if releaseThread() is called)
-        int activeThreadsCount = QThreadPool::globalInstance()->activeThreadCount();
+        // the threads of the TaskScheduler running a task, e.g: a tile or a multiThread() function
+        TaskScheduler* scheduler = appPTR->getTaskScheduler();
+        int activeThreadsCount = scheduler->getThreadCount() - scheduler->getIdleThreadCount();
         
         // Add the number of threads already running by the multiThreadSuite + parallel renders
         activeThreadsCount += appPTR->getNRunningThreads();
@@ -1222,7 +1232,7 @@ Natron::OfxHost::multiThreadNumCPUS(unsigned int *nCPUs) const
         assert(activeThreadsCount >= 0);
         
         // better than QThread::idealThreadCount();, because it can be set by a global preference:
-        int maxThreadsCount = QThreadPool::globalInstance()->maxThreadCount();
+        int maxThreadsCount = scheduler->getThreadCount();
         assert(maxThreadsCount >= 0);
         
         if (nThreadsPerEffect == 0) {
@@ -34,9 +34,7 @@
 #include <QtCore/QWaitCondition>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QString>
-#include <QtCore/QThreadPool>
 #include <QtCore/QDebug>
-#include <QtCore/QtConcurrentRun>
 #include <QtCore/QFuture>
 #include <QtCore/QFutureWatcher>
 #include <QtCore/QRunnable>
@@ -55,6 +53,7 @@
 #include "Engine/RenderStats.h"
 #include "Engine/RotoContext.h"
 #include "Engine/Settings.h"
+#include "Engine/TaskScheduler.h"
 #include "Engine/Timer.h"
 #include "Engine/TimeLine.h"
 #include "Engine/TLSHolder.h"
@@ -1233,7 +1232,8 @@ OutputSchedulerThread::adjustNumberOfThreads(int* newNThreads, int *lastNThreads
     int userSettingParallelThreads = appPTR->getCurrentSettings()->getNumberOfParallelRenders();
     
     ///How many threads are running in the application
-    int runningThreads = appPTR->getNRunningThreads() + QThreadPool::globalInstance()->activeThreadCount();
+    TaskScheduler* scheduler = appPTR->getTaskScheduler();
+    int runningThreads = appPTR->getNRunningThreads() + scheduler->getThreadCount() - scheduler->getIdleThreadCount();
     
     ///How many current threads are used by THIS renderer
     int currentParallelRenders = getNRenderThreads();
@@ -2179,6 +2179,7 @@ private:
                                                          false,  // is this render due to user interaction ?
                                                          sequentiallity == Natron::eSequentialPreferenceOnlySequential || sequentiallity == Natron::eSequentialPreferencePreferSequential, // is this sequential ?
                                                          true, // canAbort ?
+                                                         Natron::eRenderPriorityNormal,
                                                          0, //renderAge
                                                          outputNode, // viewer requester
                                                          &request,
@@ -2280,6 +2281,7 @@ DefaultScheduler::processFrame(const BufferedFrames& frames)
                                                  false,  // is this render due to user interaction ?
                                                  canOnlyHandleOneView, // is this sequential ?
                                                  true, //canAbort
+                                                 Natron::eRenderPriorityNormal,
                                                  0, //renderAge
                                                  _effect->getNode(), //tree root
                                                  0,
@@ -3536,19 +3538,14 @@ ViewerCurrentFrameRequestScheduler::renderCurrentFrame(bool enableRenderStats,bo
         functorArgs->request = request;
         
         /*
-         * Let at least 1 free thread in the thread-pool to allow the renderer to use the thread pool if we use the thread-pool
-         * with QtConcurrent::run
+         * The render runs in a thread of the TaskScheduler. It does not need a free thread to render its tiles since it
+         * renders itself the ones that no other thread took.
+         * When painting, limit the number of threads to 1 to be sure strokes are painted in the right order
          */
-        int maxThreads = QThreadPool::globalInstance()->maxThreadCount();
-        
-        //When painting, limit the number of threads to 1 to be sure strokes are painted in the right order
         if (rotoUse1Thread) {
-            maxThreads = 1;
-        }
-        if (maxThreads == 1 || (QThreadPool::globalInstance()->activeThreadCount() >= maxThreads - 1)) {
             _imp->backupThread.renderCurrentFrame(functorArgs);
         } else {
-            QtConcurrent::run(renderCurrentFrameFunctor,functorArgs);
+            appPTR->getTaskScheduler()->start(boost::bind(&renderCurrentFrameFunctor, functorArgs), Natron::eRenderPriorityInteractive);
         }
     }
     
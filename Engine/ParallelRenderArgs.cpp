@@ -30,8 +30,10 @@
 #include "Engine/Image.h"
 #include "Engine/Node.h"
 #include "Engine/NodeGroup.h"
+#include "Engine/RenderArena.h"
 #include "Engine/RotoContext.h"
 #include "Engine/RotoDrawableItem.h"
+#include "Engine/TaskScheduler.h"
 
 using namespace Natron;
 
@@ -566,6 +568,58 @@ EffectInstance::computeRequestPass(double time,
     return eStatusOK;
 }
 
+bool
+EffectInstance::canStreamTiles(const FrameRequestMap& tileRequest,
+                               const boost::shared_ptr<Natron::Node>& treeRoot,
+                               const RectD& canonicalTile,
+                               double maxMargin)
+{
+    const double maxWidth = canonicalTile.width() + 2. * maxMargin;
+    const double maxHeight = canonicalTile.height() + 2. * maxMargin;
+
+    for (FrameRequestMap::const_iterator it = tileRequest.begin(); it != tileRequest.end(); ++it) {
+        if (it->first == treeRoot) {
+            continue;
+        }
+        EffectInstance* effect = it->first->getLiveInstance();
+        for (NodeFrameViewRequestData::const_iterator it2 = it->second->frames.begin(); it2 != it->second->frames.end(); ++it2) {
+
+            ///Identities are not rendered, their input is
+            if (it2->second.globalData.isIdentity) {
+                continue;
+            }
+            if (!effect || !effect->supportsTiles()) {
+                return false;
+            }
+
+            ///What is outside of the RoD is never rendered
+            RectD roi;
+            if (!it2->second.finalData.finalRoi.intersect(it2->second.globalData.rod, &roi)) {
+                continue;
+            }
+            if (roi.width() > maxWidth || roi.height() > maxHeight) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void
+EffectInstance::setRequestPassForTile(const FrameRequestMap& tileRequest,
+                                      const FrameRequestMap& frameRequest)
+{
+    for (FrameRequestMap::const_iterator it = frameRequest.begin(); it != frameRequest.end(); ++it) {
+        FrameRequestMap::const_iterator found = tileRequest.find(it->first);
+        if (found != tileRequest.end()) {
+            *it->second = *found->second;
+        } else {
+            ///Not needed by this tile: without a request pass the node falls back on the RoIs of its current render
+            it->second->frames.clear();
+        }
+    }
+}
+
 const FrameViewRequest*
 NodeFrameRequest::getFrameViewRequest(double time, int view) const
 {
@@ -689,6 +743,7 @@ ParallelRenderArgsSetter::ParallelRenderArgsSetter(double time,
                                                    bool isRenderUserInteraction,
                                                    bool isSequential,
                                                    bool canAbort,
+                                                   Natron::RenderPriorityEnum priority,
                                                    U64 renderAge,
                                                    const boost::shared_ptr<Natron::Node>& treeRoot,
                                                    const FrameRequestMap* request,
@@ -700,9 +755,16 @@ ParallelRenderArgsSetter::ParallelRenderArgsSetter(double time,
                                                    bool viewerProgressReportEnabled,
                                                    const boost::shared_ptr<RenderStats>& stats)
 :  argsMap()
+, callerPriority( TaskScheduler::getCurrentPriority() )
+, arena( new RenderArena() )
+, callerArena( RenderArena::getCurrent() )
 {
     assert(treeRoot);
     
+    TaskScheduler::setCurrentPriority(priority);
+    ///Set before the thread-local storage of the nodes, which takes the arena of the thread
+    RenderArena::setCurrent(arena);
+    
     bool doNanHandling = appPTR->getCurrentSettings()->isNaNHandlingEnabled();
     
     getAllUpstreamNodesRecursiveWithDependencies(treeRoot, nodes);
@@ -804,8 +866,14 @@ ParallelRenderArgsSetter::ParallelRenderArgsSetter(double time,
 
 ParallelRenderArgsSetter::ParallelRenderArgsSetter(const boost::shared_ptr<std::map<boost::shared_ptr<Natron::Node>,ParallelRenderArgs > >& args)
 : argsMap(args)
+, callerPriority( TaskScheduler::getCurrentPriority() )
+, arena()
+, callerArena( RenderArena::getCurrent() )
 {
     if (args) {
+        if ( !args->empty() ) {
+            RenderArena::setCurrent(args->begin()->second.arena);
+        }
         for (std::map<boost::shared_ptr<Natron::Node>,ParallelRenderArgs >::iterator it = argsMap->begin(); it != argsMap->end(); ++it) {
             it->first->getLiveInstance()->setParallelRenderArgsTLS(it->second);
         }
@@ -814,6 +882,8 @@ ParallelRenderArgsSetter::ParallelRenderArgsSetter(const boost::shared_ptr<std::
 
 ParallelRenderArgsSetter::~ParallelRenderArgsSetter()
 {
+    TaskScheduler::setCurrentPriority(callerPriority);
+    RenderArena::setCurrent(callerArena);
     
     for (NodeList::iterator it = nodes.begin(); it != nodes.end(); ++it) {
         if (!(*it) || !(*it)->getLiveInstance()) {
@@ -844,4 +914,9 @@ ParallelRenderArgsSetter::~ParallelRenderArgsSetter()
             it->first->getLiveInstance()->invalidateParallelRenderArgsTLS();
         }
     }
+    
+    ///The render of the frame is done: free the memory kept for its temporary images
+    if (arena) {
+        arena->reset();
+    }
 }
@@ -105,6 +105,9 @@ struct ParallelRenderArgs
     ///Various stats local to the render of a frame
     boost::shared_ptr<RenderStats> stats;
 
+    ///The memory of the temporary images of the render of the frame
+    boost::shared_ptr<Natron::RenderArena> arena;
+
     ///The texture index of the viewer being rendered, only useful for abortable renders
     int textureIndex;
 
@@ -152,6 +155,7 @@ struct ParallelRenderArgs
     , treeRoot()
     , rotoPaintNodes()
     , stats()
+    , arena()
     , textureIndex(0)
     , currentThreadSafety(Natron::eRenderSafetyInstanceSafe)
     , isRenderResponseToUserInteraction(false)
@@ -263,6 +267,15 @@ class ParallelRenderArgsSetter
     boost::shared_ptr<std::map<boost::shared_ptr<Natron::Node>,ParallelRenderArgs > > argsMap;
     std::list<boost::shared_ptr<Natron::Node> > nodes;
     
+    ///The priority of the thread before the render, restored by the destructor
+    Natron::RenderPriorityEnum callerPriority;
+    
+    ///The arena of the render, owned by the setter that created the thread-local storage: it is reset by the destructor
+    boost::shared_ptr<Natron::RenderArena> arena;
+    
+    ///The arena of the thread before the render, restored by the destructor
+    boost::shared_ptr<Natron::RenderArena> callerArena;
+    
 public:
     
     /**
@@ -271,12 +284,15 @@ public:
      * We do this because TLS is needed to know the correct frame, view at which the frame is evaluated (i.e rendered)
      * even in nodes that do not belong in the tree. The reason why is because the nodes in the tree may have parameters
      * relying on other nodes that do not belong in the tree through expressions.
+     * The priority is the one of the tasks of the render run by the TaskScheduler: it is set on the calling thread
+     * until the destructor. So is a new RenderArena, in which the temporary images of the render are allocated.
      **/
     ParallelRenderArgsSetter(double time,
                              int view,
                              bool isRenderUserInteraction,
                              bool isSequential,
                              bool canAbort,
+                             Natron::RenderPriorityEnum priority,
                              U64 renderAge,
                              const boost::shared_ptr<Natron::Node>& treeRoot,
                              const FrameRequestMap* request,
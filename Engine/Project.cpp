@@ -832,6 +832,16 @@ Project::initializeKnobs()
     _imp->colorSpace32f->setDefaultValue(1);
     page->addKnob(_imp->colorSpace32f);
     
+    _imp->cacheImagesAsHalf = Natron::createKnob<KnobBool>(this, "Cache Images as Half-Float");
+    _imp->cacheImagesAsHalf->setName("cacheImagesAsHalf");
+    _imp->cacheImagesAsHalf->setHintToolTip("When checked, the images rendered in 32-bit floating point are stored in the cache "
+                                            "as 16-bit half-float images. This halves the memory taken by the cache, at the cost of "
+                                            "precision for the intermediate results. It is lossless for images read from half-float files.");
+    _imp->cacheImagesAsHalf->setDefaultValue(false);
+    _imp->cacheImagesAsHalf->setAnimationEnabled(false);
+    _imp->cacheImagesAsHalf->setEvaluateOnChange(false);
+    page->addKnob(_imp->cacheImagesAsHalf);
+    
     _imp->frameRange = Natron::createKnob<KnobInt>(this, "Frame Range",2);
     _imp->frameRange->setDefaultValue(1,0);
     _imp->frameRange->setDefaultValue(250,1);
@@ -1238,6 +1248,12 @@ Project::toggleAutoPreview()
     _imp->previewMode->setValue(!_imp->previewMode->getValue(),0);
 }
 
+bool
+Project::isCachingImagesAsHalf() const
+{
+    return _imp->cacheImagesAsHalf->getValue();
+}
+
 boost::shared_ptr<TimeLine> Project::getTimeLine() const
 {
     return _imp->timeline;
@@ -155,6 +155,12 @@ public:
 
     void toggleAutoPreview();
 
+    /**
+     * @brief Returns true if the images rendered in floating point are stored in the cache as half-float images,
+     * which halves their memory footprint. They are converted back to float when read from the cache.
+     **/
+    bool isCachingImagesAsHalf() const;
+
     boost::shared_ptr<TimeLine> getTimeLine() const WARN_UNUSED_RETURN;
 
     int currentFrame() const WARN_UNUSED_RETURN;
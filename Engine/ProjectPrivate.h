@@ -117,6 +117,7 @@ struct ProjectPrivate
     boost::shared_ptr<KnobChoice> colorSpace8u;
     boost::shared_ptr<KnobChoice> colorSpace16u;
     boost::shared_ptr<KnobChoice> colorSpace32f;
+    boost::shared_ptr<KnobBool> cacheImagesAsHalf;
     boost::shared_ptr<KnobDouble> frameRate;
     boost::shared_ptr<KnobInt> frameRange;
     boost::shared_ptr<KnobBool> lockFrameRange;
@@ -0,0 +1,237 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "RenderArena.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <new>
+#include <vector>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+#include <QtCore/QThreadStorage>
+
+using namespace Natron;
+
+namespace {
+///The arena of the render the thread is running
+QThreadStorage<boost::shared_ptr<RenderArena> > currentArena;
+
+///The live arenas, so that their kept blocks can be released. Locked before the lock of an arena.
+QMutex arenasLock;
+std::list<RenderArenaPrivate*> arenas;
+
+///The blocks kept by all the arenas and their limit, counted in NATRON_RENDER_ARENA_BLOCK_GRANULARITY bytes units so
+///that they fit in a QAtomicInt
+QAtomicInt totalKeptUnits(0);
+QAtomicInt maxKeptUnits(NATRON_RENDER_ARENA_MAX_KEPT_BYTES / NATRON_RENDER_ARENA_BLOCK_GRANULARITY);
+
+std::size_t
+getBlockSize(std::size_t bytes)
+{
+    return ( (bytes + NATRON_RENDER_ARENA_BLOCK_GRANULARITY - 1) / NATRON_RENDER_ARENA_BLOCK_GRANULARITY ) * NATRON_RENDER_ARENA_BLOCK_GRANULARITY;
+}
+
+///Accounts for a block about to be kept, unless the arenas already keep as much as allowed
+bool
+reserveKeptBlock(std::size_t blockSize)
+{
+    const int units = (int)(blockSize / NATRON_RENDER_ARENA_BLOCK_GRANULARITY);
+    const int maxUnits = maxKeptUnits.fetchAndAddRelaxed(0);
+
+    for (;;) {
+        int kept = totalKeptUnits.fetchAndAddRelaxed(0);
+        if (kept + units > maxUnits) {
+            return false;
+        }
+        if ( totalKeptUnits.testAndSetOrdered(kept, kept + units) ) {
+            return true;
+        }
+    }
+}
+
+void
+releaseKeptBytes(std::size_t bytes)
+{
+    totalKeptUnits.fetchAndAddOrdered( -(int)(bytes / NATRON_RENDER_ARENA_BLOCK_GRANULARITY) );
+}
+}
+
+namespace Natron {
+
+struct RenderArenaPrivate
+{
+    mutable QMutex lock;
+
+    //The blocks kept for reuse, by size
+    std::map<std::size_t, std::vector<void*> > keptBlocks;
+
+    //The sum of the sizes of keptBlocks
+    std::size_t keptBytes;
+
+    //False once reset() was called
+    bool keepBlocks;
+
+    RenderArenaPrivate()
+    : lock()
+    , keptBlocks()
+    , keptBytes(0)
+    , keepBlocks(true)
+    {
+    }
+
+    void freeKeptBlocks()
+    {
+        for (std::map<std::size_t, std::vector<void*> >::iterator it = keptBlocks.begin(); it != keptBlocks.end(); ++it) {
+            for (std::size_t i = 0; i < it->second.size(); ++i) {
+                free(it->second[i]);
+            }
+        }
+        keptBlocks.clear();
+        releaseKeptBytes(keptBytes);
+        keptBytes = 0;
+    }
+};
+
+RenderArena::RenderArena()
+    : _imp( new RenderArenaPrivate() )
+{
+    QMutexLocker k(&arenasLock);
+
+    arenas.push_back( _imp.get() );
+}
+
+RenderArena::~RenderArena()
+{
+    {
+        QMutexLocker k(&arenasLock);
+        arenas.remove( _imp.get() );
+    }
+    _imp->freeKeptBlocks();
+}
+
+void*
+RenderArena::allocate(std::size_t bytes)
+{
+    const std::size_t blockSize = getBlockSize(bytes);
+    {
+        QMutexLocker k(&_imp->lock);
+        std::map<std::size_t, std::vector<void*> >::iterator found = _imp->keptBlocks.find(blockSize);
+        if ( ( found != _imp->keptBlocks.end() ) && !found->second.empty() ) {
+            void* ptr = found->second.back();
+            found->second.pop_back();
+            _imp->keptBytes -= blockSize;
+            releaseKeptBytes(blockSize);
+
+            return ptr;
+        }
+    }
+    void* ptr = malloc(blockSize);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+void
+RenderArena::deallocate(void* ptr,
+                        std::size_t bytes)
+{
+    if (!ptr) {
+        return;
+    }
+    const std::size_t blockSize = getBlockSize(bytes);
+    {
+        QMutexLocker k(&_imp->lock);
+        if ( _imp->keepBlocks && reserveKeptBlock(blockSize) ) {
+            _imp->keptBlocks[blockSize].push_back(ptr);
+            _imp->keptBytes += blockSize;
+
+            return;
+        }
+    }
+    free(ptr);
+}
+
+void
+RenderArena::reset()
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->keepBlocks = false;
+    _imp->freeKeptBlocks();
+}
+
+std::size_t
+RenderArena::getKeptBytes() const
+{
+    QMutexLocker k(&_imp->lock);
+
+    return _imp->keptBytes;
+}
+
+void
+RenderArena::releaseAllKeptBlocks()
+{
+    QMutexLocker k(&arenasLock);
+
+    for (std::list<RenderArenaPrivate*>::iterator it = arenas.begin(); it != arenas.end(); ++it) {
+        QMutexLocker arenaLocker(&(*it)->lock);
+        (*it)->freeKeptBlocks();
+    }
+}
+
+std::size_t
+RenderArena::getTotalKeptBytes()
+{
+    return (std::size_t)totalKeptUnits.fetchAndAddRelaxed(0) * NATRON_RENDER_ARENA_BLOCK_GRANULARITY;
+}
+
+void
+RenderArena::setMaxKeptBytes(std::size_t bytes)
+{
+    bytes = std::min( bytes, (std::size_t)NATRON_RENDER_ARENA_MAX_KEPT_BYTES );
+    maxKeptUnits.fetchAndStoreOrdered( (int)(bytes / NATRON_RENDER_ARENA_BLOCK_GRANULARITY) );
+}
+
+boost::shared_ptr<RenderArena>
+RenderArena::getCurrent()
+{
+    if ( !currentArena.hasLocalData() ) {
+        return boost::shared_ptr<RenderArena>();
+    }
+
+    return currentArena.localData();
+}
+
+void
+RenderArena::setCurrent(const boost::shared_ptr<RenderArena> & arena)
+{
+    currentArena.setLocalData(arena);
+}
+} // namespace Natron
@@ -0,0 +1,150 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NATRON_ENGINE_RENDERARENA_H
+#define NATRON_ENGINE_RENDERARENA_H
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <cstddef>
+
+#include "Global/Macros.h"
+
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#endif
+
+///The sizes of the blocks are rounded up to a multiple of this, so that the temporary images of the tiles of a render,
+///whose sizes differ by a few rows, share the same blocks
+#define NATRON_RENDER_ARENA_BLOCK_GRANULARITY 65536
+
+///The blocks freed during the renders are kept for reuse up to this many bytes for all the arenas together, beyond which
+///they are freed right away
+#define NATRON_RENDER_ARENA_MAX_KEPT_BYTES (512ULL * 1024ULL * 1024ULL)
+
+///The arenas keep at most this fraction of the RAM budget of the node cache, @see RenderArena::setMaxKeptBytes
+#define NATRON_RENDER_ARENA_MAX_KEPT_CACHE_FRACTION 0.1
+
+namespace Natron {
+
+struct RenderArenaPrivate;
+
+/**
+ * @brief The memory of the images a render of a frame creates outside of the cache (downscaled and full scale
+ * temporary images, images converted to other components or bit depth...).
+ * A block freed during the render is kept for the next temporary image of the same size instead of being given back to
+ * the system, so that the threads rendering the tiles of the frame do not contend on malloc and do not fragment the heap
+ * with large short-lived blocks. All the kept blocks are freed at once by reset(), when the render of the frame is done:
+ * from then on the blocks still in use are freed when they are deallocated, hence an image may outlive the render.
+ *
+ * The arena is owned by the ParallelRenderArgsSetter of the frame and given to the threads of the render with the
+ * ParallelRenderArgs: the images allocate their memory in the arena of the calling thread, see getCurrent().
+ * Several frames may be rendered at once: the bytes kept by all the arenas are limited together, see setMaxKeptBytes(),
+ * and can be given back to the system under memory pressure, see releaseAllKeptBlocks().
+ * This class is MT-safe.
+ **/
+class RenderArena
+{
+public:
+
+    RenderArena();
+
+    ~RenderArena();
+
+    /**
+     * @brief Returns a block of at least bytes bytes, aligned like malloc.
+     * WARNING: This function throws a std::bad_alloc if the allocation fails.
+     **/
+    void* allocate(std::size_t bytes);
+
+    /**
+     * @brief Gives back a block returned by allocate(bytes), which is kept for reuse until reset() is called.
+     **/
+    void deallocate(void* ptr, std::size_t bytes);
+
+    /**
+     * @brief Frees all the blocks kept for reuse. The blocks deallocated afterwards are freed right away.
+     **/
+    void reset();
+
+    /**
+     * @brief Returns the number of bytes of the blocks kept for reuse.
+     **/
+    std::size_t getKeptBytes() const;
+
+    /**
+     * @brief Frees the blocks kept for reuse by all the arenas, e.g: under memory pressure. Unlike reset(), the arenas
+     * keep the blocks deallocated afterwards.
+     **/
+    static void releaseAllKeptBlocks();
+
+    /**
+     * @brief Returns the number of bytes of the blocks kept for reuse by all the arenas.
+     **/
+    static std::size_t getTotalKeptBytes();
+
+    /**
+     * @brief Sets the number of bytes all the arenas may keep for reuse together, at most NATRON_RENDER_ARENA_MAX_KEPT_BYTES.
+     * Lowering it does not free the blocks already kept.
+     **/
+    static void setMaxKeptBytes(std::size_t bytes);
+
+    /**
+     * @brief Returns the arena of the render the calling thread is running, or NULL.
+     **/
+    static boost::shared_ptr<RenderArena> getCurrent();
+
+    /**
+     * @brief Sets the arena of the render the calling thread is running, e.g: by ParallelRenderArgsSetter.
+     **/
+    static void setCurrent(const boost::shared_ptr<RenderArena> & arena);
+
+private:
+
+    boost::scoped_ptr<RenderArenaPrivate> _imp;
+};
+
+/**
+ * @brief Sets the arena of the calling thread for its lifetime, then restores the previous one.
+ **/
+class RenderArenaSetter
+{
+    boost::shared_ptr<RenderArena> _callerArena;
+
+public:
+
+    explicit RenderArenaSetter(const boost::shared_ptr<RenderArena> & arena)
+    : _callerArena( RenderArena::getCurrent() )
+    {
+        RenderArena::setCurrent(arena);
+    }
+
+    ~RenderArenaSetter()
+    {
+        RenderArena::setCurrent(_callerArena);
+    }
+};
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_RENDERARENA_H
@@ -74,6 +74,10 @@ struct NodeRenderStatsPrivate
     //Premultiplication of the output imge
     Natron::ImagePremultiplicationEnum outputPremult;
     
+    //NaN and infinite values found in the rendered images
+    int nbNaNs;
+    int nbInfinities;
+    
     NodeRenderStatsPrivate()
     : totalTimeSpentRendering(0)
     , rod()
@@ -89,6 +93,8 @@ struct NodeRenderStatsPrivate
     , renderScaleSupportEnabled(false)
     , channelsEnabled()
     , outputPremult(Natron::eImagePremultiplicationOpaque)
+    , nbNaNs(0)
+    , nbInfinities(0)
     {
         for (int i = 0; i < 4; ++i) {
             channelsEnabled[i] = false;
@@ -132,6 +138,8 @@ NodeRenderStats::operator=(const NodeRenderStats& other)
         _imp->channelsEnabled[i] = other._imp->channelsEnabled[i];
     }
     _imp->outputPremult = other._imp->outputPremult;
+    _imp->nbNaNs = other._imp->nbNaNs;
+    _imp->nbInfinities = other._imp->nbInfinities;
 }
 
 void
@@ -295,6 +303,20 @@ NodeRenderStats::getOutputPremult() const
     return _imp->outputPremult;
 }
 
+void
+NodeRenderStats::addNonFiniteValues(int nbNaNs, int nbInfinities)
+{
+    _imp->nbNaNs += nbNaNs;
+    _imp->nbInfinities += nbInfinities;
+}
+
+void
+NodeRenderStats::getNonFiniteValues(int* nbNaNs, int* nbInfinities) const
+{
+    *nbNaNs = _imp->nbNaNs;
+    *nbInfinities = _imp->nbInfinities;
+}
+
 struct RenderStatsPrivate
 {
     mutable QMutex lock;
@@ -427,6 +449,18 @@ RenderStats::addRenderInfosForNode(const boost::shared_ptr<Natron::Node>& node,
     stats.addPlaneRendered(plane);
 }
 
+void
+RenderStats::addNonFiniteValuesForNode(const boost::shared_ptr<Natron::Node>& node,
+                                       int nbNaNs,
+                                       int nbInfinities)
+{
+    QMutexLocker k(&_imp->lock);
+    assert(_imp->doNodesProfiling);
+    
+    NodeRenderStats& stats = _imp->findOrCreateNodeStats(node);
+    stats.addNonFiniteValues(nbNaNs, nbInfinities);
+}
+
 std::map<boost::shared_ptr<Natron::Node>,NodeRenderStats >
 RenderStats::getStats(double *totalTimeSpent) const
 {
@@ -96,6 +96,9 @@ public:
     void setOutputPremult(Natron::ImagePremultiplicationEnum premult);
     Natron::ImagePremultiplicationEnum getOutputPremult() const;
     
+    void addNonFiniteValues(int nbNaNs, int nbInfinities);
+    void getNonFiniteValues(int* nbNaNs, int* nbInfinities) const;
+    
 private:
     
     boost::scoped_ptr<NodeRenderStatsPrivate> _imp;
@@ -139,6 +142,14 @@ public:
                         const RectI& rectangle,
                         double timeSpent);
     
+    /**
+     * @brief Records the NaN and infinite values found in the images rendered by the node when NaN handling is enabled.
+     * Since the NaNs are converted, the first node of the tree having some is the one that produced them.
+     **/
+    void addNonFiniteValuesForNode(const boost::shared_ptr<Natron::Node>& node,
+                                   int nbNaNs,
+                                   int nbInfinities);
+    
     std::map<boost::shared_ptr<Natron::Node>,NodeRenderStats > getStats(double *totalTimeSpent) const;
     
 private:
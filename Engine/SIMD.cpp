@@ -0,0 +1,1316 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "SIMD.h"
+
+#include <cstring> // memcpy
+
+#include "Engine/Half.h"
+#include "Engine/Lut.h"
+
+// The vector kernels are compiled for their own instruction set with a target attribute, so that the rest of
+// the binary still runs on any CPU.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#  if defined(_MSC_VER) && !defined(__clang__)
+#    define NATRON_SIMD_X86
+#    define NATRON_SIMD_TARGET(t)
+#  elif defined(__clang__) || ( defined(__GNUC__) && ( (__GNUC__ > 4) || ( (__GNUC__ == 4) && (__GNUC_MINOR__ >= 9) ) ) )
+#    define NATRON_SIMD_X86
+#    define NATRON_SIMD_TARGET(t) __attribute__( ( target(t) ) )
+#  endif
+#endif
+
+#ifdef NATRON_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#define NATRON_SIMD_SSE41 NATRON_SIMD_TARGET("sse4.1")
+#define NATRON_SIMD_AVX2 NATRON_SIMD_TARGET("avx2")
+// the half-float conversions are only used with AVX2, every CPU with AVX2 but a few early ones has F16C
+#define NATRON_SIMD_F16C NATRON_SIMD_TARGET("avx2,f16c")
+
+using namespace Natron;
+using namespace Natron::SIMD;
+
+namespace {
+
+InstructionSetEnum
+detectInstructionSet()
+{
+#ifdef NATRON_SIMD_X86
+#  if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    const int nIds = info[0];
+    if (nIds < 1) {
+        return eInstructionSetScalar;
+    }
+    __cpuid(info, 1);
+    const bool sse41 = (info[2] & (1 << 19)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    bool avx2 = false;
+    if ( (nIds >= 7) && osxsave && avx && ( (_xgetbv(0) & 6) == 6 ) ) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#  else
+    __builtin_cpu_init();
+    const bool sse41 = __builtin_cpu_supports("sse4.1");
+    const bool avx2 = __builtin_cpu_supports("avx2");
+#  endif
+    if (avx2 && sse41) {
+        return eInstructionSetAVX2;
+    } else if (sse41) {
+        return eInstructionSetSSE41;
+    }
+#endif // NATRON_SIMD_X86
+
+    return eInstructionSetScalar;
+}
+
+// F16C is not an instruction set level of its own: it is checked on top of AVX2
+bool
+detectF16C()
+{
+#ifdef NATRON_SIMD_X86
+#  if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 1) {
+        return false;
+    }
+    __cpuid(info, 1);
+
+    return (info[2] & (1 << 29)) != 0;
+#  else
+    unsigned int eax, ebx, ecx, edx;
+    if ( !__get_cpuid(1, &eax, &ebx, &ecx, &edx) ) {
+        return false;
+    }
+
+    return (ecx & (1 << 29)) != 0;
+#  endif
+#else
+
+    return false;
+#endif // NATRON_SIMD_X86
+}
+
+const InstructionSetEnum supportedInstructionSet = detectInstructionSet();
+const bool supportedF16C = detectF16C();
+InstructionSetEnum maxInstructionSet = eInstructionSetAVX2;
+
+inline unsigned short
+hipart(float f)
+{
+    unsigned int bits;
+
+    std::memcpy( &bits, &f, sizeof(bits) );
+
+    return (unsigned short)(bits >> 16);
+}
+
+///////////////////////////// Scalar
+
+void
+convertUint8ToFloat_scalar(const unsigned char* from,
+                           float* to,
+                           int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = Color::intToFloat<256>(from[i]);
+    }
+}
+
+void
+convertUint16ToFloat_scalar(const unsigned short* from,
+                            float* to,
+                            int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = Color::intToFloat<65536>(from[i]);
+    }
+}
+
+void
+convertFloatToUint8_scalar(const float* from,
+                           unsigned char* to,
+                           int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = (unsigned char)Color::floatToInt<256>(from[i]);
+    }
+}
+
+void
+convertFloatToUint16_scalar(const float* from,
+                            unsigned short* to,
+                            int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = (unsigned short)Color::floatToInt<65536>(from[i]);
+    }
+}
+
+void
+convertFloatToUint8xx_scalar(const float* from,
+                             unsigned short* to,
+                             int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = (unsigned short)Color::floatToInt<0xff01>(from[i]);
+    }
+}
+
+void
+convertUint8ToUint16_scalar(const unsigned char* from,
+                            unsigned short* to,
+                            int n)
+{
+    for (int i = 0; i < n; ++i) {
+        // 0x01 -> 0x0101, 0x02 -> 0x0202, ..., 0xff -> 0xffff
+        to[i] = (unsigned short)( (from[i] << 8) + from[i] );
+    }
+}
+
+void
+convertUint16ToUint8_scalar(const unsigned short* from,
+                            unsigned char* to,
+                            int n)
+{
+    for (int i = 0; i < n; ++i) {
+        // the following is from ImageMagick's quantum.h
+        to[i] = (unsigned char)( ( (from[i] + 128UL) - ( (from[i] + 128UL) >> 8 ) ) >> 8 );
+    }
+}
+
+void
+lookupUint8ToFloat_scalar(const float* table,
+                          const unsigned char* from,
+                          float* to,
+                          int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = table[from[i]];
+    }
+}
+
+void
+lookupHipartToUint16_scalar(const unsigned short* table,
+                            const float* from,
+                            unsigned short* to,
+                            int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = table[hipart(from[i])];
+    }
+}
+
+void
+premultRGBA_scalar(float* pixels,
+                   int n)
+{
+    for (int i = 0; i < n; ++i, pixels += 4) {
+        for (int c = 0; c < 3; ++c) {
+            pixels[c] = pixels[c] * pixels[3];
+        }
+    }
+}
+
+void
+unpremultRGBA_scalar(float* pixels,
+                     int n)
+{
+    for (int i = 0; i < n; ++i, pixels += 4) {
+        if (pixels[3] != 0) {
+            for (int c = 0; c < 3; ++c) {
+                pixels[c] = pixels[c] / pixels[3];
+            }
+        }
+    }
+}
+
+void
+maskMix_scalar(float* dst,
+               const float* src,
+               const float* alpha,
+               int n,
+               int nComps)
+{
+    for (int i = 0; i < n; ++i, dst += nComps) {
+        const float a = alpha[i];
+        if (src) {
+            for (int c = 0; c < nComps; ++c) {
+                dst[c] = dst[c] * a + (1.f - a) * src[c];
+            }
+            src += nComps;
+        } else {
+            for (int c = 0; c < nComps; ++c) {
+                dst[c] = dst[c] * a;
+            }
+        }
+    }
+}
+
+///The DOCHANNEL macro of ImageCopyChannels.cpp for a float channel of an original RGBA pixel (maxValue is 1)
+inline float
+copyChannel(float src,
+            float srcA,
+            float dstAorig,
+            bool doA,
+            bool premult,
+            bool originalPremult)
+{
+    if (originalPremult) {
+        if (srcA == 0) {
+            return src;
+        } else if (premult) {
+            return doA ? src : (src / srcA) * dstAorig;
+        } else {
+            return src / srcA;
+        }
+    } else if (premult) {
+        return src * (doA ? srcA : dstAorig);
+    }
+
+    return src;
+}
+
+void
+copyUnProcessedChannelsRGBA_scalar(float* dst,
+                                   const float* src,
+                                   int n,
+                                   const bool doChannel[4],
+                                   bool premult,
+                                   bool originalPremult)
+{
+    for (int i = 0; i < n; ++i, dst += 4, src += 4) {
+        const float srcA = src[3];
+        const float dstAorig = dst[3];
+        for (int c = 0; c < 3; ++c) {
+            if (doChannel[c]) {
+                dst[c] = copyChannel(src[c], srcA, dstAorig, doChannel[3], premult, originalPremult);
+            }
+        }
+        if (doChannel[3]) {
+            dst[3] = srcA;
+        }
+    }
+}
+
+void
+halveRows_scalar(const float* row0,
+                 const float* row1,
+                 float* dst,
+                 int n,
+                 int nComps)
+{
+    for (int i = 0; i < n; ++i, row0 += 2 * nComps, row1 += 2 * nComps, dst += nComps) {
+        for (int c = 0; c < nComps; ++c) {
+            dst[c] = (row0[c] + row0[c + nComps] + row1[c] + row1[c + nComps]) / 4;
+        }
+    }
+}
+
+void
+convertHalfToFloat_scalar(const unsigned short* from,
+                          float* to,
+                          int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = Half::halfToFloat(from[i]);
+    }
+}
+
+void
+convertFloatToHalf_scalar(const float* from,
+                          unsigned short* to,
+                          int n)
+{
+    for (int i = 0; i < n; ++i) {
+        to[i] = Half::floatToHalf(from[i]);
+    }
+}
+
+void
+replaceNaNs_scalar(float* values,
+                   int n,
+                   int* nbNaNs,
+                   int* nbInfinities)
+{
+    for (int i = 0; i < n; ++i) {
+        // the bits are tested, which does not depend on the floating point comparisons being IEEE compliant
+        unsigned int bits;
+        std::memcpy( &bits, &values[i], sizeof(bits) );
+        bits &= 0x7fffffff;
+        if (bits > 0x7f800000) {
+            values[i] = 1.f;
+            ++(*nbNaNs);
+        } else if (bits == 0x7f800000) {
+            ++(*nbInfinities);
+        }
+    }
+}
+
+#ifdef NATRON_SIMD_X86
+
+///////////////////////////// SSE4.1
+
+/*
+ * Color::floatToInt<numvals>() on 4 values. The scalar version returns (int)(value * (numvals - 1) + 0.5) where
+ * the addition is made in double precision: adding 0.5 in single precision would round some values up, so the
+ * rounding is made by comparing the fractional part, which is exact, to 0.5.
+ * NaN gives 0, like the scalar version once converted to the destination type.
+ */
+template <int numvals>
+NATRON_SIMD_SSE41 inline __m128i
+floatToInt_sse41(__m128 v)
+{
+    // _mm_max_ps returns its second operand if the first one is NaN
+    v = _mm_min_ps( _mm_max_ps( v, _mm_setzero_ps() ), _mm_set1_ps(1.f) );
+    const __m128 scaled = _mm_mul_ps( v, _mm_set1_ps( (float)(numvals - 1) ) );
+    const __m128i truncated = _mm_cvttps_epi32(scaled);
+    const __m128 fraction = _mm_sub_ps( scaled, _mm_cvtepi32_ps(truncated) );
+
+    // the comparison gives -1 where the value must be rounded up
+    return _mm_sub_epi32( truncated, _mm_castps_si128( _mm_cmpge_ps( fraction, _mm_set1_ps(0.5f) ) ) );
+}
+
+NATRON_SIMD_SSE41 void
+convertUint8ToFloat_sse41(const unsigned char* from,
+                          float* to,
+                          int n)
+{
+    const __m128 maxValue = _mm_set1_ps(255.f);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        int packed;
+        std::memcpy(&packed, from + i, 4);
+        const __m128 v = _mm_cvtepi32_ps( _mm_cvtepu8_epi32( _mm_cvtsi32_si128(packed) ) );
+        // a division, not a multiplication by the inverse, to give the same result as intToFloat()
+        _mm_storeu_ps( to + i, _mm_div_ps(v, maxValue) );
+    }
+    convertUint8ToFloat_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_SSE41 void
+convertUint16ToFloat_sse41(const unsigned short* from,
+                           float* to,
+                           int n)
+{
+    const __m128 maxValue = _mm_set1_ps(65535.f);
+    int i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        const __m128 v = _mm_cvtepi32_ps( _mm_cvtepu16_epi32( _mm_loadl_epi64( (const __m128i*)(from + i) ) ) );
+        _mm_storeu_ps( to + i, _mm_div_ps(v, maxValue) );
+    }
+    convertUint16ToFloat_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_SSE41 void
+convertFloatToUint8_sse41(const float* from,
+                          unsigned char* to,
+                          int n)
+{
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const __m128i lo = floatToInt_sse41<256>( _mm_loadu_ps(from + i) );
+        const __m128i hi = floatToInt_sse41<256>( _mm_loadu_ps(from + i + 4) );
+        const __m128i v = _mm_packus_epi16( _mm_packus_epi32(lo, hi), _mm_setzero_si128() );
+        _mm_storel_epi64( (__m128i*)(to + i), v );
+    }
+    convertFloatToUint8_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_SSE41 void
+convertFloatToUint16_sse41(const float* from,
+                           unsigned short* to,
+                           int n)
+{
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const __m128i lo = floatToInt_sse41<65536>( _mm_loadu_ps(from + i) );
+        const __m128i hi = floatToInt_sse41<65536>( _mm_loadu_ps(from + i + 4) );
+        _mm_storeu_si128( (__m128i*)(to + i), _mm_packus_epi32(lo, hi) );
+    }
+    convertFloatToUint16_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_SSE41 void
+convertFloatToUint8xx_sse41(const float* from,
+                            unsigned short* to,
+                            int n)
+{
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const __m128i lo = floatToInt_sse41<0xff01>( _mm_loadu_ps(from + i) );
+        const __m128i hi = floatToInt_sse41<0xff01>( _mm_loadu_ps(from + i + 4) );
+        _mm_storeu_si128( (__m128i*)(to + i), _mm_packus_epi32(lo, hi) );
+    }
+    convertFloatToUint8xx_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_SSE41 void
+convertUint8ToUint16_sse41(const unsigned char* from,
+                           unsigned short* to,
+                           int n)
+{
+    const __m128i factor = _mm_set1_epi16(257);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const __m128i v = _mm_cvtepu8_epi16( _mm_loadl_epi64( (const __m128i*)(from + i) ) );
+        // (v << 8) + v
+        _mm_storeu_si128( (__m128i*)(to + i), _mm_mullo_epi16(v, factor) );
+    }
+    convertUint8ToUint16_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_SSE41 inline __m128i
+uint16ToUint8_sse41(__m128i v)
+{
+    // computed on 32 bits because v + 128 may not fit in 16 bits
+    v = _mm_add_epi32( v, _mm_set1_epi32(128) );
+
+    return _mm_srli_epi32(_mm_sub_epi32( v, _mm_srli_epi32(v, 8) ), 8);
+}
+
+NATRON_SIMD_SSE41 void
+convertUint16ToUint8_sse41(const unsigned short* from,
+                           unsigned char* to,
+                           int n)
+{
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const __m128i v = _mm_loadu_si128( (const __m128i*)(from + i) );
+        const __m128i lo = uint16ToUint8_sse41( _mm_cvtepu16_epi32(v) );
+        const __m128i hi = uint16ToUint8_sse41( _mm_cvtepu16_epi32( _mm_srli_si128(v, 8) ) );
+        _mm_storel_epi64( (__m128i*)(to + i), _mm_packus_epi16( _mm_packus_epi32(lo, hi), _mm_setzero_si128() ) );
+    }
+    convertUint16ToUint8_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_SSE41 void
+lookupHipartToUint16_sse41(const unsigned short* table,
+                           const float* from,
+                           unsigned short* to,
+                           int n)
+{
+    int i = 0;
+
+    // SSE4.1 has no gather: only the indices are computed with vectors
+    for (; i + 4 <= n; i += 4) {
+        const __m128i index = _mm_srli_epi32(_mm_castps_si128( _mm_loadu_ps(from + i) ), 16);
+        to[i] = table[_mm_extract_epi32(index, 0)];
+        to[i + 1] = table[_mm_extract_epi32(index, 1)];
+        to[i + 2] = table[_mm_extract_epi32(index, 2)];
+        to[i + 3] = table[_mm_extract_epi32(index, 3)];
+    }
+    lookupHipartToUint16_scalar(table, from + i, to + i, n - i);
+}
+
+NATRON_SIMD_SSE41 void
+premultRGBA_sse41(float* pixels,
+                  int n)
+{
+    for (int i = 0; i < n; ++i, pixels += 4) {
+        const __m128 p = _mm_loadu_ps(pixels);
+        const __m128 a = _mm_shuffle_ps(p, p, 0xff);
+        // the alpha is kept as is
+        _mm_storeu_ps( pixels, _mm_blend_ps(_mm_mul_ps(p, a), p, 0x8) );
+    }
+}
+
+NATRON_SIMD_SSE41 void
+unpremultRGBA_sse41(float* pixels,
+                    int n)
+{
+    const __m128 zero = _mm_setzero_ps();
+
+    for (int i = 0; i < n; ++i, pixels += 4) {
+        const __m128 p = _mm_loadu_ps(pixels);
+        const __m128 a = _mm_shuffle_ps(p, p, 0xff);
+        const __m128 q = _mm_blendv_ps( _mm_div_ps(p, a), p, _mm_cmpeq_ps(a, zero) );
+        _mm_storeu_ps( pixels, _mm_blend_ps(q, p, 0x8) );
+    }
+}
+
+NATRON_SIMD_SSE41 void
+maskMix_sse41(float* dst,
+              const float* src,
+              const float* alpha,
+              int n,
+              int nComps)
+{
+    const __m128 one = _mm_set1_ps(1.f);
+    int i = 0;
+
+    if (nComps == 4) {
+        // one pixel per vector
+        for (; i < n; ++i) {
+            const __m128 a = _mm_set1_ps(alpha[i]);
+            __m128 v = _mm_mul_ps(_mm_loadu_ps(dst + 4 * i), a);
+            if (src) {
+                v = _mm_add_ps( v, _mm_mul_ps( _mm_sub_ps(one, a), _mm_loadu_ps(src + 4 * i) ) );
+            }
+            _mm_storeu_ps(dst + 4 * i, v);
+        }
+    } else if (nComps == 1) {
+        for (; i + 4 <= n; i += 4) {
+            const __m128 a = _mm_loadu_ps(alpha + i);
+            __m128 v = _mm_mul_ps(_mm_loadu_ps(dst + i), a);
+            if (src) {
+                v = _mm_add_ps( v, _mm_mul_ps( _mm_sub_ps(one, a), _mm_loadu_ps(src + i) ) );
+            }
+            _mm_storeu_ps(dst + i, v);
+        }
+    }
+    maskMix_scalar(dst + i * nComps, src ? src + i * nComps : 0, alpha + i, n - i, nComps);
+}
+
+NATRON_SIMD_SSE41 inline __m128
+copyChannels_sse41(__m128 s,
+                   __m128 d,
+                   __m128 channelMask,
+                   bool doA,
+                   bool premult,
+                   bool originalPremult)
+{
+    const __m128 srcA = _mm_shuffle_ps(s, s, 0xff);
+    const __m128 dstAorig = _mm_shuffle_ps(d, d, 0xff);
+    __m128 v = s;
+
+    // same as copyChannel()
+    if (originalPremult) {
+        if (!premult || !doA) {
+            v = _mm_div_ps(s, srcA);
+            if (premult) {
+                v = _mm_mul_ps(v, dstAorig);
+            }
+            v = _mm_blendv_ps( v, s, _mm_cmpeq_ps( srcA, _mm_setzero_ps() ) );
+        }
+    } else if (premult) {
+        v = _mm_mul_ps(s, doA ? srcA : dstAorig);
+    }
+    v = _mm_blendv_ps(d, v, channelMask);
+
+    return doA ? _mm_blend_ps(v, s, 0x8) : v;
+}
+
+NATRON_SIMD_SSE41 void
+copyUnProcessedChannelsRGBA_sse41(float* dst,
+                                  const float* src,
+                                  int n,
+                                  const bool doChannel[4],
+                                  bool premult,
+                                  bool originalPremult)
+{
+    // the alpha is handled separately: it is never premultiplied
+    const __m128 channelMask = _mm_castsi128_ps( _mm_setr_epi32(doChannel[0] ? -1 : 0, doChannel[1] ? -1 : 0, doChannel[2] ? -1 : 0, 0) );
+
+    for (int i = 0; i < n; ++i, dst += 4, src += 4) {
+        const __m128 v = copyChannels_sse41(_mm_loadu_ps(src), _mm_loadu_ps(dst), channelMask, doChannel[3], premult, originalPremult);
+        _mm_storeu_ps(dst, v);
+    }
+}
+
+// Multiplying by 0.25 gives exactly the same result as dividing by 4 since it is a power of two
+NATRON_SIMD_SSE41 void
+halveRows_sse41(const float* row0,
+                const float* row1,
+                float* dst,
+                int n,
+                int nComps)
+{
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    int i = 0;
+
+    if (nComps == 4) {
+        for (; i < n; ++i) {
+            const __m128 a = _mm_loadu_ps(row0 + 8 * i);
+            const __m128 b = _mm_loadu_ps(row0 + 8 * i + 4);
+            const __m128 c = _mm_loadu_ps(row1 + 8 * i);
+            const __m128 d = _mm_loadu_ps(row1 + 8 * i + 4);
+            _mm_storeu_ps( dst + 4 * i, _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(a, b), c), d), quarter) );
+        }
+    } else if (nComps == 1) {
+        for (; i + 4 <= n; i += 4) {
+            const __m128 r0lo = _mm_loadu_ps(row0 + 2 * i);
+            const __m128 r0hi = _mm_loadu_ps(row0 + 2 * i + 4);
+            const __m128 r1lo = _mm_loadu_ps(row1 + 2 * i);
+            const __m128 r1hi = _mm_loadu_ps(row1 + 2 * i + 4);
+            // even columns in a and c, odd columns in b and d
+            const __m128 a = _mm_shuffle_ps( r0lo, r0hi, _MM_SHUFFLE(2, 0, 2, 0) );
+            const __m128 b = _mm_shuffle_ps( r0lo, r0hi, _MM_SHUFFLE(3, 1, 3, 1) );
+            const __m128 c = _mm_shuffle_ps( r1lo, r1hi, _MM_SHUFFLE(2, 0, 2, 0) );
+            const __m128 d = _mm_shuffle_ps( r1lo, r1hi, _MM_SHUFFLE(3, 1, 3, 1) );
+            _mm_storeu_ps( dst + i, _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(a, b), c), d), quarter) );
+        }
+    }
+    halveRows_scalar(row0 + 2 * i * nComps, row1 + 2 * i * nComps, dst + i * nComps, n - i, nComps);
+}
+
+/*
+ * Non-finite values are rare: 16 values are tested at once, as integers since a float has all its exponent bits set
+ * if and only if its absolute value is above the largest finite float, and the scalar version handles the blocks
+ * that have a non-finite value.
+ */
+NATRON_SIMD_SSE41 void
+replaceNaNs_sse41(float* values,
+                  int n,
+                  int* nbNaNs,
+                  int* nbInfinities)
+{
+    const __m128i absMask = _mm_set1_epi32(0x7fffffff);
+    const __m128i maxFinite = _mm_set1_epi32(0x7f7fffff);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        const __m128i* p = (const __m128i*)(values + i);
+        const __m128i v0 = _mm_cmpgt_epi32(_mm_and_si128(_mm_loadu_si128(p), absMask), maxFinite);
+        const __m128i v1 = _mm_cmpgt_epi32(_mm_and_si128(_mm_loadu_si128(p + 1), absMask), maxFinite);
+        const __m128i v2 = _mm_cmpgt_epi32(_mm_and_si128(_mm_loadu_si128(p + 2), absMask), maxFinite);
+        const __m128i v3 = _mm_cmpgt_epi32(_mm_and_si128(_mm_loadu_si128(p + 3), absMask), maxFinite);
+        const __m128i nonFinite = _mm_or_si128( _mm_or_si128(v0, v1), _mm_or_si128(v2, v3) );
+        if ( !_mm_testz_si128(nonFinite, nonFinite) ) {
+            replaceNaNs_scalar(values + i, 16, nbNaNs, nbInfinities);
+        }
+    }
+    replaceNaNs_scalar(values + i, n - i, nbNaNs, nbInfinities);
+}
+
+///////////////////////////// AVX2
+
+/// @see floatToInt_sse41()
+template <int numvals>
+NATRON_SIMD_AVX2 inline __m256i
+floatToInt_avx2(__m256 v)
+{
+    v = _mm256_min_ps( _mm256_max_ps( v, _mm256_setzero_ps() ), _mm256_set1_ps(1.f) );
+    const __m256 scaled = _mm256_mul_ps( v, _mm256_set1_ps( (float)(numvals - 1) ) );
+    const __m256i truncated = _mm256_cvttps_epi32(scaled);
+    const __m256 fraction = _mm256_sub_ps( scaled, _mm256_cvtepi32_ps(truncated) );
+
+    return _mm256_sub_epi32( truncated, _mm256_castps_si256( _mm256_cmp_ps(fraction, _mm256_set1_ps(0.5f), _CMP_GE_OQ) ) );
+}
+
+/// Packs the 16 unsigned 32 bits values of lo and hi to 16 bits, in order.
+NATRON_SIMD_AVX2 inline __m256i
+packUint32ToUint16_avx2(__m256i lo,
+                        __m256i hi)
+{
+    // _mm256_packus_epi32 packs each 128 bits lane separately
+    return _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xd8);
+}
+
+NATRON_SIMD_AVX2 void
+convertUint8ToFloat_avx2(const unsigned char* from,
+                         float* to,
+                         int n)
+{
+    const __m256 maxValue = _mm256_set1_ps(255.f);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const __m256 v = _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*)(from + i) ) ) );
+        _mm256_storeu_ps( to + i, _mm256_div_ps(v, maxValue) );
+    }
+    convertUint8ToFloat_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_AVX2 void
+convertUint16ToFloat_avx2(const unsigned short* from,
+                          float* to,
+                          int n)
+{
+    const __m256 maxValue = _mm256_set1_ps(65535.f);
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const __m256 v = _mm256_cvtepi32_ps( _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i*)(from + i) ) ) );
+        _mm256_storeu_ps( to + i, _mm256_div_ps(v, maxValue) );
+    }
+    convertUint16ToFloat_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_AVX2 void
+convertFloatToUint8_avx2(const float* from,
+                         unsigned char* to,
+                         int n)
+{
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        const __m256i lo = floatToInt_avx2<256>( _mm256_loadu_ps(from + i) );
+        const __m256i hi = floatToInt_avx2<256>( _mm256_loadu_ps(from + i + 8) );
+        const __m256i v16 = packUint32ToUint16_avx2(lo, hi);
+        const __m128i v = _mm_packus_epi16( _mm256_castsi256_si128(v16), _mm256_extracti128_si256(v16, 1) );
+        _mm_storeu_si128( (__m128i*)(to + i), v );
+    }
+    convertFloatToUint8_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_AVX2 void
+convertFloatToUint16_avx2(const float* from,
+                          unsigned short* to,
+                          int n)
+{
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        const __m256i lo = floatToInt_avx2<65536>( _mm256_loadu_ps(from + i) );
+        const __m256i hi = floatToInt_avx2<65536>( _mm256_loadu_ps(from + i + 8) );
+        _mm256_storeu_si256( (__m256i*)(to + i), packUint32ToUint16_avx2(lo, hi) );
+    }
+    convertFloatToUint16_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_AVX2 void
+convertFloatToUint8xx_avx2(const float* from,
+                           unsigned short* to,
+                           int n)
+{
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        const __m256i lo = floatToInt_avx2<0xff01>( _mm256_loadu_ps(from + i) );
+        const __m256i hi = floatToInt_avx2<0xff01>( _mm256_loadu_ps(from + i + 8) );
+        _mm256_storeu_si256( (__m256i*)(to + i), packUint32ToUint16_avx2(lo, hi) );
+    }
+    convertFloatToUint8xx_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_AVX2 void
+convertUint8ToUint16_avx2(const unsigned char* from,
+                          unsigned short* to,
+                          int n)
+{
+    const __m256i factor = _mm256_set1_epi16(257);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        const __m256i v = _mm256_cvtepu8_epi16( _mm_loadu_si128( (const __m128i*)(from + i) ) );
+        _mm256_storeu_si256( (__m256i*)(to + i), _mm256_mullo_epi16(v, factor) );
+    }
+    convertUint8ToUint16_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_AVX2 inline __m256i
+uint16ToUint8_avx2(__m256i v)
+{
+    v = _mm256_add_epi32( v, _mm256_set1_epi32(128) );
+
+    return _mm256_srli_epi32(_mm256_sub_epi32( v, _mm256_srli_epi32(v, 8) ), 8);
+}
+
+NATRON_SIMD_AVX2 void
+convertUint16ToUint8_avx2(const unsigned short* from,
+                          unsigned char* to,
+                          int n)
+{
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        const __m256i lo = uint16ToUint8_avx2( _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i*)(from + i) ) ) );
+        const __m256i hi = uint16ToUint8_avx2( _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i*)(from + i + 8) ) ) );
+        const __m256i v16 = packUint32ToUint16_avx2(lo, hi);
+        const __m128i v = _mm_packus_epi16( _mm256_castsi256_si128(v16), _mm256_extracti128_si256(v16, 1) );
+        _mm_storeu_si128( (__m128i*)(to + i), v );
+    }
+    convertUint16ToUint8_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_AVX2 void
+lookupUint8ToFloat_avx2(const float* table,
+                        const unsigned char* from,
+                        float* to,
+                        int n)
+{
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        const __m256i index = _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*)(from + i) ) );
+        _mm256_storeu_ps( to + i, _mm256_i32gather_ps(table, index, 4) );
+    }
+    lookupUint8ToFloat_scalar(table, from + i, to + i, n - i);
+}
+
+NATRON_SIMD_AVX2 void
+lookupHipartToUint16_avx2(const unsigned short* table,
+                          const float* from,
+                          unsigned short* to,
+                          int n)
+{
+    const __m256i lowMask = _mm256_set1_epi32(0xffff);
+    int i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        const __m256i indexLo = _mm256_srli_epi32(_mm256_castps_si256( _mm256_loadu_ps(from + i) ), 16);
+        const __m256i indexHi = _mm256_srli_epi32(_mm256_castps_si256( _mm256_loadu_ps(from + i + 8) ), 16);
+        // each gather reads 32 bits, i.e. the entry and the next one, hence the padding entry at the end of the table
+        const __m256i lo = _mm256_and_si256( _mm256_i32gather_epi32( (const int*)table, indexLo, 2 ), lowMask );
+        const __m256i hi = _mm256_and_si256( _mm256_i32gather_epi32( (const int*)table, indexHi, 2 ), lowMask );
+        _mm256_storeu_si256( (__m256i*)(to + i), packUint32ToUint16_avx2(lo, hi) );
+    }
+    lookupHipartToUint16_scalar(table, from + i, to + i, n - i);
+}
+
+NATRON_SIMD_AVX2 void
+premultRGBA_avx2(float* pixels,
+                 int n)
+{
+    int i = 0;
+
+    // two pixels per vector
+    for (; i + 2 <= n; i += 2, pixels += 8) {
+        const __m256 p = _mm256_loadu_ps(pixels);
+        const __m256 a = _mm256_shuffle_ps(p, p, 0xff);
+        _mm256_storeu_ps( pixels, _mm256_blend_ps(_mm256_mul_ps(p, a), p, 0x88) );
+    }
+    premultRGBA_scalar(pixels, n - i);
+}
+
+NATRON_SIMD_AVX2 void
+unpremultRGBA_avx2(float* pixels,
+                   int n)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    int i = 0;
+
+    for (; i + 2 <= n; i += 2, pixels += 8) {
+        const __m256 p = _mm256_loadu_ps(pixels);
+        const __m256 a = _mm256_shuffle_ps(p, p, 0xff);
+        const __m256 q = _mm256_blendv_ps( _mm256_div_ps(p, a), p, _mm256_cmp_ps(a, zero, _CMP_EQ_OQ) );
+        _mm256_storeu_ps( pixels, _mm256_blend_ps(q, p, 0x88) );
+    }
+    unpremultRGBA_scalar(pixels, n - i);
+}
+
+NATRON_SIMD_AVX2 void
+maskMix_avx2(float* dst,
+             const float* src,
+             const float* alpha,
+             int n,
+             int nComps)
+{
+    const __m256 one = _mm256_set1_ps(1.f);
+    int i = 0;
+
+    if (nComps == 4) {
+        for (; i + 2 <= n; i += 2) {
+            const __m256 a = _mm256_setr_ps(alpha[i], alpha[i], alpha[i], alpha[i], alpha[i + 1], alpha[i + 1], alpha[i + 1], alpha[i + 1]);
+            __m256 v = _mm256_mul_ps(_mm256_loadu_ps(dst + 4 * i), a);
+            if (src) {
+                v = _mm256_add_ps( v, _mm256_mul_ps( _mm256_sub_ps(one, a), _mm256_loadu_ps(src + 4 * i) ) );
+            }
+            _mm256_storeu_ps(dst + 4 * i, v);
+        }
+    } else if (nComps == 1) {
+        for (; i + 8 <= n; i += 8) {
+            const __m256 a = _mm256_loadu_ps(alpha + i);
+            __m256 v = _mm256_mul_ps(_mm256_loadu_ps(dst + i), a);
+            if (src) {
+                v = _mm256_add_ps( v, _mm256_mul_ps( _mm256_sub_ps(one, a), _mm256_loadu_ps(src + i) ) );
+            }
+            _mm256_storeu_ps(dst + i, v);
+        }
+    }
+    maskMix_scalar(dst + i * nComps, src ? src + i * nComps : 0, alpha + i, n - i, nComps);
+}
+
+NATRON_SIMD_AVX2 void
+copyUnProcessedChannelsRGBA_avx2(float* dst,
+                                 const float* src,
+                                 int n,
+                                 const bool doChannel[4],
+                                 bool premult,
+                                 bool originalPremult)
+{
+    const int r = doChannel[0] ? -1 : 0;
+    const int g = doChannel[1] ? -1 : 0;
+    const int b = doChannel[2] ? -1 : 0;
+    const __m256 channelMask = _mm256_castsi256_ps( _mm256_setr_epi32(r, g, b, 0, r, g, b, 0) );
+    const bool doA = doChannel[3];
+    int i = 0;
+
+    // @see copyChannels_sse41(), on two pixels per vector
+    for (; i + 2 <= n; i += 2, dst += 8, src += 8) {
+        const __m256 s = _mm256_loadu_ps(src);
+        const __m256 d = _mm256_loadu_ps(dst);
+        const __m256 srcA = _mm256_shuffle_ps(s, s, 0xff);
+        const __m256 dstAorig = _mm256_shuffle_ps(d, d, 0xff);
+        __m256 v = s;
+        if (originalPremult) {
+            if (!premult || !doA) {
+                v = _mm256_div_ps(s, srcA);
+                if (premult) {
+                    v = _mm256_mul_ps(v, dstAorig);
+                }
+                v = _mm256_blendv_ps( v, s, _mm256_cmp_ps(srcA, _mm256_setzero_ps(), _CMP_EQ_OQ) );
+            }
+        } else if (premult) {
+            v = _mm256_mul_ps(s, doA ? srcA : dstAorig);
+        }
+        v = _mm256_blendv_ps(d, v, channelMask);
+        if (doA) {
+            v = _mm256_blend_ps(v, s, 0x88);
+        }
+        _mm256_storeu_ps(dst, v);
+    }
+    copyUnProcessedChannelsRGBA_scalar(dst, src, n - i, doChannel, premult, originalPremult);
+}
+
+NATRON_SIMD_AVX2 void
+halveRows_avx2(const float* row0,
+               const float* row1,
+               float* dst,
+               int n,
+               int nComps)
+{
+    const __m256 quarter = _mm256_set1_ps(0.25f);
+    int i = 0;
+
+    if (nComps == 4) {
+        // two output pixels per vector
+        for (; i + 2 <= n; i += 2) {
+            const __m256 r0lo = _mm256_loadu_ps(row0 + 8 * i);
+            const __m256 r0hi = _mm256_loadu_ps(row0 + 8 * i + 8);
+            const __m256 r1lo = _mm256_loadu_ps(row1 + 8 * i);
+            const __m256 r1hi = _mm256_loadu_ps(row1 + 8 * i + 8);
+            const __m256 a = _mm256_permute2f128_ps(r0lo, r0hi, 0x20);
+            const __m256 b = _mm256_permute2f128_ps(r0lo, r0hi, 0x31);
+            const __m256 c = _mm256_permute2f128_ps(r1lo, r1hi, 0x20);
+            const __m256 d = _mm256_permute2f128_ps(r1lo, r1hi, 0x31);
+            _mm256_storeu_ps( dst + 4 * i, _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(a, b), c), d), quarter) );
+        }
+    } else if (nComps == 1) {
+        for (; i + 8 <= n; i += 8) {
+            const __m256 r0lo = _mm256_loadu_ps(row0 + 2 * i);
+            const __m256 r0hi = _mm256_loadu_ps(row0 + 2 * i + 8);
+            const __m256 r1lo = _mm256_loadu_ps(row1 + 2 * i);
+            const __m256 r1hi = _mm256_loadu_ps(row1 + 2 * i + 8);
+            // the shuffles work within 128-bit lanes, the sum is put back in order at the end
+            const __m256 a = _mm256_shuffle_ps( r0lo, r0hi, _MM_SHUFFLE(2, 0, 2, 0) );
+            const __m256 b = _mm256_shuffle_ps( r0lo, r0hi, _MM_SHUFFLE(3, 1, 3, 1) );
+            const __m256 c = _mm256_shuffle_ps( r1lo, r1hi, _MM_SHUFFLE(2, 0, 2, 0) );
+            const __m256 d = _mm256_shuffle_ps( r1lo, r1hi, _MM_SHUFFLE(3, 1, 3, 1) );
+            const __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(a, b), c), d), quarter);
+            _mm256_storeu_ps( dst + i, _mm256_castpd_ps( _mm256_permute4x64_pd(_mm256_castps_pd(v), _MM_SHUFFLE(3, 1, 2, 0)) ) );
+        }
+    }
+    halveRows_scalar(row0 + 2 * i * nComps, row1 + 2 * i * nComps, dst + i * nComps, n - i, nComps);
+}
+
+NATRON_SIMD_AVX2 void
+replaceNaNs_avx2(float* values,
+                 int n,
+                 int* nbNaNs,
+                 int* nbInfinities)
+{
+    const __m256i absMask = _mm256_set1_epi32(0x7fffffff);
+    const __m256i maxFinite = _mm256_set1_epi32(0x7f7fffff);
+    int i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        const __m256i* p = (const __m256i*)(values + i);
+        const __m256i v0 = _mm256_cmpgt_epi32(_mm256_and_si256(_mm256_loadu_si256(p), absMask), maxFinite);
+        const __m256i v1 = _mm256_cmpgt_epi32(_mm256_and_si256(_mm256_loadu_si256(p + 1), absMask), maxFinite);
+        const __m256i v2 = _mm256_cmpgt_epi32(_mm256_and_si256(_mm256_loadu_si256(p + 2), absMask), maxFinite);
+        const __m256i v3 = _mm256_cmpgt_epi32(_mm256_and_si256(_mm256_loadu_si256(p + 3), absMask), maxFinite);
+        const __m256i nonFinite = _mm256_or_si256( _mm256_or_si256(v0, v1), _mm256_or_si256(v2, v3) );
+        if ( !_mm256_testz_si256(nonFinite, nonFinite) ) {
+            replaceNaNs_scalar(values + i, 32, nbNaNs, nbInfinities);
+        }
+    }
+    replaceNaNs_sse41(values + i, n - i, nbNaNs, nbInfinities);
+}
+
+///////////////////////////// F16C
+
+NATRON_SIMD_F16C void
+convertHalfToFloat_f16c(const unsigned short* from,
+                        float* to,
+                        int n)
+{
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps( to + i, _mm256_cvtph_ps( _mm_loadu_si128( (const __m128i*)(from + i) ) ) );
+    }
+    convertHalfToFloat_scalar(from + i, to + i, n - i);
+}
+
+NATRON_SIMD_F16C void
+convertFloatToHalf_f16c(const float* from,
+                        unsigned short* to,
+                        int n)
+{
+    int i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        // 0 is _MM_FROUND_TO_NEAREST_INT, which is not defined by every compiler
+        _mm_storeu_si128( (__m128i*)(to + i), _mm256_cvtps_ph(_mm256_loadu_ps(from + i), 0) );
+    }
+    convertFloatToHalf_scalar(from + i, to + i, n - i);
+}
+
+#endif // NATRON_SIMD_X86
+
+} // anon namespace
+
+// Calls the version of the kernel for the instruction set in use
+#ifdef NATRON_SIMD_X86
+#define NATRON_SIMD_DISPATCH(kernel, args) \
+    switch ( getInstructionSet() ) { \
+    case eInstructionSetAVX2: \
+        kernel ## _avx2 args; \
+        break; \
+    case eInstructionSetSSE41: \
+        kernel ## _sse41 args; \
+        break; \
+    case eInstructionSetScalar: \
+        kernel ## _scalar args; \
+        break; \
+    }
+#else
+#define NATRON_SIMD_DISPATCH(kernel, args) \
+    kernel ## _scalar args;
+#endif
+
+namespace Natron {
+namespace SIMD {
+
+InstructionSetEnum
+getInstructionSet()
+{
+    return supportedInstructionSet < maxInstructionSet ? supportedInstructionSet : maxInstructionSet;
+}
+
+InstructionSetEnum
+getSupportedInstructionSet()
+{
+    return supportedInstructionSet;
+}
+
+void
+setMaxInstructionSet(InstructionSetEnum set)
+{
+    maxInstructionSet = set;
+}
+
+const char*
+getInstructionSetName(InstructionSetEnum set)
+{
+    switch (set) {
+    case eInstructionSetScalar:
+        return "scalar";
+    case eInstructionSetSSE41:
+        return "SSE4.1";
+    case eInstructionSetAVX2:
+        return "AVX2";
+    }
+
+    return "";
+}
+
+void
+convertUint8ToFloat(const unsigned char* from,
+                    float* to,
+                    int n)
+{
+    NATRON_SIMD_DISPATCH( convertUint8ToFloat, (from, to, n) )
+}
+
+void
+convertUint16ToFloat(const unsigned short* from,
+                     float* to,
+                     int n)
+{
+    NATRON_SIMD_DISPATCH( convertUint16ToFloat, (from, to, n) )
+}
+
+void
+convertFloatToUint8(const float* from,
+                    unsigned char* to,
+                    int n)
+{
+    NATRON_SIMD_DISPATCH( convertFloatToUint8, (from, to, n) )
+}
+
+void
+convertFloatToUint16(const float* from,
+                     unsigned short* to,
+                     int n)
+{
+    NATRON_SIMD_DISPATCH( convertFloatToUint16, (from, to, n) )
+}
+
+void
+convertFloatToUint8xx(const float* from,
+                      unsigned short* to,
+                      int n)
+{
+    NATRON_SIMD_DISPATCH( convertFloatToUint8xx, (from, to, n) )
+}
+
+void
+convertUint8ToUint16(const unsigned char* from,
+                     unsigned short* to,
+                     int n)
+{
+    NATRON_SIMD_DISPATCH( convertUint8ToUint16, (from, to, n) )
+}
+
+void
+convertUint16ToUint8(const unsigned short* from,
+                     unsigned char* to,
+                     int n)
+{
+    NATRON_SIMD_DISPATCH( convertUint16ToUint8, (from, to, n) )
+}
+
+void
+convertHalfToFloat(const unsigned short* from,
+                   float* to,
+                   int n)
+{
+#ifdef NATRON_SIMD_X86
+    if ( supportedF16C && (getInstructionSet() == eInstructionSetAVX2) ) {
+        convertHalfToFloat_f16c(from, to, n);
+
+        return;
+    }
+#endif
+    convertHalfToFloat_scalar(from, to, n);
+}
+
+void
+convertFloatToHalf(const float* from,
+                   unsigned short* to,
+                   int n)
+{
+#ifdef NATRON_SIMD_X86
+    if ( supportedF16C && (getInstructionSet() == eInstructionSetAVX2) ) {
+        convertFloatToHalf_f16c(from, to, n);
+
+        return;
+    }
+#endif
+    convertFloatToHalf_scalar(from, to, n);
+}
+
+void
+lookupUint8ToFloat(const float* table,
+                   const unsigned char* from,
+                   float* to,
+                   int n)
+{
+#ifdef NATRON_SIMD_X86
+    // without gather there is nothing to vectorize
+    if (getInstructionSet() == eInstructionSetAVX2) {
+        lookupUint8ToFloat_avx2(table, from, to, n);
+
+        return;
+    }
+#endif
+    lookupUint8ToFloat_scalar(table, from, to, n);
+}
+
+void
+lookupHipartToUint16(const unsigned short* table,
+                     const float* from,
+                     unsigned short* to,
+                     int n)
+{
+    NATRON_SIMD_DISPATCH( lookupHipartToUint16, (table, from, to, n) )
+}
+
+void
+premultRGBA(float* pixels,
+            int n)
+{
+    NATRON_SIMD_DISPATCH( premultRGBA, (pixels, n) )
+}
+
+void
+unpremultRGBA(float* pixels,
+              int n)
+{
+    NATRON_SIMD_DISPATCH( unpremultRGBA, (pixels, n) )
+}
+
+void
+maskMix(float* dst,
+        const float* src,
+        const float* alpha,
+        int n,
+        int nComps)
+{
+    NATRON_SIMD_DISPATCH( maskMix, (dst, src, alpha, n, nComps) )
+}
+
+void
+copyUnProcessedChannelsRGBA(float* dst,
+                            const float* src,
+                            int n,
+                            const bool doChannel[4],
+                            bool premult,
+                            bool originalPremult)
+{
+    NATRON_SIMD_DISPATCH( copyUnProcessedChannelsRGBA, (dst, src, n, doChannel, premult, originalPremult) )
+}
+
+void
+halveRows(const float* row0,
+          const float* row1,
+          float* dst,
+          int n,
+          int nComps)
+{
+    NATRON_SIMD_DISPATCH( halveRows, (row0, row1, dst, n, nComps) )
+}
+
+void
+replaceNaNs(float* values,
+            int n,
+            int* nbNaNs,
+            int* nbInfinities)
+{
+    NATRON_SIMD_DISPATCH( replaceNaNs, (values, n, nbNaNs, nbInfinities) )
+}
+
+} // namespace SIMD
+} // namespace Natron
@@ -0,0 +1,145 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NATRON_ENGINE_SIMD_H
+#define NATRON_ENGINE_SIMD_H
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+
+/**
+ * @brief Row kernels used by the image processing functions, with SSE4.1 and AVX2 versions chosen at runtime
+ * depending on the CPU. The binary is still built for the baseline instruction set: the vector versions are
+ * compiled with a function-level target attribute, so they are only available on x86 with GCC >= 4.9, Clang or MSVC.
+ * Each kernel gives exactly the same result as its scalar version, which is the per-sample function named in its
+ * documentation.
+ **/
+
+namespace Natron {
+namespace SIMD {
+
+enum InstructionSetEnum
+{
+    eInstructionSetScalar = 0,
+    eInstructionSetSSE41,
+    eInstructionSetAVX2
+};
+
+/**
+ * @brief Returns the instruction set used by the kernels: the best one supported by both the CPU and the build,
+ * limited by setMaxInstructionSet().
+ **/
+InstructionSetEnum getInstructionSet();
+
+/**
+ * @brief Returns the best instruction set supported by both the CPU and the build.
+ **/
+InstructionSetEnum getSupportedInstructionSet();
+
+/**
+ * @brief Limits the instruction set used by the kernels, e.g: eInstructionSetScalar to run the scalar code.
+ * This is meant for the tests and benchmarks and is not MT-safe with respect to running kernels.
+ **/
+void setMaxInstructionSet(InstructionSetEnum set);
+
+const char* getInstructionSetName(InstructionSetEnum set);
+
+/// Color::intToFloat<256>() for n values
+void convertUint8ToFloat(const unsigned char* from, float* to, int n);
+
+/// Color::intToFloat<65536>() for n values
+void convertUint16ToFloat(const unsigned short* from, float* to, int n);
+
+/// Color::floatToInt<256>() for n values
+void convertFloatToUint8(const float* from, unsigned char* to, int n);
+
+/// Color::floatToInt<65536>() for n values
+void convertFloatToUint16(const float* from, unsigned short* to, int n);
+
+/// Color::floatToInt<0xff01>() for n values, the input of the error diffusion to bytes
+void convertFloatToUint8xx(const float* from, unsigned short* to, int n);
+
+/// convertPixelDepth<unsigned char, unsigned short>() for n values
+void convertUint8ToUint16(const unsigned char* from, unsigned short* to, int n);
+
+/// convertPixelDepth<unsigned short, unsigned char>() for n values
+void convertUint16ToUint8(const unsigned short* from, unsigned char* to, int n);
+
+/// Half::halfToFloat() for n values, with F16C when the instruction set in use is AVX2
+void convertHalfToFloat(const unsigned short* from, float* to, int n);
+
+/// Half::floatToHalf() for n values, with F16C when the instruction set in use is AVX2
+void convertFloatToHalf(const float* from, unsigned short* to, int n);
+
+/**
+ * @brief to[i] = table[from[i]], table has 256 entries.
+ **/
+void lookupUint8ToFloat(const float* table, const unsigned char* from, float* to, int n);
+
+/**
+ * @brief to[i] = table[hipart(from[i])] where hipart() returns the 16 most significant bits of a float.
+ * table must have 0x10001 entries: the last one is never used but lets the AVX2 version gather 32 bits at a time.
+ **/
+void lookupHipartToUint16(const unsigned short* table, const float* from, unsigned short* to, int n);
+
+/// Image::premultImage() on n float RGBA pixels
+void premultRGBA(float* pixels, int n);
+
+/// Image::unpremultImage() on n float RGBA pixels: the pixels with a 0 alpha are left untouched
+void unpremultRGBA(float* pixels, int n);
+
+/**
+ * @brief The mask mix of Image::applyMaskMix() on n float pixels of nComps components:
+ * dst = dst * alpha + (1 - alpha) * src, or dst = dst * alpha if src is NULL. alpha has one value per pixel.
+ * Only 1 and 4 components are vectorized.
+ **/
+void maskMix(float* dst, const float* src, const float* alpha, int n, int nComps);
+
+/**
+ * @brief The copy of Image::copyUnProcessedChannels() on n float RGBA pixels, all of them having an original pixel.
+ * doChannel tells which of the R, G, B and A channels are copied from src.
+ **/
+void copyUnProcessedChannelsRGBA(float* dst,
+                                 const float* src,
+                                 int n,
+                                 const bool doChannel[4],
+                                 bool premult,
+                                 bool originalPremult);
+
+/**
+ * @brief The box filter of Image::halveRoI() on n float pixels of nComps components that have all their 4 source pixels:
+ * dst[x] = (row0[2x] + row0[2x+1] + row1[2x] + row1[2x+1]) / 4. Only 1 and 4 components are vectorized.
+ **/
+void halveRows(const float* row0, const float* row1, float* dst, int n, int nComps);
+
+/**
+ * @brief The NaN handling of Image::checkForNaNs() on n float values: the NaNs are replaced by 1 and infinite values are
+ * left untouched. The number of NaN and infinite values found are added to nbNaNs and nbInfinities.
+ * The vector versions only test the values, which are written only where a non-finite value was found.
+ **/
+void replaceNaNs(float* values, int n, int* nbNaNs, int* nbInfinities);
+
+} // namespace SIMD
+} // namespace Natron
+
+#endif // NATRON_ENGINE_SIMD_H
@@ -232,6 +232,18 @@ Settings::initializeKnobsGeneral()
     _nThreadsPerEffect->disableSlider();
     _generalTab->addKnob(_nThreadsPerEffect);
 
+    _nThreadsPerImageOperation = Natron::createKnob<KnobInt>(this, "Max threads usable per image operation (0=\"guess\")");
+    _nThreadsPerImageOperation->setName("nThreadsPerImageOp");
+    _nThreadsPerImageOperation->setAnimationEnabled(false);
+    _nThreadsPerImageOperation->setHintToolTip("Controls how many threads at most are used by the internal operations on large images, "
+                                               "such as filling, copying or converting them to another bit depth. These operations only "
+                                               "use the threads of the global thread-pool that are idle. "
+                                               "1 processes the images in the render thread only. "
+                                               "By default (0) the operations may use as many threads as the hardware has cores.");
+    _nThreadsPerImageOperation->setMinimum(0);
+    _nThreadsPerImageOperation->disableSlider();
+    _generalTab->addKnob(_nThreadsPerImageOperation);
+
     _renderInSeparateProcess = Natron::createKnob<KnobBool>(this, "Render in a separate process");
     _renderInSeparateProcess->setName("renderNewProcess");
     _renderInSeparateProcess->setAnimationEnabled(false);
@@ -839,6 +851,16 @@ Settings::initializeKnobsViewers()
                                           "is unchecked.");
     _viewersTab->addKnob(_enableProgressReport);
     
+    _streamTiles = Natron::createKnob<KnobBool>(this, "Stream tiles through the node graph");
+    _streamTiles->setName("streamTiles");
+    _streamTiles->setAnimationEnabled(false);
+    _streamTiles->setHintToolTip("When checked, the viewer breaks large portions to render into tiles and renders each tile through "
+                                 "the whole graph before starting the next one, so that the images of the nodes in between are still "
+                                 "in the CPU cache when they are read. This is only done when all the nodes support tiles and "
+                                 "none of them needs a large area around a tile to render it (e.g: a large Blur), otherwise the "
+                                 "portion to render is rendered at once.");
+    _viewersTab->addKnob(_streamTiles);
+    
 }
 
 void
@@ -1066,6 +1088,30 @@ Settings::initializeKnobsCaching()
                                                                                                                            "output has its settings panel opened.");
     _cachingTab->addKnob(_aggressiveCaching);
     
+    _contentBasedNodeHash = Natron::createKnob<KnobBool>(this, "Content-based node hashes");
+    _contentBasedNodeHash->setName("contentBasedNodeHash");
+    _contentBasedNodeHash->setAnimationEnabled(false);
+    _contentBasedNodeHash->setHintToolTip("When checked, the cache key of a node is computed from the values, animation curves and "
+                                          "expressions of its parameters, its plug-in ID and version and the keys of its inputs, "
+                                          "instead of the number of edits made to the node.\n"
+                                          "This allows undoing a parameter change, re-opening a project or duplicating nodes "
+                                          "to re-use images already present in the cache (including the disk cache across sessions).\n"
+                                          "Nodes whose parameters have expressions and Roto/RotoPaint nodes still use the edit count.\n"
+                                          "The change takes effect for each node the next time one of its parameters changes or when "
+                                          "the project is re-opened.");
+    _cachingTab->addKnob(_contentBasedNodeHash);
+
+    _cacheAdmissionPolicy = Natron::createKnob<KnobBool>(this, "Don't cache cheap images");
+    _cacheAdmissionPolicy->setName("cacheAdmissionPolicy");
+    _cacheAdmissionPolicy->setAnimationEnabled(false);
+    _cacheAdmissionPolicy->setHintToolTip("When checked, the output of a node is not cached merely because it is the direct input "
+                                          "of a viewer, it never changes over time or the settings panel of its output is opened, "
+                                          "if rendering it and all the nodes upstream again is cheap (based on the time they took "
+                                          "to render so far). This leaves room in the cache for images that are expensive to render.\n"
+                                          "This has no effect on nodes which have their \"Force caching\" parameter checked or when "
+                                          "\"Aggressive caching\" is checked.");
+    _cachingTab->addKnob(_cacheAdmissionPolicy);
+    
     _maxRAMPercent = Natron::createKnob<KnobInt>(this, "Maximum amount of RAM memory used for caching (% of total RAM)");
     _maxRAMPercent->setName("maxRAMPercent");
     _maxRAMPercent->setAnimationEnabled(false);
@@ -1075,6 +1121,12 @@ Settings::initializeKnobsCaching()
                         "This system has ");
     ramHint.append( printAsRAM( getSystemTotalRAM() ).toStdString() );
     ramHint.append(" of RAM.");
+    U64 cgroupLimit = appPTR->getMemoryPressureState().cgroupLimit;
+    if (cgroupLimit > 0) {
+        ramHint.append("\nThe memory of " NATRON_APPLICATION_NAME " is limited to ");
+        ramHint.append( printAsRAM(cgroupLimit).toStdString() );
+        ramHint.append(" by its control group (e.g: a container), which is the total RAM used for caching.");
+    }
     if ( isApplication32Bits() && getSystemTotalRAM() > 4ULL * 1024ULL * 1024ULL * 1024ULL) {
         ramHint.append("\nThe version of " NATRON_APPLICATION_NAME " you are running is 32 bits, which means the available RAM "
                                                                    "is limited to 4GiB. The amount of RAM used for caching is 4GiB * MaxRamPercent.");
@@ -1108,6 +1160,38 @@ Settings::initializeKnobsCaching()
     _maxPlaybackLabel->setAnimationEnabled(false);
     _cachingTab->addKnob(_maxPlaybackLabel);
 
+    _compressedCachePercent = Natron::createKnob<KnobInt>(this, "Compressed RAM cache (% of the RAM used by each cache)");
+    _compressedCachePercent->setName("compressedCachePercent");
+    _compressedCachePercent->setAnimationEnabled(false);
+    _compressedCachePercent->setMinimum(0);
+    _compressedCachePercent->setMaximum(90);
+    _compressedCachePercent->setHintToolTip("Images and playback frames evicted from the RAM caches are kept compressed "
+                                            "(losslessly) in RAM, up to this percentage of the RAM of each cache, before "
+                                            "being written to the disk cache or deleted. Reading back a compressed image "
+                                            "is much faster than reading it from disk or rendering it again, and most images "
+                                            "compress to less than half of their size, so more frames stay in RAM for playback.\n"
+                                            "0 disables the compression of evicted images.");
+    _cachingTab->addKnob(_compressedCachePercent);
+
+    _cacheEvictionPolicy = Natron::createKnob<KnobChoice>(this, "Cache eviction policy");
+    _cacheEvictionPolicy->setName("cacheEvictionPolicy");
+    _cacheEvictionPolicy->setAnimationEnabled(false);
+    std::vector<std::string> evictionPolicies;
+    std::vector<std::string> helpStringsEvictionPolicies;
+    assert((int)evictionPolicies.size() == (int)Natron::eCacheEvictionPolicyLRU);
+    evictionPolicies.push_back("Least recently used");
+    helpStringsEvictionPolicies.push_back("The images that were not used for the longest time are removed first.");
+    assert((int)evictionPolicies.size() == (int)Natron::eCacheEvictionPolicyGDSF);
+    evictionPolicies.push_back("Render cost");
+    helpStringsEvictionPolicies.push_back("The images that are the fastest to render again, relative to the memory they use, "
+                                          "and that were used the least often are removed first. Images that took a long time to "
+                                          "render stay longer in the caches than images that are cheap to compute, such as "
+                                          "frames decoded by a Reader (GreedyDual-Size-Frequency policy).");
+    _cacheEvictionPolicy->populateChoices(evictionPolicies,helpStringsEvictionPolicies);
+    _cacheEvictionPolicy->setHintToolTip("Which images are removed first from the caches when they are full."
+                                         " Hover each option with the mouse for a detailed description.");
+    _cachingTab->addKnob(_cacheEvictionPolicy);
+
     _unreachableRAMPercent = Natron::createKnob<KnobInt>(this, "System RAM to keep free (% of total RAM)");
     _unreachableRAMPercent->setName("unreachableRAMPercent");
     _unreachableRAMPercent->setAnimationEnabled(false);
@@ -1131,6 +1215,25 @@ Settings::initializeKnobsCaching()
     _unreachableRAMLabel->setAnimationEnabled(false);
     _cachingTab->addKnob(_unreachableRAMLabel);
 
+    _memoryStateLabel = Natron::createKnob<KnobString>(this, "Memory state");
+    _memoryStateLabel->setName("memoryStateLabel");
+    _memoryStateLabel->setIsPersistant(false);
+    _memoryStateLabel->setAsLabel();
+    _memoryStateLabel->setAnimationEnabled(false);
+    _memoryStateLabel->setHintToolTip("The RAM " NATRON_APPLICATION_NAME " may use (the system RAM, or the memory limit of its "
+                                      "control group if it runs in a container), the RAM still available, the memory pressure "
+                                      "and the RAM the node and playback caches may currently use.\n"
+                                      "When the available RAM gets lower than the RAM to keep free, or when the system reports that "
+                                      "tasks are stalling on memory (Linux pressure stall information), the caches give back "
+                                      "memory in large batches. They grow back progressively once the pressure is gone.");
+    _memoryStateLabel->setAddNewLine(false);
+    _cachingTab->addKnob(_memoryStateLabel);
+
+    _refreshMemoryState = Natron::createKnob<KnobButton>(this, "Refresh");
+    _refreshMemoryState->setName("refreshMemoryState");
+    _refreshMemoryState->setHintToolTip("Updates the memory state.");
+    _cachingTab->addKnob(_refreshMemoryState);
+
     _maxViewerDiskCacheGB = Natron::createKnob<KnobInt>(this, "Maximum playback disk cache size (GiB)");
     _maxViewerDiskCacheGB->setName("maxViewerDiskCache");
     _maxViewerDiskCacheGB->setAnimationEnabled(false);
@@ -1325,13 +1428,46 @@ Settings::setCachingLabels()
 {
     int maxPlaybackPercent = _maxPlayBackPercent->getValue();
     int maxTotalRam = _maxRAMPercent->getValue();
-    U64 systemTotalRam = getSystemTotalRAM();
+    U64 systemTotalRam = appPTR->getMemoryPressureState().totalRAM;
     U64 maxRAM = (U64)( ( (double)maxTotalRam / 100. ) * systemTotalRam );
 
     _maxRAMLabel->setValue(printAsRAM(maxRAM).toStdString(), 0);
     _maxPlaybackLabel->setValue(printAsRAM( (U64)( maxRAM * ( (double)maxPlaybackPercent / 100. ) ) ).toStdString(), 0);
 
     _unreachableRAMLabel->setValue(printAsRAM( (double)systemTotalRam * ( (double)_unreachableRAMPercent->getValue() / 100. ) ).toStdString(), 0);
+
+    setMemoryStateLabel();
+}
+
+void
+Settings::setMemoryStateLabel()
+{
+    Natron::MemoryPressureState state = appPTR->getMemoryPressureState();
+    std::string label;
+
+    label.append( printAsRAM(state.totalRAM).toStdString() );
+    if (state.cgroupLimit > 0) {
+        label.append(" (cgroup limit)");
+    }
+    label.append(", available: ");
+    label.append( printAsRAM(state.availableRAM).toStdString() );
+    label.append(", pressure: ");
+    switch (state.level) {
+    case Natron::eMemoryPressureLevelNone:
+        label.append("none");
+        break;
+    case Natron::eMemoryPressureLevelModerate:
+        label.append("moderate");
+        break;
+    case Natron::eMemoryPressureLevelCritical:
+        label.append("critical");
+        break;
+    }
+    label.append(", node cache budget: ");
+    label.append( printAsRAM( appPTR->getNodeCacheMemoryBudget() ).toStdString() );
+    label.append(", playback cache budget: ");
+    label.append( printAsRAM( appPTR->getViewerCacheMemoryBudget() ).toStdString() );
+    _memoryStateLabel->setValue(label, 0);
 }
 
 void
@@ -1358,6 +1494,7 @@ Settings::setDefaultValues()
     _numberOfParallelRenders->setDefaultValue(0,0);
     _useThreadPool->setDefaultValue(true);
     _nThreadsPerEffect->setDefaultValue(0);
+    _nThreadsPerImageOperation->setDefaultValue(0);
     _renderInSeparateProcess->setDefaultValue(false,0);
     _autoPreviewEnabledForNewProjects->setDefaultValue(true,0);
     _firstReadSetProjectFormat->setDefaultValue(true);
@@ -1385,13 +1522,18 @@ Settings::setDefaultValues()
     _autoProxyWhenScrubbingTimeline->setDefaultValue(true);
     _autoProxyLevel->setDefaultValue(1);
     _enableProgressReport->setDefaultValue(false);
+    _streamTiles->setDefaultValue(true);
     
     _warnOcioConfigKnobChanged->setDefaultValue(true);
     _ocioStartupCheck->setDefaultValue(true);
 
     _aggressiveCaching->setDefaultValue(false);
+    _contentBasedNodeHash->setDefaultValue(false);
+    _cacheAdmissionPolicy->setDefaultValue(true);
     _maxRAMPercent->setDefaultValue(50,0);
     _maxPlayBackPercent->setDefaultValue(25,0);
+    _compressedCachePercent->setDefaultValue(25,0);
+    _cacheEvictionPolicy->setDefaultValue(0,0);
     _unreachableRAMPercent->setDefaultValue(5);
     _maxViewerDiskCacheGB->setDefaultValue(5,0);
     _maxDiskCacheNodeGB->setDefaultValue(10,0);
@@ -1864,6 +2006,7 @@ Settings::restoreSettings()
         appPTR->setNThreadsPerEffect(getNumberOfThreadsPerEffect());
         appPTR->setNThreadsToRender(getNumberOfThreads());
         appPTR->setUseThreadPool(_useThreadPool->getValue());
+        appPTR->setNThreadsPerImageOperation( getNumberOfThreadsPerImageOperation() );
     } catch (std::logic_error) {
         // ignore
     }
@@ -1976,8 +2119,18 @@ Settings::onKnobValueChanged(KnobI* k,
             appPTR->setPlaybackCacheMaximumSize( getRamPlaybackMaximumPercent() );
         }
         setCachingLabels();
+    } else if ( k == _compressedCachePercent.get() ) {
+        if (!_restoringSettings) {
+            appPTR->setApplicationsCachesCompressedPortion( getCompressedCachePercent() );
+        }
+    } else if ( k == _cacheEvictionPolicy.get() ) {
+        if (!_restoringSettings) {
+            appPTR->setApplicationsCachesEvictionPolicy( getCacheEvictionPolicy() );
+        }
     } else if ( k == _diskCachePath.get() ) {
         appPTR->setDiskCacheLocation(_diskCachePath->getValue().c_str());
+    } else if ( k == _refreshMemoryState.get() ) {
+        setMemoryStateLabel();
     } else if ( k == _wipeDiskCache.get() ) {
         appPTR->wipeAndCreateDiskCacheStructure();
     } else if ( k == _numberOfThreads.get() ) {
@@ -1993,6 +2146,8 @@ Settings::onKnobValueChanged(KnobI* k,
         }
     } else if ( k == _nThreadsPerEffect.get() ) {
         appPTR->setNThreadsPerEffect( getNumberOfThreadsPerEffect() );
+    } else if ( k == _nThreadsPerImageOperation.get() ) {
+        appPTR->setNThreadsPerImageOperation( getNumberOfThreadsPerImageOperation() );
     } else if ( k == _ocioConfigKnob.get() ) {
         if (_ocioConfigKnob->getActiveEntryText_mt_safe() == NATRON_CUSTOM_OCIO_CONFIG_NAME) {
             _customOcioConfigFile->setAllDimensionsEnabled(true);
@@ -2106,6 +2261,23 @@ Settings::getRamPlaybackMaximumPercent() const
     return (double)_maxPlayBackPercent->getValue() / 100.;
 }
 
+double
+Settings::getCompressedCachePercent() const
+{
+    return (double)_compressedCachePercent->getValue() / 100.;
+}
+
+Natron::CacheEvictionPolicyEnum
+Settings::getCacheEvictionPolicy() const
+{
+    int v = _cacheEvictionPolicy->getValue();
+    if (v == 1) {
+        return Natron::eCacheEvictionPolicyGDSF;
+    } else {
+        return Natron::eCacheEvictionPolicyLRU;
+    }
+}
+
 U64
 Settings::getMaximumViewerDiskCacheSize() const
 {
@@ -2136,6 +2308,12 @@ Settings::getNumberOfThreadsPerEffect() const
     return _nThreadsPerEffect->getValue();
 }
 
+int
+Settings::getNumberOfThreadsPerImageOperation() const
+{
+    return _nThreadsPerImageOperation->getValue();
+}
+
 int
 Settings::getNumberOfThreads() const
 {
@@ -3018,6 +3196,18 @@ Settings::isAggressiveCachingEnabled() const
     return _aggressiveCaching->getValue();
 }
 
+bool
+Settings::isContentBasedNodeHashEnabled() const
+{
+    return _contentBasedNodeHash->getValue();
+}
+
+bool
+Settings::isCacheAdmissionPolicyEnabled() const
+{
+    return _cacheAdmissionPolicy->getValue();
+}
+
 bool
 Settings::isAutoTurboEnabled() const
 {
@@ -3421,6 +3611,12 @@ Settings::isInViewerProgressReportEnabled() const
     return _enableProgressReport->getValue();
 }
 
+bool
+Settings::isViewerTileStreamingEnabled() const
+{
+    return _streamTiles->getValue();
+}
+
 bool
 Settings::isDefaultAppearanceOutdated() const
 {
@@ -98,6 +98,10 @@ public:
 
     double getRamPlaybackMaximumPercent() const;
 
+    double getCompressedCachePercent() const;
+
+    Natron::CacheEvictionPolicyEnum getCacheEvictionPolicy() const;
+
     U64 getMaximumViewerDiskCacheSize() const;
     
     U64 getMaximumDiskCacheNodeSize() const;
@@ -116,6 +120,8 @@ public:
     
     int getNumberOfThreadsPerEffect() const;
     
+    int getNumberOfThreadsPerImageOperation() const;
+    
     bool useGlobalThreadPool() const;
     
     void setUseGlobalThreadPool(bool use) ;
@@ -259,6 +265,10 @@ public:
     
     bool isAggressiveCachingEnabled() const;
     
+    bool isContentBasedNodeHashEnabled() const;
+
+    bool isCacheAdmissionPolicyEnabled() const;
+    
     bool isAutoTurboEnabled() const;
     
     void setAutoTurboModeEnabled(bool e);
@@ -334,6 +344,8 @@ public:
     
     bool isInViewerProgressReportEnabled() const;
     
+    bool isViewerTileStreamingEnabled() const;
+    
     bool isDefaultAppearanceOutdated() const;
     void restoreDefaultAppearance();
     
@@ -362,6 +374,7 @@ private:
     void warnChangedKnobs(const std::vector<KnobI*>& knobs);
     
     void setCachingLabels();
+    void setMemoryStateLabel();
     void setDefaultValues();
 
     bool tryLoadOpenColorIOConfig();
@@ -380,6 +393,7 @@ private:
     boost::shared_ptr<KnobInt> _numberOfParallelRenders;
     boost::shared_ptr<KnobBool> _useThreadPool;
     boost::shared_ptr<KnobInt> _nThreadsPerEffect;
+    boost::shared_ptr<KnobInt> _nThreadsPerImageOperation;
     boost::shared_ptr<KnobBool> _renderInSeparateProcess;
     boost::shared_ptr<KnobBool> _autoPreviewEnabledForNewProjects;
     boost::shared_ptr<KnobBool> _firstReadSetProjectFormat;
@@ -402,10 +416,18 @@ private:
     boost::shared_ptr<KnobPage> _cachingTab;
 
     boost::shared_ptr<KnobBool> _aggressiveCaching;
+    boost::shared_ptr<KnobBool> _contentBasedNodeHash;
+    boost::shared_ptr<KnobBool> _cacheAdmissionPolicy;
     ///The percentage of the value held by _maxRAMPercent to dedicate to playback cache (viewer cache's in-RAM portion) only
     boost::shared_ptr<KnobInt> _maxPlayBackPercent;
     boost::shared_ptr<KnobString> _maxPlaybackLabel;
 
+    ///The percentage of the in-RAM portion of the caches that may hold evicted entries compressed
+    boost::shared_ptr<KnobInt> _compressedCachePercent;
+
+    ///Which entries the caches evict first, @see Natron::CacheEvictionPolicyEnum
+    boost::shared_ptr<KnobChoice> _cacheEvictionPolicy;
+
     ///The percentage of the system total's RAM to dedicate to caching in theory. In practise this is limited
     ///by _unreachableRamPercent that determines how much RAM should be left free for other use on the computer
     boost::shared_ptr<KnobInt> _maxRAMPercent;
@@ -419,6 +441,8 @@ private:
     ///10% seems a reasonable value.
     boost::shared_ptr<KnobInt> _unreachableRAMPercent;
     boost::shared_ptr<KnobString> _unreachableRAMLabel;
+    boost::shared_ptr<KnobString> _memoryStateLabel;
+    boost::shared_ptr<KnobButton> _refreshMemoryState;
     
     ///The total disk space allowed for all Natron's caches
     boost::shared_ptr<KnobInt> _maxViewerDiskCacheGB;
@@ -436,6 +460,7 @@ private:
     boost::shared_ptr<KnobBool> _autoProxyWhenScrubbingTimeline;
     boost::shared_ptr<KnobChoice> _autoProxyLevel;
     boost::shared_ptr<KnobBool> _enableProgressReport;
+    boost::shared_ptr<KnobBool> _streamTiles;
     
     boost::shared_ptr<KnobPage> _nodegraphTab;
     boost::shared_ptr<KnobBool> _autoTurbo;
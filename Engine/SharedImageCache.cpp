@@ -0,0 +1,652 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "SharedImageCache.h"
+
+#ifdef __NATRON_UNIX__
+#include <fcntl.h>
+#include <sys/file.h>      // flock
+#include <sys/mman.h>      // shm_open, mmap
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>        // ftruncate, getuid, getpid
+#include <cerrno>
+#include <csignal>         // kill
+#endif
+#include <sstream>
+#include <cassert>
+#include <cstring>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDir>
+#include <QtCore/QMutex>
+#include <QtCore/QDebug>
+
+///"NISC"
+#define NATRON_SHARED_IMAGE_CACHE_MAGIC 0x4353494e
+///Bump this whenever the layout of the segment changes
+#define NATRON_SHARED_IMAGE_CACHE_LAYOUT_VERSION 2
+
+using namespace Natron;
+
+namespace {
+
+///All the structures below live in the segment and are shared by processes of possibly different builds:
+///they only use types of the same size on all supported platforms.
+
+///An image being copied into the segment without holding the lock
+struct SegmentWrite
+{
+    U64 position; //< where the image is copied, see SegmentHeader::dataHead
+    U32 slot; //< the index of the slot of the image
+    U32 pid; //< the process copying the image, 0 if this write is not used
+};
+
+struct SegmentHeader
+{
+    U32 magic;
+    U32 version;
+    U64 segmentSize;
+    U64 dataSize; //< size of the data area following the index
+    U64 dataHead; //< where the next image is copied: positions only grow, position p is at p % dataSize in the data area
+    U64 clock; //< incremented at each access, used to find the least recently used image
+    U32 busy; //< 1 while a process modifies the index, if still 1 when taking the lock the process holding it died
+    U32 padding;
+    SegmentWrite writes[NATRON_SHARED_IMAGE_CACHE_MAX_WRITES];
+};
+
+enum SegmentSlotStateEnum
+{
+    eSegmentSlotStateFree = 0,
+    eSegmentSlotStateWriting, //< the image is being copied into the segment
+    eSegmentSlotStateReady
+};
+
+struct SegmentSlot
+{
+    U64 hash;
+    U64 position; //< where the pixels are, see SegmentHeader::dataHead
+    U64 size;
+    U64 lastAccess;
+    U64 generation; //< incremented whenever the slot is freed or given to another image
+    double par;
+    double rod[4];
+    int bounds[4];
+    U32 state; //< a SegmentSlotStateEnum
+    U32 isRodProjectFormat;
+};
+
+std::size_t
+getDataAreaOffset()
+{
+    std::size_t indexEnd = sizeof(SegmentHeader) + NATRON_SHARED_IMAGE_CACHE_MAX_ENTRIES * sizeof(SegmentSlot);
+
+    // align the pixels on cache lines
+    return (indexEnd + 63) & ~(std::size_t)63;
+}
+
+} // anon namespace
+
+namespace Natron {
+
+struct SharedImageCachePrivate
+{
+    std::string name;
+    mutable QMutex lock; //< serializes the threads of this process, the lock file serializes the processes
+    int segmentHandle;
+    int lockFileHandle;
+    unsigned char* segment;
+    std::size_t segmentSize;
+
+    SharedImageCachePrivate(const std::string & name)
+    : name(name)
+    , lock()
+    , segmentHandle(-1)
+    , lockFileHandle(-1)
+    , segment(0)
+    , segmentSize(0)
+    {
+    }
+
+    SegmentHeader* header() const
+    {
+        return reinterpret_cast<SegmentHeader*>(segment);
+    }
+
+    SegmentSlot* slots() const
+    {
+        return reinterpret_cast<SegmentSlot*>(segment + sizeof(SegmentHeader));
+    }
+
+    unsigned char* data() const
+    {
+        return segment + getDataAreaOffset();
+    }
+
+    ///Takes the lock of all processes, lock must be held
+    void lockSegment() const;
+
+    void unlockSegment() const;
+
+    ///Erases the index and the writes, the lock must be held
+    void initialize(std::size_t segmentSize) const;
+
+    ///Frees all the slots of the index, the lock must be held
+    void resetIndex() const;
+
+    ///Returns the first of the NATRON_SHARED_IMAGE_CACHE_SLOTS_PER_HASH slots the image with the given hash may use
+    SegmentSlot* getSlotsForHash(U64 hash) const
+    {
+        const U64 nSets = NATRON_SHARED_IMAGE_CACHE_MAX_ENTRIES / NATRON_SHARED_IMAGE_CACHE_SLOTS_PER_HASH;
+
+        return slots() + ( ( hash ^ (hash >> 32) ) % nSets ) * NATRON_SHARED_IMAGE_CACHE_SLOTS_PER_HASH;
+    }
+
+    ///True if the pixels of the slot were not overwritten by the images copied after it, the lock must be held
+    bool isSlotDataIntact(const SegmentSlot & slot) const
+    {
+        return slot.position + header()->dataSize >= header()->dataHead;
+    }
+
+    ///Frees the slot, so that the copies of its image out of the segment in progress fail, the lock must be held
+    void freeSlot(SegmentSlot & slot) const
+    {
+        slot.state = eSegmentSlotStateFree;
+        ++slot.generation;
+    }
+
+    ///Returns the slot of the image with the given hash, ready or being written, or NULL. The lock must be held
+    SegmentSlot* findSlot(U64 hash) const;
+
+    ///Returns the slot the image with the given hash should replace, or NULL if all the slots it may use are being written.
+    ///The lock must be held
+    SegmentSlot* findSlotToReuse(U64 hash) const;
+
+    ///Forgets a write whose process died, the lock must be held
+    void dropWrite(SegmentWrite & write) const;
+};
+
+} // namespace Natron
+
+namespace {
+
+/**
+ * @brief Takes both the lock of the threads of this process and the lock of all processes.
+ **/
+class SegmentLocker
+{
+    const SharedImageCachePrivate* _imp;
+
+public:
+
+    SegmentLocker(const SharedImageCachePrivate* imp)
+    : _imp(imp)
+    {
+        _imp->lock.lock();
+        _imp->lockSegment();
+        SegmentHeader* header = _imp->header();
+        if (header->busy) {
+            // The process that held the lock died while modifying the index
+            _imp->resetIndex();
+        }
+    }
+
+    ~SegmentLocker()
+    {
+        _imp->unlockSegment();
+        _imp->lock.unlock();
+    }
+};
+
+} // anon namespace
+
+void
+SharedImageCachePrivate::lockSegment() const
+{
+#ifdef __NATRON_UNIX__
+    while (flock(lockFileHandle, LOCK_EX) == -1 && errno == EINTR) {
+    }
+#endif
+}
+
+void
+SharedImageCachePrivate::unlockSegment() const
+{
+#ifdef __NATRON_UNIX__
+    flock(lockFileHandle, LOCK_UN);
+#endif
+}
+
+void
+SharedImageCachePrivate::initialize(std::size_t segmentSize) const
+{
+    SegmentHeader* h = header();
+
+    std::memset( segment, 0, getDataAreaOffset() );
+    h->segmentSize = segmentSize;
+    h->dataSize = segmentSize - getDataAreaOffset();
+    h->version = NATRON_SHARED_IMAGE_CACHE_LAYOUT_VERSION;
+    h->magic = NATRON_SHARED_IMAGE_CACHE_MAGIC;
+}
+
+void
+SharedImageCachePrivate::resetIndex() const
+{
+    SegmentSlot* s = slots();
+
+    // The writes and the data head are kept: other processes may still be copying images into the segment, the
+    // data they write must not be given to other images, and their images are not published since their slot is freed
+    for (int i = 0; i < NATRON_SHARED_IMAGE_CACHE_MAX_ENTRIES; ++i) {
+        freeSlot(s[i]);
+    }
+    header()->busy = 0;
+}
+
+SegmentSlot*
+SharedImageCachePrivate::findSlot(U64 hash) const
+{
+    SegmentSlot* s = getSlotsForHash(hash);
+
+    for (int i = 0; i < NATRON_SHARED_IMAGE_CACHE_SLOTS_PER_HASH; ++i) {
+        if ( (s[i].state == eSegmentSlotStateFree) || (s[i].hash != hash) ) {
+            continue;
+        }
+        if ( (s[i].state == eSegmentSlotStateReady) && !isSlotDataIntact(s[i]) ) {
+            // Evicted by the images copied after it
+            freeSlot(s[i]);
+            continue;
+        }
+
+        return &s[i];
+    }
+
+    return 0;
+}
+
+SegmentSlot*
+SharedImageCachePrivate::findSlotToReuse(U64 hash) const
+{
+    SegmentSlot* s = getSlotsForHash(hash);
+    SegmentSlot* ret = 0;
+
+    for (int i = 0; i < NATRON_SHARED_IMAGE_CACHE_SLOTS_PER_HASH; ++i) {
+        if ( (s[i].state == eSegmentSlotStateFree) || ( (s[i].state == eSegmentSlotStateReady) && !isSlotDataIntact(s[i]) ) ) {
+            return &s[i];
+        }
+        if ( (s[i].state == eSegmentSlotStateReady) && ( !ret || (s[i].lastAccess < ret->lastAccess) ) ) {
+            ret = &s[i];
+        }
+    }
+
+    return ret;
+}
+
+void
+SharedImageCachePrivate::dropWrite(SegmentWrite & write) const
+{
+    SegmentSlot & slot = slots()[write.slot];
+
+    if ( (slot.state == eSegmentSlotStateWriting) && (slot.position == write.position) ) {
+        freeSlot(slot);
+    }
+    write.pid = 0;
+}
+
+static U32
+getProcessId()
+{
+#ifdef __NATRON_UNIX__
+    return (U32)getpid();
+#else
+    return 1;
+#endif
+}
+
+static bool
+isProcessAlive(U32 pid)
+{
+#ifdef __NATRON_UNIX__
+    return pid == getProcessId() || kill( (pid_t)pid, 0 ) == 0 || errno != ESRCH;
+#else
+    Q_UNUSED(pid);
+
+    return true;
+#endif
+}
+
+SharedImageCache::SharedImageCache(const std::string & name,
+                                   std::size_t size)
+    : _imp( new SharedImageCachePrivate(name) )
+{
+#ifdef __NATRON_UNIX__
+    std::string lockFilePath = QDir::tempPath().toStdString() + name + ".lock";
+    _imp->lockFileHandle = ::open(lockFilePath.c_str(), O_RDWR | O_CREAT, 0600);
+    if (_imp->lockFileHandle == -1) {
+        qDebug() << "Failed to open the lock file of the shared image cache" << lockFilePath.c_str();
+
+        return;
+    }
+    _imp->segmentHandle = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+    if (_imp->segmentHandle == -1) {
+        qDebug() << "Failed to open the shared image cache" << name.c_str();
+
+        return;
+    }
+
+    QMutexLocker k(&_imp->lock);
+    _imp->lockSegment();
+
+    // The first process to take the lock sizes the segment, the others use its size
+    struct stat st;
+    bool ok = fstat(_imp->segmentHandle, &st) == 0;
+    std::size_t segmentSize = ok ? (std::size_t)st.st_size : 0;
+    if ( ok && (segmentSize == 0) ) {
+        segmentSize = size;
+        ok = segmentSize > getDataAreaOffset() && ftruncate(_imp->segmentHandle, segmentSize) == 0;
+    }
+    ok = ok && segmentSize > getDataAreaOffset();
+    if (ok) {
+        void* segment = mmap(0, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, _imp->segmentHandle, 0);
+        if (segment != MAP_FAILED) {
+            _imp->segment = (unsigned char*)segment;
+            _imp->segmentSize = segmentSize;
+        }
+    }
+    if (_imp->segment) {
+        SegmentHeader* header = _imp->header();
+        if ( (header->magic != NATRON_SHARED_IMAGE_CACHE_MAGIC) || (header->version != NATRON_SHARED_IMAGE_CACHE_LAYOUT_VERSION) ||
+             (header->segmentSize != segmentSize) ) {
+            _imp->initialize(segmentSize);
+        }
+    } else {
+        qDebug() << "Failed to map the shared image cache" << name.c_str();
+    }
+
+    _imp->unlockSegment();
+#else
+    Q_UNUSED(size);
+#endif
+}
+
+SharedImageCache::~SharedImageCache()
+{
+#ifdef __NATRON_UNIX__
+    if (_imp->segment) {
+        munmap(_imp->segment, _imp->segmentSize);
+    }
+    if (_imp->segmentHandle != -1) {
+        ::close(_imp->segmentHandle);
+    }
+    if (_imp->lockFileHandle != -1) {
+        ::close(_imp->lockFileHandle);
+    }
+#endif
+    delete _imp;
+}
+
+SharedImageCache*
+SharedImageCache::createFromEnvironment()
+{
+    QByteArray sizeStr = qgetenv(NATRON_SHARED_IMAGE_CACHE_SIZE_ENV_VAR);
+
+    if ( sizeStr.isEmpty() ) {
+        return 0;
+    }
+    bool ok;
+    qulonglong sizeMB = sizeStr.toULongLong(&ok);
+    if ( !ok || (sizeMB == 0) ) {
+        return 0;
+    }
+    SharedImageCache* ret = new SharedImageCache(getDefaultSegmentName(), sizeMB * 1024 * 1024);
+    if ( !ret->isValid() ) {
+        delete ret;
+
+        return 0;
+    }
+
+    return ret;
+}
+
+std::string
+SharedImageCache::getDefaultSegmentName()
+{
+    std::stringstream ss;
+
+    // Keep it short: some systems limit the names of shared memory objects to 31 characters
+    ss << "/NatronImageCache" << NATRON_CACHE_VERSION;
+#ifdef __NATRON_UNIX__
+    ss << '-' << getuid();
+#endif
+
+    return ss.str();
+}
+
+void
+SharedImageCache::unlink(const std::string & name)
+{
+#ifdef __NATRON_UNIX__
+    shm_unlink( name.c_str() );
+#else
+    Q_UNUSED(name);
+#endif
+}
+
+bool
+SharedImageCache::isValid() const
+{
+    return _imp->segment != 0;
+}
+
+std::size_t
+SharedImageCache::getDataSize() const
+{
+    if ( !isValid() ) {
+        return 0;
+    }
+
+    return _imp->header()->dataSize;
+}
+
+std::size_t
+SharedImageCache::getEntriesCount() const
+{
+    if ( !isValid() ) {
+        return 0;
+    }
+    SegmentLocker k( _imp );
+    const SegmentSlot* slots = _imp->slots();
+    std::size_t ret = 0;
+    for (int i = 0; i < NATRON_SHARED_IMAGE_CACHE_MAX_ENTRIES; ++i) {
+        if ( (slots[i].state == eSegmentSlotStateReady) && _imp->isSlotDataIntact(slots[i]) ) {
+            ++ret;
+        }
+    }
+
+    return ret;
+}
+
+bool
+SharedImageCache::find(U64 hash,
+                       SharedImageCacheEntryInfo* info) const
+{
+    if ( !isValid() ) {
+        return false;
+    }
+    SegmentLocker k( _imp );
+    SegmentSlot* slot = _imp->findSlot(hash);
+    if ( !slot || (slot->state != eSegmentSlotStateReady) ) {
+        return false;
+    }
+    slot->lastAccess = ++_imp->header()->clock;
+    info->size = slot->size;
+    info->par = slot->par;
+    for (int i = 0; i < 4; ++i) {
+        info->rod[i] = slot->rod[i];
+        info->bounds[i] = slot->bounds[i];
+    }
+    info->isRodProjectFormat = slot->isRodProjectFormat != 0;
+
+    return true;
+}
+
+bool
+SharedImageCache::read(U64 hash,
+                       void* data,
+                       std::size_t size) const
+{
+    if ( !isValid() ) {
+        return false;
+    }
+    const U64 dataSize = _imp->header()->dataSize;
+    std::size_t index;
+    U64 generation, position;
+    {
+        SegmentLocker k( _imp );
+        SegmentSlot* slot = _imp->findSlot(hash);
+        if ( !slot || (slot->state != eSegmentSlotStateReady) || (slot->size != size) ) {
+            return false;
+        }
+        slot->lastAccess = ++_imp->header()->clock;
+        index = slot - _imp->slots();
+        generation = slot->generation;
+        position = slot->position;
+    }
+
+    // The image may be evicted and its pixels overwritten during the copy, in which case the copy is discarded
+    std::memcpy(data, _imp->data() + position % dataSize, size);
+
+    SegmentLocker k( _imp );
+    const SegmentSlot & slot = _imp->slots()[index];
+
+    return slot.generation == generation && slot.state == eSegmentSlotStateReady && _imp->isSlotDataIntact(slot);
+}
+
+bool
+SharedImageCache::insert(U64 hash,
+                         const void* data,
+                         const SharedImageCacheEntryInfo & info)
+{
+    if ( !isValid() || (info.size == 0) ) {
+        return false;
+    }
+    SegmentHeader* header = _imp->header();
+    const U64 dataSize = header->dataSize;
+    if (info.size > dataSize) {
+        return false;
+    }
+    const U32 pid = getProcessId();
+    std::size_t index, writeIndex;
+    U64 generation, position;
+    {
+        SegmentLocker k( _imp );
+        if ( _imp->findSlot(hash) ) {
+            // Another process rendered it too
+            return true;
+        }
+
+        header->busy = 1;
+
+        // The image is copied after the previous one, or at the start of the data area if it does not fit at its end
+        position = header->dataHead;
+        U64 offset = position % dataSize;
+        if (offset + info.size > dataSize) {
+            position += dataSize - offset;
+        }
+        const U64 end = position + info.size;
+
+        // The images being copied must not be overwritten, unless their process died
+        SegmentWrite* write = 0;
+        bool overwritesWrite = false;
+        for (int pass = 0; pass < 2 && !write; ++pass) {
+            for (int i = 0; i < NATRON_SHARED_IMAGE_CACHE_MAX_WRITES; ++i) {
+                SegmentWrite & w = header->writes[i];
+                if ( w.pid && ( (pass == 1) || (end > w.position + dataSize) ) && !isProcessAlive(w.pid) ) {
+                    _imp->dropWrite(w);
+                }
+                if (!w.pid) {
+                    if (!write) {
+                        write = &w;
+                    }
+                } else if (end > w.position + dataSize) {
+                    overwritesWrite = true;
+                }
+            }
+        }
+        SegmentSlot* slot = ( write && !overwritesWrite ) ? _imp->findSlotToReuse(hash) : 0;
+        if (!slot) {
+            header->busy = 0;
+
+            return false;
+        }
+
+        ++slot->generation;
+        slot->hash = hash;
+        slot->position = position;
+        slot->size = info.size;
+        slot->lastAccess = ++header->clock;
+        slot->par = info.par;
+        for (int i = 0; i < 4; ++i) {
+            slot->rod[i] = info.rod[i];
+            slot->bounds[i] = info.bounds[i];
+        }
+        slot->isRodProjectFormat = info.isRodProjectFormat ? 1 : 0;
+        slot->state = eSegmentSlotStateWriting;
+        index = slot - _imp->slots();
+        generation = slot->generation;
+
+        write->position = position;
+        write->slot = (U32)index;
+        write->pid = pid;
+        writeIndex = write - header->writes;
+
+        header->dataHead = end;
+        header->busy = 0;
+    }
+
+    std::memcpy(_imp->data() + position % dataSize, data, info.size);
+
+    SegmentLocker k( _imp );
+    SegmentWrite & write = header->writes[writeIndex];
+    if ( (write.pid == pid) && (write.slot == index) && (write.position == position) ) {
+        write.pid = 0;
+    }
+    // The slot is freed if the index was reset meanwhile
+    SegmentSlot & slot = _imp->slots()[index];
+    if ( (slot.generation == generation) && (slot.state == eSegmentSlotStateWriting) ) {
+        slot.state = eSegmentSlotStateReady;
+        slot.lastAccess = ++header->clock;
+    }
+
+    return true;
+}
+
+void
+SharedImageCache::clear()
+{
+    if ( !isValid() ) {
+        return;
+    }
+    SegmentLocker k( _imp );
+    _imp->resetIndex();
+}
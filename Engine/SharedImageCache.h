@@ -0,0 +1,164 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NATRON_ENGINE_SHAREDIMAGECACHE_H
+#define NATRON_ENGINE_SHAREDIMAGECACHE_H
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <cstddef>
+#include <string>
+
+#include "Global/GlobalDefines.h"
+#include "Global/Macros.h"
+
+///When this environment variable is set to a size in MiB, the processes of the same user share the images they render
+///through a shared memory segment of that size, @see SharedImageCache
+#define NATRON_SHARED_IMAGE_CACHE_SIZE_ENV_VAR "NATRON_SHARED_IMAGE_CACHE_SIZE"
+
+///Maximum number of images in the shared memory segment
+#define NATRON_SHARED_IMAGE_CACHE_MAX_ENTRIES 4096
+
+///An image may only be stored in this many slots of the index, chosen from its hash, so that it is found without
+///scanning the whole index. Must divide NATRON_SHARED_IMAGE_CACHE_MAX_ENTRIES.
+#define NATRON_SHARED_IMAGE_CACHE_SLOTS_PER_HASH 16
+
+///Maximum number of images being copied into the segment at the same time by all processes
+#define NATRON_SHARED_IMAGE_CACHE_MAX_WRITES 64
+
+namespace Natron {
+
+/**
+ * @brief What is stored along with the pixels of an image in the shared cache so that
+ * another process can re-create the image.
+ **/
+struct SharedImageCacheEntryInfo
+{
+    U64 size; //< the size in bytes of the pixels
+    double par;
+    double rod[4]; //< x1, y1, x2, y2
+    int bounds[4]; //< x1, y1, x2, y2
+    bool isRodProjectFormat;
+
+    SharedImageCacheEntryInfo()
+    : size(0)
+    , par(1.)
+    , isRodProjectFormat(false)
+    {
+        rod[0] = rod[1] = rod[2] = rod[3] = 0.;
+        bounds[0] = bounds[1] = bounds[2] = bounds[3] = 0;
+    }
+};
+
+struct SharedImageCachePrivate;
+
+/**
+ * @brief A cache of read-only images shared by all the processes of the same user through a named shared memory segment,
+ * so that several NatronRenderer instances rendering the same project render each image only once.
+ * The segment starts with an index of NATRON_SHARED_IMAGE_CACHE_MAX_ENTRIES entries followed by the data area, which is
+ * filled like a ring buffer: inserting an image evicts the images whose data it overwrites, and when the slots an image
+ * may use in the index are full the least recently used of them is evicted.
+ * The index is only accessed while holding a lock shared by all processes (a lock file plus a mutex for the threads of
+ * this process). The lock is released by the system if a process dies, in which case the next process taking it resets
+ * the index if the segment was being modified.
+ * The pixels are copied without holding the lock: an image is published once copied into the segment, and the data
+ * area it was copied into is not given to another image meanwhile, unless its process died. An image copied out of the
+ * segment is checked afterwards not to have been evicted during the copy.
+ *
+ * Only implemented on Unix systems, elsewhere isValid() always returns false.
+ * This class is MT-safe.
+ **/
+class SharedImageCache
+{
+public:
+
+    /**
+     * @brief Opens the segment with the given name, creating it with the given size if it does not exist yet.
+     * If it already exists its size is used instead.
+     **/
+    SharedImageCache(const std::string & name,
+                     std::size_t size);
+
+    ~SharedImageCache();
+
+    /**
+     * @brief Creates the shared cache from the environment of the process.
+     * @returns NULL if NATRON_SHARED_IMAGE_CACHE_SIZE_ENV_VAR is not set or the segment could not be opened.
+     **/
+    static SharedImageCache* createFromEnvironment();
+
+    /**
+     * @brief Returns the name of the segment used by createFromEnvironment() for the current user and cache version.
+     **/
+    static std::string getDefaultSegmentName();
+
+    /**
+     * @brief Removes the segment from the system. Processes that have it opened can still use it.
+     **/
+    static void unlink(const std::string & name);
+
+    bool isValid() const;
+
+    /**
+     * @brief Returns the size in bytes of the data area of the segment.
+     **/
+    std::size_t getDataSize() const;
+
+    /**
+     * @brief Returns the number of images currently in the segment.
+     **/
+    std::size_t getEntriesCount() const;
+
+    /**
+     * @brief Looks-up the image with the given hash.
+     * @returns True if it was found, in which case info holds what was stored with it.
+     **/
+    bool find(U64 hash, SharedImageCacheEntryInfo* info) const WARN_UNUSED_RETURN;
+
+    /**
+     * @brief Copies the pixels of the image with the given hash to data which must be of size bytes.
+     * @returns False if the image is no longer in the segment, if it was evicted while being copied, or if its size is
+     * not size.
+     **/
+    bool read(U64 hash, void* data, std::size_t size) const WARN_UNUSED_RETURN;
+
+    /**
+     * @brief Copies info.size bytes of data to the segment under the given hash, evicting older images.
+     * @returns False if the image is larger than the segment, or if it cannot be copied right now because the data it
+     * would overwrite or all the slots it may use are being written. If an image with the same hash is already
+     * in the segment or being copied into it, nothing is done and true is returned.
+     **/
+    bool insert(U64 hash, const void* data, const SharedImageCacheEntryInfo & info);
+
+    /**
+     * @brief Removes all images from the segment.
+     **/
+    void clear();
+
+private:
+
+    SharedImageCachePrivate* _imp;
+};
+
+} // namespace Natron
+
+#endif // NATRON_ENGINE_SHAREDIMAGECACHE_H
@@ -0,0 +1,588 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "TaskScheduler.h"
+
+#include <algorithm> // min, max
+#include <cassert>
+#include <deque>
+#include <new> // bad_alloc
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QDebug>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QWaitCondition>
+
+///The number of values of RenderPriorityEnum
+#define NATRON_RENDER_PRIORITIES_COUNT (Natron::eRenderPriorityInteractive + 1)
+
+///How long at most a thread waiting for a group gives way to the tasks of higher priority between two tasks of its group
+#define NATRON_TASK_PREEMPTION_MAX_WAIT_MS 100
+
+using namespace Natron;
+
+namespace {
+///The priority of what the thread is running, stored as priority + 1 so that 0 means none was set
+QThreadStorage<int> currentPriority;
+}
+
+namespace Natron {
+
+enum TaskFailureEnum
+{
+    eTaskFailureNone = 0,
+    eTaskFailureBadAlloc, //< a task threw a std::bad_alloc
+    eTaskFailureException, //< a task threw another std::exception
+    eTaskFailureUnknown //< a task threw something else
+};
+
+struct TaskGroupPrivate
+{
+    QMutex lock;
+
+    //The tasks that were not started yet
+    std::deque<boost::function<void ()> > pending;
+
+    //The number of tasks being run
+    int nRunning;
+
+    //Woken up when the last task is done
+    QWaitCondition done;
+
+    //The scheduler the tasks were submitted to
+    TaskSchedulerPrivate* scheduler;
+
+    RenderPriorityEnum priority;
+
+    //What the first task that threw an exception threw, reported by TaskGroup::wait()
+    TaskFailureEnum failure;
+    std::string failureMessage;
+
+    //True for the groups of TaskScheduler::start(), which nobody waits for
+    bool detached;
+
+    TaskGroupPrivate(TaskSchedulerPrivate* scheduler,
+                     RenderPriorityEnum priority)
+    : lock()
+    , pending()
+    , nRunning(0)
+    , done()
+    , scheduler(scheduler)
+    , priority(priority)
+    , failure(eTaskFailureNone)
+    , failureMessage()
+    , detached(false)
+    {
+    }
+
+    bool hasPendingTasks()
+    {
+        QMutexLocker k(&lock);
+
+        return !pending.empty();
+    }
+
+    /**
+     * @brief Runs the next task that was not started, returns false if there is none.
+     * An exception thrown by the task is recorded, @see TaskGroup::wait.
+     **/
+    bool runNextTask();
+
+    ///Must be called with lock held
+    void setFailure(TaskFailureEnum taskFailure,
+                    const std::string & message)
+    {
+        if (failure == eTaskFailureNone) {
+            failure = taskFailure;
+            failureMessage = message;
+        }
+    }
+};
+
+typedef boost::shared_ptr<TaskGroupPrivate> TaskGroupPrivatePtr;
+
+class TaskSchedulerThread
+    : public QThread
+{
+public:
+
+    TaskSchedulerThread(TaskSchedulerPrivate* scheduler,
+                        int index)
+    : QThread()
+    , _scheduler(scheduler)
+    , _index(index)
+    {
+        setObjectName("Task scheduler");
+    }
+
+    TaskSchedulerPrivate* getScheduler() const
+    {
+        return _scheduler;
+    }
+
+    int getIndex() const
+    {
+        return _index;
+    }
+
+private:
+
+    virtual void run() OVERRIDE FINAL;
+
+    TaskSchedulerPrivate* _scheduler;
+    int _index;
+};
+
+/**
+ * @brief The deque of a thread of the scheduler. Each entry stands for one task of a group: the tasks themselves stay in their
+ * group so that the thread waiting for the group can run them, in which case the entries left in the deques are skipped.
+ **/
+struct TaskDeque
+{
+    QMutex lock;
+    std::deque<TaskGroupPrivatePtr> entries[NATRON_RENDER_PRIORITIES_COUNT];
+};
+
+struct TaskSchedulerPrivate
+{
+    //Protects threads, nThreads and mustQuit, and is the mutex of the wait conditions
+    mutable QMutex lock;
+    QWaitCondition taskSubmitted;
+
+    //Woken up when all the tasks of a priority were started, for the threads giving way to them
+    QWaitCondition priorityStarted;
+
+    //The number of threads that may run tasks
+    int nThreads;
+    bool mustQuit;
+
+    //Only grows: the threads in excess of nThreads stay asleep
+    std::vector<TaskSchedulerThread*> threads;
+
+    //One deque per entry of threads, allocated up front so that they may be accessed without holding lock
+    std::vector<TaskDeque*> deques;
+
+    //The entries submitted by threads that are not threads of the scheduler
+    TaskDeque sharedQueue;
+
+    //The number of entries in all the deques
+    QAtomicInt nEntries;
+
+    //The number of threads running a task
+    QAtomicInt nBusy;
+
+    //The size of threads, for the threads looking for an entry to steal
+    QAtomicInt nStarted;
+
+    //The number of tasks submitted that were not started yet, per priority
+    QAtomicInt nPending[NATRON_RENDER_PRIORITIES_COUNT];
+
+    TaskSchedulerPrivate(int nThreads)
+    : lock()
+    , taskSubmitted()
+    , priorityStarted()
+    , nThreads(nThreads)
+    , mustQuit(false)
+    , threads()
+    , deques()
+    , sharedQueue()
+    , nEntries(0)
+    , nBusy(0)
+    , nStarted(0)
+    {
+    }
+
+    int getMaxThreadCount() const
+    {
+        return (int)deques.size();
+    }
+
+    void push(const TaskGroupPrivatePtr & group)
+    {
+        nPending[group->priority].fetchAndAddOrdered(1);
+
+        ///A thread of the scheduler pushes on its own deque, the others on the shared queue
+        TaskSchedulerThread* thread = dynamic_cast<TaskSchedulerThread*>( QThread::currentThread() );
+        TaskDeque* deque = (thread && thread->getScheduler() == this) ? deques[thread->getIndex()] : &sharedQueue;
+        {
+            QMutexLocker k(&deque->lock);
+            deque->entries[group->priority].push_back(group);
+        }
+        nEntries.fetchAndAddOrdered(1);
+
+        QMutexLocker k(&lock);
+        startThreadsIfNeeded();
+        if ( (int)threads.size() > nThreads ) {
+            ///A thread in excess of the thread count would go back to sleep without taking the task
+            taskSubmitted.wakeAll();
+        } else {
+            taskSubmitted.wakeOne();
+        }
+    }
+
+    TaskGroupPrivatePtr take(int index)
+    {
+        if ( nEntries.fetchAndAddOrdered(0) <= 0 ) {
+            return TaskGroupPrivatePtr();
+        }
+        TaskGroupPrivatePtr ret;
+        const int nDeques = nStarted.fetchAndAddOrdered(0);
+        for (int p = NATRON_RENDER_PRIORITIES_COUNT - 1; !ret && p >= 0; --p) {
+            ///Own deque first, newest entry first
+            {
+                TaskDeque* own = deques[index];
+                QMutexLocker k(&own->lock);
+                if ( !own->entries[p].empty() ) {
+                    ret = own->entries[p].back();
+                    own->entries[p].pop_back();
+                }
+            }
+            if (!ret) {
+                QMutexLocker k(&sharedQueue.lock);
+                if ( !sharedQueue.entries[p].empty() ) {
+                    ret = sharedQueue.entries[p].front();
+                    sharedQueue.entries[p].pop_front();
+                }
+            }
+            ///Steal the oldest entry of another thread
+            for (int i = 1; !ret && i < nDeques; ++i) {
+                TaskDeque* victim = deques[(index + i) % nDeques];
+                QMutexLocker k(&victim->lock);
+                if ( !victim->entries[p].empty() ) {
+                    ret = victim->entries[p].front();
+                    victim->entries[p].pop_front();
+                }
+            }
+        }
+        if (ret) {
+            nEntries.fetchAndAddOrdered(-1);
+        }
+
+        return ret;
+    }
+
+    bool hasPendingTasksAbove(RenderPriorityEnum priority)
+    {
+        for (int p = priority + 1; p < NATRON_RENDER_PRIORITIES_COUNT; ++p) {
+            if (nPending[p].fetchAndAddOrdered(0) > 0) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void onTaskStarted(RenderPriorityEnum priority)
+    {
+        if ( (nPending[priority].fetchAndAddOrdered(-1) == 1) && (priority > eRenderPriorityBackground) ) {
+            QMutexLocker k(&lock);
+            priorityStarted.wakeAll();
+        }
+    }
+
+    /**
+     * @brief Waits until all the tasks of a priority higher than the given one were started, for at most
+     * NATRON_TASK_PREEMPTION_MAX_WAIT_MS: the tasks of higher priority may be waiting for the calling thread.
+     **/
+    void giveWayToHigherPriorities(RenderPriorityEnum priority)
+    {
+        if ( !hasPendingTasksAbove(priority) ) {
+            return;
+        }
+        QMutexLocker k(&lock);
+        while ( hasPendingTasksAbove(priority) ) {
+            if ( !priorityStarted.wait(&lock, NATRON_TASK_PREEMPTION_MAX_WAIT_MS) ) {
+                break;
+            }
+        }
+    }
+
+    ///Must be called with lock held
+    void startThreadsIfNeeded()
+    {
+        if (mustQuit) {
+            return;
+        }
+        const int nToStart = std::min( nThreads, getMaxThreadCount() );
+        while ( (int)threads.size() < nToStart ) {
+            TaskSchedulerThread* thread = new TaskSchedulerThread( this, (int)threads.size() );
+            threads.push_back(thread);
+            nStarted.fetchAndAddOrdered(1);
+            thread->start();
+        }
+    }
+
+    void runThread(int index)
+    {
+        for (;;) {
+            {
+                QMutexLocker k(&lock);
+                for (;;) {
+                    if ( mustQuit && (nEntries.fetchAndAddOrdered(0) <= 0) ) {
+                        return;
+                    }
+                    ///Threads in excess of the thread count sleep, even if there are tasks
+                    if ( (index < nThreads) && (nEntries.fetchAndAddOrdered(0) > 0) ) {
+                        break;
+                    }
+                    taskSubmitted.wait(&lock);
+                }
+            }
+
+            TaskGroupPrivatePtr group = take(index);
+            if (group) {
+                nBusy.fetchAndAddOrdered(1);
+                group->runNextTask();
+                nBusy.fetchAndAddOrdered(-1);
+            }
+        }
+    }
+};
+
+void
+TaskSchedulerThread::run()
+{
+    _scheduler->runThread(_index);
+}
+
+bool
+TaskGroupPrivate::runNextTask()
+{
+    boost::function<void ()> task;
+    {
+        QMutexLocker k(&lock);
+        if ( pending.empty() ) {
+            return false;
+        }
+        task.swap( pending.front() );
+        pending.pop_front();
+        ++nRunning;
+    }
+    if (scheduler) {
+        scheduler->onTaskStarted(priority);
+    }
+
+    ///The groups created by the task have its priority
+    const RenderPriorityEnum callerPriority = TaskScheduler::getCurrentPriority();
+    TaskScheduler::setCurrentPriority(priority);
+    TaskFailureEnum taskFailure = eTaskFailureNone;
+    std::string message;
+    try {
+        task();
+    } catch (const std::bad_alloc & e) {
+        taskFailure = eTaskFailureBadAlloc;
+        message = e.what();
+    } catch (const std::exception & e) {
+        taskFailure = eTaskFailureException;
+        message = e.what();
+    } catch (...) {
+        taskFailure = eTaskFailureUnknown;
+        message = "Unknown exception";
+    }
+    TaskScheduler::setCurrentPriority(callerPriority);
+
+    if ( (taskFailure != eTaskFailureNone) && detached ) {
+        qDebug() << "Exception in a task of the TaskScheduler:" << message.c_str();
+    }
+
+    QMutexLocker k(&lock);
+    if (taskFailure != eTaskFailureNone) {
+        setFailure(taskFailure, message);
+    }
+    --nRunning;
+    if ( (nRunning == 0) && pending.empty() ) {
+        done.wakeAll();
+    }
+
+    return true;
+}
+} // namespace Natron
+
+TaskGroup::TaskGroup(TaskScheduler* scheduler)
+: _scheduler(scheduler)
+, _imp( new TaskGroupPrivate(scheduler ? scheduler->_imp.get() : 0, TaskScheduler::getCurrentPriority()) )
+{
+}
+
+TaskGroup::TaskGroup(TaskScheduler* scheduler,
+                     RenderPriorityEnum priority)
+: _scheduler(scheduler)
+, _imp( new TaskGroupPrivate(scheduler ? scheduler->_imp.get() : 0, priority) )
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    waitForTasks();
+}
+
+void
+TaskGroup::run(const boost::function<void ()> & task)
+{
+    if (!_scheduler) {
+        task();
+
+        return;
+    }
+    {
+        QMutexLocker k(&_imp->lock);
+        _imp->pending.push_back(task);
+    }
+    _scheduler->submit(_imp);
+}
+
+void
+TaskGroup::wait()
+{
+    waitForTasks();
+
+    TaskFailureEnum failure;
+    std::string message;
+    {
+        QMutexLocker k(&_imp->lock);
+        failure = _imp->failure;
+        message.swap(_imp->failureMessage);
+        ///Reported once
+        _imp->failure = eTaskFailureNone;
+    }
+    switch (failure) {
+    case eTaskFailureNone:
+        break;
+    case eTaskFailureBadAlloc:
+        throw std::bad_alloc();
+    case eTaskFailureException:
+    case eTaskFailureUnknown:
+        throw std::runtime_error(message);
+    }
+}
+
+void
+TaskGroup::waitForTasks()
+{
+    ///Run the tasks that no thread of the scheduler took yet, giving way to the tasks of higher priority between two of them
+    for (;;) {
+        if ( _scheduler && _imp->hasPendingTasks() ) {
+            _scheduler->_imp->giveWayToHigherPriorities(_imp->priority);
+        }
+        if ( !_imp->runNextTask() ) {
+            break;
+        }
+    }
+
+    QMutexLocker k(&_imp->lock);
+    while (_imp->nRunning > 0) {
+        _imp->done.wait(&_imp->lock);
+    }
+}
+
+TaskScheduler::TaskScheduler(int nThreads)
+: _imp( new TaskSchedulerPrivate( std::max(1, nThreads) ) )
+{
+    ///The deques of the threads that may be started later are allocated now so that they never move
+    const int maxThreads = std::max( _imp->nThreads, QThread::idealThreadCount() ) * 4;
+    _imp->deques.resize(maxThreads);
+    for (int i = 0; i < maxThreads; ++i) {
+        _imp->deques[i] = new TaskDeque;
+    }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        QMutexLocker k(&_imp->lock);
+        _imp->mustQuit = true;
+        ///The sleeping threads in excess of the thread count must run what is left
+        _imp->nThreads = std::max( _imp->nThreads, (int)_imp->threads.size() );
+        _imp->taskSubmitted.wakeAll();
+    }
+    for (std::size_t i = 0; i < _imp->threads.size(); ++i) {
+        _imp->threads[i]->wait();
+        delete _imp->threads[i];
+    }
+    for (std::size_t i = 0; i < _imp->deques.size(); ++i) {
+        delete _imp->deques[i];
+    }
+}
+
+void
+TaskScheduler::setThreadCount(int nThreads)
+{
+    QMutexLocker k(&_imp->lock);
+
+    _imp->nThreads = std::max( 1, std::min( nThreads, _imp->getMaxThreadCount() ) );
+    if ( !_imp->threads.empty() ) {
+        _imp->startThreadsIfNeeded();
+    }
+    _imp->taskSubmitted.wakeAll();
+}
+
+int
+TaskScheduler::getThreadCount() const
+{
+    QMutexLocker k(&_imp->lock);
+
+    return _imp->nThreads;
+}
+
+int
+TaskScheduler::getIdleThreadCount() const
+{
+    return std::max( 0, getThreadCount() - _imp->nBusy.fetchAndAddOrdered(0) );
+}
+
+void
+TaskScheduler::start(const boost::function<void ()> & task,
+                     RenderPriorityEnum priority)
+{
+    TaskGroupPrivatePtr group( new TaskGroupPrivate(_imp.get(), priority) );
+
+    group->detached = true;
+    group->pending.push_back(task);
+    submit(group);
+}
+
+RenderPriorityEnum
+TaskScheduler::getCurrentPriority()
+{
+    const int priority = currentPriority.localData();
+
+    return priority > 0 ? (RenderPriorityEnum)(priority - 1) : eRenderPriorityNormal;
+}
+
+void
+TaskScheduler::setCurrentPriority(RenderPriorityEnum priority)
+{
+    currentPriority.setLocalData(priority + 1);
+}
+
+void
+TaskScheduler::submit(const boost::shared_ptr<TaskGroupPrivate> & group)
+{
+    _imp->push(group);
+}
@@ -0,0 +1,180 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef NATRON_ENGINE_TASKSCHEDULER_H
+#define NATRON_ENGINE_TASKSCHEDULER_H
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include "Global/Macros.h"
+#include "Global/Enums.h"
+
+#if !defined(Q_MOC_RUN) && !defined(SBK_RUN)
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_OFF
+// /usr/local/include/boost/bind/arg.hpp:37:9: warning: unused typedef 'boost_static_assert_typedef_37' [-Wunused-local-typedef]
+#include <boost/bind.hpp>
+GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
+#endif
+
+namespace Natron {
+
+class TaskScheduler;
+struct TaskGroupPrivate;
+
+/**
+ * @brief A set of tasks run by the TaskScheduler that are waited for together, e.g: the tiles of a render.
+ * The tasks are added with run() and wait() returns once they are all done. A TaskGroup must be used by one thread only,
+ * the one that created it. The destructor waits for the tasks.
+ *
+ * The thread waiting for a group runs the tasks of the group that were not started yet, but never the tasks of other groups:
+ * the renders keep their state in thread-local storage, which an unrelated task run in the middle of a render would clobber.
+ * Waiting therefore never deadlocks, since the waiting thread can run all the tasks of its group by itself, and nested groups
+ * (frame, node, tile...) never start more threads than the scheduler has.
+ *
+ * The tasks of a group have the priority of the group. Between two of its tasks, a thread waiting for a group gives way to the
+ * tasks of higher priority that no thread started yet, for at most NATRON_TASK_PREEMPTION_MAX_WAIT_MS so that it never waits for
+ * a render that waits for it.
+ *
+ * An exception thrown by a task does not stop the other tasks of the group: it is rethrown by wait() once they are all done.
+ **/
+class TaskGroup
+{
+public:
+
+    /**
+     * @brief If scheduler is NULL, e.g: in a program without AppManager, the tasks are run by run() in the calling thread.
+     * The priority of the group is the one of the calling thread, see TaskScheduler::getCurrentPriority(), so that the
+     * nested groups of a render have the priority of the render.
+     **/
+    explicit TaskGroup(TaskScheduler* scheduler);
+
+    TaskGroup(TaskScheduler* scheduler,
+              Natron::RenderPriorityEnum priority);
+
+    ~TaskGroup();
+
+    void run(const boost::function<void ()> & task);
+
+    /**
+     * @brief Runs func as a task and stores its result in ret, which must stay valid until wait() returns.
+     **/
+    template <typename RET>
+    void run(const boost::function<RET ()> & func,
+             RET* ret)
+    {
+        run( boost::bind(&TaskGroup::storeResult<RET>, func, ret) );
+    }
+
+    /**
+     * @brief Waits for all the tasks run so far. If some of them threw an exception, throws the first one: a std::bad_alloc
+     * as is, any other exception as a std::runtime_error with the same message.
+     * The destructor waits for the tasks too but never throws: an exception not reported by wait() is lost.
+     **/
+    void wait();
+
+private:
+
+    void waitForTasks();
+
+    template <typename RET>
+    static void storeResult(const boost::function<RET ()> & func,
+                            RET* ret)
+    {
+        *ret = func();
+    }
+
+    TaskScheduler* _scheduler;
+    boost::shared_ptr<TaskGroupPrivate> _imp;
+};
+
+struct TaskSchedulerPrivate;
+
+/**
+ * @brief The threads running the tasks of the renders and image operations of the application, shared by all of them instead
+ * of each level of parallelism starting its own threads.
+ * Each thread has a deque of tasks: a thread running a task pushes the tasks it submits at the back of its own deque and takes
+ * its next task from the back, so that it finishes the innermost work first while it is hot in the cache. Idle threads steal
+ * from the front of the other deques, where the oldest and usually largest tasks are. Tasks submitted by other threads
+ * (the main thread, the render threads of the OutputSchedulerThread...) go to a shared queue.
+ * There is one such set of deques per priority: a thread that is done with a task always takes the next task of the highest
+ * priority, hence the interactive renders preempt the others at the next tile boundary and the others resume afterwards.
+ * The threads are started on the first task and never exit before the scheduler is destroyed, so that the thread-local
+ * storage of the renders is not lost. This class is MT-safe.
+ **/
+class TaskScheduler
+{
+    friend class TaskGroup;
+
+public:
+
+    /**
+     * @brief nThreads is the number of threads running the tasks, not counting the threads waiting for a TaskGroup.
+     **/
+    explicit TaskScheduler(int nThreads);
+
+    /**
+     * @brief Waits for all the tasks, including the ones started with start(), to be done.
+     **/
+    ~TaskScheduler();
+
+    /**
+     * @brief Changes the number of threads running the tasks. When it decreases, the threads in excess stop taking tasks once
+     * they finish their current one.
+     **/
+    void setThreadCount(int nThreads);
+
+    int getThreadCount() const;
+
+    /**
+     * @brief Returns the number of threads of the scheduler that are not running a task.
+     **/
+    int getIdleThreadCount() const;
+
+    /**
+     * @brief Runs task in one of the threads of the scheduler without waiting for it.
+     **/
+    void start(const boost::function<void ()> & task,
+               Natron::RenderPriorityEnum priority = Natron::eRenderPriorityNormal);
+
+    /**
+     * @brief Returns the priority of what the calling thread is running: the priority of its task for a thread running a task of
+     * a group, otherwise the priority last set with setCurrentPriority() or eRenderPriorityNormal.
+     **/
+    static Natron::RenderPriorityEnum getCurrentPriority();
+
+    /**
+     * @brief Sets the priority of the render the calling thread is running, e.g: by ParallelRenderArgsSetter.
+     **/
+    static void setCurrentPriority(Natron::RenderPriorityEnum priority);
+
+private:
+
+    void submit(const boost::shared_ptr<TaskGroupPrivate> & group);
+
+    boost::scoped_ptr<TaskSchedulerPrivate> _imp;
+};
+} // namespace Natron
+
+#endif // NATRON_ENGINE_TASKSCHEDULER_H
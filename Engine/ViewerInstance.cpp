@@ -36,12 +36,10 @@ GCC_DIAG_UNUSED_LOCAL_TYPEDEFS_ON
 
 CLANG_DIAG_OFF(deprecated)
 #include <QtCore/QtGlobal>
-#include <QtConcurrentMap> // QtCore on Qt4, QtConcurrent on Qt5
 #include <QtCore/QFutureWatcher>
 #include <QtCore/QMutex>
 #include <QtCore/QWaitCondition>
 #include <QtCore/QCoreApplication>
-#include <QtCore/QThreadPool>
 CLANG_DIAG_ON(deprecated)
 
 #include "Global/MemoryInfo.h"
@@ -64,6 +62,7 @@ CLANG_DIAG_ON(deprecated)
 #include "Engine/RotoPaint.h"
 #include "Engine/RotoStrokeItem.h"
 #include "Engine/Settings.h"
+#include "Engine/TaskScheduler.h"
 #include "Engine/TimeLine.h"
 #include "Engine/Timer.h"
 
@@ -74,6 +73,12 @@ CLANG_DIAG_ON(deprecated)
 
 #define NATRON_TIME_ELASPED_BEFORE_PROGRESS_REPORT 0.4
 
+///The size in pixels of the tiles pulled one after the other through the tree when the viewer streams tiles
+#define NATRON_STREAMING_TILE_SIZE 512
+
+///How much larger than a tile, on each side and in pixels, the region a node renders for the tile may be for the tiles to be streamed
+#define NATRON_STREAMING_TILE_MAX_MARGIN 128
+
 using namespace Natron;
 using std::make_pair;
 using boost::shared_ptr;
@@ -86,6 +91,7 @@ static void scaleToTexture8bits(const RectI& roi,
 static void scaleToTexture32bits(const RectI& roi,
                                  const RenderViewerArgs & args,
                                  float *output);
+static ImagePtr convertHalfImageToFloat(const ImagePtr& image, const RectI& roi);
 static std::pair<double, double>
 findAutoContrastVminVmax(boost::shared_ptr<const Natron::Image> inputImage,
                          Natron::DisplayChannelsEnum channels,
@@ -134,6 +140,27 @@ ViewerInstance::lutFromColorspace(Natron::ViewerColorSpaceEnum cs)
 }
 
 
+/**
+ * @brief The texture functions only read byte, short and float images: returns a float copy of the portion roi
+ * of a half image, or the image itself if it is not half.
+ **/
+static ImagePtr
+convertHalfImageToFloat(const ImagePtr& image,
+                        const RectI& roi)
+{
+    if ( !image || (image->getBitDepth() != Natron::eImageBitDepthHalf) ) {
+        return image;
+    }
+    RectI bounds;
+    if ( !roi.intersect(image->getBounds(), &bounds) ) {
+        return image;
+    }
+    ImagePtr ret( new Image(image->getComponents(), image->getRoD(), bounds, image->getMipMapLevel(), image->getPixelAspectRatio(), Natron::eImageBitDepthFloat, false) );
+    image->convertToFormat(bounds, Natron::eViewerColorSpaceLinear, Natron::eViewerColorSpaceLinear, -1, false, false, ret.get());
+
+    return ret;
+}
+
 class ViewerRenderingStarted_RAII
 {
     ViewerInstance* _node;
@@ -377,6 +404,7 @@ public:
                                    bool isRenderUserInteraction,
                                    bool isSequential,
                                    bool canAbort,
+                                   Natron::RenderPriorityEnum priority,
                                    U64 renderAge,
                                    const boost::shared_ptr<Natron::Node>& treeRoot,
                                    const FrameRequestMap* request,
@@ -388,7 +416,7 @@ public:
                                    bool draftMode,
                                    bool viewerProgressReportEnabled,
                                    const boost::shared_ptr<RenderStats>& stats)
-    : ParallelRenderArgsSetter(time,view,isRenderUserInteraction,isSequential,canAbort,renderAge,treeRoot, request,textureIndex,timeline,rotoPaintNode, isAnalysis, draftMode, viewerProgressReportEnabled,stats)
+    : ParallelRenderArgsSetter(time,view,isRenderUserInteraction,isSequential,canAbort,priority,renderAge,treeRoot, request,textureIndex,timeline,rotoPaintNode, isAnalysis, draftMode, viewerProgressReportEnabled,stats)
     , rotoNode(rotoPaintNode)
     , viewerNode(treeRoot)
     , viewerInputNode()
@@ -489,6 +517,7 @@ ViewerInstance::getViewerArgsAndRenderViewer(SequenceTime time,
                                            true,
                                            false,
                                            canAbort,
+                                           Natron::eRenderPriorityInteractive,
                                            renderAge,
                                            thisNode,
                                            0,
@@ -842,6 +871,7 @@ ViewerInstance::getRenderViewerArgsAndCheckCache(SequenceTime time,
                                                      !isSequential,  // is this render due to user interaction ?
                                                      isSequential, // is this sequential ?
                                                      canAbort,
+                                                     isSequential ? Natron::eRenderPriorityNormal : Natron::eRenderPriorityInteractive,
                                                      renderAge,
                                                      getNode(),
                                                      0, // request
@@ -1028,6 +1058,7 @@ ViewerInstance::getRenderViewerArgsAndCheckCache(SequenceTime time,
         }
         
         if (!isCached) {
+            getNode()->getCacheStats()->addMiss();
             if (stats  && stats->isInDepthProfilingEnabled()) {
                 stats->addCacheInfosForNode(getNode(), true, false);
             }
@@ -1061,6 +1092,7 @@ ViewerInstance::getRenderViewerArgsAndCheckCache(SequenceTime time,
             
             outArgs->params->ramBuffer = outArgs->params->cachedFrame->data();
             
+            getNode()->getCacheStats()->addHit();
             if (stats && stats->isInDepthProfilingEnabled()) {
                 stats->addCacheInfosForNode(getNode(), false, false);
             }
@@ -1143,14 +1175,14 @@ ViewerInstance::renderViewer_internal(int view,
     ///Make sure the parallel render args are set on the thread and die when rendering is finished
     boost::shared_ptr<ViewerParallelRenderArgsSetter> frameArgs;
     bool tilingProgressReportPrefEnabled = false;
+    FrameRequestMap frameRequest;
     if (useTLS) {
         tilingProgressReportPrefEnabled = appPTR->getCurrentSettings()->isInViewerProgressReportEnabled();
         
         RectD canonicalRoi;
         roi.toCanonical(inArgs.params->mipMapLevel, inArgs.activeInputToRender->getPreferredAspectRatio(), inArgs.params->rod, &canonicalRoi);
         
-        FrameRequestMap request;
-        Natron::StatusEnum stat = EffectInstance::computeRequestPass(inArgs.params->time, view, inArgs.params->mipMapLevel, canonicalRoi, getNode(), request);
+        Natron::StatusEnum stat = EffectInstance::computeRequestPass(inArgs.params->time, view, inArgs.params->mipMapLevel, canonicalRoi, getNode(), frameRequest);
         if (stat == eStatusFailed) {
             if (!isSequentialRender) {
                 _imp->removeOngoingRender(inArgs.params->textureIndex, inArgs.params->renderAge);
@@ -1163,9 +1195,10 @@ ViewerInstance::renderViewer_internal(int view,
                                                            !isSequentialRender,
                                                            isSequentialRender,
                                                            canAbort,
+                                                           isSequentialRender ? Natron::eRenderPriorityNormal : Natron::eRenderPriorityInteractive,
                                                            inArgs.params->renderAge,
                                                            getNode(),
-                                                           &request,
+                                                           &frameRequest,
                                                            inArgs.params->textureIndex,
                                                            getTimeline().get(),
                                                            false,
@@ -1338,6 +1371,8 @@ ViewerInstance::renderViewer_internal(int view,
     
     
     std::vector<RectI> splitRoi;
+    bool progressTiles = false;
+    const bool streamingPrefEnabled = useTLS && !rotoPaintNode && !inArgs.autoContrast && appPTR->getCurrentSettings()->isViewerTileStreamingEnabled();
     if (tilingProgressReportPrefEnabled &&
         inArgs.params->cachedFrame &&
         !isSequentialRender &&
@@ -1347,6 +1382,12 @@ ViewerInstance::renderViewer_internal(int view,
          Split the RoI in tiles and update viewer if rendering takes too much time.
          */
        splitRoi = roi.splitIntoSmallerRects(0);
+       progressTiles = splitRoi.size() > 1;
+    } else if ( streamingPrefEnabled && (roi.area() > 2 * NATRON_STREAMING_TILE_SIZE * NATRON_STREAMING_TILE_SIZE) ) {
+        /*
+         Split the RoI in tiles that are pulled one after the other through the tree, if it can stream them (see below)
+         */
+        splitRoi = roi.splitIntoSmallerRects( roi.area() / (NATRON_STREAMING_TILE_SIZE * NATRON_STREAMING_TILE_SIZE) );
     } else {
         /*
          Just render 1 tile
@@ -1354,6 +1395,27 @@ ViewerInstance::renderViewer_internal(int view,
         splitRoi.push_back(roi);
     }
     
+    /*
+     Each tile is pulled through the whole tree before the next one: the images of the nodes in between are still in the CPU cache
+     when they are read. This requires every node to render a tile of its output from a tile of its inputs that is not much larger,
+     which is checked on a tile in the middle of the RoI. Otherwise, the request pass of the whole RoI makes each node render its
+     whole RoI on the first tile.
+     */
+    bool streamTiles = false;
+    const double par = inArgs.activeInputToRender->getPreferredAspectRatio();
+    if (streamingPrefEnabled && splitRoi.size() > 1) {
+        FrameRequestMap tileRequest;
+        RectD canonicalTile;
+        splitRoi[splitRoi.size() / 2].toCanonical(inArgs.params->mipMapLevel, par, inArgs.params->rod, &canonicalTile);
+        if (EffectInstance::computeRequestPass(inArgs.params->time, view, inArgs.params->mipMapLevel, canonicalTile, getNode(), tileRequest) == eStatusOK) {
+            const double maxMargin = NATRON_STREAMING_TILE_MAX_MARGIN / Image::getScaleFromMipMapLevel(inArgs.params->mipMapLevel);
+            streamTiles = EffectInstance::canStreamTiles(tileRequest, getNode(), canonicalTile, maxMargin);
+        }
+    }
+    if (!streamTiles && !progressTiles && splitRoi.size() > 1) {
+        splitRoi.assign(1, roi);
+    }
+    
     if (stats && stats->isInDepthProfilingEnabled()) {
         std::bitset<4> channelsRendered;
         switch (inArgs.channels) {
@@ -1406,16 +1468,29 @@ ViewerInstance::renderViewer_internal(int view,
         try {
             
             ImageList planes;
-            EffectInstance::RenderRoIRetCode retCode =
-            inArgs.activeInputToRender->renderRoI(EffectInstance::RenderRoIArgs(inArgs.params->time,
-                                                                                inArgs.key->getScale(),
-                                                                                inArgs.params->mipMapLevel,
-                                                                                view,
-                                                                                inArgs.forceRender,
-                                                                                splitRoi[rectIndex],
-                                                                                inArgs.params->rod,
-                                                                                requestedComponents,
-                                                                                imageDepth, false, this),&planes);
+            EffectInstance::RenderRoIRetCode retCode = EffectInstance::eRenderRoIRetCodeFailed;
+            bool tileRequestOk = true;
+            if (streamTiles) {
+                ///The nodes fetch from their inputs only what this tile needs
+                FrameRequestMap tileRequest;
+                RectD canonicalTile;
+                splitRoi[rectIndex].toCanonical(inArgs.params->mipMapLevel, par, inArgs.params->rod, &canonicalTile);
+                tileRequestOk = EffectInstance::computeRequestPass(inArgs.params->time, view, inArgs.params->mipMapLevel, canonicalTile, getNode(), tileRequest) == eStatusOK;
+                if (tileRequestOk) {
+                    EffectInstance::setRequestPassForTile(tileRequest, frameRequest);
+                }
+            }
+            if (tileRequestOk) {
+                retCode = inArgs.activeInputToRender->renderRoI(EffectInstance::RenderRoIArgs(inArgs.params->time,
+                                                                                              inArgs.key->getScale(),
+                                                                                              inArgs.params->mipMapLevel,
+                                                                                              view,
+                                                                                              inArgs.forceRender,
+                                                                                              splitRoi[rectIndex],
+                                                                                              inArgs.params->rod,
+                                                                                              requestedComponents,
+                                                                                              imageDepth, false, this),&planes);
+            }
             //Either rendering failed or we have 2 planes (alpha mask and color image) or we have a single plane (color image)
             assert(planes.size() == 0 || planes.size() <= 2);
             if (!planes.empty() && retCode == EffectInstance::eRenderRoIRetCodeOk) {
@@ -1465,7 +1540,7 @@ ViewerInstance::renderViewer_internal(int view,
                 return eStatusReplyDefault;
             }
             
-            if (!reportProgress && splitRoi.size() > 1) {
+            if (!reportProgress && progressTiles) {
                 double timeSpan = timer.getTimeElapsedReset();
                 totalRenderTime += timeSpan;
                 reportProgress = totalRenderTime > NATRON_TIME_ELASPED_BEFORE_PROGRESS_REPORT && !isCurrentlyUpdatingOpenGLViewer();
@@ -1516,10 +1591,14 @@ ViewerInstance::renderViewer_internal(int view,
             viewerRenderTimeRecorder.reset(new TimeLapse());
         }
         
+        ///Half images are displayed from a float copy of the portion to render
+        ImagePtr viewerColorImage = convertHalfImageToFloat(colorImage, viewerRenderRoI);
+        ImagePtr viewerAlphaImage = alphaImage == colorImage ? viewerColorImage : convertHalfImageToFloat(alphaImage, viewerRenderRoI);
+        
         if (singleThreaded) {
             if (inArgs.autoContrast) {
                 double vmin, vmax;
-                std::pair<double,double> vMinMax = findAutoContrastVminVmax(colorImage, inArgs.channels, viewerRenderRoI);
+                std::pair<double,double> vMinMax = findAutoContrastVminVmax(viewerColorImage, inArgs.channels, viewerRenderRoI);
                 vmin = vMinMax.first;
                 vmax = vMinMax.second;
                 
@@ -1532,8 +1611,8 @@ ViewerInstance::renderViewer_internal(int view,
                 inArgs.params->offset = -vmin / ( vmax - vmin);
             }
             
-            const RenderViewerArgs args(colorImage,
-                                        alphaImage,
+            const RenderViewerArgs args(viewerColorImage,
+                                        viewerAlphaImage,
                                         inArgs.params->textureRect,
                                         inArgs.channels,
                                         inArgs.params->srcPremult,
@@ -1552,11 +1631,10 @@ ViewerInstance::renderViewer_internal(int view,
                           inArgs.params->ramBuffer);
         } else {
             
-            bool runInCurrentThread = QThreadPool::globalInstance()->activeThreadCount() >= QThreadPool::globalInstance()->maxThreadCount();
+            ///The small tiles of the progress report are processed by a single thread. Otherwise the pieces are run by
+            ///the TaskScheduler, this thread processing the ones that no other thread took.
+            bool runInCurrentThread = progressTiles;
             std::vector<RectI> splitRects;
-            if (!runInCurrentThread && splitRoi.size() > 1) {
-                runInCurrentThread = true;
-            }
             if (!runInCurrentThread) {
                 splitRects = viewerRenderRoI.splitIntoSmallerRects(appPTR->getHardwareIdealThreadCount());
             }
@@ -1569,24 +1647,29 @@ ViewerInstance::renderViewer_internal(int view,
                 
                 if (!runInCurrentThread) {
                     
-                    QFuture<std::pair<double,double> > future = QtConcurrent::mapped( splitRects,
-                                                                                     boost::bind(findAutoContrastVminVmax,
-                                                                                                 colorImage,
+                    std::vector<std::pair<double,double> > vMinMaxes( splitRects.size() );
+                    {
+                        TaskGroup group( appPTR->getTaskScheduler() );
+                        for (std::size_t i = 0; i < splitRects.size(); ++i) {
+                            group.run( boost::function<std::pair<double,double> ()>( boost::bind(findAutoContrastVminVmax,
+                                                                                                 viewerColorImage,
                                                                                                  inArgs.channels,
-                                                                                                 _1) );
-                    future.waitForFinished();
+                                                                                                 splitRects[i]) ),
+                                       &vMinMaxes[i] );
+                        }
+                        group.wait();
+                    }
                     
-                    std::pair<double,double> vMinMax;
-                    Q_FOREACH ( vMinMax, future.results() ) {
-                        if (vMinMax.first < vmin) {
-                            vmin = vMinMax.first;
+                    for (std::size_t i = 0; i < vMinMaxes.size(); ++i) {
+                        if (vMinMaxes[i].first < vmin) {
+                            vmin = vMinMaxes[i].first;
                         }
-                        if (vMinMax.second > vmax) {
-                            vmax = vMinMax.second;
+                        if (vMinMaxes[i].second > vmax) {
+                            vmax = vMinMaxes[i].second;
                         }
                     }
                 } else { //!runInCurrentThread
-                    std::pair<double,double> vMinMax = findAutoContrastVminVmax(colorImage, inArgs.channels, viewerRenderRoI);
+                    std::pair<double,double> vMinMax = findAutoContrastVminVmax(viewerColorImage, inArgs.channels, viewerRenderRoI);
                     vmin = vMinMax.first;
                     vmax = vMinMax.second;
                 }
@@ -1604,8 +1687,8 @@ ViewerInstance::renderViewer_internal(int view,
                 }
             }
             
-            const RenderViewerArgs args(colorImage,
-                                        alphaImage,
+            const RenderViewerArgs args(viewerColorImage,
+                                        viewerAlphaImage,
                                         inArgs.params->textureRect,
                                         inArgs.channels,
                                         inArgs.params->srcPremult,
@@ -1622,15 +1705,18 @@ ViewerInstance::renderViewer_internal(int view,
                               args, this, inArgs.params->ramBuffer);
             } else {
                 QReadLocker k(&_imp->gammaLookupMutex);
-                QtConcurrent::map( splitRects,
-                                  boost::bind(&renderFunctor,
-                                              _1,
-                                              args,
-                                              this,
-                                              inArgs.params->ramBuffer) ).waitForFinished();
+                TaskGroup group( appPTR->getTaskScheduler() );
+                for (std::size_t i = 0; i < splitRects.size(); ++i) {
+                    group.run( boost::bind(&renderFunctor,
+                                           splitRects[i],
+                                           boost::cref(args),
+                                           this,
+                                           inArgs.params->ramBuffer) );
+                }
+                group.wait();
             }
             
-            if (splitRoi.size() > 1 && rectIndex < (splitRoi.size() -1)) {
+            if (progressTiles && rectIndex < (splitRoi.size() -1)) {
                 unreportedTiles.push_back(viewerRenderRoI);
                 if (reportProgress) {
                     _imp->reportProgress(inArgs.params, unreportedTiles, stats, request);
@@ -1647,6 +1733,11 @@ ViewerInstance::renderViewer_internal(int view,
         }
     } // for (std::vector<RectI>::iterator rect = splitRoi.begin(); rect != splitRoi.end(), ++rect) {
     
+    if (inArgs.params->cachedFrame) {
+        ///Let the cache know how long it takes to render this texture again
+        inArgs.params->cachedFrame->addRenderTime( timer.getTimeSinceCreation() );
+    }
+
     if (!isSequentialRender) {
         
         bool couldRemove = _imp->removeOngoingRender(inArgs.params->textureIndex, inArgs.params->renderAge);
@@ -2240,7 +2331,7 @@ scaleToTexture8bits(const RectI& roi,
             scaleToTexture8bitsForDepth<unsigned short, 65535>(roi, args,viewer,output);
             break;
         case Natron::eImageBitDepthHalf:
-            assert(false);
+            ///half images are converted to float by convertHalfImageToFloat(), this is only reached for an empty roi
             break;
         case Natron::eImageBitDepthNone:
             break;
@@ -2573,7 +2664,7 @@ scaleToTexture32bits(const RectI& roi,
             scaleToTexture32bitsForPremult<unsigned short, 65535>(roi, args, output);
             break;
         case Natron::eImageBitDepthHalf:
-            assert(false);
+            ///half images are converted to float by convertHalfImageToFloat(), this is only reached for an empty roi
             break;
         case Natron::eImageBitDepthNone:
             break;
@@ -424,6 +424,26 @@ enum StorageModeEnum
     eStorageModeDisk //< will be allocated on virtual memory using mmap(). Fall-back on disk is assured by the operating system
 };
 
+enum CacheEvictionPolicyEnum
+{
+    eCacheEvictionPolicyLRU = 0, //< the least recently used entries are evicted first
+    eCacheEvictionPolicyGDSF //< GreedyDual-Size-Frequency: entries that are cheap to render again per byte and rarely used are evicted first
+};
+
+enum CacheAdmissionHintEnum
+{
+    eCacheAdmissionHintDefault = 0, //< the render cost measured for the node decides whether its output is cheap to render again
+    eCacheAdmissionHintCheap, //< the output of the node is always cheap to render again, e.g: a simple per-pixel operation
+    eCacheAdmissionHintExpensive //< the output of the node is never cheap to render again, e.g: it reads files
+};
+
+enum MemoryPressureLevelEnum
+{
+    eMemoryPressureLevelNone = 0, //< there is enough free memory, the caches may use their whole budget
+    eMemoryPressureLevelModerate, //< the free memory is getting low or tasks start stalling on memory, the caches should shrink
+    eMemoryPressureLevelCritical //< the process is about to run out of memory, the caches must shrink right away
+};
+
 enum OrientationEnum
 {
     eOrientationHorizontal = 0x1,
@@ -443,6 +463,13 @@ enum SchedulingPolicyEnum
     eSchedulingPolicyOrdered ///frames will be rendered in order
 };
     
+enum RenderPriorityEnum
+{
+    eRenderPriorityBackground = 0, //< the renders nobody waits for, e.g: the previews of the nodes
+    eRenderPriorityNormal, //< playback and the renders of the Write nodes
+    eRenderPriorityInteractive //< the renders of the viewer in response to a user interaction, which preempt the others
+};
+    
 enum DisplayChannelsEnum
 {
     eDisplayChannelsRGB = 0,
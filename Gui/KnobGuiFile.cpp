@@ -161,6 +161,7 @@ KnobGuiFile::onReloadClicked()
         if (effect) {
             effect->purgeCaches();
             effect->clearPersistentMessage(false);
+            effect->getNode()->onFileReloaded();
         }
         knob->evaluateValueChange(0, knob->getCurrentTime(), Natron::eValueChangedReasonNatronInternalEdited);
     }
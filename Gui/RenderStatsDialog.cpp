@@ -62,8 +62,10 @@ using namespace Natron;
 #define COL_NB_CACHE_HIT 13
 #define COL_NB_CACHE_HIT_DOWNSCALED 14
 #define COL_NB_CACHE_MISS 15
+#define COL_NB_NANS 16
+#define COL_NB_INFINITIES 17
 
-#define NUM_COLS 16
+#define NUM_COLS 18
 
 
 enum ItemsRoleEnum
@@ -104,6 +106,9 @@ struct StatRowsCompare
                 return lhs.item->data((int)eItemsRoleRenderedTilesNb).toInt() < rhs.item->data((int)eItemsRoleRenderedTilesNb).toInt();
             case COL_TIME:
                 return lhs.item->data((int)eItemsRoleTime).toDouble() < rhs.item->data((int)eItemsRoleTime).toDouble();
+            case COL_NB_NANS:
+            case COL_NB_INFINITIES:
+                return lhs.item->text().toInt() < rhs.item->text().toInt();
             default:
                 return lhs.item->text() < rhs.item->text();
         }
@@ -636,6 +641,71 @@ public:
                 view->setItem(row, COL_NB_CACHE_MISS, item);
             }
         }
+        {
+            TableItem* item = 0;
+            
+            int nb = 0;
+            if (exists) {
+                item = view->item(row, COL_NB_NANS);
+                if (item) {
+                    nb = item->text().toInt();
+                }
+            } else {
+                item = new TableItem;
+                QString tt = Natron::convertFromPlainText(QObject::tr("The number of NaN (Not-a-Number) values found in the images rendered "
+                                                                      "by the node. They are only looked for when the \"Convert NaN values\" "
+                                                                      "preference is checked, in which case they are converted to 1: the first "
+                                                                      "node of the tree having some is the one producing them."), Qt::WhiteSpaceNormal);
+                item->setToolTip(tt);
+                item->setFlags(Qt::ItemIsSelectable | Qt::ItemIsEnabled);
+            }
+            assert(item);
+            int nbNaNs,nbInfinities;
+            stats.getNonFiniteValues(&nbNaNs, &nbInfinities);
+            nb += nbNaNs;
+            
+            QString str = QString::number(nb);
+            if (nodeUi) {
+                item->setTextColor(Qt::black);
+                item->setBackgroundColor(c);
+            }
+            item->setText(str);
+            if (!exists) {
+                view->setItem(row, COL_NB_NANS, item);
+            }
+        }
+        {
+            TableItem* item = 0;
+            
+            int nb = 0;
+            if (exists) {
+                item = view->item(row, COL_NB_INFINITIES);
+                if (item) {
+                    nb = item->text().toInt();
+                }
+            } else {
+                item = new TableItem;
+                QString tt = Natron::convertFromPlainText(QObject::tr("The number of infinite values found in the images rendered "
+                                                                      "by the node. They are only looked for when the \"Convert NaN values\" "
+                                                                      "preference is checked and are left untouched."), Qt::WhiteSpaceNormal);
+                item->setToolTip(tt);
+                item->setFlags(Qt::ItemIsSelectable | Qt::ItemIsEnabled);
+            }
+            assert(item);
+            int nbNaNs,nbInfinities;
+            stats.getNonFiniteValues(&nbNaNs, &nbInfinities);
+            nb += nbInfinities;
+            
+            QString str = QString::number(nb);
+            if (nodeUi) {
+                item->setTextColor(Qt::black);
+                item->setBackgroundColor(c);
+            }
+            item->setText(str);
+            if (!exists) {
+                view->setItem(row, COL_NB_INFINITIES, item);
+            }
+        }
         if (!exists) {
             rows.push_back(node);
         }
@@ -897,7 +967,9 @@ RenderStatsDialog::RenderStatsDialog(Gui* gui)
     << tr("Rendered Planes")
     << tr("Cache Hits")
     << tr("Cache Hits Higher Scale")
-    << tr("Cache Misses");
+    << tr("Cache Misses")
+    << tr("NaNs")
+    << tr("Infinities");
     
     _imp->view->setColumnCount( dimensionNames.size() );
     _imp->view->setHorizontalHeaderLabels(dimensionNames);
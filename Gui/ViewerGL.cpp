@@ -4024,6 +4024,14 @@ ViewerGL::getColorAt(double x,
                                                                dstColorSpace,
                                                                r, g, b, a);
             break;
+        case eImageBitDepthHalf:
+            gotval = getColorAtInternal<Natron::Half, 1>(tiles,
+                                                         xPixel, yPixel,
+                                                         forceLinear,
+                                                         srcColorSpace,
+                                                         dstColorSpace,
+                                                         r, g, b, a);
+            break;
         case eImageBitDepthFloat:
             gotval = getColorAtInternal<float, 1>(tiles,
                                                   xPixel, yPixel,
@@ -4200,6 +4208,12 @@ ViewerGL::getColorAtRect(const RectD &rect, // rectangle in canonical coordinate
                                                                        &rPix, &gPix, &bPix, &aPix);
                     break;
                 case eImageBitDepthHalf:
+                    gotval = getColorAtInternal<Natron::Half, 1>(tiles,
+                                                                 xPixel, yPixel,
+                                                                 forceLinear,
+                                                                 srcColorSpace,
+                                                                 dstColorSpace,
+                                                                 &rPix, &gPix, &bPix, &aPix);
                     break;
                 case eImageBitDepthFloat:
                     gotval = getColorAtInternal<float, 1>(tiles,
@@ -35,6 +35,7 @@
 #include "Engine/Plugin.h"
 #include "Engine/Curve.h"
 #include "Engine/CLArgs.h"
+#include "Engine/Settings.h"
 using namespace Natron;
 
 static AppManager* g_manager = 0;
@@ -278,6 +279,48 @@ TEST_F(BaseTest,SetValues)
     
 }
 
+///Check that with content-based hashes, the hash only depends on the parameters of the node
+TEST_F(BaseTest,ContentBasedNodeHash)
+{
+    boost::shared_ptr<KnobI> settingKnob = appPTR->getCurrentSettings()->getKnobByName("contentBasedNodeHash");
+    KnobBool* contentBasedHash = dynamic_cast<KnobBool*>(settingKnob.get());
+    ASSERT_TRUE(contentBasedHash);
+    contentBasedHash->setValue(true, 0);
+    
+    boost::shared_ptr<Node> generator = createNode(_dotGeneratorPluginID);
+    boost::shared_ptr<Node> duplicate = createNode(_dotGeneratorPluginID);
+    ASSERT_TRUE(generator && duplicate);
+    
+    ///incrementKnobsAge() recomputes the hash
+    generator->incrementKnobsAge();
+    duplicate->incrementKnobsAge();
+    
+    ///2 nodes with the same parameters share the same hash
+    U64 originalHash = generator->getHashValue();
+    EXPECT_EQ( originalHash, duplicate->getHashValue() );
+    
+    KnobDouble* radius = dynamic_cast<KnobDouble*>(generator->getKnobByName("radius").get());
+    ASSERT_TRUE(radius);
+    double originalRadius = radius->getValue();
+    radius->setValue(originalRadius + 10., 0);
+    generator->incrementKnobsAge();
+    EXPECT_NE( originalHash, generator->getHashValue() );
+    
+    ///Going back to the previous value gives back the previous hash
+    radius->setValue(originalRadius, 0);
+    generator->incrementKnobsAge();
+    EXPECT_EQ( originalHash, generator->getHashValue() );
+    
+    ///Reloading the files of the node changes its hash even though its parameters did not change
+    generator->onFileReloaded();
+    EXPECT_NE( originalHash, generator->getHashValue() );
+    
+    contentBasedHash->setValue(false, 0);
+    generator->incrementKnobsAge();
+    duplicate->incrementKnobsAge();
+    EXPECT_NE( generator->getHashValue(), duplicate->getHashValue() );
+}
+
 ///High level test: simple node connections test
 TEST_F(BaseTest,SimpleNodeConnections) {
     ///create the generator
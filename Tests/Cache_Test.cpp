@@ -0,0 +1,991 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <QtCore/QDir>
+#include <QtCore/QThread>
+
+#include "BaseTest.h"
+
+#include "Engine/Cache.h"
+#include "Engine/CacheAccessTrace.h"
+#include "Engine/CacheCompression.h"
+#include "Engine/CacheSegmentStore.h"
+#include "Engine/Image.h"
+#include "Engine/MemoryPressure.h"
+#include "Engine/RenderArena.h"
+#include "Engine/SharedImageCache.h"
+#include "Engine/Timer.h"
+
+using namespace Natron;
+
+#define CACHE_BENCH_KEYS_PER_THREAD 2000
+#define CACHE_BENCH_DISTINCT_KEYS 512
+
+///When set to the path of a trace recorded with NATRON_CACHE_TRACE_DIR_ENV_VAR, the trace is also replayed by the TraceReplay test
+#define CACHE_REPLAY_TRACE_ENV_VAR "NATRON_CACHE_REPLAY_TRACE"
+
+namespace {
+
+/**
+ * @brief Hammers getOrCreate() with a set of keys shared by all threads so that we get a mix of
+ * cache hits and freshly created entries, like render threads fetching tiles of the same nodes.
+ **/
+class GetOrCreateThread
+    : public QThread
+{
+    const Cache<Image>* _cache;
+    int _seed;
+
+public:
+
+    int nHits;
+
+    GetOrCreateThread(const Cache<Image>* cache,
+                      int seed)
+        : QThread()
+        , _cache(cache)
+        , _seed(seed)
+        , nHits(0)
+    {
+    }
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        RectI bounds(0, 0, 16, 16);
+        RectD rod(0, 0, 16, 16);
+        std::map<int, std::map<int, std::vector<RangeD> > > framesNeeded;
+
+        for (int i = 0; i < CACHE_BENCH_KEYS_PER_THREAD; ++i) {
+            U64 nodeHash = (U64)( (i * 7919 + _seed) % CACHE_BENCH_DISTINCT_KEYS ) + 1;
+            ImageKey key(0, nodeHash, false, 0, 0, 1., false, false);
+            boost::shared_ptr<ImageParams> params = Image::makeParams(0, rod, bounds, 1., 0, false,
+                                                                      ImageComponents::getRGBAComponents(),
+                                                                      eImageBitDepthFloat, framesNeeded);
+            ImagePtr image;
+            if ( _cache->getOrCreate(key, params, &image) ) {
+                ++nHits;
+            } else if (image) {
+                image->allocateMemory();
+            }
+        }
+    }
+};
+
+/**
+ * @brief Returns the time in seconds taken by nThreads threads to run their getOrCreate() calls
+ **/
+double
+runGetOrCreateBenchmark(int nShards,
+                        int nThreads,
+                        int* nHits)
+{
+    Cache<Image> cache("CacheContentionBenchmark", NATRON_CACHE_VERSION, (U64)1 << 30, 1., nShards);
+    std::vector<GetOrCreateThread*> threads;
+
+    for (int i = 0; i < nThreads; ++i) {
+        threads.push_back( new GetOrCreateThread(&cache, i) );
+    }
+
+    TimeLapse timer;
+    for (int i = 0; i < nThreads; ++i) {
+        threads[i]->start();
+    }
+    *nHits = 0;
+    for (int i = 0; i < nThreads; ++i) {
+        threads[i]->wait();
+        *nHits += threads[i]->nHits;
+        delete threads[i];
+    }
+    double elapsed = timer.getTimeElapsedReset();
+
+    cache.waitForDeleterThread();
+
+    return elapsed;
+}
+
+/**
+ * @brief Reads images of a cache whose compressed portion is used, so that threads look-up entries being
+ * compressed or decompressed by other threads. Some of the images found are removed from the cache.
+ **/
+class CompressedGetThread
+    : public QThread
+{
+    Cache<Image>* _cache;
+    int _seed;
+    int _nImages;
+
+public:
+
+    int nFound;
+    int nWrongPixels;
+
+    CompressedGetThread(Cache<Image>* cache,
+                        int seed,
+                        int nImages)
+        : QThread()
+        , _cache(cache)
+        , _seed(seed)
+        , _nImages(nImages)
+        , nFound(0)
+        , nWrongPixels(0)
+    {
+    }
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        for (int i = 0; i < 1000; ++i) {
+            int index = (i * 31 + _seed) % _nImages;
+            ImageKey key(0, (U64)index + 1, false, 0, 0, 1., false, false);
+            std::list<ImagePtr> images;
+            if ( !_cache->get(key, &images) ) {
+                continue;
+            }
+            ++nFound;
+            for (std::list<ImagePtr>::iterator it = images.begin(); it != images.end(); ++it) {
+                const float* pix = (const float*)(*it)->pixelAt(10, 10);
+                if ( !pix || (pix[0] != (float)index) ) {
+                    ++nWrongPixels;
+                }
+            }
+            if (i % 97 == 0) {
+                _cache->removeEntry( images.front() );
+            }
+        }
+    }
+};
+
+///Inserts and reads images filled with their hash in a small shared image cache, so that images are overwritten while being copied
+class SharedImageCacheThread
+    : public QThread
+{
+    SharedImageCache* _cache;
+    int _seed;
+
+public:
+
+    int nRead;
+    int nWrongPixels;
+
+    SharedImageCacheThread(SharedImageCache* cache,
+                           int seed)
+        : QThread()
+        , _cache(cache)
+        , _seed(seed)
+        , nRead(0)
+        , nWrongPixels(0)
+    {
+    }
+
+private:
+
+    virtual void run() OVERRIDE FINAL
+    {
+        const std::size_t size = 256 * 1024;
+        std::vector<unsigned char> data(size);
+        SharedImageCacheEntryInfo info;
+
+        info.size = size;
+        for (int i = 0; i < 2000; ++i) {
+            U64 hash = (i / 2 * 7 + _seed) % 20;
+            if (i % 2 == 0) {
+                std::fill( data.begin(), data.end(), (unsigned char)hash );
+                _cache->insert(hash, &data.front(), info);
+            } else if ( _cache->read(hash, &data.front(), size) ) {
+                ++nRead;
+                if ( (data.front() != (unsigned char)hash) || (data[size / 2] != (unsigned char)hash) || (data.back() != (unsigned char)hash) ) {
+                    ++nWrongPixels;
+                }
+            }
+        }
+    }
+};
+
+struct TraceReplayResult
+{
+    int nLookups;
+    int nHits;
+    double renderTime; //< the time spent rendering the entries that were not found in the cache
+
+    TraceReplayResult()
+        : nLookups(0)
+        , nHits(0)
+        , renderTime(0.)
+    {
+    }
+};
+
+/**
+ * @brief Returns the size and render time of all entries of the trace, the last ones recorded for each hash.
+ **/
+void
+getTraceEntries(const std::vector<CacheAccessTraceRecord> & records,
+                std::map<U64, std::pair<U64, double> >* entries)
+{
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        if (records[i].type == CacheAccessTraceRecord::eTypeRenderTime) {
+            (*entries)[records[i].hash] = std::make_pair(records[i].size, records[i].renderTime);
+        }
+    }
+}
+
+/**
+ * @brief Replays the look-ups of a trace in a single shard cache of maximumSize bytes. Each image is created with
+ * 1/sizeScale of its recorded size so that traces of real sessions can be replayed with little memory.
+ * Every miss costs the recorded render time of the image. Look-ups of images that were never rendered are ignored.
+ **/
+TraceReplayResult
+replayTrace(const std::vector<CacheAccessTraceRecord> & records,
+            U64 maximumSize,
+            U64 sizeScale,
+            CacheEvictionPolicyEnum policy)
+{
+    std::map<U64, std::pair<U64, double> > entries;
+    getTraceEntries(records, &entries);
+
+    Cache<Image> cache("CacheReplayBenchmark", NATRON_CACHE_VERSION, maximumSize, 1., 1);
+    cache.setEvictionPolicy(policy);
+
+    std::map<int, std::map<int, std::vector<RangeD> > > framesNeeded;
+    TraceReplayResult result;
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        if (records[i].type != CacheAccessTraceRecord::eTypeLookup) {
+            continue;
+        }
+        std::map<U64, std::pair<U64, double> >::const_iterator found = entries.find(records[i].hash);
+        if ( found == entries.end() ) {
+            continue;
+        }
+        ++result.nLookups;
+
+        int width = (int)std::max( (U64)1, found->second.first / sizeScale / (4 * sizeof(float)) );
+        RectI bounds(0, 0, width, 1);
+        RectD rod(0, 0, width, 1);
+        ImageKey key(0, records[i].hash, false, 0, 0, 1., false, false);
+        boost::shared_ptr<ImageParams> params = Image::makeParams(0, rod, bounds, 1., 0, false,
+                                                                  ImageComponents::getRGBAComponents(),
+                                                                  eImageBitDepthFloat, framesNeeded);
+        ImagePtr image;
+        if ( cache.getOrCreate(key, params, &image) ) {
+            ++result.nHits;
+        } else if (image) {
+            image->allocateMemory();
+            image->addRenderTime(found->second.second);
+            result.renderTime += found->second.second;
+        }
+    }
+
+    cache.waitForDeleterThread();
+
+    return result;
+}
+
+void
+printReplayResult(const std::string & name,
+                  const TraceReplayResult & lru,
+                  const TraceReplayResult & gdsf)
+{
+    std::cout << name << ": " << lru.nLookups << " look-ups, LRU " << lru.nHits << " hits " << lru.renderTime
+              << "s spent rendering, GDSF " << gdsf.nHits << " hits " << gdsf.renderTime << "s spent rendering" << std::endl;
+}
+} // anon namespace
+
+class CacheTest
+    : public BaseTest
+{
+};
+
+TEST_F(CacheTest, ShardsCount) {
+    unsigned int nShards = Cache<Image>::getDefaultShardsCount();
+
+    ASSERT_TRUE(nShards >= 1 && nShards <= NATRON_CACHE_MAX_SHARDS);
+    ///Must be a power of 2
+    EXPECT_EQ( 0u, nShards & (nShards - 1) );
+}
+
+TEST_F(CacheTest, GetOrCreateContention) {
+    int maxThreads = std::max(1, QThread::idealThreadCount());
+    int defaultShards = (int)Cache<Image>::getDefaultShardsCount();
+    std::vector<int> threadCounts;
+
+    for (int n = 1; n < maxThreads; n *= 2) {
+        threadCounts.push_back(n);
+    }
+    threadCounts.push_back(maxThreads);
+
+    for (std::size_t i = 0; i < threadCounts.size(); ++i) {
+        int nThreads = threadCounts[i];
+        int hitsSingle, hitsSharded;
+        ///A single shard serializes all accesses like a cache with one global lock
+        double singleShard = runGetOrCreateBenchmark(1, nThreads, &hitsSingle);
+        double sharded = runGetOrCreateBenchmark(defaultShards, nThreads, &hitsSharded);
+
+        std::cout << "getOrCreate " << nThreads << " thread(s): 1 shard " << singleShard << "s, "
+                  << defaultShards << " shards " << sharded << "s" << std::endl;
+
+        ///Whatever the number of shards, every access but the first one of each distinct key is a hit
+        EXPECT_EQ(nThreads * CACHE_BENCH_KEYS_PER_THREAD - CACHE_BENCH_DISTINCT_KEYS, hitsSingle);
+        EXPECT_EQ(hitsSingle, hitsSharded);
+    }
+}
+
+TEST_F(CacheTest, CompressedPortion) {
+    const int nImages = 64;
+    RectI bounds(0, 0, 64, 64);
+    RectD rod(0, 0, 64, 64);
+    U64 imageSize = bounds.area() * 4 * sizeof(float);
+    std::map<int, std::map<int, std::vector<RangeD> > > framesNeeded;
+    ///Room for 16 uncompressed images, half of which may be used by compressed images
+    Cache<Image> cache("CacheCompressionTest", NATRON_CACHE_VERSION, imageSize * 16, 1., 1);
+
+    cache.setCompressedPortion(0.5);
+
+    for (int i = 0; i < nImages; ++i) {
+        ImageKey key(0, (U64)i + 1, false, 0, 0, 1., false, false);
+        boost::shared_ptr<ImageParams> params = Image::makeParams(0, rod, bounds, 1., 0, false,
+                                                                  ImageComponents::getRGBAComponents(),
+                                                                  eImageBitDepthFloat, framesNeeded);
+        ImagePtr image;
+        ASSERT_FALSE( cache.getOrCreate(key, params, &image) );
+        ASSERT_TRUE(image);
+        image->allocateMemory();
+        image->fill(bounds, (float)i, 0., 0., 1.);
+    }
+
+    ///The least recently used images were compressed instead of being deleted
+    EXPECT_TRUE(cache.getCompressedCacheSize() > 0);
+
+    ///Uniform images compress very well: all of them fit in the budget
+    int nFound = 0;
+    for (int i = 0; i < nImages; ++i) {
+        ImageKey key(0, (U64)i + 1, false, 0, 0, 1., false, false);
+        std::list<ImagePtr> images;
+        if ( cache.get(key, &images) ) {
+            ASSERT_EQ( 1u, images.size() );
+            const float* pix = (const float*)images.front()->pixelAt(10, 10);
+            ASSERT_TRUE(pix != 0);
+            EXPECT_EQ( (float)i, pix[0] );
+            EXPECT_EQ( 1.f, pix[3] );
+            ++nFound;
+        }
+    }
+    EXPECT_EQ(nImages, nFound);
+
+    cache.waitForDeleterThread();
+}
+
+///Entries are compressed and decompressed outside of the shard lock: look-ups of these entries must wait for them
+///and entries removed meanwhile must not be put back
+TEST_F(CacheTest, CompressedPortionConcurrentAccess) {
+    const int nImages = 64;
+    const int nThreads = 8;
+    RectI bounds(0, 0, 64, 64);
+    RectD rod(0, 0, 64, 64);
+    U64 imageSize = bounds.area() * 4 * sizeof(float);
+    std::map<int, std::map<int, std::vector<RangeD> > > framesNeeded;
+    Cache<Image> cache("CacheCompressionConcurrencyTest", NATRON_CACHE_VERSION, imageSize * 16, 1., 2);
+
+    cache.setCompressedPortion(0.5);
+
+    for (int i = 0; i < nImages; ++i) {
+        ImageKey key(0, (U64)i + 1, false, 0, 0, 1., false, false);
+        boost::shared_ptr<ImageParams> params = Image::makeParams(0, rod, bounds, 1., 0, false,
+                                                                  ImageComponents::getRGBAComponents(),
+                                                                  eImageBitDepthFloat, framesNeeded);
+        ImagePtr image;
+        ASSERT_FALSE( cache.getOrCreate(key, params, &image) );
+        ASSERT_TRUE(image);
+        image->allocateMemory();
+        image->fill(bounds, (float)i, 0., 0., 1.);
+    }
+
+    std::vector<CompressedGetThread*> threads;
+    for (int i = 0; i < nThreads; ++i) {
+        threads.push_back( new CompressedGetThread(&cache, i * 7, nImages) );
+    }
+    for (int i = 0; i < nThreads; ++i) {
+        threads[i]->start();
+    }
+    int nFound = 0;
+    for (int i = 0; i < nThreads; ++i) {
+        threads[i]->wait();
+        EXPECT_EQ(0, threads[i]->nWrongPixels);
+        nFound += threads[i]->nFound;
+        delete threads[i];
+    }
+    EXPECT_TRUE(nFound > 0);
+
+    cache.clear();
+    cache.waitForDeleterThread();
+    EXPECT_EQ( 0u, cache.getCompressedCacheSize() );
+}
+
+TEST_F(CacheTest, WriteBack) {
+    const int nImages = 16;
+    RectI bounds(0, 0, 64, 64);
+    RectD rod(0, 0, 64, 64);
+    U64 imageSize = bounds.area() * 4 * sizeof(float);
+    std::map<int, std::map<int, std::vector<RangeD> > > framesNeeded;
+    ///Room for 8 images in RAM and 8 images on disk
+    Cache<Image> cache("CacheWriteBackTest", NATRON_CACHE_VERSION, imageSize * 16, 0.5, 1);
+
+    for (int i = 0; i < nImages; ++i) {
+        ImageKey key(0, (U64)i + 1, false, 0, 0, 1., false, false);
+        ///A cost of 1 stores the images on disk
+        boost::shared_ptr<ImageParams> params = Image::makeParams(1, rod, bounds, 1., 0, false,
+                                                                  ImageComponents::getRGBAComponents(),
+                                                                  eImageBitDepthFloat, framesNeeded);
+        ImagePtr image;
+        ASSERT_FALSE( cache.getOrCreate(key, params, &image) );
+        ASSERT_TRUE(image);
+        image->allocateMemory();
+        image->fill(bounds, (float)i, 0., 0., 1.);
+    }
+
+    ///Once written, the evicted images are moved to the disk portion
+    cache.waitForWriteBack();
+    EXPECT_TRUE(cache.getDiskCacheSize() > 0);
+    EXPECT_TRUE(cache.getMemoryCacheSize() <= imageSize * 8);
+
+    ///The images read back from disk hold the data written by the write-back threads
+    int nFound = 0;
+    for (int i = 0; i < nImages; ++i) {
+        ImageKey key(0, (U64)i + 1, false, 0, 0, 1., false, false);
+        std::list<ImagePtr> images;
+        if ( cache.get(key, &images) ) {
+            ASSERT_EQ( 1u, images.size() );
+            const float* pix = (const float*)images.front()->pixelAt(10, 10);
+            ASSERT_TRUE(pix != 0);
+            EXPECT_EQ( (float)i, pix[0] );
+            EXPECT_EQ( 1.f, pix[3] );
+            ++nFound;
+        }
+    }
+    EXPECT_TRUE(nFound > 0);
+
+    cache.clear();
+    cache.waitForDeleterThread();
+}
+
+TEST_F(CacheTest, TraceReplay) {
+    const int nCompFrames = 16;
+    const int nReadFrames = 48;
+    const int nLoops = 4;
+    const U64 imageSize = 64 * 64 * 4 * sizeof(float);
+    std::string tracePath = QDir::temp().absoluteFilePath("NatronCacheReplayTest.trace").toStdString();
+
+    std::remove( tracePath.c_str() );
+    {
+        ///The frames of an expensive comp are viewed again after scrubbing through footage decoded by a Reader, which is cheap
+        ///to read again. LRU evicts the comp frames to make room for the footage, which is never looked-up twice.
+        CacheAccessTrace trace(tracePath);
+        ASSERT_TRUE( trace.isOpen() );
+        for (int loop = 0; loop < nLoops; ++loop) {
+            for (int f = 0; f < nCompFrames; ++f) {
+                trace.recordLookup(1000 + f);
+                if (loop == 0) {
+                    trace.recordRenderTime(1000 + f, imageSize, 2.);
+                }
+            }
+            for (int f = 0; f < nReadFrames; ++f) {
+                U64 hash = 2000 + loop * nReadFrames + f;
+                trace.recordLookup(hash);
+                trace.recordRenderTime(hash, imageSize, 0.01);
+            }
+        }
+    }
+
+    std::vector<CacheAccessTraceRecord> records;
+    ASSERT_TRUE( CacheAccessTrace::read(tracePath, &records) );
+    std::remove( tracePath.c_str() );
+    ASSERT_EQ( (std::size_t)(nCompFrames * (nLoops + 1) + nReadFrames * nLoops * 2), records.size() );
+
+    ///Room for the comp frames and a few frames of footage
+    U64 cacheSize = imageSize * (nCompFrames + 8);
+    TraceReplayResult lru = replayTrace(records, cacheSize, 1, eCacheEvictionPolicyLRU);
+    TraceReplayResult gdsf = replayTrace(records, cacheSize, 1, eCacheEvictionPolicyGDSF);
+    printReplayResult("Comp and footage", lru, gdsf);
+
+    EXPECT_EQ( (nCompFrames + nReadFrames) * nLoops, lru.nLookups );
+    EXPECT_EQ(lru.nLookups, gdsf.nLookups);
+    EXPECT_EQ(0, lru.nHits);
+    ///The comp frames stay in the cache after the first loop
+    EXPECT_EQ(nCompFrames * (nLoops - 1), gdsf.nHits);
+    EXPECT_TRUE(gdsf.renderTime < lru.renderTime / 2.);
+
+    ///Replay a trace recorded in a real session, in a cache holding a quarter of the images it uses
+    const char* recordedTracePath = std::getenv(CACHE_REPLAY_TRACE_ENV_VAR);
+    if (recordedTracePath) {
+        std::vector<CacheAccessTraceRecord> recorded;
+        ASSERT_TRUE( CacheAccessTrace::read(recordedTracePath, &recorded) );
+        std::map<U64, std::pair<U64, double> > entries;
+        getTraceEntries(recorded, &entries);
+        const U64 sizeScale = 256;
+        U64 totalSize = 0;
+        for (std::map<U64, std::pair<U64, double> >::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+            totalSize += std::max( (U64)1, it->second.first / sizeScale );
+        }
+        TraceReplayResult recordedLru = replayTrace(recorded, totalSize / 4, sizeScale, eCacheEvictionPolicyLRU);
+        TraceReplayResult recordedGdsf = replayTrace(recorded, totalSize / 4, sizeScale, eCacheEvictionPolicyGDSF);
+        printReplayResult(recordedTracePath, recordedLru, recordedGdsf);
+    }
+}
+
+namespace {
+
+class StatsTestHolder
+    : public CacheEntryHolder
+{
+public:
+
+    virtual std::string getCacheID() const OVERRIDE FINAL
+    {
+        return "StatsTestHolder";
+    }
+};
+
+} // anon namespace
+
+TEST_F(CacheTest, Stats) {
+    const int nImages = 8;
+    RectI bounds(0, 0, 64, 64);
+    RectD rod(0, 0, 64, 64);
+    U64 imageSize = bounds.area() * 4 * sizeof(float);
+    std::map<int, std::map<int, std::vector<RangeD> > > framesNeeded;
+    ///Room for 4 images
+    Cache<Image> cache("CacheStatsTest", NATRON_CACHE_VERSION, imageSize * 4, 1., 1);
+    StatsTestHolder holder;
+
+    for (int i = 0; i < nImages; ++i) {
+        ImageKey key(&holder, (U64)i + 1, false, 0, 0, 1., false, false);
+        boost::shared_ptr<ImageParams> params = Image::makeParams(0, rod, bounds, 1., 0, false,
+                                                                  ImageComponents::getRGBAComponents(),
+                                                                  eImageBitDepthFloat, framesNeeded);
+        ImagePtr image;
+        ASSERT_FALSE( cache.getOrCreate(key, params, &image) );
+        ASSERT_TRUE(image);
+        image->allocateMemory();
+    }
+    {
+        ImageKey key(&holder, (U64)nImages, false, 0, 0, 1., false, false);
+        std::list<ImagePtr> images;
+        EXPECT_TRUE( cache.get(key, &images) );
+    }
+    cache.waitForDeleterThread();
+
+    CacheStatsSnapshot cacheStats = cache.getStats();
+    EXPECT_EQ(1u, cacheStats.hits);
+    EXPECT_EQ( (U64)nImages, cacheStats.misses );
+    EXPECT_EQ(nImages * imageSize, cacheStats.bytesAllocated);
+    ///The images beyond the first 4 evicted older ones, which are not stored on disk
+    EXPECT_TRUE(cacheStats.evictions >= (U64)nImages - 4);
+    EXPECT_EQ(0u, cacheStats.demotionsToDisk);
+
+    ///The cache records what it can attribute to the holder, the hits and misses are recorded by the nodes
+    CacheStatsSnapshot holderStats = holder.getCacheStats()->getSnapshot();
+    EXPECT_EQ(0u, holderStats.hits);
+    EXPECT_EQ(cacheStats.bytesAllocated, holderStats.bytesAllocated);
+    EXPECT_EQ(cacheStats.evictions, holderStats.evictions);
+
+    cache.resetStats();
+    cacheStats = cache.getStats();
+    EXPECT_EQ(0u, cacheStats.misses);
+    EXPECT_EQ(0u, cacheStats.bytesAllocated);
+}
+
+TEST(CacheCompression, RoundTrip) {
+    const std::size_t nPixels = 300 * 1000 + 7;
+    std::vector<float> smooth(nPixels * 4);
+    std::vector<unsigned char> noise(nPixels * 4);
+    unsigned int seed = 1;
+
+    for (std::size_t i = 0; i < nPixels; ++i) {
+        for (int c = 0; c < 4; ++c) {
+            smooth[i * 4 + c] = c == 3 ? 1.f : (float)( (i / 64) % 256 ) / 255.f;
+            seed = seed * 1103515245 + 12345;
+            noise[i * 4 + c] = (unsigned char)(seed >> 16);
+        }
+    }
+
+    ///Floating point data, whose size is not a multiple of the block size
+    std::size_t size = smooth.size() * sizeof(float) - 3;
+    std::vector<unsigned char> compressed;
+    ASSERT_TRUE( CacheCompression::compress(&smooth[0], size, sizeof(float), size, &compressed) );
+    EXPECT_TRUE(compressed.size() < size * NATRON_CACHE_COMPRESSION_MAX_RATIO);
+
+    std::vector<float> decompressed( smooth.size() );
+    ASSERT_TRUE( CacheCompression::decompress(&compressed[0], compressed.size(), sizeof(float), &decompressed[0], size) );
+    EXPECT_EQ( 0, memcmp(&smooth[0], &decompressed[0], size) );
+
+    ///Wrong size or corrupted data must be detected
+    EXPECT_FALSE( CacheCompression::decompress(&compressed[0], compressed.size(), sizeof(float), &decompressed[0], size - 1) );
+    EXPECT_FALSE( CacheCompression::decompress(&compressed[0], compressed.size() - 1, sizeof(float), &decompressed[0], size) );
+
+    ///Random bytes do not compress
+    EXPECT_FALSE( CacheCompression::compress(&noise[0], noise.size(), 1, noise.size() * NATRON_CACHE_COMPRESSION_MAX_RATIO, &compressed) );
+}
+
+TEST(CacheSegmentStore, ChunkSize) {
+    EXPECT_EQ(NATRON_CACHE_SEGMENT_BLOCK_SIZE, CacheSegmentStore::getChunkSize(1));
+    EXPECT_EQ(NATRON_CACHE_SEGMENT_BLOCK_SIZE, CacheSegmentStore::getChunkSize(NATRON_CACHE_SEGMENT_BLOCK_SIZE));
+    ///A 4K float RGBA frame
+    U64 size = 4096ULL * 2160ULL * 4ULL * sizeof(float);
+    U64 chunk = CacheSegmentStore::getChunkSize(size);
+    EXPECT_TRUE(chunk >= size);
+    EXPECT_TRUE(chunk - size <= size / NATRON_CACHE_SEGMENT_SIZE_CLASSES_PER_POW2);
+    EXPECT_EQ(0u, chunk % NATRON_CACHE_SEGMENT_BLOCK_SIZE);
+}
+
+TEST(CacheSegmentStore, AllocateReadWrite) {
+    QDir dir( QDir::tempPath() + "/NatronCacheSegmentStoreTest" );
+    dir.mkpath(".");
+    std::string path = dir.absolutePath().toStdString();
+    const U64 segmentSize = 16ULL * 1024ULL * 1024ULL;
+    const int nEntries = 200;
+    const U64 entrySize = 300 * 1024;
+
+    std::vector<CacheSegmentLocation> locations(nEntries);
+    {
+        CacheSegmentStore store(path, segmentSize);
+        for (int i = 0; i < nEntries; ++i) {
+            ASSERT_TRUE( store.allocate(entrySize, &locations[i]) );
+            std::vector<unsigned char> data(entrySize, (unsigned char)i);
+            ASSERT_TRUE( store.write(locations[i], &data.front(), entrySize) );
+        }
+        ///Thousands of entries only need a few files
+        EXPECT_TRUE( store.getSegmentsCount() <= (int)( (nEntries * CacheSegmentStore::getChunkSize(entrySize)) / segmentSize ) + 1 );
+
+        for (int i = 0; i < nEntries; ++i) {
+            std::vector<unsigned char> data(entrySize);
+            ASSERT_TRUE( store.read(locations[i], &data.front(), entrySize) );
+            EXPECT_EQ( (unsigned char)i, data.front() );
+            EXPECT_EQ( (unsigned char)i, data.back() );
+        }
+
+        ///Released chunks are merged back and re-used
+        U64 allocated = store.getAllocatedSize();
+        int nSegments = store.getSegmentsCount();
+        for (int i = 0; i < nEntries; i += 2) {
+            store.release(locations[i]);
+        }
+        for (int i = 0; i < nEntries; i += 2) {
+            ASSERT_TRUE( store.allocate(entrySize, &locations[i]) );
+            std::vector<unsigned char> data(entrySize, (unsigned char)i);
+            ASSERT_TRUE( store.write(locations[i], &data.front(), entrySize) );
+        }
+        EXPECT_EQ( allocated, store.getAllocatedSize() );
+        EXPECT_EQ( nSegments, store.getSegmentsCount() );
+
+        ///Chunks larger than a segment cannot be allocated
+        CacheSegmentLocation tooLarge;
+        EXPECT_FALSE( store.allocate(segmentSize + 1, &tooLarge) );
+    }
+
+    ///Restoration in another session
+    {
+        CacheSegmentStore store(path, segmentSize);
+        for (int i = 0; i < nEntries; ++i) {
+            CacheSegmentLocation location = locations[i];
+            ASSERT_TRUE( store.reserve(&location) );
+            std::vector<unsigned char> data(entrySize);
+            ASSERT_TRUE( store.read(location, &data.front(), entrySize) );
+            EXPECT_EQ( (unsigned char)i, data.front() );
+        }
+        ///A chunk cannot be reserved twice
+        CacheSegmentLocation location = locations[0];
+        EXPECT_FALSE( store.reserve(&location) );
+
+        ///After a reset, previous locations are no longer readable
+        store.reset(path);
+        std::vector<unsigned char> data(entrySize);
+        EXPECT_FALSE( store.read(locations[0], &data.front(), entrySize) );
+        store.removeUnusedSegmentFiles();
+    }
+    QDir().rmdir( dir.absolutePath() );
+}
+
+#ifdef __NATRON_UNIX__
+TEST(SharedImageCache, InsertFindEvict) {
+    const std::string name = "/NatronSharedImageCacheTest";
+    const std::size_t entrySize = 1024 * 1024;
+
+    SharedImageCache::unlink(name);
+    SharedImageCache cache(name, 8 * entrySize);
+    ASSERT_TRUE( cache.isValid() );
+    std::size_t maxEntries = cache.getDataSize() / entrySize;
+
+    SharedImageCacheEntryInfo info;
+    info.size = entrySize;
+    info.par = 2.;
+    info.bounds[2] = 512;
+    info.bounds[3] = 512;
+    const int nEntries = (int)maxEntries * 2;
+    for (int i = 0; i < nEntries; ++i) {
+        std::vector<unsigned char> data(entrySize, (unsigned char)i);
+        ASSERT_TRUE( cache.insert(i, &data.front(), info) );
+    }
+    ///The oldest images were overwritten by the most recent ones
+    EXPECT_EQ( maxEntries, cache.getEntriesCount() );
+    SharedImageCacheEntryInfo found;
+    EXPECT_FALSE( cache.find(0, &found) );
+    ASSERT_TRUE( cache.find(nEntries - 1, &found) );
+    EXPECT_EQ( entrySize, found.size );
+    EXPECT_EQ( 2., found.par );
+    EXPECT_EQ( 512, found.bounds[3] );
+
+    ///Another process opening the same segment sees the same images, whatever size it asks for
+    {
+        SharedImageCache other(name, 1);
+        ASSERT_TRUE( other.isValid() );
+        std::vector<unsigned char> data(entrySize);
+        ASSERT_TRUE( other.read(nEntries - 1, &data.front(), entrySize) );
+        EXPECT_EQ( (unsigned char)(nEntries - 1), data.front() );
+        EXPECT_EQ( (unsigned char)(nEntries - 1), data.back() );
+        EXPECT_FALSE( other.read(nEntries - 1, &data.front(), entrySize - 1) );
+    }
+
+    ///Images larger than the segment are not shared
+    info.size = cache.getDataSize() + 1;
+    std::vector<unsigned char> tooLarge(info.size);
+    EXPECT_FALSE( cache.insert(nEntries, &tooLarge.front(), info) );
+
+    cache.clear();
+    EXPECT_EQ( (std::size_t)0, cache.getEntriesCount() );
+    SharedImageCache::unlink(name);
+}
+
+TEST(SharedImageCache, ConcurrentInsertRead) {
+    const std::string name = "/NatronSharedImageCacheConcurrentTest";
+    const int nThreads = 6;
+
+    SharedImageCache::unlink(name);
+    ///Room for 4 images: images are evicted while other threads copy them
+    SharedImageCache cache(name, 4 * 256 * 1024 + 200000);
+    ASSERT_TRUE( cache.isValid() );
+
+    std::vector<SharedImageCacheThread*> threads;
+    for (int i = 0; i < nThreads; ++i) {
+        threads.push_back( new SharedImageCacheThread(&cache, i * 3) );
+    }
+    for (int i = 0; i < nThreads; ++i) {
+        threads[i]->start();
+    }
+    int nRead = 0;
+    for (int i = 0; i < nThreads; ++i) {
+        threads[i]->wait();
+        ///Copies that raced with an eviction must have been discarded
+        EXPECT_EQ(0, threads[i]->nWrongPixels);
+        nRead += threads[i]->nRead;
+        delete threads[i];
+    }
+    EXPECT_TRUE(nRead > 0);
+    EXPECT_TRUE( cache.getEntriesCount() <= cache.getDataSize() / (256 * 1024) );
+    SharedImageCache::unlink(name);
+}
+#endif // __NATRON_UNIX__
+
+TEST(MemoryPressure, Parse) {
+    std::string v2Path, v1Path;
+    MemoryPressure::parseProcCgroup("0::/user.slice/session-1.scope\n", &v2Path, &v1Path);
+    EXPECT_EQ(std::string("/user.slice/session-1.scope"), v2Path);
+    EXPECT_TRUE( v1Path.empty() );
+    ///On hybrid systems the memory controller is in the v1 hierarchy
+    MemoryPressure::parseProcCgroup("4:memory:/docker/abc\n3:cpu,cpuacct:/docker/abc\n0::/\n", &v2Path, &v1Path);
+    EXPECT_TRUE( v2Path.empty() );
+    EXPECT_EQ(std::string("/docker/abc"), v1Path);
+
+    U64 limit = 1;
+    EXPECT_TRUE( MemoryPressure::parseLimit("max\n", &limit) );
+    EXPECT_EQ(0u, limit);
+    EXPECT_TRUE( MemoryPressure::parseLimit("1073741824\n", &limit) );
+    EXPECT_EQ(1073741824ULL, limit);
+    EXPECT_FALSE( MemoryPressure::parseLimit("", &limit) );
+
+    double someAvg10 = -1., fullAvg10 = -1.;
+    EXPECT_TRUE( MemoryPressure::parsePressure("some avg10=12.50 avg60=3.00 avg300=1.00 total=100\n"
+                                               "full avg10=0.25 avg60=0.00 avg300=0.00 total=10\n", &someAvg10, &fullAvg10) );
+    EXPECT_DOUBLE_EQ(12.5, someAvg10);
+    EXPECT_DOUBLE_EQ(0.25, fullAvg10);
+
+    EXPECT_EQ( 4096u, MemoryPressure::parseStat("active_file 1024\ninactive_file 4096\n", "inactive_file") );
+    EXPECT_EQ( 0u, MemoryPressure::parseStat("active_file 1024\n", "inactive_file") );
+
+    MemoryPressureState state;
+    state.totalRAM = 1000;
+    state.availableRAM = 500;
+    EXPECT_EQ( eMemoryPressureLevelNone, MemoryPressure::computeLevel(state, 0.1) );
+    state.availableRAM = 150;
+    EXPECT_EQ( eMemoryPressureLevelModerate, MemoryPressure::computeLevel(state, 0.1) );
+    state.availableRAM = 50;
+    EXPECT_EQ( eMemoryPressureLevelCritical, MemoryPressure::computeLevel(state, 0.1) );
+    state.availableRAM = 500;
+    state.someAvg10 = NATRON_MEMORY_PRESSURE_SOME_AVG10_MODERATE;
+    EXPECT_EQ( eMemoryPressureLevelModerate, MemoryPressure::computeLevel(state, 0.1) );
+    state.fullAvg10 = NATRON_MEMORY_PRESSURE_FULL_AVG10_CRITICAL;
+    EXPECT_EQ( eMemoryPressureLevelCritical, MemoryPressure::computeLevel(state, 0.1) );
+}
+
+TEST(MemoryPressure, SustainedPressure) {
+    MemoryPressure pressure(0.1);
+    MemoryPressureState state;
+    const U64 maxCacheSize = 1000;
+    double scale = 1.;
+
+    state.totalRAM = 10000;
+    state.availableRAM = 5000;
+    ///The PSI averages stay above the threshold for seconds after the caches were shrunk
+    state.someAvg10 = NATRON_MEMORY_PRESSURE_SOME_AVG10_MODERATE * 2;
+    state.fullAvg10 = 0.;
+    state.level = MemoryPressure::computeLevel(state, 0.1);
+    ASSERT_EQ(eMemoryPressureLevelModerate, state.level);
+
+    ///Poll as checkCacheFreeMemoryIsGoodEnough does for a few seconds
+    int nShrinks = 0;
+    for (int i = 0; i < 50; ++i) {
+        state.time = i * NATRON_MEMORY_PRESSURE_POLL_INTERVAL_MS;
+        if (pressure.getBudgetAction(state) == eMemoryBudgetActionShrink) {
+            U64 cacheSize = scale * maxCacheSize;
+            scale = std::min( scale, (double)( cacheSize - MemoryPressure::computeAmountToFree(state, 0.1, cacheSize) ) / maxCacheSize );
+            ++nShrinks;
+        }
+    }
+    EXPECT_EQ(1, nShrinks);
+    EXPECT_NEAR(1. - NATRON_MEMORY_PRESSURE_MODERATE_BATCH, scale, 0.01);
+
+    ///A worse pressure shrinks the caches again right away
+    state.fullAvg10 = NATRON_MEMORY_PRESSURE_FULL_AVG10_CRITICAL;
+    state.level = MemoryPressure::computeLevel(state, 0.1);
+    state.time += NATRON_MEMORY_PRESSURE_POLL_INTERVAL_MS;
+    EXPECT_EQ( eMemoryBudgetActionShrink, pressure.getBudgetAction(state) );
+    state.time += NATRON_MEMORY_PRESSURE_POLL_INTERVAL_MS;
+    EXPECT_EQ( eMemoryBudgetActionNone, pressure.getBudgetAction(state) );
+
+    ///A pressure still there after the cooldown shrinks them again
+    state.time += NATRON_MEMORY_PRESSURE_SHRINK_COOLDOWN_MS;
+    EXPECT_EQ( eMemoryBudgetActionShrink, pressure.getBudgetAction(state) );
+
+    ///The budgets grow back only once the averages are well below the thresholds
+    state.someAvg10 = NATRON_MEMORY_PRESSURE_SOME_AVG10_MODERATE * 0.8;
+    state.fullAvg10 = NATRON_MEMORY_PRESSURE_FULL_AVG10_CRITICAL * 0.8;
+    state.level = MemoryPressure::computeLevel(state, 0.1);
+    ASSERT_EQ(eMemoryPressureLevelNone, state.level);
+    state.time += NATRON_MEMORY_PRESSURE_POLL_INTERVAL_MS;
+    EXPECT_EQ( eMemoryBudgetActionNone, pressure.getBudgetAction(state) );
+    state.someAvg10 = state.fullAvg10 = 0.;
+    state.time += NATRON_MEMORY_PRESSURE_POLL_INTERVAL_MS;
+    EXPECT_EQ( eMemoryBudgetActionGrow, pressure.getBudgetAction(state) );
+}
+
+TEST(RenderArena, ReuseAndReset) {
+    boost::shared_ptr<RenderArena> arena(new RenderArena);
+    const std::size_t tileBytes = 256 * 256 * 4 * sizeof(float);
+
+    ///A block freed during the render is given to the next temporary image of about the same size
+    void* first = arena->allocate(tileBytes);
+    arena->deallocate(first, tileBytes);
+    EXPECT_LE( tileBytes, arena->getKeptBytes() );
+    void* second = arena->allocate(tileBytes - 100);
+    EXPECT_EQ(first, second);
+    EXPECT_EQ( (std::size_t)0, arena->getKeptBytes() );
+
+    ///Once the render is done, the kept blocks are freed and the blocks still in use are freed when deallocated
+    void* third = arena->allocate(tileBytes);
+    arena->deallocate(third, tileBytes);
+    arena->reset();
+    EXPECT_EQ( (std::size_t)0, arena->getKeptBytes() );
+    arena->deallocate(second, tileBytes);
+    EXPECT_EQ( (std::size_t)0, arena->getKeptBytes() );
+}
+
+TEST(RenderArena, KeptBytesLimit) {
+    const std::size_t blockBytes = NATRON_RENDER_ARENA_BLOCK_GRANULARITY * 4;
+    boost::shared_ptr<RenderArena> first(new RenderArena);
+    boost::shared_ptr<RenderArena> second(new RenderArena);
+
+    ///The arenas of the frames rendered at once keep at most the limit together
+    RenderArena::setMaxKeptBytes(blockBytes * 3);
+    std::vector<void*> blocks;
+    for (int i = 0; i < 4; ++i) {
+        blocks.push_back( first->allocate(blockBytes) );
+        blocks.push_back( second->allocate(blockBytes) );
+    }
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+        ( (i % 2) ? second : first )->deallocate(blocks[i], blockBytes);
+    }
+    EXPECT_EQ( blockBytes * 3, first->getKeptBytes() + second->getKeptBytes() );
+    EXPECT_EQ( blockBytes * 3, RenderArena::getTotalKeptBytes() );
+
+    ///Under memory pressure the kept blocks of all the arenas are freed, but the arenas keep the next ones
+    RenderArena::releaseAllKeptBlocks();
+    EXPECT_EQ( (std::size_t)0, first->getKeptBytes() + second->getKeptBytes() );
+    EXPECT_EQ( (std::size_t)0, RenderArena::getTotalKeptBytes() );
+    void* block = first->allocate(blockBytes);
+    first->deallocate(block, blockBytes);
+    EXPECT_EQ( blockBytes, RenderArena::getTotalKeptBytes() );
+
+    ///The limit cannot be raised above NATRON_RENDER_ARENA_MAX_KEPT_BYTES
+    RenderArena::setMaxKeptBytes( (std::size_t)-1 );
+    first.reset();
+    EXPECT_EQ( (std::size_t)0, RenderArena::getTotalKeptBytes() );
+}
+
+TEST(RenderArena, RamBuffer) {
+    boost::shared_ptr<RenderArena> arena(new RenderArena);
+    {
+        RamBuffer<float> buffer;
+        buffer.resize(1000, arena);
+        EXPECT_EQ( arena, buffer.getArena() );
+        buffer.getData()[999] = 1.f;
+
+        ///The copy made when a shared buffer is written to lives in the same arena
+        RamBuffer<float> shared;
+        shared.share(buffer);
+        shared.detach();
+        EXPECT_EQ( arena, shared.getArena() );
+        EXPECT_EQ( 1.f, shared.getData()[999] );
+        EXPECT_NE( buffer.getData(), shared.getData() );
+    }
+    EXPECT_LT( (std::size_t)0, arena->getKeptBytes() );
+
+    ///The buffers of the thread's render are allocated in its arena
+    RenderArena::setCurrent(arena);
+    EXPECT_EQ( arena, RenderArena::getCurrent() );
+    {
+        RenderArenaSetter setter( (boost::shared_ptr<RenderArena>()) );
+        EXPECT_FALSE( RenderArena::getCurrent() );
+    }
+    EXPECT_EQ( arena, RenderArena::getCurrent() );
+    RenderArena::setCurrent( boost::shared_ptr<RenderArena>() );
+}
@@ -22,9 +22,264 @@
 #include <Python.h>
 // ***** END PYTHON BLOCK *****
 
+#include <cstdlib>
 #include <cstring>
+#include <iostream>
+#include <limits>
+#include <vector>
 #include <gtest/gtest.h>
+
+#include <QtCore/QThread>
+
+#include "BaseTest.h"
+
+#include "Engine/AppManager.h"
 #include "Engine/Image.h"
+#include "Engine/Lut.h"
+#include "Engine/SIMD.h"
+#include "Engine/Timer.h"
+
+namespace {
+
+///Returns true if all the pixels of rect have the given state
+bool
+bitmapIsFilledWith(const Natron::Bitmap & bm,
+                   const RectI & rect,
+                   char state)
+{
+    for (int y = rect.y1; y < rect.y2; ++y) {
+        for (int x = rect.x1; x < rect.x2; ++x) {
+            if (bm.getPixel(x, y) != state) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief The former bitmap, which stores the render state with one byte per pixel, used as a reference
+ * for the tiled Natron::Bitmap
+ **/
+class PixelBitmap
+{
+    RectI _bounds;
+    std::vector<char> _map;
+
+public:
+
+    PixelBitmap(const RectI & bounds)
+        : _bounds(bounds)
+        , _map(bounds.area(), 0)
+    {
+    }
+
+    char getPixel(int x,
+                  int y) const
+    {
+        return _map[(y - _bounds.y1) * _bounds.width() + (x - _bounds.x1)];
+    }
+
+    void fill(const RectI & roi,
+              char state)
+    {
+        for (int y = roi.y1; y < roi.y2; ++y) {
+            memset(&_map[(y - _bounds.y1) * _bounds.width() + (roi.x1 - _bounds.x1)], state, roi.width());
+        }
+    }
+
+    ///Returns true if all the pixels of the row (or column) are rendered
+    bool isRowRendered(const RectI & roi,
+                       bool row,
+                       int i) const
+    {
+        if (row) {
+            const char* pix = &_map[(i - _bounds.y1) * _bounds.width() + (roi.x1 - _bounds.x1)];
+            for (int x = roi.x1; x < roi.x2; ++x, ++pix) {
+                if (*pix != 1) {
+                    return false;
+                }
+            }
+        } else {
+            const char* pix = &_map[(roi.y1 - _bounds.y1) * _bounds.width() + (i - _bounds.x1)];
+            for (int y = roi.y1; y < roi.y2; ++y, pix += _bounds.width()) {
+                if (*pix != 1) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    RectI minimalNonMarkedBbox(const RectI & roi) const
+    {
+        RectI bbox = roi;
+
+        while ( !bbox.isNull() && isRowRendered(bbox, true, bbox.y1) ) {
+            ++bbox.y1;
+        }
+        while ( !bbox.isNull() && isRowRendered(bbox, true, bbox.y2 - 1) ) {
+            --bbox.y2;
+        }
+        while ( !bbox.isNull() && isRowRendered(bbox, false, bbox.x1) ) {
+            ++bbox.x1;
+        }
+        while ( !bbox.isNull() && isRowRendered(bbox, false, bbox.x2 - 1) ) {
+            --bbox.x2;
+        }
+
+        return bbox;
+    }
+
+    ///Returns the state of the first pixel of the row (or column) of roi, scanned from its left (bottom), whose state is not
+    ///the given one, or -1 if there is none
+    int firstPixelNotIn(const RectI & roi,
+                        bool row,
+                        int i,
+                        char state) const
+    {
+        for (int j = row ? roi.x1 : roi.y1; j < (row ? roi.x2 : roi.y2); ++j) {
+            char pix = row ? getPixel(j, i) : getPixel(i, j);
+            if (pix != state) {
+                return pix;
+            }
+        }
+
+        return -1;
+    }
+
+    bool rowContains(const RectI & roi,
+                     bool row,
+                     int i,
+                     char state) const
+    {
+        for (int j = row ? roi.x1 : roi.y1; j < (row ? roi.x2 : roi.y2); ++j) {
+            if ( (row ? getPixel(j, i) : getPixel(i, j)) == state ) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    ///Skips the rows (or columns) of the bbox without pixels to render, flagging the pixels being rendered elsewhere they hold
+    void skipRowsToRender_trimap(RectI* bbox,
+                                 bool row,
+                                 bool fromStart,
+                                 bool* isBeingRenderedElsewhere) const
+    {
+        while ( !bbox->isNull() ) {
+            int i = row ? (fromStart ? bbox->y1 : bbox->y2 - 1) : (fromStart ? bbox->x1 : bbox->x2 - 1);
+            if ( rowContains(*bbox, row, i, 0) ) {
+                break;
+            }
+            if ( rowContains(*bbox, row, i, 2) ) {
+                *isBeingRenderedElsewhere = true;
+            }
+            if (row) {
+                fromStart ? ++bbox->y1 : --bbox->y2;
+            } else {
+                fromStart ? ++bbox->x1 : --bbox->x2;
+            }
+        }
+    }
+
+    RectI minimalNonMarkedBbox_trimap(const RectI & roi,
+                                      bool* isBeingRenderedElsewhere) const
+    {
+        RectI bbox = roi;
+
+        skipRowsToRender_trimap(&bbox, true, true, isBeingRenderedElsewhere);
+        skipRowsToRender_trimap(&bbox, true, false, isBeingRenderedElsewhere);
+        skipRowsToRender_trimap(&bbox, false, true, isBeingRenderedElsewhere);
+        skipRowsToRender_trimap(&bbox, false, false, isBeingRenderedElsewhere);
+
+        return bbox;
+    }
+
+    /**
+     * @brief Returns the number of rows (or columns) of rect made only of pixels not rendered, starting from its bottom (left)
+     * or top (right). The pixels being rendered elsewhere are only flagged if the first pixel that is not 0 in the row where
+     * the scan stops is one of them.
+     **/
+    int countRowsNotRendered_trimap(const RectI & rect,
+                                    bool row,
+                                    bool fromStart,
+                                    bool* isBeingRenderedElsewhere) const
+    {
+        if ( rect.isNull() ) {
+            return 0;
+        }
+        int start = row ? rect.y1 : rect.x1;
+        int end = row ? rect.y2 : rect.x2;
+        for (int n = 0; n < end - start; ++n) {
+            int first = firstPixelNotIn(rect, row, fromStart ? start + n : end - 1 - n, 0);
+            if (first != -1) {
+                if (first == 2) {
+                    *isBeingRenderedElsewhere = true;
+                }
+
+                return n;
+            }
+        }
+
+        return end - start;
+    }
+
+    void minimalNonMarkedRects_trimap(const RectI & roi,
+                                      std::list<RectI> & ret,
+                                      bool* isBeingRenderedElsewhere) const
+    {
+        RectI bboxX = minimalNonMarkedBbox_trimap(roi, isBeingRenderedElsewhere);
+
+        if ( bboxX.isNull() ) {
+            return;
+        }
+        int n = countRowsNotRendered_trimap(bboxX, true, true, isBeingRenderedElsewhere);
+        if (n) {
+            ret.push_back( RectI(bboxX.x1, bboxX.y1, bboxX.x2, bboxX.y1 + n) );
+            bboxX.y1 += n;
+        }
+        n = countRowsNotRendered_trimap(bboxX, true, false, isBeingRenderedElsewhere);
+        if (n) {
+            ret.push_back( RectI(bboxX.x1, bboxX.y2 - n, bboxX.x2, bboxX.y2) );
+            bboxX.y2 -= n;
+        }
+        n = countRowsNotRendered_trimap(bboxX, false, true, isBeingRenderedElsewhere);
+        if (n) {
+            ret.push_back( RectI(bboxX.x1, bboxX.y1, bboxX.x1 + n, bboxX.y2) );
+            bboxX.x1 += n;
+        }
+        n = countRowsNotRendered_trimap(bboxX, false, false, isBeingRenderedElsewhere);
+        if (n) {
+            ret.push_back( RectI(bboxX.x2 - n, bboxX.y1, bboxX.x2, bboxX.y2) );
+            bboxX.x2 -= n;
+        }
+        bboxX = minimalNonMarkedBbox_trimap(bboxX, isBeingRenderedElsewhere);
+        if ( !bboxX.isNull() ) {
+            ret.push_back(bboxX);
+        }
+    }
+};
+
+RectI
+randomRect(const RectI & bounds)
+{
+    // coverity[dont_call]
+    int x1 = bounds.x1 + rand() % bounds.width();
+    // coverity[dont_call]
+    int y1 = bounds.y1 + rand() % bounds.height();
+    // coverity[dont_call]
+    int x2 = x1 + 1 + rand() % (bounds.x2 - x1);
+    // coverity[dont_call]
+    int y2 = y1 + 1 + rand() % (bounds.y2 - y1);
+
+    return RectI(x1, y1, x2, y2);
+}
+
+} // anon namespace
 
 
 TEST(BitmapTest,SimpleRect) {
@@ -43,8 +298,7 @@ TEST(BitmapTest,SimpleRect) {
     ASSERT_TRUE(rod == nonRenderedRectsUnion);
 
     ///assert that the "underlying" bitmap is clean
-    const char* map = bm.getBitmap();
-    ASSERT_TRUE( !memchr( map,1,rod.area() ) );
+    ASSERT_TRUE( bitmapIsFilledWith(bm, rod, 0) );
 
     RectI halfRoD(0,0,100,50);
     bm.markForRendered(halfRoD);
@@ -58,14 +312,12 @@ TEST(BitmapTest,SimpleRect) {
 
 
     ///assert that the underlying bitmap is marked as expected
-    const char* start = map;
 
     ///check that there are only ones in the rendered half
-    ASSERT_TRUE( !memchr( start,0,halfRoD.area() ) );
+    ASSERT_TRUE( bitmapIsFilledWith(bm, halfRoD, 1) );
 
     ///check that there are only 0s in the non rendered half
-    start = map + halfRoD.area();
-    ASSERT_TRUE( !memchr( start,1,halfRoD.area() ) );
+    ASSERT_TRUE( bitmapIsFilledWith(bm, nonRenderedHalf, 0) );
 
     ///mark for renderer the other half of the rod
     bm.markForRendered(nonRenderedHalf);
@@ -74,7 +326,7 @@ TEST(BitmapTest,SimpleRect) {
     nonRenderedRects.clear();
     bm.minimalNonMarkedRects(rod, nonRenderedRects);
     ASSERT_TRUE( nonRenderedRects.empty() );
-    ASSERT_TRUE( !memchr( map,0,rod.area() ) );
+    ASSERT_TRUE( bitmapIsFilledWith(bm, rod, 1) );
     
     ///More complex example where A,B,C,D are not rendered check that both trimap & bitmap yield the same result
     // BBBBBBBBBBBBBB
@@ -106,6 +358,126 @@ TEST(BitmapTest,SimpleRect) {
     EXPECT_TRUE(nonRenderedRects.size() == 3);
 }
 
+TEST(BitmapTest,Tiles) {
+    ///Bounds that are not aligned on the tiles, with tiles partially covered by each mark
+    RectI rod(-37, 13, 3 * NATRON_BITMAP_TILE_SIZE + 5, 2 * NATRON_BITMAP_TILE_SIZE + 50);
+    Natron::Bitmap bm(rod);
+    PixelBitmap ref(rod);
+
+    srand(2000);
+    for (int i = 0; i < 200; ++i) {
+        RectI rect = randomRect(rod);
+        // coverity[dont_call]
+        int state = rand() % 3;
+        if (state == 0) {
+            bm.clear(rect);
+        } else if (state == 1) {
+            bm.markForRendered(rect);
+        } else {
+            bm.markForRendering(rect);
+        }
+        ref.fill(rect, (char)state);
+
+        for (int y = rod.y1; y < rod.y2; ++y) {
+            for (int x = rod.x1; x < rod.x2; ++x) {
+                ASSERT_EQ( ref.getPixel(x, y), bm.getPixel(x, y) );
+            }
+        }
+
+        ///The rectangles left to render must cover all the pixels that are not rendered and nothing outside of the roi
+        RectI roi = randomRect(rod);
+        std::list<RectI> rects;
+        bm.minimalNonMarkedRects(roi, rects);
+        for (int y = roi.y1; y < roi.y2; ++y) {
+            for (int x = roi.x1; x < roi.x2; ++x) {
+                bool covered = false;
+                for (std::list<RectI>::iterator it = rects.begin(); it != rects.end(); ++it) {
+                    covered |= it->contains(x, y);
+                }
+                ASSERT_TRUE( covered || ref.getPixel(x, y) == 1 );
+            }
+        }
+        for (std::list<RectI>::iterator it = rects.begin(); it != rects.end(); ++it) {
+            ASSERT_TRUE( roi.contains(*it) );
+        }
+        ASSERT_TRUE( bm.minimalNonMarkedBbox(roi) == ref.minimalNonMarkedBbox(roi) );
+
+        ///With the trimap, the pixels being rendered elsewhere are not rendered again but flagged
+        bool isBeingRenderedElsewhere = false;
+        bool refIsBeingRenderedElsewhere = false;
+        ASSERT_TRUE( bm.minimalNonMarkedBbox_trimap(roi, &isBeingRenderedElsewhere) ==
+                     ref.minimalNonMarkedBbox_trimap(roi, &refIsBeingRenderedElsewhere) );
+        ASSERT_EQ(refIsBeingRenderedElsewhere, isBeingRenderedElsewhere);
+
+        std::list<RectI> refRects;
+        rects.clear();
+        isBeingRenderedElsewhere = refIsBeingRenderedElsewhere = false;
+        bm.minimalNonMarkedRects_trimap(roi, rects, &isBeingRenderedElsewhere);
+        ref.minimalNonMarkedRects_trimap(roi, refRects, &refIsBeingRenderedElsewhere);
+        ASSERT_TRUE(rects == refRects);
+        ASSERT_EQ(refIsBeingRenderedElsewhere, isBeingRenderedElsewhere);
+    }
+
+    ///Marking everything collapses the tiles back to a single state each
+    bm.markForRendered(rod);
+    std::list<RectI> rects;
+    bm.minimalNonMarkedRects(rod, rects);
+    EXPECT_TRUE( rects.empty() );
+    EXPECT_TRUE( bitmapIsFilledWith(bm, rod, 1) );
+
+    ///Copy and downscale keep the state of each pixel
+    Natron::Bitmap copy(rod);
+    RectI half(rod.x1, rod.y1, rod.x2, rod.y1 + rod.height() / 2);
+    copy.copyBitmapPortion(half, bm);
+    EXPECT_TRUE( bitmapIsFilledWith(copy, half, 1) );
+    EXPECT_TRUE( bitmapIsFilledWith(copy, RectI(rod.x1, half.y2, rod.x2, rod.y2), 0) );
+
+    RectI halfRod(-19, 6, (rod.x2 + 1) / 2, (rod.y2 + 1) / 2);
+    Natron::Bitmap downscaled(halfRod);
+    downscaled.halveBitmapPortion(halfRod, copy);
+    ///Only the rows that are entirely made of rendered pixels at full scale are rendered
+    EXPECT_TRUE( bitmapIsFilledWith(downscaled, RectI(halfRod.x1, halfRod.y1, halfRod.x2, half.y2 / 2), 1) );
+    EXPECT_TRUE( bitmapIsFilledWith(downscaled, RectI(halfRod.x1, (half.y2 + 1) / 2, halfRod.x2, halfRod.y2), 0) );
+}
+
+/**
+ * @brief Compares the tiled bitmap with a bitmap storing one byte per pixel on a 4K image rendered by tiles,
+ * looking for what is left to render after each tile like the render of the viewer does.
+ **/
+TEST(BitmapTest,Benchmark) {
+    RectI rod(0, 0, 4096, 2160);
+    const int renderTileSize = 256;
+    double tiledTime = 0., pixelTime = 0.;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        Natron::Bitmap bm(rod);
+        PixelBitmap ref(rod);
+        TimeLapse timer;
+        for (int y = rod.y1; y < rod.y2; y += renderTileSize) {
+            for (int x = rod.x1; x < rod.x2; x += renderTileSize) {
+                RectI tile( x, y, std::min(x + renderTileSize, rod.x2), std::min(y + renderTileSize, rod.y2) );
+                RectI bbox;
+                if (pass == 0) {
+                    bm.markForRendered(tile);
+                    bbox = bm.minimalNonMarkedBbox(rod);
+                } else {
+                    ref.fill(tile, 1);
+                    bbox = ref.minimalNonMarkedBbox(rod);
+                }
+                ASSERT_TRUE( bbox.isNull() || bbox.y1 >= tile.y1 );
+            }
+        }
+        if (pass == 0) {
+            tiledTime = timer.getTimeElapsedReset();
+            EXPECT_LT( bm.getTilesMemorySize(), rod.area() / 1000 );
+        } else {
+            pixelTime = timer.getTimeElapsedReset();
+        }
+    }
+    std::cout << "Bitmap of " << rod.width() << "x" << rod.height() << ": tiled " << tiledTime << "s, one byte per pixel "
+              << pixelTime << "s" << std::endl;
+}
+
 TEST(ImageKeyTest,Equality) {
     srand(2000);
     // coverity[dont_call]
@@ -149,3 +521,393 @@ TEST(ImageKeyTest,Difference) {
     ASSERT_TRUE(keyHash1 != keyHash2);
 }
 
+TEST(ImageBoundsTest,Growth) {
+    using namespace Natron;
+    const RectI rodBounds(-100, -100, 4000, 3000);
+
+    // already contained: nothing to grow
+    RectI bounds(0, 0, 1000, 500);
+    EXPECT_TRUE( Image::getGrownBounds( bounds, RectI(10, 10, 20, 20), rodBounds ) == bounds );
+
+    // growing to the right by a few pixels grows by half the width, rounded to the bitmap tiles
+    RectI grown = Image::getGrownBounds( bounds, RectI(900, 0, 1010, 100), rodBounds );
+    EXPECT_TRUE( grown.contains(bounds) );
+    EXPECT_EQ(0, grown.x1);
+    EXPECT_EQ(0, grown.y1);
+    EXPECT_EQ(512, grown.y2); // rounded to the tiles
+    EXPECT_GE(grown.x2, 1500);
+    EXPECT_EQ(0, grown.x2 % NATRON_BITMAP_TILE_SIZE);
+
+    // the growth is clipped to the region of definition, but the requested bounds are always contained
+    grown = Image::getGrownBounds( bounds, RectI(-50, -50, 4500, 100), rodBounds );
+    EXPECT_TRUE( grown.contains( RectI(-50, -50, 4500, 500) ) );
+    EXPECT_EQ(-100, grown.x1);
+    EXPECT_EQ(-100, grown.y1);
+    EXPECT_EQ(4500, grown.x2);
+
+    // rendering a large image piece by piece reallocates it a logarithmic number of times
+    bounds = RectI(0, 0, 256, 256);
+    int resizes = 0;
+    for (int y = 0; y < 3000; y += 256) {
+        for (int x = 0; x < 4000; x += 256) {
+            const RectI piece( x, y, std::min(x + 256, 4000), std::min(y + 256, 3000) );
+            if ( !bounds.contains(piece) ) {
+                bounds = Image::getGrownBounds(bounds, piece, rodBounds);
+                ++resizes;
+            }
+            ASSERT_TRUE( bounds.contains(piece) );
+        }
+    }
+    EXPECT_LE(resizes, 16);
+}
+
+///The post-render kernels must give exactly the result of the scalar loops of premultInternal, applyMaskMix
+///and copyUnProcessedChannels, whatever the instruction set.
+TEST(ImageSIMDTest,PostRenderKernels) {
+    using namespace Natron;
+    const int n = 1001; // odd, to go through the scalar tails
+    std::vector<float> pixels(n * 4), src(n * 4), alpha(n);
+    for (int i = 0; i < n * 4; ++i) {
+        pixels[i] = (rand() % 1000) / 500.f - 0.2f;
+        src[i] = (rand() % 1000) / 500.f - 0.2f;
+        if (rand() % 5 == 0) {
+            // some zero alphas
+            pixels[i] = 0.f;
+            src[i] = 0.f;
+        }
+    }
+    for (int i = 0; i < n; ++i) {
+        alpha[i] = (rand() % 1000) / 1000.f;
+    }
+
+    for (int set = SIMD::eInstructionSetScalar; set <= SIMD::getSupportedInstructionSet(); ++set) {
+        SIMD::setMaxInstructionSet( (SIMD::InstructionSetEnum)set );
+        SCOPED_TRACE( SIMD::getInstructionSetName( (SIMD::InstructionSetEnum)set ) );
+
+        std::vector<float> out(pixels);
+        SIMD::premultRGBA(&out[0], n);
+        for (int i = 0; i < n * 4; ++i) {
+            ASSERT_EQ( (i % 4 == 3) ? pixels[i] : pixels[i] * pixels[i - i % 4 + 3], out[i] );
+        }
+
+        out = pixels;
+        SIMD::unpremultRGBA(&out[0], n);
+        for (int i = 0; i < n * 4; ++i) {
+            const float a = pixels[i - i % 4 + 3];
+            ASSERT_EQ( (i % 4 == 3 || a == 0) ? pixels[i] : pixels[i] / a, out[i] );
+        }
+
+        for (int nComps = 1; nComps <= 4; ++nComps) {
+            for (int withSrc = 0; withSrc < 2; ++withSrc) {
+                out = pixels;
+                SIMD::maskMix(&out[0], withSrc ? &src[0] : 0, &alpha[0], n, nComps);
+                for (int i = 0; i < n * nComps; ++i) {
+                    const float a = alpha[i / nComps];
+                    const float expected = withSrc ? pixels[i] * a + (1.f - a) * src[i] : pixels[i] * a;
+                    ASSERT_EQ(expected, out[i]);
+                }
+            }
+        }
+
+        for (int channels = 0; channels < 16; ++channels) {
+            const bool doChannel[4] = { (channels & 1) != 0, (channels & 2) != 0, (channels & 4) != 0, (channels & 8) != 0 };
+            for (int premult = 0; premult < 2; ++premult) {
+                for (int originalPremult = 0; originalPremult < 2; ++originalPremult) {
+                    out = pixels;
+                    SIMD::copyUnProcessedChannelsRGBA(&out[0], &src[0], n, doChannel, premult, originalPremult);
+                    for (int i = 0; i < n * 4; ++i) {
+                        const int c = i % 4;
+                        const float srcA = src[i - c + 3];
+                        const float dstAorig = pixels[i - c + 3];
+                        float expected = pixels[i];
+                        if ( doChannel[c] && (c == 3) ) {
+                            expected = srcA;
+                        } else if (doChannel[c]) {
+                            // the DOCHANNEL macro of ImageCopyChannels.cpp
+                            if (originalPremult) {
+                                if (srcA == 0) {
+                                    expected = src[i];
+                                } else if (premult) {
+                                    expected = doChannel[3] ? src[i] : (src[i] / srcA) * dstAorig;
+                                } else {
+                                    expected = src[i] / srcA;
+                                }
+                            } else if (premult) {
+                                expected = src[i] * (doChannel[3] ? srcA : dstAorig);
+                            } else {
+                                expected = src[i];
+                            }
+                        }
+                        ASSERT_EQ(expected, out[i]) << "channels: " << channels << " premult: " << premult << " originalPremult: " << originalPremult;
+                    }
+                }
+            }
+        }
+    }
+    SIMD::setMaxInstructionSet(SIMD::eInstructionSetAVX2);
+}
+
+TEST(ImageSIMDTest,HalveRows) {
+    using namespace Natron;
+    const int n = 333; // odd, to go through the scalar tails
+    std::vector<float> row0(n * 2 * 4), row1(n * 2 * 4);
+    for (std::size_t i = 0; i < row0.size(); ++i) {
+        row0[i] = (rand() % 1000) / 300.f - 0.5f;
+        row1[i] = (rand() % 1000) / 300.f - 0.5f;
+    }
+
+    for (int set = SIMD::eInstructionSetScalar; set <= SIMD::getSupportedInstructionSet(); ++set) {
+        SIMD::setMaxInstructionSet( (SIMD::InstructionSetEnum)set );
+        SCOPED_TRACE( SIMD::getInstructionSetName( (SIMD::InstructionSetEnum)set ) );
+
+        for (int nComps = 1; nComps <= 4; ++nComps) {
+            std::vector<float> out(n * nComps);
+            SIMD::halveRows(&row0[0], &row1[0], &out[0], n, nComps);
+            for (int x = 0; x < n; ++x) {
+                for (int k = 0; k < nComps; ++k) {
+                    // the box filter of Image::halveRoIForDepth()
+                    const float a = row0[x * 2 * nComps + k];
+                    const float b = row0[(x * 2 + 1) * nComps + k];
+                    const float c = row1[x * 2 * nComps + k];
+                    const float d = row1[(x * 2 + 1) * nComps + k];
+                    ASSERT_EQ( (a + b + c + d) / 4, out[x * nComps + k] ) << "nComps: " << nComps << " x: " << x;
+                }
+            }
+        }
+    }
+    SIMD::setMaxInstructionSet(SIMD::eInstructionSetAVX2);
+}
+
+TEST(ImageSIMDTest,ReplaceNaNs) {
+    using namespace Natron;
+    const int n = 1001; // odd, to go through the scalar tails
+    const float inf = std::numeric_limits<float>::infinity();
+    std::vector<float> values(n);
+    int expectedNaNs = 0, expectedInfinities = 0;
+    for (int i = 0; i < n; ++i) {
+        values[i] = (rand() % 1000) / 300.f - 0.5f;
+        // sparse non-finite values, some of them in the same block
+        if (i % 97 == 3 || i == n - 1) {
+            values[i] = std::numeric_limits<float>::quiet_NaN();
+            ++expectedNaNs;
+        } else if (i % 131 == 5 || i == 6) {
+            values[i] = (i % 2) ? inf : -inf;
+            ++expectedInfinities;
+        }
+    }
+
+    for (int set = SIMD::eInstructionSetScalar; set <= SIMD::getSupportedInstructionSet(); ++set) {
+        SIMD::setMaxInstructionSet( (SIMD::InstructionSetEnum)set );
+        SCOPED_TRACE( SIMD::getInstructionSetName( (SIMD::InstructionSetEnum)set ) );
+
+        std::vector<float> out = values;
+        int nbNaNs = 0, nbInfinities = 0;
+        SIMD::replaceNaNs(&out[0], n, &nbNaNs, &nbInfinities);
+        EXPECT_EQ(expectedNaNs, nbNaNs);
+        EXPECT_EQ(expectedInfinities, nbInfinities);
+        for (int i = 0; i < n; ++i) {
+            if (values[i] != values[i]) {
+                ASSERT_EQ(1.f, out[i]) << "i: " << i;
+            } else {
+                ASSERT_EQ(values[i], out[i]) << "i: " << i;
+            }
+        }
+    }
+    SIMD::setMaxInstructionSet(SIMD::eInstructionSetAVX2);
+}
+
+TEST(ImageSIMDTest,HalfConversions) {
+    using namespace Natron;
+    // every half, including the subnormals, infinities and NaNs
+    std::vector<unsigned short> halves(0x10000);
+    for (int i = 0; i < 0x10000; ++i) {
+        halves[i] = (unsigned short)i;
+    }
+    std::vector<float> floats(halves.size() * 2);
+    for (std::size_t i = 0; i < floats.size(); ++i) {
+        unsigned int bits = ( (unsigned int)rand() << 16 ) ^ (unsigned int)rand();
+        // mostly values in the range of halves, some of them out of it
+        if (i % 4 != 0) {
+            bits = (bits & 0x83ffffff) | 0x30000000 | ( (bits & 0x0c000000) >> 1 );
+        }
+        memcpy( &floats[i], &bits, sizeof(float) );
+    }
+
+    for (int set = SIMD::eInstructionSetScalar; set <= SIMD::getSupportedInstructionSet(); ++set) {
+        SIMD::setMaxInstructionSet( (SIMD::InstructionSetEnum)set );
+        SCOPED_TRACE( SIMD::getInstructionSetName( (SIMD::InstructionSetEnum)set ) );
+
+        std::vector<float> out( halves.size() );
+        SIMD::convertHalfToFloat(&halves[0], &out[0], (int)halves.size());
+        for (std::size_t i = 0; i < halves.size(); ++i) {
+            const float expected = Half::halfToFloat(halves[i]);
+            ASSERT_EQ( 0, memcmp( &expected, &out[i], sizeof(float) ) ) << "half: " << i;
+            if (out[i] == out[i]) {
+                // the conversion back to half is exact
+                ASSERT_EQ( halves[i], Half::floatToHalf(out[i]) ) << "half: " << i;
+            }
+        }
+
+        std::vector<unsigned short> outHalves( floats.size() );
+        SIMD::convertFloatToHalf(&floats[0], &outHalves[0], (int)floats.size());
+        for (std::size_t i = 0; i < floats.size(); ++i) {
+            ASSERT_EQ( Half::floatToHalf(floats[i]), outHalves[i] ) << "float: " << floats[i];
+        }
+    }
+    SIMD::setMaxInstructionSet(SIMD::eInstructionSetAVX2);
+
+    // round to nearest even, overflow to infinity
+    EXPECT_EQ( 1.f, (float)Half(1.f + 1.f / 4096.f) );
+    EXPECT_EQ( 1.f + 1.f / 512.f, (float)Half(1.f + 3.f / 2048.f) );
+    EXPECT_EQ( 65504.f, (float)Half(65519.f) );
+    EXPECT_EQ( 0x7c00, Half(65520.f).bits() );
+    EXPECT_EQ( 0xfc00, Half(-1e10f).bits() );
+}
+
+class ImageThreadingTest
+    : public BaseTest
+{
+};
+
+TEST_F(ImageThreadingTest, Benchmark) {
+    using namespace Natron;
+    const RectI bounds(0, 0, 4096, 2160);
+    const RectD rod(0, 0, 4096, 2160);
+    ///A roi smaller than the bounds so that pasteFrom() copies the pixels instead of sharing them
+    const RectI pasteRoI(0, 0, 4096, 2159);
+    ImagePtr src( new Image(ImageComponents::getRGBAComponents(), rod, bounds, 0, 1., eImageBitDepthFloat) );
+    ImagePtr dst( new Image(ImageComponents::getRGBAComponents(), rod, bounds, 0, 1., eImageBitDepthFloat) );
+    ImagePtr dstByte( new Image(ImageComponents::getRGBAComponents(), rod, bounds, 0, 1., eImageBitDepthByte) );
+
+    std::vector<int> threadCounts;
+    const int maxThreads = std::max(1, QThread::idealThreadCount());
+    for (int n = 1; n < maxThreads; n *= 2) {
+        threadCounts.push_back(n);
+    }
+    threadCounts.push_back(maxThreads);
+
+    for (std::size_t i = 0; i < threadCounts.size(); ++i) {
+        appPTR->setNThreadsPerImageOperation(threadCounts[i]);
+        const float value = 1.f / (i + 2);
+
+        TimeLapse timer;
+        src->fill(bounds, value, value, value, 1.);
+        double fillTime = timer.getTimeElapsedReset();
+        dst->pasteFrom(*src, pasteRoI, false);
+        double pasteTime = timer.getTimeElapsedReset();
+        src->convertToFormat(bounds, eViewerColorSpaceLinear, eViewerColorSpaceLinear, -1, false, false, dstByte.get());
+        double convertTime = timer.getTimeElapsedReset();
+
+        std::cout << bounds.width() << "x" << bounds.height() << " RGBA float, " << threadCounts[i] << " thread(s): fill "
+                  << fillTime << "s, pasteFrom " << pasteTime << "s, convertToFormat to byte " << convertTime << "s" << std::endl;
+
+        ///Check the first and last pixel of every row, whichever band they were in
+        Image::ReadAccess acc( dst.get() );
+        Image::ReadAccess accByte( dstByte.get() );
+        const unsigned char expectedByte = Color::floatToInt<256>(value);
+        for (int y = pasteRoI.y1; y < pasteRoI.y2; ++y) {
+            const float* first = (const float*)acc.pixelAt(pasteRoI.x1, y);
+            const float* last = (const float*)acc.pixelAt(pasteRoI.x2 - 1, y);
+            ASSERT_EQ(value, first[0]) << "y: " << y;
+            ASSERT_EQ(value, last[2]) << "y: " << y;
+            ASSERT_EQ(1.f, last[3]) << "y: " << y;
+            const unsigned char* firstByte = accByte.pixelAt(pasteRoI.x1, y);
+            ASSERT_NEAR(expectedByte, firstByte[0], 1) << "y: " << y;
+        }
+    }
+    appPTR->setNThreadsPerImageOperation(0);
+}
+
+class ImageConvertTest
+    : public BaseTest
+{
+};
+
+TEST_F(ImageConvertTest, ExtractChannel) {
+    using namespace Natron;
+    const RectI bounds(-3, 2, 61, 37);
+    const RectD rod(-3, 2, 61, 37);
+    ImagePtr rgba( new Image(ImageComponents::getRGBAComponents(), rod, bounds, 0, 1., eImageBitDepthFloat) );
+    {
+        Image::WriteAccess acc( rgba.get() );
+        for (int y = bounds.y1; y < bounds.y2; ++y) {
+            float* pix = (float*)acc.pixelAt(bounds.x1, y);
+            for (int x = bounds.x1; x < bounds.x2; ++x, pix += 4) {
+                for (int c = 0; c < 4; ++c) {
+                    pix[c] = (x - bounds.x1 + (y - bounds.y1) * 3 + c * 7) / 300.f;
+                }
+            }
+        }
+    }
+
+    ///Extract each channel as a mask, in float and in byte, over a window that does not cover the whole image
+    const RectI window(0, 5, 50, 30);
+    for (int channel = 0; channel < 4; ++channel) {
+        ImagePtr alphaFloat( new Image(ImageComponents::getAlphaComponents(), rod, bounds, 0, 1., eImageBitDepthFloat) );
+        ImagePtr alphaByte( new Image(ImageComponents::getAlphaComponents(), rod, bounds, 0, 1., eImageBitDepthByte) );
+        rgba->convertToFormat(window, eViewerColorSpaceLinear, eViewerColorSpaceLinear, channel, false, false, alphaFloat.get());
+        rgba->convertToFormat(window, eViewerColorSpaceLinear, eViewerColorSpaceSRGB, channel, false, false, alphaByte.get());
+
+        Image::ReadAccess srcAcc( rgba.get() );
+        Image::ReadAccess floatAcc( alphaFloat.get() );
+        Image::ReadAccess byteAcc( alphaByte.get() );
+        for (int y = window.y1; y < window.y2; ++y) {
+            for (int x = window.x1; x < window.x2; ++x) {
+                const float v = ( (const float*)srcAcc.pixelAt(x, y) )[channel];
+                ASSERT_EQ( v, *(const float*)floatAcc.pixelAt(x, y) ) << "channel: " << channel << " x: " << x << " y: " << y;
+                ///Masks are not color managed
+                ASSERT_EQ( (int)Color::floatToInt<256>(v), (int)*byteAcc.pixelAt(x, y) ) << "channel: " << channel << " x: " << x << " y: " << y;
+            }
+        }
+    }
+}
+
+class ImageCopyOnWriteTest
+    : public BaseTest
+{
+};
+
+TEST_F(ImageCopyOnWriteTest, WriteSharedPixels) {
+    using namespace Natron;
+    const RectI bounds(0, 0, 64, 32);
+    const RectD rod(0, 0, 64, 32);
+    ImagePtr src( new Image(ImageComponents::getRGBAComponents(), rod, bounds, 0, 1., eImageBitDepthFloat) );
+    ImagePtr filled( new Image(ImageComponents::getRGBAComponents(), rod, bounds, 0, 1., eImageBitDepthFloat) );
+    ImagePtr written( new Image(ImageComponents::getRGBAComponents(), rod, bounds, 0, 1., eImageBitDepthFloat) );
+
+    src->fill(bounds, 0.25, 0.25, 0.25, 1.);
+    ///Pasting the whole image shares the pixels instead of copying them
+    filled->pasteFrom(*src, bounds, false);
+    written->pasteFrom(*src, bounds, false);
+    {
+        Image::ReadAccess srcAcc( src.get() );
+        Image::ReadAccess filledAcc( filled.get() );
+        Image::ReadAccess writtenAcc( written.get() );
+        EXPECT_EQ( srcAcc.pixelAt(0, 0), filledAcc.pixelAt(0, 0) );
+        EXPECT_EQ( srcAcc.pixelAt(0, 0), writtenAcc.pixelAt(0, 0) );
+    }
+
+    ///Writing to the images copies their pixels first
+    filled->fill(bounds, 0.5, 0.5, 0.5, 1.);
+    {
+        Image::WriteAccess acc( written.get() );
+        float* pix = (float*)acc.pixelAt(10, 20);
+        pix[0] = 1.f;
+    }
+
+    Image::ReadAccess srcAcc( src.get() );
+    Image::ReadAccess filledAcc( filled.get() );
+    Image::ReadAccess writtenAcc( written.get() );
+    EXPECT_NE( srcAcc.pixelAt(0, 0), filledAcc.pixelAt(0, 0) );
+    EXPECT_NE( srcAcc.pixelAt(0, 0), writtenAcc.pixelAt(0, 0) );
+    for (int y = bounds.y1; y < bounds.y2; ++y) {
+        for (int x = bounds.x1; x < bounds.x2; ++x) {
+            const float* srcPix = (const float*)srcAcc.pixelAt(x, y);
+            ASSERT_EQ(0.25f, srcPix[0]) << "x: " << x << " y: " << y;
+            ASSERT_EQ(1.f, srcPix[3]) << "x: " << x << " y: " << y;
+            ASSERT_EQ(0.5f, ( (const float*)filledAcc.pixelAt(x, y) )[0]) << "x: " << x << " y: " << y;
+            const float expected = (x == 10 && y == 20) ? 1.f : 0.25f;
+            ASSERT_EQ(expected, ( (const float*)writtenAcc.pixelAt(x, y) )[0]) << "x: " << x << " y: " << y;
+        }
+    }
+}
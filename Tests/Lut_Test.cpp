@@ -22,12 +22,44 @@
 #include <Python.h>
 // ***** END PYTHON BLOCK *****
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
 #include <gtest/gtest.h>
 #include "Engine/Lut.h"
+#include "Engine/SIMD.h"
+#include "Engine/Timer.h"
 
 using namespace Natron::Color;
 
+namespace {
+
+///Floats spread over all the exponents, both signs, and the values where the rounding to integers changes
+void
+makeTestFloats(std::vector<float>* values)
+{
+    values->clear();
+    for (unsigned int bits = 0; bits < 0xfffff000u; bits += 0x3fff) {
+        float f;
+        std::memcpy( &f, &bits, sizeof(f) );
+        if (f == f) { // skip NaN, the scalar conversions do not handle it
+            values->push_back(f);
+        }
+    }
+    for (int i = 0; i <= 0xff01; ++i) {
+        float f = (i + 0.5f) / 0xff00;
+        values->push_back(f);
+        values->push_back( (i + 0.5f) / 255.f );
+        values->push_back( (i + 0.5f) / 65535.f );
+    }
+    // an odd count so that the kernels also go through their scalar tail
+    values->push_back(1.f);
+}
+
+} // anon namespace
+
 TEST(Lut,IntConversions) {
     for (int i = 0; i < 0x10000; ++i) {
         //printf("%x -> %x,%x\n", i, uint16ToChar(i), floatToInt<256>(intToFloat<65536>(i)));
@@ -48,3 +80,113 @@ TEST(Lut,IntConversions) {
         EXPECT_EQ( i, uint8xxToChar( charToUint8xx(i) ) );
     }
 }
+
+TEST(Lut,SIMDConversions) {
+    using namespace Natron;
+    std::vector<float> floats;
+    makeTestFloats(&floats);
+    const int nFloats = (int)floats.size();
+    std::vector<unsigned char> bytes(256 + 13);
+    for (std::size_t i = 0; i < bytes.size(); ++i) {
+        bytes[i] = (unsigned char)i;
+    }
+    std::vector<unsigned short> shorts(0x10000 + 13);
+    for (std::size_t i = 0; i < shorts.size(); ++i) {
+        shorts[i] = (unsigned short)i;
+    }
+    const Lut* luts[2] = { LutManager::sRGBLut(), LutManager::Rec709Lut() };
+    luts[0]->validate();
+    luts[1]->validate();
+
+    std::vector<float> floatOut( std::max( nFloats, (int)shorts.size() ) );
+    std::vector<unsigned short> shortOut( std::max( nFloats, (int)shorts.size() ) );
+    std::vector<unsigned char> byteOut( std::max( nFloats, (int)shorts.size() ) );
+
+    // every instruction set available must give the same result as the scalar functions
+    for (int set = SIMD::eInstructionSetScalar; set <= SIMD::getSupportedInstructionSet(); ++set) {
+        SIMD::setMaxInstructionSet( (SIMD::InstructionSetEnum)set );
+        SCOPED_TRACE( SIMD::getInstructionSetName( (SIMD::InstructionSetEnum)set ) );
+
+        SIMD::convertUint8ToFloat( &bytes[0], &floatOut[0], (int)bytes.size() );
+        for (std::size_t i = 0; i < bytes.size(); ++i) {
+            ASSERT_EQ( intToFloat<256>(bytes[i]), floatOut[i] );
+        }
+        SIMD::convertUint16ToFloat( &shorts[0], &floatOut[0], (int)shorts.size() );
+        for (std::size_t i = 0; i < shorts.size(); ++i) {
+            ASSERT_EQ( intToFloat<65536>(shorts[i]), floatOut[i] );
+        }
+        SIMD::convertUint8ToUint16( &bytes[0], &shortOut[0], (int)bytes.size() );
+        for (std::size_t i = 0; i < bytes.size(); ++i) {
+            ASSERT_EQ( charToUint16(bytes[i]), shortOut[i] );
+        }
+        SIMD::convertUint16ToUint8( &shorts[0], &byteOut[0], (int)shorts.size() );
+        for (std::size_t i = 0; i < shorts.size(); ++i) {
+            ASSERT_EQ( uint16ToChar(shorts[i]), byteOut[i] );
+        }
+        SIMD::convertFloatToUint8(&floats[0], &byteOut[0], nFloats);
+        for (int i = 0; i < nFloats; ++i) {
+            ASSERT_EQ( floatToInt<256>(floats[i]), byteOut[i] ) << "value: " << floats[i];
+        }
+        SIMD::convertFloatToUint16(&floats[0], &shortOut[0], nFloats);
+        for (int i = 0; i < nFloats; ++i) {
+            ASSERT_EQ( floatToInt<65536>(floats[i]), shortOut[i] ) << "value: " << floats[i];
+        }
+        SIMD::convertFloatToUint8xx(&floats[0], &shortOut[0], nFloats);
+        for (int i = 0; i < nFloats; ++i) {
+            ASSERT_EQ( floatToInt<0xff01>(floats[i]), shortOut[i] ) << "value: " << floats[i];
+        }
+
+        for (int l = 0; l < 2; ++l) {
+            SCOPED_TRACE( luts[l]->getName() );
+            luts[l]->fromColorSpaceUint8ToLinearFloatFast( &bytes[0], &floatOut[0], (int)bytes.size() );
+            for (std::size_t i = 0; i < bytes.size(); ++i) {
+                ASSERT_EQ( luts[l]->fromColorSpaceUint8ToLinearFloatFast(bytes[i]), floatOut[i] );
+            }
+            luts[l]->toColorSpaceUint8xxFromLinearFloatFast(&floats[0], &shortOut[0], nFloats);
+            for (int i = 0; i < nFloats; ++i) {
+                ASSERT_EQ( luts[l]->toColorSpaceUint8xxFromLinearFloatFast(floats[i]), shortOut[i] ) << "value: " << floats[i];
+            }
+        }
+    }
+    SIMD::setMaxInstructionSet(SIMD::eInstructionSetAVX2);
+}
+
+TEST(Lut,SIMDBenchmark) {
+    using namespace Natron;
+    // a 2K RGBA row buffer, converted as many times as there are rows
+    const int n = 2048 * 4;
+    const int rows = 1556;
+    std::vector<float> floats(n);
+    std::vector<unsigned char> bytes(n);
+    std::vector<unsigned short> shorts(n);
+    for (int i = 0; i < n; ++i) {
+        floats[i] = (float)rand() / RAND_MAX;
+        bytes[i] = (unsigned char)( rand() % 256 );
+    }
+    const Lut* lut = LutManager::sRGBLut();
+    lut->validate();
+
+    for (int set = SIMD::eInstructionSetScalar; set <= SIMD::getSupportedInstructionSet(); ++set) {
+        SIMD::setMaxInstructionSet( (SIMD::InstructionSetEnum)set );
+        TimeLapse timer;
+        for (int y = 0; y < rows; ++y) {
+            SIMD::convertFloatToUint16(&floats[0], &shorts[0], n);
+        }
+        double floatToUint16 = timer.getTimeElapsedReset();
+        for (int y = 0; y < rows; ++y) {
+            SIMD::convertUint8ToFloat(&bytes[0], &floats[0], n);
+        }
+        double uint8ToFloat = timer.getTimeElapsedReset();
+        for (int y = 0; y < rows; ++y) {
+            lut->toColorSpaceUint8xxFromLinearFloatFast(&floats[0], &shorts[0], n);
+        }
+        double toSRGB = timer.getTimeElapsedReset();
+        for (int y = 0; y < rows; ++y) {
+            lut->fromColorSpaceUint8ToLinearFloatFast(&bytes[0], &floats[0], n);
+        }
+        double fromSRGB = timer.getTimeElapsedReset();
+        std::cout << SIMD::getInstructionSetName( (SIMD::InstructionSetEnum)set ) << ": float->uint16 " << floatToUint16
+                  << "s, uint8->float " << uint8ToFloat << "s, linear->sRGB " << toSRGB << "s, sRGB->linear " << fromSRGB << "s" << std::endl;
+    }
+    SIMD::setMaxInstructionSet(SIMD::eInstructionSetAVX2);
+}
@@ -0,0 +1,312 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ * This file is part of Natron <http://www.natron.fr/>,
+ * Copyright (C) 2016 INRIA and Alexandre Gauthier-Foichat
+ *
+ * Natron is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Natron is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Natron.  If not, see <http://www.gnu.org/licenses/gpl-2.0.html>
+ * ***** END LICENSE BLOCK ***** */
+
+// ***** BEGIN PYTHON BLOCK *****
+// from <https://docs.python.org/3/c-api/intro.html#include-files>:
+// "Since Python may define some pre-processor definitions which affect the standard headers on some systems, you must include Python.h before any standard headers are included."
+#include <Python.h>
+// ***** END PYTHON BLOCK *****
+
+#include <new>
+#include <stdexcept>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QThread>
+
+#include "Engine/TaskScheduler.h"
+
+using namespace Natron;
+
+namespace {
+
+/**
+ * @brief Counts the tasks run and the largest number of them running at the same time.
+ **/
+struct TaskCounters
+{
+    QAtomicInt nRun;
+    QAtomicInt nRunning;
+    QAtomicInt maxRunning;
+
+    TaskCounters()
+    : nRun(0)
+    , nRunning(0)
+    , maxRunning(0)
+    {
+    }
+};
+
+int
+tileTask(TaskCounters* counters,
+         int index)
+{
+    const int running = counters->nRunning.fetchAndAddOrdered(1) + 1;
+    int max = counters->maxRunning.fetchAndAddOrdered(0);
+
+    while ( running > max && !counters->maxRunning.testAndSetOrdered(max, running) ) {
+        max = counters->maxRunning.fetchAndAddOrdered(0);
+    }
+    // some work, so that the tasks overlap
+    volatile double x = 0.;
+    for (int i = 0; i < 20000; ++i) {
+        x = x + i * 0.5;
+    }
+    counters->nRunning.fetchAndAddOrdered(-1);
+    counters->nRun.fetchAndAddOrdered(1);
+
+    return index * 2;
+}
+
+int
+isCurrentThread(const QThread* thread)
+{
+    return QThread::currentThread() == thread;
+}
+
+///A node renders its tiles in parallel, like EffectInstance::renderRoI
+void
+nodeTask(TaskScheduler* scheduler,
+         TaskCounters* counters,
+         int nTiles,
+         bool* resultsOk)
+{
+    std::vector<int> results(nTiles, -1);
+    {
+        TaskGroup tiles(scheduler);
+        for (int i = 0; i < nTiles; ++i) {
+            tiles.run( boost::function<int ()>( boost::bind(&tileTask, counters, i) ), &results[i] );
+        }
+    }
+    for (int i = 0; i < nTiles; ++i) {
+        if (results[i] != i * 2) {
+            *resultsOk = false;
+        }
+    }
+}
+
+///A frame renders its nodes in parallel, and each node renders its tiles in parallel
+void
+frameTask(TaskScheduler* scheduler,
+          TaskCounters* counters,
+          int nNodes,
+          int nTiles,
+          bool* resultsOk)
+{
+    TaskGroup nodes(scheduler);
+    for (int i = 0; i < nNodes; ++i) {
+        nodes.run( boost::bind(&nodeTask, scheduler, counters, nTiles, resultsOk) );
+    }
+    nodes.wait();
+}
+} // anon namespace
+
+TEST(TaskScheduler, RunsAllTasks) {
+    TaskScheduler scheduler(4);
+    TaskCounters counters;
+    bool resultsOk = true;
+
+    nodeTask(&scheduler, &counters, 1000, &resultsOk);
+    EXPECT_EQ( 1000, counters.nRun.fetchAndAddOrdered(0) );
+    EXPECT_TRUE(resultsOk);
+}
+
+TEST(TaskScheduler, NoScheduler) {
+    TaskGroup group(0);
+    int result = 0;
+
+    ///The task is run by run() in the calling thread
+    group.run( boost::function<int ()>( boost::bind(&isCurrentThread, QThread::currentThread()) ), &result );
+    EXPECT_EQ(1, result);
+}
+
+TEST(TaskScheduler, NestedGroups) {
+    ///With a single thread, every level waits for tasks that can only be run by itself or by the thread of the scheduler
+    for (int nThreads = 1; nThreads <= 4; nThreads *= 2) {
+        TaskScheduler scheduler(nThreads);
+        TaskCounters counters;
+        bool resultsOk = true;
+
+        {
+            TaskGroup frames(&scheduler);
+            for (int i = 0; i < 4; ++i) {
+                frames.run( boost::bind(&frameTask, &scheduler, &counters, 5, 20, &resultsOk) );
+            }
+        }
+        EXPECT_EQ( 4 * 5 * 20, counters.nRun.fetchAndAddOrdered(0) ) << "nThreads: " << nThreads;
+        EXPECT_TRUE(resultsOk);
+        ///The threads of the scheduler plus the calling thread, whatever the nesting
+        EXPECT_LE(counters.maxRunning.fetchAndAddOrdered(0), nThreads + 1) << "nThreads: " << nThreads;
+    }
+}
+
+TEST(TaskScheduler, StartAndThreadCount) {
+    TaskCounters counters;
+    bool resultsOk = true;
+
+    {
+        TaskScheduler scheduler(2);
+        for (int i = 0; i < 8; ++i) {
+            scheduler.start( boost::bind(&nodeTask, &scheduler, &counters, 10, &resultsOk) );
+        }
+        scheduler.setThreadCount(1);
+        scheduler.setThreadCount(3);
+        EXPECT_EQ( 3, scheduler.getThreadCount() );
+        {
+            TaskGroup group(&scheduler);
+            group.run( boost::bind(&nodeTask, &scheduler, &counters, 10, &resultsOk) );
+        }
+        ///The destructor waits for the tasks started without a group
+    }
+    EXPECT_EQ( (8 + 1) * 10, counters.nRun.fetchAndAddOrdered(0) );
+    EXPECT_TRUE(resultsOk);
+}
+
+namespace {
+
+/**
+ * @brief Records the order in which the tasks run.
+ **/
+struct TaskOrder
+{
+    QAtomicInt blockerStarted;
+    QAtomicInt released;
+    QAtomicInt nRun;
+    std::vector<int> order;
+
+    TaskOrder(int nTasks)
+    : blockerStarted(0)
+    , released(0)
+    , nRun(0)
+    , order(nTasks, -1)
+    {
+    }
+};
+
+void
+blockerTask(TaskOrder* order)
+{
+    order->blockerStarted.fetchAndAddOrdered(1);
+    while ( order->released.fetchAndAddOrdered(0) == 0 ) {
+        QThread::yieldCurrentThread();
+    }
+}
+
+void
+orderedTask(TaskOrder* order,
+            int index)
+{
+    order->order[index] = order->nRun.fetchAndAddOrdered(1);
+}
+} // anon namespace
+
+TEST(TaskScheduler, Priorities) {
+    const int nTasks = 8;
+    TaskOrder order(nTasks * 2);
+
+    {
+        ///A single thread, kept busy until all the tasks are submitted
+        TaskScheduler scheduler(1);
+        scheduler.start(boost::bind(&blockerTask, &order), eRenderPriorityBackground);
+        while ( order.blockerStarted.fetchAndAddOrdered(0) == 0 ) {
+            QThread::yieldCurrentThread();
+        }
+        for (int i = 0; i < nTasks; ++i) {
+            scheduler.start(boost::bind(&orderedTask, &order, i), eRenderPriorityBackground);
+        }
+        for (int i = 0; i < nTasks; ++i) {
+            scheduler.start(boost::bind(&orderedTask, &order, nTasks + i), eRenderPriorityInteractive);
+        }
+        order.released.fetchAndAddOrdered(1);
+    }
+    ///The interactive tasks, submitted last, ran first
+    for (int i = 0; i < nTasks; ++i) {
+        EXPECT_EQ(nTasks + i, order.order[i]);
+        EXPECT_GT(nTasks, order.order[nTasks + i]);
+    }
+}
+
+TEST(TaskScheduler, InheritedPriority) {
+    TaskScheduler scheduler(2);
+    int priority = -1;
+
+    {
+        TaskGroup group(&scheduler, eRenderPriorityBackground);
+        group.run( boost::function<int ()>( &TaskScheduler::getCurrentPriority ), &priority );
+    }
+    EXPECT_EQ( (int)eRenderPriorityBackground, priority );
+
+    ///The nested groups of a task have its priority
+    TaskScheduler::setCurrentPriority(eRenderPriorityInteractive);
+    {
+        TaskGroup group(&scheduler);
+        group.run( boost::function<int ()>( &TaskScheduler::getCurrentPriority ), &priority );
+    }
+    EXPECT_EQ( (int)eRenderPriorityInteractive, priority );
+    TaskScheduler::setCurrentPriority(eRenderPriorityNormal);
+}
+
+namespace {
+
+int
+throwingTask(TaskCounters* counters,
+             int index,
+             int failingIndex,
+             bool outOfMemory)
+{
+    counters->nRun.fetchAndAddOrdered(1);
+    if (index == failingIndex) {
+        if (outOfMemory) {
+            throw std::bad_alloc();
+        }
+        throw std::runtime_error("tile failed");
+    }
+
+    return index;
+}
+} // anon namespace
+
+TEST(TaskScheduler, Exceptions) {
+    TaskScheduler scheduler(2);
+
+    for (int outOfMemory = 0; outOfMemory < 2; ++outOfMemory) {
+        TaskCounters counters;
+        std::vector<int> results(100, -1);
+        TaskGroup group(&scheduler);
+        for (int i = 0; i < 100; ++i) {
+            group.run( boost::function<int ()>( boost::bind(&throwingTask, &counters, i, 50, outOfMemory != 0) ), &results[i] );
+        }
+        if (outOfMemory) {
+            EXPECT_THROW(group.wait(), std::bad_alloc);
+        } else {
+            try {
+                group.wait();
+                ADD_FAILURE() << "wait() did not throw";
+            } catch (const std::runtime_error & e) {
+                EXPECT_STREQ("tile failed", e.what());
+            }
+        }
+        ///The other tasks ran, and the task that threw stored no result
+        EXPECT_EQ( 100, counters.nRun.fetchAndAddOrdered(0) );
+        EXPECT_EQ(-1, results[50]);
+        EXPECT_EQ(99, results[99]);
+        ///The exception is reported once
+        EXPECT_NO_THROW( group.wait() );
+    }
+}
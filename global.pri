@@ -256,6 +256,8 @@ unix {
              LIBS +=  $$system(pkg-config --variable=libdir cairo)/libcairo.a
          }
          LIBS += -ldl
+         # shm_open, used by the shared image cache
+         LIBS += -lrt
          QMAKE_LFLAGS += '-Wl,-rpath,\'\$$ORIGIN/../lib\',-z,origin'
      } else {
          cairo:     PKGCONFIG += cairo